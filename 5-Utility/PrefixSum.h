@@ -0,0 +1,232 @@
+template<typename T>
+class PrefixSum
+{
+  public:
+    PrefixSum();
+    PrefixSum(const PrefixSum<T>& prefixSum);
+    PrefixSum<T>& operator=(const PrefixSum<T>& prefixSum);
+
+    int GetSize() const {return (int) m_valueArray.GetSize();}
+    void SetSize(int iSize, T defaultValue);
+
+    T Get(int iIndex) const {return m_valueArray[iIndex];}
+    void Set(int iIndex, T value);
+
+    void Add(T value);
+    void InsertAt(int iIndex, T value);
+    void InsertAt(int iIndex, const PrefixSum<T>& prefixSum);
+    void RemoveAt(int iIndex, int iCount = 1);
+
+    T Sum(int iIndex) const;
+    T GetTotal() const {return m_total;}
+    int Find(T position) const;
+
+    void Serialize(CArchive& archive);
+
+  private:
+    void Rebuild();
+
+    CArray<T> m_valueArray, m_treeArray;
+    T m_total;
+};
+
+// A prefix sum holds a sequence of non-negative values, such as the heights
+// of the rows of a spreadsheet, and answers the sum of the values before a
+// given index as well as the index holding a given position. It is
+// implemented as a Fenwick tree (binary indexed tree), stored in
+// m_treeArray with index one as its root, where element i holds the sum of
+// the values in the range (i - lowbit(i), i]. The plain values are also kept
+// in m_valueArray, so that they can be looked up directly. Updating a value,
+// summing, and finding a position all take logarithmic time.
+
+template<typename T>
+PrefixSum<T>::PrefixSum()
+ :m_total(0)
+{
+  m_treeArray.Add(0);
+}
+
+template<typename T>
+PrefixSum<T>::PrefixSum(const PrefixSum<T>& prefixSum)
+{
+  operator=(prefixSum);
+}
+
+template<typename T>
+PrefixSum<T>& PrefixSum<T>::operator=(const PrefixSum<T>& prefixSum)
+{
+  if (this != &prefixSum)
+  {
+    m_valueArray.Copy(prefixSum.m_valueArray);
+    m_treeArray.Copy(prefixSum.m_treeArray);
+    m_total = prefixSum.m_total;
+  }
+
+  return *this;
+}
+
+// SetSize gives the sequence the given size, with every value set to the
+// default value.
+
+template<typename T>
+void PrefixSum<T>::SetSize(int iSize, T defaultValue)
+{
+  check_memory(m_valueArray.SetSize(iSize));
+
+  for (int iIndex = 0; iIndex < iSize; ++iIndex)
+  {
+    m_valueArray[iIndex] = defaultValue;
+  }
+
+  Rebuild();
+}
+
+// Set updates one value. The difference between the new and old value is
+// added to every tree element covering the index, which are found by
+// repeatedly adding the lowest set bit to the index.
+
+template<typename T>
+void PrefixSum<T>::Set(int iIndex, T value)
+{
+  T delta = value - m_valueArray[iIndex];
+  m_valueArray[iIndex] = value;
+  m_total += delta;
+
+  int iSize = GetSize();
+  for (int iTree = iIndex + 1; iTree <= iSize; iTree += (iTree & -iTree))
+  {
+    m_treeArray[iTree] += delta;
+  }
+}
+
+// Add appends a value to the end of the sequence in logarithmic time. The
+// new tree element covers the new value and the values of the range
+// (i - lowbit(i), i - 1], whose sum is found by two calls to Sum.
+
+template<typename T>
+void PrefixSum<T>::Add(T value)
+{
+  int iTree = GetSize() + 1;
+  T treeValue = value + Sum(iTree - 1) - Sum(iTree - (iTree & -iTree));
+
+  check_memory(m_valueArray.Add(value));
+  check_memory(m_treeArray.Add(treeValue));
+  m_total += value;
+}
+
+// InsertAt and RemoveAt change the length of the sequence. As that shifts
+// the ranges of the tree elements, the tree is rebuilt, which takes linear
+// time.
+
+template<typename T>
+void PrefixSum<T>::InsertAt(int iIndex, T value)
+{
+  check_memory(m_valueArray.InsertAt(iIndex, value));
+  Rebuild();
+}
+
+template<typename T>
+void PrefixSum<T>::InsertAt(int iIndex, const PrefixSum<T>& prefixSum)
+{
+  check_memory(m_valueArray.InsertAt(iIndex,
+               (CArray<T>*) &prefixSum.m_valueArray));
+  Rebuild();
+}
+
+template<typename T>
+void PrefixSum<T>::RemoveAt(int iIndex, int iCount /* = 1 */)
+{
+  m_valueArray.RemoveAt(iIndex, iCount);
+  Rebuild();
+}
+
+// Sum returns the sum of the values before the given index; that is, Sum(0)
+// is zero and Sum(GetSize()) is the total sum. The tree elements are found
+// by repeatedly removing the lowest set bit of the index.
+
+template<typename T>
+T PrefixSum<T>::Sum(int iIndex) const
+{
+  T sum = 0;
+
+  for (int iTree = iIndex; iTree > 0; iTree -= (iTree & -iTree))
+  {
+    sum += m_treeArray[iTree];
+  }
+
+  return sum;
+}
+
+// Find returns the index whose range holds the given position; that is,
+// the index where Sum(index) <= position < Sum(index + 1). If the position
+// is beyond the total sum, the size of the sequence is returned. We descend
+// the tree from its largest power of two, and step into an element whenever
+// the position is not inside it.
+
+template<typename T>
+int PrefixSum<T>::Find(T position) const
+{
+  int iSize = GetSize(), iIndex = 0, iStep = 1;
+
+  while ((2 * iStep) <= iSize)
+  {
+    iStep *= 2;
+  }
+
+  for (; iStep > 0; iStep /= 2)
+  {
+    int iNext = iIndex + iStep;
+
+    if ((iNext <= iSize) && (m_treeArray[iNext] <= position))
+    {
+      iIndex = iNext;
+      position -= m_treeArray[iNext];
+    }
+  }
+
+  return iIndex;
+}
+
+// Serialize stores or loads the plain values only, the tree is rebuilt when
+// the values are loaded.
+
+template<typename T>
+void PrefixSum<T>::Serialize(CArchive& archive)
+{
+  m_valueArray.Serialize(archive);
+
+  if (archive.IsLoading())
+  {
+    Rebuild();
+  }
+}
+
+// Rebuild builds the tree from the plain values in linear time. Each value
+// is added to its own element, and each element is then added to its parent;
+// that is, the next element whose range covers it.
+
+template<typename T>
+void PrefixSum<T>::Rebuild()
+{
+  int iSize = GetSize();
+  check_memory(m_treeArray.SetSize(iSize + 1));
+
+  m_treeArray[0] = 0;
+  m_total = 0;
+
+  for (int iIndex = 0; iIndex < iSize; ++iIndex)
+  {
+    m_treeArray[iIndex + 1] = m_valueArray[iIndex];
+    m_total += m_valueArray[iIndex];
+  }
+
+  for (int iTree = 1; iTree <= iSize; ++iTree)
+  {
+    int iParent = iTree + (iTree & -iTree);
+
+    if (iParent <= iSize)
+    {
+      m_treeArray[iParent] += m_treeArray[iTree];
+    }
+  }
+}
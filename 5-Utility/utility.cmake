@@ -8,6 +8,7 @@ ${UTILITY_DIR}/Color.h
 ${UTILITY_DIR}/Font.cpp
 ${UTILITY_DIR}/Font.h
 ${UTILITY_DIR}/List.h
+${UTILITY_DIR}/PrefixSum.h
 ${UTILITY_DIR}/Set.h
 )
 
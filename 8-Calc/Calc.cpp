@@ -11,13 +11,17 @@
 #include "Color.h"
 #include "Font.h"
 #include "Caret.h"
+#include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "CalcDoc.h"
 #include "CalcView.h"
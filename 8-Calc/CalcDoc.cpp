@@ -6,13 +6,17 @@
 #include "Color.h"
 #include "Font.h"
 #include "Caret.h"
+#include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "CalcView.h"
 #include "CalcDoc.h"
@@ -65,16 +69,15 @@ END_MESSAGE_MAP()
 
 CCalcDoc::CCalcDoc()
  :m_eCalcStatus(CS_MARK),
-  m_eKeyboardState(KM_INSERT),
-  m_rfMinCopy(-1, -1),
-  m_rfMaxCopy(-1, -1)
+  m_eKeyboardState(KM_INSERT)
 {
   m_cellMatrix.SetTargetSetMatrix(&m_tSetMatrix);
   m_tSetMatrix.SetCellMatrix(&m_cellMatrix);
 }
 
 // Serialize is quite simple. As the document is created by the Application
-// Framework, we have to call Serialize in the base class CDocument.
+// Framework, we have to call Serialize in the base class CDocument. The grid
+// index comes last, so that files saved without it can still be loaded.
 
 void CCalcDoc::Serialize(CArchive& archive)
 {
@@ -82,6 +85,7 @@ void CCalcDoc::Serialize(CArchive& archive)
 
   m_cellMatrix.Serialize(archive);
   m_tSetMatrix.Serialize(archive);
+  m_gridIndex.Serialize(archive);
 }
 
 // When the user has modified the text of a cell, the cell has to be
@@ -89,10 +93,7 @@ void CCalcDoc::Serialize(CArchive& archive)
 
 void CCalcDoc::RepaintEditArea()
 {
-  CPoint ptTopLeft(m_rfEdit.GetCol() * COL_WIDTH,m_rfEdit.GetRow() * ROW_HEIGHT);
-  CSize szEditCell(COL_WIDTH, ROW_HEIGHT);
-
-  CRect rcEditCell(ptTopLeft, szEditCell);
+  CRect rcEditCell = m_gridIndex.GetCellRect(m_rfEdit);
   UpdateAllViews(NULL, (LPARAM) &rcEditCell);
 }
 
@@ -107,11 +108,8 @@ void CCalcDoc::RepaintMarkedArea()
   int iMinMarkedCol = min(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol());
   int iMaxMarkedCol = max(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol());
 
-  CPoint ptTopLeft(iMinMarkedCol * COL_WIDTH, iMinMarkedRow * ROW_HEIGHT);
-  CPoint ptBottomRight((iMaxMarkedCol + 1) * COL_WIDTH,
-                       (iMaxMarkedRow + 1) * ROW_HEIGHT);
-
-  CRect rcMarkedBlock(ptTopLeft, ptBottomRight);
+  CRect rcMarkedBlock = m_gridIndex.GetBlockRect(iMinMarkedRow, iMinMarkedCol,
+                                                 iMaxMarkedRow, iMaxMarkedCol);
   UpdateAllViews(NULL, (LPARAM) &rcMarkedBlock);
 }
 
@@ -126,16 +124,38 @@ void CCalcDoc::RepaintSet(const ReferenceSet& repaintSet)
        position != NULL; repaintSet.GetNext(position))
   {
     Reference reference = repaintSet.GetAt(position);
+    CRect rcCell = m_gridIndex.GetCellRect(reference);
+    UpdateAllViews(NULL, (LPARAM) &rcCell);
+  }
+}
 
-    int iRow = reference.GetRow();
-    int iCol = reference.GetCol();
+// SetRowHeight and SetColWidth are called by the view class when the user
+// drags the border of a row or column header. The new size is stored in the
+// grid index, which takes logarithmic time regardless of the number of rows
+// or columns. The view then updates its scroll bars and repaints the
+// spreadsheet, as every row below the row or every column to the right of
+// the column has moved.
 
-    CPoint ptCell(iCol * COL_WIDTH, iRow * ROW_HEIGHT);
-    CSize szCell(COL_WIDTH, ROW_HEIGHT);
-    CRect rcCell(ptCell, szCell);
+void CCalcDoc::SetRowHeight(int iRow, int iHeight)
+{
+  m_gridIndex.SetRowHeight(iRow, iHeight);
+  SetModifiedFlag();
 
-    UpdateAllViews(NULL, (LPARAM) &rcCell);
-  }
+  CCalcView* pCalcView = (CCalcView*) m_caret.GetView();
+  pCalcView->UpdateScrollBars();
+  pCalcView->Invalidate();
+  UpdateCaret();
+}
+
+void CCalcDoc::SetColWidth(int iCol, int iWidth)
+{
+  m_gridIndex.SetColWidth(iCol, iWidth);
+  SetModifiedFlag();
+
+  CCalcView* pCalcView = (CCalcView*) m_caret.GetView();
+  pCalcView->UpdateScrollBars();
+  pCalcView->Invalidate();
+  UpdateCaret();
 }
 
 // DoubleClick is called by the view class when the user double clicks with
@@ -155,10 +175,10 @@ void CCalcDoc::DoubleClick(Reference rfCell, CPoint ptMouse, CDC* pDC)
   Cell* pEditCell = m_cellMatrix.Get(m_rfEdit.GetRow(), m_rfEdit.GetCol());
   pEditCell->GenerateInputText();
 
-  CPoint ptTopLeft(m_rfEdit.GetCol() * COL_WIDTH,m_rfEdit.GetRow() * ROW_HEIGHT);
-  m_iInputIndex = pEditCell->MouseToIndex(ptMouse - ptTopLeft);
+  CRect rcEditCell = m_gridIndex.GetCellRect(m_rfEdit);
+  m_iInputIndex = pEditCell->MouseToIndex(ptMouse - rcEditCell.TopLeft());
 
-  pEditCell->GenerateCaretArray(pDC);
+  pEditCell->GenerateCaretArray(rcEditCell.Size(), pDC);
   RepaintEditArea();
   UpdateCaret();
 }
@@ -175,8 +195,7 @@ void CCalcDoc::MakeCellVisible(Reference rfCell)
 
 void CCalcDoc::MakeCellVisible(int iRow, int iCol)
 {
-  CPoint ptTopLeft(iCol * COL_WIDTH, iRow * ROW_HEIGHT);
-  CRect rcCell(ptTopLeft, CSize(COL_WIDTH, ROW_HEIGHT));
+  CRect rcCell = m_gridIndex.GetCellRect(iRow, iCol);
 
   CCalcView* pCalcView = (CCalcView*) m_caret.GetView();
   pCalcView->MakeCellVisible(rcCell);
@@ -210,8 +229,7 @@ void CCalcDoc::UpdateCaret()
       if (pCalcView->IsCellVisible(m_rfEdit.GetRow(), m_rfEdit.GetCol()))
       {
         Cell* pEditCell = m_cellMatrix.Get(m_rfEdit);
-        CPoint ptTopLeft(m_rfEdit.GetCol() * COL_WIDTH,
-                         m_rfEdit.GetRow() * ROW_HEIGHT);
+        CPoint ptTopLeft = m_gridIndex.GetCellRect(m_rfEdit).TopLeft();
         CRect rcCaret = ptTopLeft +
                         pEditCell->IndexToCaret(m_iInputIndex);
 
@@ -284,16 +302,31 @@ void CCalcDoc::UnmarkAndMark(int iNewFirstMarkedRow,int iNewFirstMarkedCol,
 
         try
         {
-          pCell->EndEdit(m_rfEdit);
-          pCell->EvaluateValue(FALSE);
+          // If the cell has been changed, we need to evaluate and update all
+          // targets of this cell. If not, we only repaint the cell itself.
+          // The number of edges added to or removed from the dependency graph
+          // is traced, an unchanged cell shall not cause any edits at all.
 
-          // We need to evaluate and update all targets of this cell.
+          int iEditCount = m_tSetMatrix.GetEditCount();
 
-          ReferenceSet repaintSet =
-                       m_tSetMatrix.EvaluateTargets(m_rfEdit);
-          RepaintSet(repaintSet);
+          if (pCell->EndEdit(m_rfEdit))
+          {
+            pCell->EvaluateValue(FALSE);
 
-          SetModifiedFlag();
+            ReferenceSet repaintSet =
+                         m_tSetMatrix.EvaluateTargets(m_rfEdit);
+            RepaintSet(repaintSet);
+
+            SetModifiedFlag();
+          }
+
+          else
+          {
+            RepaintEditArea();
+          }
+
+          TRACE(TEXT("EndEdit: %d dependency graph edits.\n"),
+                m_tSetMatrix.GetEditCount() - iEditCount);
         }
 
         // In case of a parse error, we display the message in a message
@@ -320,8 +353,7 @@ void CCalcDoc::UnmarkAndMark(int iNewFirstMarkedRow,int iNewFirstMarkedCol,
           if ((iRow < iNewMinMarkedRow) || (iRow > iNewMaxMarkedRow) ||
               (iCol < iNewMinMarkedCol) || (iCol > iNewMaxMarkedCol))
           {
-            CPoint ptTopLeft(iCol * COL_WIDTH, iRow * ROW_HEIGHT);
-            CRect rcCell(ptTopLeft, CSize(COL_WIDTH, ROW_HEIGHT));
+            CRect rcCell = m_gridIndex.GetCellRect(iRow, iCol);
             UpdateAllViews(NULL, (LPARAM) &rcCell);
           }
         }
@@ -339,8 +371,7 @@ void CCalcDoc::UnmarkAndMark(int iNewFirstMarkedRow,int iNewFirstMarkedCol,
       if ((iRow < iOldMinMarkedRow) || (iRow > iOldMaxMarkedRow) ||
           (iCol < iOldMinMarkedCol) || (iCol > iOldMaxMarkedCol))
       {
-        CPoint ptTopLeft(iCol * COL_WIDTH, iRow * ROW_HEIGHT);
-        CRect rcCell(ptTopLeft,  CSize(COL_WIDTH, ROW_HEIGHT));
+        CRect rcCell = m_gridIndex.GetCellRect(iRow, iCol);
         UpdateAllViews(NULL, (LPARAM) &rcCell);
       }
     }
@@ -494,7 +525,7 @@ void CCalcDoc::CharDown(UINT uChar, CDC* pDC)
   // We add the character and generate a new caret array.
   Cell* pCell = m_cellMatrix.Get(m_rfEdit);
   pCell->CharDown(uChar, m_iInputIndex++, m_eKeyboardState);
-  pCell->GenerateCaretArray(pDC);
+  pCell->GenerateCaretArray(m_gridIndex.GetCellRect(m_rfEdit).Size(), pDC);
 
   // Finally, we update the edit area (the cell being edited) and the caret.
   RepaintEditArea();
@@ -785,7 +816,8 @@ void CCalcDoc::DeleteKey(CDC* pDC)
         {
           stInput.Delete(m_iInputIndex);
           pCell->SetInputText(stInput);
-          pCell->GenerateCaretArray(pDC);
+          pCell->GenerateCaretArray(m_gridIndex.GetCellRect(m_rfEdit).Size(),
+                                    pDC);
           RepaintEditArea();
           SetModifiedFlag();
         }
@@ -837,23 +869,17 @@ void CCalcDoc::OnUpdateCopy(CCmdUI *pCmdUI)
 }
 
 // OnCopy is called when the user choose the Copy menu item, or Copy button
-// on the toolbar.
+// on the toolbar. The marked block is stored in the copy block, which holds
+// the marked cells only.
  
 void CCalcDoc::OnCopy()
 {
-  m_rfMinCopy.SetRow(min(m_rfFirstMark.GetRow(), m_rfLastMark.GetRow()));
-  m_rfMinCopy.SetCol(min(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol()));
-
-  m_rfMaxCopy.SetRow(max(m_rfFirstMark.GetRow(), m_rfLastMark.GetRow()));
-  m_rfMaxCopy.SetCol(max(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol()));
+  Reference rfMinCopy(min(m_rfFirstMark.GetRow(), m_rfLastMark.GetRow()),
+                      min(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol()));
+  Reference rfMaxCopy(max(m_rfFirstMark.GetRow(), m_rfLastMark.GetRow()),
+                      max(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol()));
 
-  for (int iRow = m_rfMinCopy.GetRow(); iRow <= m_rfMaxCopy.GetRow(); ++iRow)
-  {
-    for (int iCol = m_rfMinCopy.GetCol(); iCol <= m_rfMaxCopy.GetCol();++iCol)
-    {
-      *m_copyMatrix.Get(iRow, iCol) = *m_cellMatrix.Get(iRow, iCol);
-    }
-  }
+  m_copyBlock.Copy(&m_cellMatrix, rfMinCopy, rfMaxCopy);
 }
 
 // The Cut menu item, toolbar button, and accelerator are enabled when the
@@ -873,7 +899,7 @@ void CCalcDoc::OnCut()
 
 // The Paste menu item, toolbar button, and accelerator are disabled when
 // the application is in edit mode. In mark mode, it is enabled if there is
-// a block of cells to start with (m_rfMinCopy.GetRow() != -1) and if
+// a block of cells to start with (the copy block is not empty) and if
 // exactly one cell is marked or if a block of the same size at the copied
 // block is marked.
 
@@ -886,10 +912,10 @@ void CCalcDoc::OnUpdatePaste(CCmdUI *pCmdUI)
       break;
 
     case CS_MARK:
-      if (m_rfMinCopy.GetRow() != -1)
+      if (!m_copyBlock.IsEmpty())
       {
-        int iCopiedRows = abs(m_rfMaxCopy.GetRow() - m_rfMinCopy.GetRow()) +1;
-        int iCopiedCols = abs(m_rfMaxCopy.GetCol() - m_rfMinCopy.GetCol()) +1;
+        int iCopiedRows = m_copyBlock.GetRows();
+        int iCopiedCols = m_copyBlock.GetCols();
 
         if ((m_rfFirstMark.GetRow() == m_rfLastMark.GetRow()) &&
             (m_rfFirstMark.GetCol() == m_rfLastMark.GetCol()))
@@ -920,118 +946,95 @@ void CCalcDoc::OnUpdatePaste(CCmdUI *pCmdUI)
 }
 
 // When we paste a cell block into the spreadsheet, we have to check that
-// it does not introduce a cycle into the cell matrix. Then we paste and
-// parse the cells one by one. We start by defining a test cell matrix and a
-// test target set matrix, which are copies of the document field m_cellMatrix
-// and m_tSetMatrix.
-
-// Then we paste the cells one by one. Before we paste a cell, we have to
-// remove it as a target for each of its sources. For each pasted cell, we
-// adjust its references, check for cycles, and evaluates its value
-// recursively; that is, each time we find a reference in a formula, we
-// evaluate that reference and if it is a formula itself, its references
-// are evaluated, and so on. As we do not have any cyclic references, the
-// recursive evaluation have to terminate. This is necessary in order for the
-// cells in the pasted block to receive their correct values. Otherwise, we
-// cannot be sure that the value of a reference is the correct one or if it is
-// the one of the previous cell, before the paste.
-
-// In case of any problem, an exception is thrown, a message box reports the
-// error to the user, and the method returns. The cell and target set
-// matrices are only updated at the end of the method if every cell has been
-// pasted without any problems.
+// it does not introduce a cycle into the cell matrix. Rather than copying
+// the whole cell and target set matrices in order to protect them in case
+// of errors, we only save the cells of the area the block is pasted into in
+// a backup block.
+
+// Then we remove the cells of the area as targets of their sources, and
+// paste the whole block at once; the references of the pasted formulas are
+// adjusted by the copy block. When every cell is in place, we search the
+// pasted cells and their sources for cycles in one pass. Only when the whole block has been accepted do we
+// add the pasted cells as targets for their sources, and evaluate the pasted
+// cells and every cell depending on them in one single pass.
+
+// In case of any problem, an exception is thrown, the backup block and the
+// targets of its cells are restored, a message box reports the error to the
+// user, and the method returns.
 
 void CCalcDoc::OnPaste()
 {
-  // We need to find the difference between the copy and paste location of the
-  // block in order to update the references of the block.
-
   int iMinMarkedRow = min(m_rfFirstMark.GetRow(), m_rfLastMark.GetRow());
   int iMinMarkedCol = min(m_rfFirstMark.GetCol(), m_rfLastMark.GetCol());
 
-  int iRowDiff = iMinMarkedRow - m_rfMinCopy.GetRow();
-  int iColDiff = iMinMarkedCol - m_rfMinCopy.GetCol();
-
-  // We introduce test matrices to protect the original ones in case of
-  // cyclic references.
+  Reference rfMinPaste(iMinMarkedRow, iMinMarkedCol);
+  Reference rfMaxPaste(iMinMarkedRow + m_copyBlock.GetRows() - 1,
+                       iMinMarkedCol + m_copyBlock.GetCols() - 1);
 
-  TSetMatrix testTSetMatrix(m_tSetMatrix);
-  CellMatrix testCellMatrix(m_cellMatrix);
+  CellBlock backupBlock;
+  backupBlock.Copy(&m_cellMatrix, rfMinPaste, rfMaxPaste);
 
-  testTSetMatrix.SetCellMatrix(&testCellMatrix);
-  testCellMatrix.SetTargetSetMatrix(&testTSetMatrix);
+  // As the cells are visited in row order, we can add them to the end of the
+  // paste set and still keep it sorted.
 
-  ReferenceSet totalRepaintSet;
-  BOOL bModified = FALSE;
-  for (int iSourceRow = m_rfMinCopy.GetRow(); iSourceRow <= m_rfMaxCopy.GetRow();
-       ++iSourceRow)
+  ReferenceSet pasteSet;
+  for (int iRow = rfMinPaste.GetRow(); iRow <= rfMaxPaste.GetRow(); ++iRow)
   {
-    for (int iSourceCol = m_rfMinCopy.GetCol();
-         iSourceCol <= m_rfMaxCopy.GetCol();++iSourceCol)
+    for (int iCol = rfMinPaste.GetCol(); iCol <= rfMaxPaste.GetCol(); ++iCol)
     {
-      int iTargetRow = iSourceRow + iRowDiff;
-      int iTargetCol = iSourceCol + iColDiff;
+      Reference mark(iRow, iCol);
+      m_tSetMatrix.RemoveTargets(mark);
+      pasteSet.AddTail(mark);
+    }
+  }
 
-      Reference mark(iTargetRow, iTargetCol);
-      testTSetMatrix.RemoveTargets(mark);
+  // We paste the block and check the pasted cells for cyclic references.
 
-      Cell* pSourceCell = m_copyMatrix.Get(iSourceRow, iSourceCol);
-      Cell* pTargetCell = testCellMatrix.Get(iTargetRow, iTargetCol);
+  BOOL bModified = FALSE;
+  try
+  {
+    bModified = m_copyBlock.Paste(&m_cellMatrix, rfMinPaste);
+    m_tSetMatrix.CheckCircular(pasteSet);
+  }
 
-      // We paste the cell.
-      *pTargetCell = *pSourceCell;
-    
-      if (!pSourceCell->IsEmpty() && !pTargetCell->IsEmpty())
-      {
-        bModified = TRUE;
-      }
+  // If we find an invalid or cyclic reference, an exception is thrown. We
+  // restore the original cells, add them as targets for their sources
+  // again, report the error and return the method. As the pasted cells have
+  // not yet been added as targets, the target set matrix is then back in
+  // its original state.
 
-      // We update the references of the cell's formula, if it has one. Then
-      // we check for cyclic references. If it goes well, we add the cell as
-      // a target for each cell in its source set by calling AddTargets and
-      // add its area to the total set of cell client areas to be updated.
+  catch (const CString stMessage)
+  {
+    backupBlock.Paste(&m_cellMatrix, rfMinPaste);
 
-      try
-      {
-        pTargetCell->UpdateSyntaxTree(iRowDiff, iColDiff);
-        testTSetMatrix.CheckCircular(mark, pTargetCell->GetSourceSet());
-        testTSetMatrix.AddTargets(mark);
+    for (POSITION position = pasteSet.GetHeadPosition();
+         position != NULL; pasteSet.GetNext(position))
+    {
+      m_tSetMatrix.AddTargets(pasteSet.GetAt(position));
+    }
 
-        pTargetCell->EvaluateValue(TRUE);
-        ReferenceSet repaintSet =  testTSetMatrix.EvaluateTargets(mark);
-        totalRepaintSet.AddAll(repaintSet);
-      }
+    AfxGetApp()->GetMainWnd()->MessageBox(stMessage, TEXT("Parse Error."));
+    return;
+  }
 
-      // If we find a cyclic reference, an exception is thrown. We report the
-      // the error and return the method. Note that as we have been working on
-      // copies of the original cell and target set matrix, nothing has
-      // actually been pasted.
+  // If we make this far without finding any cyclic references, we add the
+  // pasted cells as targets, evaluate the affected cells, and update their
+  // client areas.
 
-      catch (const CString stMessage)
-      {
-        AfxGetApp()->GetMainWnd()->MessageBox(stMessage, TEXT("Parse Error."));
-        return;
-      }
-   }
+  for (POSITION position = pasteSet.GetHeadPosition();
+       position != NULL; pasteSet.GetNext(position))
+  {
+    m_tSetMatrix.AddTargets(pasteSet.GetAt(position));
   }
 
-  // If everything worked and at least one cell has been changed, we set the
-  // modified flag. Note that we could not set the flag immediate as we did
-  // not know if the block really was to be pasted, of if a circular reference
-  // was to be found, in case nothing had been modified.
+  ReferenceSet repaintSet = m_tSetMatrix.EvaluateTargets(pasteSet);
 
   if (bModified)
   {
     SetModifiedFlag();
   }
 
-  // If we make this far without finding any cyclic references, we replace the
-  // original cell and target set matrices and update the client areas of the
-  // pasted cells.
-
-  m_cellMatrix = testCellMatrix;
-  m_tSetMatrix = testTSetMatrix;
-  RepaintSet(totalRepaintSet);
+  RepaintSet(repaintSet);
 }
 
 // The delete menu item and accelerator is enabled when the application is
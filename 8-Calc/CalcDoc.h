@@ -1,12 +1,6 @@
 const int HEADER_WIDTH = 1000;
 const int HEADER_HEIGHT = 500;
 
-const int COL_WIDTH = 4000;
-const int ROW_HEIGHT = 1000;
-
-const int TOTAL_WIDTH = HEADER_WIDTH + COLS * COL_WIDTH;
-const int TOTAL_HEIGHT = HEADER_HEIGHT + ROWS * ROW_HEIGHT;
-
 enum CalcState {CS_MARK, CS_EDIT};
 
 class CCalcDoc : public CDocument
@@ -19,6 +13,7 @@ class CCalcDoc : public CDocument
   public:
     virtual void Serialize(CArchive& archive);
     CellMatrix* GetCellMatrix() {return &m_cellMatrix;}
+    GridIndex* GetGridIndex() {return &m_gridIndex;}
 
     int GetCalcStatus() {return m_eCalcStatus;}
     Caret* GetCaret() {return &m_caret;}
@@ -31,6 +26,9 @@ class CCalcDoc : public CDocument
     void RepaintMarkedArea();
     void RepaintSet(const ReferenceSet& referenceSet);
 
+    void SetRowHeight(int iRow, int iHeight);
+    void SetColWidth(int iCol, int iWidth);
+
     void DoubleClick(Reference rfCell, CPoint ptMouse,
                      CDC* pDC);
     void MakeCellVisible(Reference rfCell);
@@ -114,9 +112,10 @@ class CCalcDoc : public CDocument
     KeyboardState m_eKeyboardState;
 
     int m_iInputIndex;
-    Reference m_rfEdit, m_rfFirstMark, m_rfLastMark,
-              m_rfMinCopy, m_rfMaxCopy;
+    Reference m_rfEdit, m_rfFirstMark, m_rfLastMark;
 
-    CellMatrix m_cellMatrix, m_copyMatrix;
+    CellMatrix m_cellMatrix;
+    CellBlock m_copyBlock;
     TSetMatrix m_tSetMatrix;
+    GridIndex m_gridIndex;
 };
@@ -7,13 +7,16 @@
 #include "Color.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "CalcView.h"
 #include "CalcDoc.h"
@@ -38,13 +41,16 @@ BEGIN_MESSAGE_MAP(CCalcView, CView)
 
   ON_WM_SETFOCUS()
   ON_WM_KILLFOCUS()
+  ON_WM_SETCURSOR()
 
   ON_WM_PAINT()
 END_MESSAGE_MAP()
 
 CCalcView::CCalcView()
  :m_bDoubleClick(FALSE),
-  m_pCalcDoc(NULL)
+  m_pCalcDoc(NULL),
+  m_eResizeMode(RM_NONE),
+  m_iResizeIndex(0)
 {
   // Empty.
 }
@@ -69,10 +75,24 @@ int CCalcView::OnCreate(LPCREATESTRUCT lpCreateStruct)
 }
 
 // OnInitialUpdate is called when the view is first visible. It sets the
-// scroll views. It is slightly complicated as we have to take the row and
-// column headers into consideration.
+// scroll bars, which are scrolled to the top left corner of the spreadsheet.
 
 void CCalcView::OnInitialUpdate()
+{
+  UpdateScrollBars();
+  SetScrollPos(SB_HORZ, 0);
+  SetScrollPos(SB_VERT, 0);
+
+  // Finally, the caret needs to be updated.
+  m_pCalcDoc->UpdateCaret();
+}
+
+// UpdateScrollBars sets the ranges and pages of the scroll bars. It is
+// called when the view is first visible and when the user has altered the
+// height of a row or the width of a column. It is slightly complicated as we
+// have to take the row and column headers into consideration.
+
+void CCalcView::UpdateScrollBars()
 {
   // First, we need to create and prepare a device context.
 
@@ -92,30 +112,28 @@ void CCalcView::OnInitialUpdate()
   int iPageWidth = rcClient.right - HEADER_WIDTH;
   int iPageHeight = rcClient.bottom - HEADER_HEIGHT;
 
-  // The size of the horizontal scroll bar is the size of the columns plus the
-  // rest between the page and column width. This make sure the cells will fit
-  // nicely into the client area.
+  // The size of the horizontal scroll bar is the total width of the columns
+  // plus the rest between the page and the default column width. This make
+  // sure the cells will fit nicely into the client area.
+
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
 
   SCROLLINFO scrollInfo;
-  scrollInfo.fMask = SIF_ALL;
-  scrollInfo.nPos = 0;
+  scrollInfo.fMask = SIF_RANGE | SIF_PAGE;
   scrollInfo.nMin = 0;
-  scrollInfo.nPage = rcClient.right - HEADER_WIDTH;
-  scrollInfo.nMax = COLS * COL_WIDTH + iPageWidth % COL_WIDTH - 1;
+  scrollInfo.nPage = iPageWidth;
+  scrollInfo.nMax = pGridIndex->GetTotalWidth() + iPageWidth % COL_WIDTH - 1;
   SetScrollInfo(SB_HORZ, &scrollInfo);
 
-  // In the same way, the size of the scroll bar is the size of the rows plus
-  // the rest between the page and row height.
+  // In the same way, the size of the scroll bar is the total height of the
+  // rows plus the rest between the page and the default row height.
 
-  scrollInfo.fMask = SIF_ALL;
-  scrollInfo.nPos = 0;
+  scrollInfo.fMask = SIF_RANGE | SIF_PAGE;
   scrollInfo.nMin = 0;
-  scrollInfo.nPage = rcClient.bottom - HEADER_HEIGHT;
-  scrollInfo.nMax = ROWS * ROW_HEIGHT + iPageHeight % ROW_HEIGHT - 1;
+  scrollInfo.nPage = iPageHeight;
+  scrollInfo.nMax = pGridIndex->GetTotalHeight() +
+                    iPageHeight % ROW_HEIGHT - 1;
   SetScrollInfo(SB_VERT, &scrollInfo);
-
-  // Finally, the caret needs to be updated.
-  m_pCalcDoc->UpdateCaret();
 }
 
 // OnSize is called every time the user change the size of the window. It sets
@@ -222,17 +240,21 @@ BOOL CCalcView::IsCellVisible(int iRow, int iCol)
 {
   // With the scroll bar settings we find the first and last visible row and
   // column in the client area and compares them to the given row and column.
+  // The rows and columns at the edges of the page are looked up in the grid
+  // index.
+
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
 
   SCROLLINFO scrollInfo;
   GetScrollInfo(SB_VERT, &scrollInfo, SIF_POS | SIF_PAGE);
-  int iFirstVisibleRow = scrollInfo.nPos / ROW_HEIGHT;
-  int iLastVisibleRow = iFirstVisibleRow +
-                        scrollInfo.nPage / ROW_HEIGHT;
+  int iFirstVisibleRow = pGridIndex->RowAt(scrollInfo.nPos);
+  int iLastVisibleRow = pGridIndex->RowAt(scrollInfo.nPos +
+                                          scrollInfo.nPage);
 
   GetScrollInfo(SB_HORZ, &scrollInfo, SIF_POS | SIF_PAGE);
-  int iFirstVisibleCol = scrollInfo.nPos / COL_WIDTH;
-  int iLastVisibleCol = iFirstVisibleCol +
-                        scrollInfo.nPage / COL_WIDTH;
+  int iFirstVisibleCol = pGridIndex->ColAt(scrollInfo.nPos);
+  int iLastVisibleCol = pGridIndex->ColAt(scrollInfo.nPos +
+                                          scrollInfo.nPage);
 
   return ((iRow >= iFirstVisibleRow) && (iRow <= iLastVisibleRow) &&
           (iCol >= iFirstVisibleCol) && (iCol <= iLastVisibleCol));
@@ -250,28 +272,29 @@ void CCalcView::OnVScroll(UINT uSBCode, UINT /* yThumbPos */,
   SCROLLINFO scrollInfo;
   GetScrollInfo(SB_VERT, &scrollInfo);
 
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
   int yPos = scrollInfo.nPos;
-  int iOldRow = yPos / ROW_HEIGHT;
+  int iOldRow = pGridIndex->RowAt(yPos);
 
   switch (uSBCode)
   {
-    // We increase or decrease the line and check that the scroll position
-    // has not excluded the scroll limits. The scroll position cannot be
-    // less than zero and it cannot be greater than the height of the
-    // spreadsheet minus the height of the client area.
+    // We move to the top of the previous or next row and check that the
+    // scroll position has not excluded the scroll limits. The scroll
+    // position cannot be less than zero and it cannot be greater than the
+    // height of the spreadsheet minus the height of the client area.
 
     case SB_LINEUP:
-      yPos = max(0, yPos - ROW_HEIGHT);
+      yPos = pGridIndex->GetRowTop(max(0, iOldRow - 1));
       break;
 
     case SB_LINEDOWN:
-      yPos = min(yPos + ROW_HEIGHT, scrollInfo.nMax);
+      yPos = min(pGridIndex->GetRowTop(iOldRow + 1), scrollInfo.nMax);
       break;
 
     // We scroll one page up or down. Note the difference between scrolling
-    // one line. A line has always the same height (ROW_HEIGHT), but a page
-    // is defined by the current size of the client are, excluding the
-    // headers (scrollInfo.nMax)
+    // one line. A line has the height of its row, but a page is defined by
+    // the current size of the client are, excluding the headers
+    // (scrollInfo.nMax)
 
     case SB_PAGEUP:
       yPos = max(0, yPos - (int) scrollInfo.nPage);
@@ -289,11 +312,18 @@ void CCalcView::OnVScroll(UINT uSBCode, UINT /* yThumbPos */,
       break;
   }
 
-  int iNewRow = (int) ((double) yPos / ROW_HEIGHT + 0.5);
+  // The scroll position is rounded to the nearest row border.
+
+  int iNewRow = pGridIndex->RowAt(yPos);
+  if ((yPos - pGridIndex->GetRowTop(iNewRow)) >
+      (pGridIndex->GetRowHeight(iNewRow) / 2))
+  {
+    ++iNewRow;
+  }
 
   if (iOldRow != iNewRow)
   {
-    SetScrollPos(SB_VERT, iNewRow * ROW_HEIGHT);
+    SetScrollPos(SB_VERT, pGridIndex->GetRowTop(iNewRow));
 
     CRect rcClient;
     GetClientRect(&rcClient);
@@ -330,28 +360,29 @@ void CCalcView::OnHScroll(UINT uSBCode, UINT /* xThumbPos */,
   SCROLLINFO scrollInfo;
   GetScrollInfo(SB_HORZ, &scrollInfo);
 
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
   int xPos = scrollInfo.nPos;
-  int iOldCol = xPos / COL_WIDTH;
+  int iOldCol = pGridIndex->ColAt(xPos);
 
   switch (uSBCode)
   {
-    // We increase or decrease the line and check that the scroll position
-    // has not excluded the scroll limits. The scroll position cannot be
-    // less than zero and it cannot be greater than the width of the
-    // spreadsheet minus the width of the client area.
+    // We move to the left side of the previous or next column and check
+    // that the scroll position has not excluded the scroll limits. The
+    // scroll position cannot be less than zero and it cannot be greater than
+    // the width of the spreadsheet minus the width of the client area.
 
     case SB_LINELEFT:
-      xPos = max(0, xPos - COL_WIDTH);
+      xPos = pGridIndex->GetColLeft(max(0, iOldCol - 1));
       break;
 
     case SB_LINERIGHT:
-      xPos = min(xPos + COL_WIDTH, scrollInfo.nMax - 1);
+      xPos = min(pGridIndex->GetColLeft(iOldCol + 1), scrollInfo.nMax - 1);
       break;
 
-    // We scroll one page up or down. Note the difference between scrolling
-    // one line. A line has always the same height (ROW_HEIGHT), but a page
-    // is defined by the current size of the client are, excluding the
-    // headers (scrollInfo.nMax)
+    // We scroll one page left or right. Note the difference between
+    // scrolling one line. A line has the width of its column, but a page is
+    // defined by the current size of the client are, excluding the headers
+    // (scrollInfo.nMax)
 
     case SB_PAGELEFT:
       xPos = max(0, xPos - (int) scrollInfo.nPage);
@@ -369,11 +400,18 @@ void CCalcView::OnHScroll(UINT uSBCode, UINT /* xThumbPos */,
       break;
   }
 
-  int iNewCol = (int) ((double) xPos / COL_WIDTH + 0.5);
+  // The scroll position is rounded to the nearest column border.
+
+  int iNewCol = pGridIndex->ColAt(xPos);
+  if ((xPos - pGridIndex->GetColLeft(iNewCol)) >
+      (pGridIndex->GetColWidth(iNewCol) / 2))
+  {
+    ++iNewCol;
+  }
 
   if (iOldCol != iNewCol)
   {
-    SetScrollPos(SB_HORZ, iNewCol * COL_WIDTH);
+    SetScrollPos(SB_HORZ, pGridIndex->GetColLeft(iNewCol));
 
     CRect rcClient;
     GetClientRect(&rcClient);
@@ -411,6 +449,9 @@ SpreadSheetArea CCalcView::GetMouseLocation(CPoint ptMouse, Reference& rfCell)
   CClientDC dc(this);
   OnPrepareDC(&dc);
   dc.DPtoLP(&ptMouse);
+
+  // The row and column are looked up in the grid index.
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
   
   // Is the mouse if the top left header box?  
 
@@ -428,7 +469,7 @@ SpreadSheetArea CCalcView::GetMouseLocation(CPoint ptMouse, Reference& rfCell)
   {
     LogicalPointToSheetPoint(ptMouse);
 
-    rfCell.SetRow(min(ROWS - 1, ptMouse.y / ROW_HEIGHT));
+    rfCell.SetRow(pGridIndex->RowAt(ptMouse.y));
     rfCell.SetCol(0);
 
     return MS_ROW;
@@ -441,7 +482,7 @@ SpreadSheetArea CCalcView::GetMouseLocation(CPoint ptMouse, Reference& rfCell)
     LogicalPointToSheetPoint(ptMouse);
 
     rfCell.SetRow(0);
-    rfCell.SetCol(min(COLS - 1, ptMouse.x / COL_WIDTH));
+    rfCell.SetCol(pGridIndex->ColAt(ptMouse.x));
 
     return MS_COL;
   }
@@ -452,13 +493,99 @@ SpreadSheetArea CCalcView::GetMouseLocation(CPoint ptMouse, Reference& rfCell)
   {
     LogicalPointToSheetPoint(ptMouse);
 
-    rfCell.SetRow(min(ROWS - 1, ptMouse.y / ROW_HEIGHT));
-    rfCell.SetCol(min(COLS - 1, ptMouse.x / COL_WIDTH));
+    rfCell.SetRow(pGridIndex->RowAt(ptMouse.y));
+    rfCell.SetCol(pGridIndex->ColAt(ptMouse.x));
 
     return MS_SHEET;
   }
 }
 
+// GetResizeLocation decides whether the mouse (in device coordinates) is on
+// the border between two rows in the row header or between two columns in
+// the column header, in which case the user can drag the border in order
+// to alter the height of the row above or the width of the column to the
+// left of the border. The index of that row or column is returned in
+// iIndex.
+
+ResizeMode CCalcView::GetResizeLocation(CPoint ptMouse, int& iIndex)
+{
+  CClientDC dc(this);
+  OnPrepareDC(&dc);
+  dc.DPtoLP(&ptMouse);
+
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
+
+  if ((ptMouse.x <= HEADER_WIDTH) && (ptMouse.y > HEADER_HEIGHT))
+  {
+    LogicalPointToSheetPoint(ptMouse);
+    int iRow = pGridIndex->RowAt(ptMouse.y);
+
+    if (abs(ptMouse.y - pGridIndex->GetRowTop(iRow + 1)) <= RESIZE_MARGIN)
+    {
+      iIndex = iRow;
+      return RM_ROW;
+    }
+
+    if ((iRow > 0) &&
+        (abs(ptMouse.y - pGridIndex->GetRowTop(iRow)) <= RESIZE_MARGIN))
+    {
+      iIndex = iRow - 1;
+      return RM_ROW;
+    }
+  }
+
+  else if ((ptMouse.y <= HEADER_HEIGHT) && (ptMouse.x > HEADER_WIDTH))
+  {
+    LogicalPointToSheetPoint(ptMouse);
+    int iCol = pGridIndex->ColAt(ptMouse.x);
+
+    if (abs(ptMouse.x - pGridIndex->GetColLeft(iCol + 1)) <= RESIZE_MARGIN)
+    {
+      iIndex = iCol;
+      return RM_COL;
+    }
+
+    if ((iCol > 0) &&
+        (abs(ptMouse.x - pGridIndex->GetColLeft(iCol)) <= RESIZE_MARGIN))
+    {
+      iIndex = iCol - 1;
+      return RM_COL;
+    }
+  }
+
+  return RM_NONE;
+}
+
+// OnSetCursor displays a resize cursor when the mouse is on, or is
+// dragging, the border between two rows or columns in the headers.
+
+BOOL CCalcView::OnSetCursor(CWnd* pWnd, UINT uHitTest, UINT uMessage)
+{
+  if (uHitTest == HTCLIENT)
+  {
+    CPoint ptMouse;
+    ::GetCursorPos(&ptMouse);
+    ScreenToClient(&ptMouse);
+
+    int iIndex;
+    ResizeMode eMode = (m_eResizeMode != RM_NONE) ? m_eResizeMode
+                       : GetResizeLocation(ptMouse, iIndex);
+
+    switch (eMode)
+    {
+      case RM_ROW:
+        ::SetCursor(::LoadCursor(NULL, IDC_SIZENS));
+        return TRUE;
+
+      case RM_COL:
+        ::SetCursor(::LoadCursor(NULL, IDC_SIZEWE));
+        return TRUE;
+    }
+  }
+
+  return CView::OnSetCursor(pWnd, uHitTest, uMessage);
+}
+
 // When the user clicks the mouse, two messages are sent: WM_LBUTTONDOWN
 // followed by WM_LBUTTONUP. In practice, however, it is almost impossible
 // for the user to press and release the button without move the mouse some
@@ -478,6 +605,19 @@ SpreadSheetArea CCalcView::GetMouseLocation(CPoint ptMouse, Reference& rfCell)
 void CCalcView::OnLButtonDown(UINT /* uFlags */, CPoint ptMouse)
 {
   m_bDoubleClick = FALSE;
+
+  // If the user presses the mouse on the border between two rows or columns
+  // in the headers, the border is dragged rather than the cells marked. We
+  // capture the mouse until the button is released.
+
+  m_eResizeMode = GetResizeLocation(ptMouse, m_iResizeIndex);
+
+  if (m_eResizeMode != RM_NONE)
+  {
+    SetCapture();
+    return;
+  }
+
   SpreadSheetArea eArea = GetMouseLocation(ptMouse, m_rfFirstCell);
 
   switch (eArea)
@@ -515,6 +655,36 @@ void CCalcView::OnLButtonDown(UINT /* uFlags */, CPoint ptMouse)
 
 void CCalcView::OnMouseMove(UINT uFlags, CPoint ptMouse)
 {
+  // If the user drags the border between two rows or columns, the new
+  // height or width is the distance between the top or left side of the
+  // row or column and the mouse.
+
+  if (m_eResizeMode != RM_NONE)
+  {
+    CClientDC dc(this);
+    OnPrepareDC(&dc);
+
+    dc.DPtoLP(&ptMouse);
+    LogicalPointToSheetPoint(ptMouse);
+
+    GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
+
+    switch (m_eResizeMode)
+    {
+      case RM_ROW:
+        m_pCalcDoc->SetRowHeight(m_iResizeIndex, ptMouse.y -
+                                 pGridIndex->GetRowTop(m_iResizeIndex));
+        break;
+
+      case RM_COL:
+        m_pCalcDoc->SetColWidth(m_iResizeIndex, ptMouse.x -
+                                pGridIndex->GetColLeft(m_iResizeIndex));
+        break;
+    }
+
+    return;
+  }
+
   BOOL bLeftButtonDown = (uFlags & MK_LBUTTON);
 
   if (bLeftButtonDown && !m_bDoubleClick)
@@ -546,6 +716,18 @@ void CCalcView::OnMouseMove(UINT uFlags, CPoint ptMouse)
   }
 }
 
+// OnLButtonUp is called when the user releases the left button on the
+// mouse. If a border has been dragged, the capture of the mouse is released.
+
+void CCalcView::OnLButtonUp(UINT /* uFlags */, CPoint /* ptMouse */)
+{
+  if (m_eResizeMode != RM_NONE)
+  {
+    m_eResizeMode = RM_NONE;
+    ReleaseCapture();
+  }
+}
+
 // OnLButtonDblClk is called when the user double clicks the left button on
 // the mouse.
 
@@ -631,6 +813,10 @@ void CCalcView::MakeCellVisible(CRect rcArea)
   CClientDC dc(this);
   OnPrepareDC(&dc);
 
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
+  int iTotalWidth = HEADER_WIDTH + pGridIndex->GetTotalWidth();
+  int iTotalHeight = HEADER_HEIGHT + pGridIndex->GetTotalHeight();
+
   SCROLLINFO scrollInfo;
   GetScrollInfo(SB_HORZ, &scrollInfo);
   int xFirst = scrollInfo.nPos;
@@ -645,7 +831,7 @@ void CCalcView::MakeCellVisible(CRect rcArea)
   {
     SetScrollPos(SB_HORZ, rcArea.left);
 
-    CRect rcUpdate(HEADER_WIDTH, 0, TOTAL_WIDTH, TOTAL_HEIGHT);
+    CRect rcUpdate(HEADER_WIDTH, 0, iTotalWidth, iTotalHeight);
     dc.LPtoDP(rcUpdate);
     InvalidateRect(rcUpdate);
     UpdateWindow();
@@ -655,15 +841,22 @@ void CCalcView::MakeCellVisible(CRect rcArea)
 
   // If the cell is to the right of the last visible cell, we scroll the
   // horizontal bar to first visible cell added with the distance between
-  // given cell and the last cell and update the window and the caret.
+  // given cell and the last cell, rounded up to the next column border, and
+  // update the window and the caret.
 
   if (rcArea.right > xLast)
   {
-    int iDistance = rcArea.right - xLast;
-    iDistance += COL_WIDTH - iDistance % COL_WIDTH;
-    SetScrollPos(SB_HORZ, xFirst + iDistance);
+    int xNewFirst = xFirst + (rcArea.right - xLast);
+    int iNewFirstCol = pGridIndex->ColAt(xNewFirst);
+
+    if (pGridIndex->GetColLeft(iNewFirstCol) < xNewFirst)
+    {
+      ++iNewFirstCol;
+    }
 
-    CRect rcUpdate(HEADER_WIDTH, 0, TOTAL_WIDTH, TOTAL_HEIGHT);
+    SetScrollPos(SB_HORZ, pGridIndex->GetColLeft(iNewFirstCol));
+
+    CRect rcUpdate(HEADER_WIDTH, 0, iTotalWidth, iTotalHeight);
     dc.LPtoDP(rcUpdate);
     InvalidateRect(rcUpdate);
     UpdateWindow();
@@ -683,7 +876,7 @@ void CCalcView::MakeCellVisible(CRect rcArea)
   {
     SetScrollPos(SB_VERT, rcArea.top);
 
-    CRect rcUpdate(0, HEADER_HEIGHT, TOTAL_WIDTH, TOTAL_HEIGHT);
+    CRect rcUpdate(0, HEADER_HEIGHT, iTotalWidth, iTotalHeight);
     dc.LPtoDP(rcUpdate);
     InvalidateRect(rcUpdate);
     UpdateWindow();
@@ -693,15 +886,22 @@ void CCalcView::MakeCellVisible(CRect rcArea)
 
   // If the cell is below the last visible cell, we scroll the vertical
   // bar to top visible cell added with the distance between given cell and
-  // the bottom and update the window and the caret.
+  // the bottom, rounded up to the next row border, and update the window and
+  // the caret.
 
   if (rcArea.bottom > yLast)
   {
-    int iDistance = rcArea.bottom - yLast;
-    iDistance += ROW_HEIGHT - iDistance % ROW_HEIGHT;
-    SetScrollPos(SB_VERT, yFirst + iDistance);
+    int yNewFirst = yFirst + (rcArea.bottom - yLast);
+    int iNewFirstRow = pGridIndex->RowAt(yNewFirst);
+
+    if (pGridIndex->GetRowTop(iNewFirstRow) < yNewFirst)
+    {
+      ++iNewFirstRow;
+    }
 
-    CRect rcUpdate(0, HEADER_HEIGHT, TOTAL_WIDTH, TOTAL_HEIGHT);
+    SetScrollPos(SB_VERT, pGridIndex->GetRowTop(iNewFirstRow));
+
+    CRect rcUpdate(0, HEADER_HEIGHT, iTotalWidth, iTotalHeight);
     dc.LPtoDP(rcUpdate);
     InvalidateRect(rcUpdate);
     UpdateWindow();
@@ -752,8 +952,9 @@ void CCalcView::OnDraw(CDC* pDC)
   CBrush grayBrush(LIGHT_GRAY);
   CBrush *pOldBrush = pDC->SelectObject(&grayBrush);
 
-  int iTotalWidth = HEADER_WIDTH + COLS * COL_WIDTH;
-  int iTotalHeight = HEADER_HEIGHT + ROWS*ROW_HEIGHT;
+  GridIndex* pGridIndex = m_pCalcDoc->GetGridIndex();
+  int iTotalWidth = HEADER_WIDTH + pGridIndex->GetTotalWidth();
+  int iTotalHeight = HEADER_HEIGHT + pGridIndex->GetTotalHeight();
 
   // The area outside the spread sheet.
   pDC->Rectangle(iTotalWidth, 0, rcClient.right, iTotalHeight);
@@ -771,33 +972,41 @@ void CCalcView::OnDraw(CDC* pDC)
   int xScrollPos = GetScrollPos(SB_HORZ);
   int yScrollPos = GetScrollPos(SB_VERT);
 
-  int iStartRow = yScrollPos / ROW_HEIGHT;
-  int iStartCol = xScrollPos / COL_WIDTH;
+  // Only the rows and columns inside the client area are drawn. The first
+  // and last of them are looked up in the grid index.
+
+  int iStartRow = pGridIndex->RowAt(yScrollPos);
+  int iStartCol = pGridIndex->ColAt(xScrollPos);
+
+  int iEndRow = pGridIndex->RowAt(yScrollPos + rcClient.bottom);
+  int iEndCol = pGridIndex->ColAt(xScrollPos + rcClient.right);
 
-  for (int iRow = iStartRow; iRow < ROWS; ++iRow)
+  for (int iRow = iStartRow; iRow <= iEndRow; ++iRow)
   {
-    int yPos = iRow * ROW_HEIGHT;
+    int yPos = pGridIndex->GetRowTop(iRow);
     yPos += HEADER_HEIGHT - yScrollPos;
 
     CString stBuffer;
     stBuffer.Format(TEXT("%d"), iRow + 1);
 
-    CRect rcHeader(0, yPos, HEADER_WIDTH, yPos + ROW_HEIGHT);
+    CRect rcHeader(0, yPos, HEADER_WIDTH,
+                   yPos + pGridIndex->GetRowHeight(iRow));
     pDC->Rectangle(&rcHeader);
     pDC->DrawText(stBuffer, &rcHeader, DT_SINGLELINE | HALIGN_CENTER |VALIGN_CENTER);
   }
 
   // The column header of the spreadsheet.
 
-  for (int iCol = iStartCol; iCol < COLS; ++iCol)
+  for (int iCol = iStartCol; iCol <= iEndCol; ++iCol)
   {
-    int xPos = iCol * COL_WIDTH;
+    int xPos = pGridIndex->GetColLeft(iCol);
     xPos += HEADER_WIDTH - xScrollPos;
 
     CString stBuffer;
     stBuffer.Format(TEXT("%c"), (TCHAR) (TEXT('A') + iCol));
 
-    CRect rcHeader(xPos, 0, xPos + COL_WIDTH, HEADER_HEIGHT);
+    CRect rcHeader(xPos, 0, xPos + pGridIndex->GetColWidth(iCol),
+                   HEADER_HEIGHT);
     pDC->Rectangle(&rcHeader);
     pDC->DrawText(stBuffer, &rcHeader, DT_SINGLELINE | HALIGN_CENTER |VALIGN_CENTER);
   }
@@ -823,9 +1032,9 @@ void CCalcView::OnDraw(CDC* pDC)
   int iMinCol = min(rfFirstMark.GetCol(), rfLastMark.GetCol());
   int iMaxCol = max(rfFirstMark.GetCol(), rfLastMark.GetCol());
 
-  for (int iRow = iStartRow; iRow < ROWS; ++iRow)
+  for (int iRow = iStartRow; iRow <= iEndRow; ++iRow)
   {
-    for (int iCol = iStartCol; iCol < COLS; ++iCol)
+    for (int iCol = iStartCol; iCol <= iEndCol; ++iCol)
     {
       // The variables are initalized to to avoid compiler warnings.      
       BOOL bEdit = FALSE, bMark = FALSE;
@@ -850,11 +1059,17 @@ void CCalcView::OnDraw(CDC* pDC)
           break;
       }
 
-      // The cell is drawn relative the top left corner of the cell.
+      // The cell is drawn in its area given by the grid index. Cells
+      // outside the area to be repainted are skipped, which also saves
+      // generating their output texts.
 
-      CPoint ptTopLeft(iCol * COL_WIDTH, iRow * ROW_HEIGHT);
-      Cell* pCell = pCellMatrix->Get(iRow, iCol);
-      pCell->Draw(ptTopLeft, bEdit, bMark, pDC);
+      CRect rcCell = pGridIndex->GetCellRect(iRow, iCol);
+
+      if (pDC->RectVisible(rcCell))
+      {
+        Cell* pCell = pCellMatrix->Get(iRow, iCol);
+        pCell->Draw(rcCell, bEdit, bMark, pDC);
+      }
     }
   }
 }
@@ -1,4 +1,7 @@
 enum SpreadSheetArea {MS_ALL, MS_ROW, MS_COL, MS_SHEET};
+enum ResizeMode {RM_NONE, RM_ROW, RM_COL};
+
+const int RESIZE_MARGIN = 50;
 
 class CCalcView : public CView
 {
@@ -13,6 +16,7 @@ class CCalcView : public CView
     virtual void OnInitialUpdate();
 
     afx_msg void OnSize(UINT nType, int cx, int cy);
+    void UpdateScrollBars();
     virtual void OnPrepareDC(CDC* pDC,
                              CPrintInfo* pInfo = NULL);
 
@@ -36,11 +40,15 @@ class CCalcView : public CView
   private:
     SpreadSheetArea GetMouseLocation(CPoint ptMouse,
                                      Reference& rcCell);
+    ResizeMode GetResizeLocation(CPoint ptMouse, int& iIndex);
 
   public:
     afx_msg void OnLButtonDown(UINT uFlags, CPoint ptMouse);
     afx_msg void OnMouseMove(UINT uFlags, CPoint ptMouse);
+    afx_msg void OnLButtonUp(UINT uFlags, CPoint ptMouse);
     afx_msg void OnLButtonDblClk(UINT nFlags, CPoint ptMouse);
+    afx_msg BOOL OnSetCursor(CWnd* pWnd, UINT nHitTest,
+                             UINT message);
 
     afx_msg void OnKeyDown(UINT uChar, UINT nRepCnt,
                            UINT uFlags);
@@ -55,4 +63,7 @@ class CCalcView : public CView
     CCalcDoc* m_pCalcDoc;
     BOOL m_bDoubleClick;
     Reference m_rfFirstCell;
+
+    ResizeMode m_eResizeMode;
+    int m_iResizeIndex;
 };
@@ -7,17 +7,21 @@
 #include "Color.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "Token.h"
 #include "Scanner.h"
 #include "Parser.h"
+#include "Number.h"
 
 #include "CalcView.h"
 #include "CalcDoc.h"
@@ -31,6 +35,8 @@
 
 Cell::Cell()
  :m_eCellState(CELL_TEXT),
+  m_bHasValue(FALSE),
+  m_bOutputValid(TRUE),
   m_eHorizontalAlignment(HALIGN_CENTER),
   m_eVerticalAlignment(VALIGN_CENTER),
   m_textColor(BLACK),
@@ -64,6 +70,19 @@ Cell& Cell::operator=(const Cell& cell)
 }
 
 void Cell::CopyCell(const Cell& cell)
+{
+  CopyContent(cell);
+
+  m_stInput = cell.m_stInput;
+  m_caretRectArray.Copy(cell.m_caretRectArray);
+}
+
+// CopyContent copies the contents and the style of the cell, but not the
+// input text and the caret array, which are only used while the cell is
+// edited and are regenerated when the editing starts. It is used when
+// blocks of cells are copied and pasted.
+
+void Cell::CopyContent(const Cell& cell)
 {
   m_eCellState = cell.m_eCellState;
 
@@ -72,9 +91,9 @@ void Cell::CopyCell(const Cell& cell)
 
   m_stText = cell.m_stText;
   m_dValue = cell.m_dValue;
-
-  m_stInput = cell.m_stInput;
+  m_bHasValue = cell.m_bHasValue;
   m_stOutput = cell.m_stOutput;
+  m_bOutputValid = cell.m_bOutputValid;
 
   m_eHorizontalAlignment = cell.m_eHorizontalAlignment;
   m_eVerticalAlignment = cell.m_eVerticalAlignment;
@@ -83,7 +102,6 @@ void Cell::CopyCell(const Cell& cell)
   m_backgroundColor = cell.m_backgroundColor;
 
   m_font = cell.m_font;
-  m_caretRectArray.Copy(cell.m_caretRectArray);
 }
 
 // Clear clears the cell. It is called when the user deletes one or several
@@ -96,11 +114,13 @@ void Cell::Clear(Reference home)
   if (m_eCellState == CELL_FORMULA)
   {
     m_pTargetSetMatrix->RemoveTargets(home);
+    m_sourceSet.RemoveAll();
   }
 
   m_eCellState = CELL_TEXT;
   m_stText = TEXT("");
   m_stOutput = TEXT("");
+  m_bOutputValid = TRUE;
 }
 
 // Serialize is called for each cell in the cell matrix when the user saves
@@ -120,7 +140,7 @@ void Cell::Serialize(CArchive& archive)
 
   if (archive.IsStoring())
   {
-    archive << (int) m_eCellState << m_stText << m_dValue << m_stOutput
+    archive << (int) m_eCellState << m_stText << m_dValue << GetOutputText()
             << (int) m_eHorizontalAlignment << (int) m_eVerticalAlignment;
   }
 
@@ -131,6 +151,7 @@ void Cell::Serialize(CArchive& archive)
             >> iHorizontalAlignment >> iVerticalAlignment;
 
     m_eCellState = (CellState) iCellState;
+    m_bOutputValid = TRUE;
     m_eHorizontalAlignment = (Alignment) iHorizontalAlignment;
     m_eVerticalAlignment = (Alignment) iVerticalAlignment;
   }
@@ -181,9 +202,11 @@ void Cell::CharDown(UINT uNewChar, int iInputIndex, KeyboardState eKeyBoardMode)
 
 // When the user adds or removes a character of the text of a cell, the
 // position of the caret must be updated. GenerateCaretArray takes care of
-// that. Note that this is necessary only when the cell has input focus.
+// that. Note that this is necessary only when the cell has input focus. As
+// the rows and columns may have different sizes, the size of the cell is
+// given by the caller.
 
-void Cell::GenerateCaretArray(CDC* pDC)
+void Cell::GenerateCaretArray(CSize szCell, CDC* pDC)
 {
   // We create, initialize, and select the font of the cell text. Remember
   // that the font is stored in typographical point, which have to be
@@ -221,8 +244,8 @@ void Cell::GenerateCaretArray(CDC* pDC)
   // cell area in order to prevent the text to overwrite the cell borders.
   // The width and height of the cell is subtracted by the margin.
 
-  const int CELL_WIDTH = COL_WIDTH - 2 * CELL_MARGIN;
-  const int CELL_HEIGHT = ROW_HEIGHT - 2 * CELL_MARGIN;
+  const int CELL_WIDTH = szCell.cx - 2 * CELL_MARGIN;
+  const int CELL_HEIGHT = szCell.cy - 2 * CELL_MARGIN;
 
   // The beginning of the text (xLeftPos) shall be decided. The horizontal 
   // alignment can be set in four different modes: left, centered, right,
@@ -403,12 +426,11 @@ CRect Cell::IndexToCaret(int iIndex)
 // device context method SetTextJustification that makes the text in the
 // DrawText call be equally distributed in the cell.
 
-void Cell::Draw(CPoint ptTopLeft, BOOL bEdit, BOOL bMarked, CDC *pDC)
+void Cell::Draw(CRect rcCell, BOOL bEdit, BOOL bMarked, CDC *pDC)
 {
   // In order not to overwrite the border of the cell, we introduce a cell
   // margin.
 
-  CRect rcCell(ptTopLeft, CSize(COL_WIDTH, ROW_HEIGHT));
   CRect rcMargin(rcCell.left + CELL_MARGIN, rcCell.top + CELL_MARGIN,
                  rcCell.right - CELL_MARGIN, rcCell.bottom - CELL_MARGIN);
 
@@ -455,7 +477,7 @@ void Cell::Draw(CPoint ptTopLeft, BOOL bEdit, BOOL bMarked, CDC *pDC)
   // If the cell is in edit mode, we choose to display the input text;
   // otherwise, we display the output text.
 
-  CString stDisplay = bEdit ? m_stInput : m_stOutput;
+  CString stDisplay = bEdit ? m_stInput : GetOutputText();
 
   // If the text has justified horizontal alignment, we have to set the
   // space distribution by calling SetTextJustification. After the call to
@@ -565,14 +587,11 @@ void Cell::GenerateInputText()
       m_stInput = m_stText;
       break;
 
-    // If the cell is in value mode, we convert the value to a text by
-    // calling Format in the MFC CString class. We also remove ending zeros
-    // and the dot if there are no decimals.
+    // If the cell is in value mode, we convert the value to the shortest
+    // text that is read back as the same value.
 
     case CELL_VALUE:
-      m_stInput.Format(TEXT("%f"), m_dValue);
-      m_stInput.TrimRight(TEXT('0'));
-      m_stInput.TrimRight(TEXT('.'));
+      m_stInput = Number::ToString(m_dValue);
       break;
 
     // If the cell is in formula mode, we call the syntax tree to evaluate
@@ -587,9 +606,13 @@ void Cell::GenerateInputText()
 // EditEnd is call by the document class when the user presses the return or
 // tab key, or presses the mouse. We interpret the input or editing of the
 // cell. Depending of the text, the input cell may be set in text, value, or
-// formula mode.
+// formula mode. The return value is true if the cell has been changed, and
+// false if the input holds the same text, value, or formula as before.
+
+// The dependency graph is not rebuilt from scratch. Instead, we compare the
+// old and new source sets and only remove and add the edges that differ.
 
-void Cell::EndEdit(Reference home)
+BOOL Cell::EndEdit(Reference home)
 {
   // First, we get rid of trailing blanks in order to decide whether the
   // first character is an equals sign.
@@ -602,43 +625,72 @@ void Cell::EndEdit(Reference home)
 
   if ((!stTrimInput.IsEmpty()) && (stTrimInput[0] == TEXT('=')))
   {
+    // If the cell already holds the very same formula, which is the case
+    // when the user has started to edit the cell without changing it, there
+    // is no need to parse it again.
+
+    if ((m_eCellState == CELL_FORMULA) &&
+        (stTrimInput == (TEXT("=") + m_syntaxTree.ToString())))
+    {
+      return FALSE;
+    }
+
     Parser parser;
     SyntaxTree newSyntaxTree = parser.Formula(stTrimInput.Mid(1));
-
     ReferenceSet newSourceSet = newSyntaxTree.GetSourceSet();
-    m_pTargetSetMatrix->CheckCircular(home, newSourceSet);
+
+    // A new cycle must pass through a source that was not a source before,
+    // as the graph had no cycles. Therefore, we only need to check the
+    // added sources for cycles; if the references are unchanged, there is
+    // nothing to check.
+
+    ReferenceSet addSet = ReferenceSet::Difference(newSourceSet, m_sourceSet);
+    ReferenceSet removeSet = ReferenceSet::Difference(m_sourceSet,
+                                                      newSourceSet);
+    m_pTargetSetMatrix->CheckCircular(home, addSet);
 
     m_eCellState = CELL_FORMULA;
-    m_pTargetSetMatrix->RemoveTargets(home);
+    m_pTargetSetMatrix->RemoveTargets(home, removeSet);
+    m_pTargetSetMatrix->AddTargets(home, addSet);
 
     m_syntaxTree = newSyntaxTree;
     m_sourceSet = newSourceSet;
-
-    m_pTargetSetMatrix->AddTargets(home);
   }
 
   else if (IsNumeric(stTrimInput))
   {
-    m_eCellState = CELL_VALUE;
-    m_dValue = _tstof(stTrimInput);
+    double dValue = _tstof(stTrimInput);
 
-    m_stOutput.Format(TEXT("%f"), m_dValue);
-    m_stOutput.TrimRight(TEXT('0'));
-    m_stOutput.TrimRight(TEXT('.'));
+    if ((m_eCellState == CELL_VALUE) && (dValue == m_dValue))
+    {
+      return FALSE;
+    }
 
-    m_pTargetSetMatrix->RemoveTargets(home);
+    m_pTargetSetMatrix->RemoveTargets(home, m_sourceSet);
     m_sourceSet.RemoveAll();
+
+    m_eCellState = CELL_VALUE;
+    m_dValue = dValue;
+    m_bOutputValid = FALSE;
   }
 
   else
   {
+    if ((m_eCellState == CELL_TEXT) && (m_stInput == m_stText))
+    {
+      return FALSE;
+    }
+
+    m_pTargetSetMatrix->RemoveTargets(home, m_sourceSet);
+    m_sourceSet.RemoveAll();
+
     m_eCellState = CELL_TEXT;
     m_stText = m_stInput;
     m_stOutput = m_stText;
-
-    m_pTargetSetMatrix->RemoveTargets(home);
-    m_sourceSet.RemoveAll();
+    m_bOutputValid = TRUE;
   }
+
+  return TRUE;
 }
 
 // IsNumeric is a help function that return true if the given text holds a
@@ -725,17 +777,14 @@ void Cell::EvaluateValue(BOOL bRecursive)
   if (m_eCellState == CELL_FORMULA)
   {
     // If the value of the formula is successfully evaluated, the value
-    // flag (m_bHasValue) is set to true and the evaluated value is
-    // converted to the output text (m_stOutput).
+    // flag (m_bHasValue) is set to true. The value is not converted to the
+    // output text until it is needed, see GetOutputText below.
 
     try
     {
       m_dValue = m_syntaxTree.Evaluate(bRecursive, m_pCellMatrix);
       m_bHasValue = TRUE;
-
-      m_stOutput.Format(TEXT("%f"), m_dValue);
-      m_stOutput.TrimRight(TEXT('0'));
-      m_stOutput.TrimRight(TEXT('.'));
+      m_bOutputValid = FALSE;
     }
 
     // If the text cannot not evaluated due to division by zero or missing
@@ -746,10 +795,29 @@ void Cell::EvaluateValue(BOOL bRecursive)
     {
       m_bHasValue = FALSE;
       m_stOutput = stMessage;
+      m_bOutputValid = TRUE;
     }
   }
 }
 
+// GetOutputText returns the text displayed in the cell when it is not
+// edited. A recalculation may update the values of a large number of cells,
+// most of which are never displayed before their values change again. So
+// instead of converting every new value to text, EvaluateValue and EndEdit
+// only mark the output text as outdated (m_bOutputValid is false), and the
+// text is generated here when the cell is drawn or saved.
+
+CString Cell::GetOutputText()
+{
+  if (!m_bOutputValid)
+  {
+    m_stOutput = Number::ToString(m_dValue);
+    m_bOutputValid = TRUE;
+  }
+
+  return m_stOutput;
+}
+
 // Finally, UpdateSyntaxTree is called when a block of cells has been
 // copied and pasted into another location in the spreadsheet. If this
 // cell holds a formula, it calls UpdateReference of its syntax tree and
@@ -24,6 +24,7 @@ public:
   Cell(const Cell& cell);
   Cell& operator=(const Cell& cell);
   void CopyCell(const Cell& cell);
+  void CopyContent(const Cell& cell);
 
   void SetCellMatrix(CellMatrix* pCellMatrix)
        {m_pCellMatrix = pCellMatrix;}
@@ -38,7 +39,7 @@ public:
 
   void CharDown(UINT cChar, int iEditIndex,
                 KeyboardState eKeyBoardMode);
-  void GenerateCaretArray(CDC* pDC);
+  void GenerateCaretArray(CSize szCell, CDC* pDC);
 
   CString GetInputText() {return m_stInput;}
   void SetInputText(CString stInput) {m_stInput = stInput;}
@@ -46,7 +47,7 @@ public:
   int MouseToIndex(CPoint ptMouse);
   CRect IndexToCaret(int iIndex);
 
-  void Draw(CPoint ptTopLeft, BOOL bEdit, BOOL bMarked,
+  void Draw(CRect rcCell, BOOL bEdit, BOOL bMarked,
     CDC *pDC);
 
   Font GetFont() const {return m_font;}
@@ -59,11 +60,12 @@ public:
   void SetAlignment(Direction eDirection, Alignment eAlignment);
 
   void GenerateInputText();
-  void EndEdit(Reference home);
+  BOOL EndEdit(Reference home);
   BOOL IsNumeric(CString stText);
 
   BOOL HasValue(BOOL bRecursive);
   double GetValue() const {return m_dValue;}
+  CString GetOutputText();
 
   void EvaluateValue(BOOL bRecursive);
   void UpdateSyntaxTree(int iAddRows, int iAddCols);
@@ -79,6 +81,7 @@ private:
   BOOL m_bHasValue;
   RectArray m_caretRectArray;
   CString m_stInput, m_stOutput;
+  BOOL m_bOutputValid;
 
   Font m_font;
   Color m_textColor, m_backgroundColor;
@@ -0,0 +1,89 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Set.h"
+#include "Font.h"
+#include "Color.h"
+#include "Check.h"
+
+#include "Reference.h"
+#include "SyntaxTree.h"
+
+#include "Cell.h"
+#include "CellMatrix.h"
+#include "CellBlock.h"
+
+// A newly created block is empty; that is, nothing has been copied yet.
+
+CellBlock::CellBlock()
+ :m_rfOrigin(-1, -1),
+  m_iRows(0),
+  m_iCols(0)
+{
+  // Empty.
+}
+
+// Copy stores the cells of the rectangle between the given references. The
+// cells are stored row by row in a single array that is sized to the
+// rectangle only, regardless of the size of the cell matrix. We copy the
+// contents of the cells only, the caret array and the input text are
+// regenerated when the user starts to edit a cell. The texts of the cells
+// are not duplicated as CString shares its buffer between copies until one
+// of them is modified.
+
+void CellBlock::Copy(const CellMatrix* pCellMatrix, Reference rfMin,
+                     Reference rfMax)
+{
+  m_rfOrigin = rfMin;
+  m_iRows = rfMax.GetRow() - rfMin.GetRow() + 1;
+  m_iCols = rfMax.GetCol() - rfMin.GetCol() + 1;
+
+  check_memory(m_cellArray.SetSize(m_iRows * m_iCols));
+
+  for (int iRow = 0; iRow < m_iRows; ++iRow)
+  {
+    for (int iCol = 0; iCol < m_iCols; ++iCol)
+    {
+      Cell* pSourceCell = pCellMatrix->Get(m_rfOrigin.GetRow() + iRow,
+                                           m_rfOrigin.GetCol() + iCol);
+      m_cellArray[(iRow * m_iCols) + iCol].CopyContent(*pSourceCell);
+    }
+  }
+}
+
+// Paste inserts the block into the cell matrix with its upper left corner
+// at the given target reference. The references of the formulas are moved
+// by the distance between the origin of the block and the target. If a
+// reference ends up outside the spreadsheet, UpdateSyntaxTree throws an
+// exception that is passed on to the caller, which is responsible for
+// restoring the cell matrix. Paste does not touch the target set matrix;
+// the caller rebuilds the dependencies of the whole block at once when
+// every cell is in place. The return value is true if at least one cell
+// was changed.
+
+BOOL CellBlock::Paste(CellMatrix* pCellMatrix, Reference rfTarget) const
+{
+  int iRowDiff = rfTarget.GetRow() - m_rfOrigin.GetRow();
+  int iColDiff = rfTarget.GetCol() - m_rfOrigin.GetCol();
+  BOOL bModified = FALSE;
+
+  for (int iRow = 0; iRow < m_iRows; ++iRow)
+  {
+    for (int iCol = 0; iCol < m_iCols; ++iCol)
+    {
+      const Cell& sourceCell = m_cellArray[(iRow * m_iCols) + iCol];
+      Cell* pTargetCell = pCellMatrix->Get(rfTarget.GetRow() + iRow,
+                                           rfTarget.GetCol() + iCol);
+
+      if (!sourceCell.IsEmpty() || !pTargetCell->IsEmpty())
+      {
+        bModified = TRUE;
+      }
+
+      pTargetCell->CopyContent(sourceCell);
+      pTargetCell->UpdateSyntaxTree(iRowDiff, iColDiff);
+    }
+  }
+
+  return bModified;
+}
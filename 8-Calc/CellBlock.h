@@ -0,0 +1,24 @@
+// A CellBlock is a rectangular block of cells cut out of a cell matrix. It
+// is used as the clipboard of the spreadsheet and as a backup of the area a
+// block is pasted into. Only the cells of the rectangle are stored, and the
+// references of the formulas are kept relative to the origin of the block.
+
+class CellBlock
+{
+  public:
+    CellBlock();
+
+    BOOL IsEmpty() const {return m_cellArray.IsEmpty();}
+    int GetRows() const {return m_iRows;}
+    int GetCols() const {return m_iCols;}
+    Reference GetOrigin() const {return m_rfOrigin;}
+
+    void Copy(const CellMatrix* pCellMatrix, Reference rfMin,
+              Reference rfMax);
+    BOOL Paste(CellMatrix* pCellMatrix, Reference rfTarget) const;
+
+  private:
+    Reference m_rfOrigin;
+    int m_iRows, m_iCols;
+    CArray<Cell> m_cellArray;
+};
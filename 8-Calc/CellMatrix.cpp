@@ -5,13 +5,16 @@
 #include "Font.h"
 #include "Color.h"
 #include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "Caret.h"
 #include "CalcView.h"
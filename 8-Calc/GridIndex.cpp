@@ -0,0 +1,118 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Set.h"
+#include "Check.h"
+#include "PrefixSum.h"
+
+#include "Reference.h"
+#include "CellMatrix.h"
+#include "GridIndex.h"
+
+// The grid index keeps track of the heights of the rows and the widths of the
+// columns of the spreadsheet. They are stored as prefix sums, which means
+// that the position of a row or column as well as the row or column at a
+// given position are found in logarithmic time, and that the size of a
+// single row or column is altered in logarithmic time too, regardless of
+// the size of the spreadsheet. Initially, every row has the height
+// ROW_HEIGHT and every column has the width COL_WIDTH.
+
+GridIndex::GridIndex()
+{
+  Reset();
+}
+
+void GridIndex::Reset()
+{
+  m_rowHeightSum.SetSize(ROWS, ROW_HEIGHT);
+  m_colWidthSum.SetSize(COLS, COL_WIDTH);
+}
+
+// Serialize stores or loads the heights and widths, preceded by the marker.
+// When loading, the archive is at its end if the file was saved before the
+// sizes were stored, which is the case when its buffer is empty and the file
+// has been read to the end. Then every row and column is given its default
+// size. A marker of another version means that the file was saved by a later
+// version of the application, which we cannot read.
+
+void GridIndex::Serialize(CArchive& archive)
+{
+  if (archive.IsStoring())
+  {
+    archive << GRID_INDEX_MARKER;
+  }
+
+  if (archive.IsLoading())
+  {
+    CFile* pFile = archive.GetFile();
+
+    if (archive.IsBufferEmpty() &&
+        (pFile->GetPosition() == pFile->GetLength()))
+    {
+      Reset();
+      return;
+    }
+
+    DWORD dwMarker;
+    archive >> dwMarker;
+
+    if (dwMarker != GRID_INDEX_MARKER)
+    {
+      AfxThrowArchiveException(CArchiveException::badSchema);
+    }
+  }
+
+  m_rowHeightSum.Serialize(archive);
+  m_colWidthSum.Serialize(archive);
+}
+
+// SetRowHeight and SetColWidth alter the size of one row or column. A row
+// or column cannot be made smaller than a minimum size, as the user would
+// not be able to find it and make it larger again.
+
+void GridIndex::SetRowHeight(int iRow, int iHeight)
+{
+  check((iRow >= 0) && (iRow < ROWS));
+  m_rowHeightSum.Set(iRow, max(MIN_ROW_HEIGHT, iHeight));
+}
+
+void GridIndex::SetColWidth(int iCol, int iWidth)
+{
+  check((iCol >= 0) && (iCol < COLS));
+  m_colWidthSum.Set(iCol, max(MIN_COL_WIDTH, iWidth));
+}
+
+// RowAt and ColAt return the row or column holding the given position in
+// sheet coordinates. A position above or to the left of the spreadsheet
+// gives the first row or column, and a position below or to the right of
+// it gives the last row or column.
+
+int GridIndex::RowAt(int yPos) const
+{
+  return min(ROWS - 1, m_rowHeightSum.Find(yPos));
+}
+
+int GridIndex::ColAt(int xPos) const
+{
+  return min(COLS - 1, m_colWidthSum.Find(xPos));
+}
+
+// GetCellRect returns the area of a cell in sheet coordinates, and
+// GetBlockRect returns the area of a block of cells.
+
+CRect GridIndex::GetCellRect(int iRow, int iCol) const
+{
+  return GetBlockRect(iRow, iCol, iRow, iCol);
+}
+
+CRect GridIndex::GetCellRect(Reference rfCell) const
+{
+  return GetCellRect(rfCell.GetRow(), rfCell.GetCol());
+}
+
+CRect GridIndex::GetBlockRect(int iMinRow, int iMinCol,
+                              int iMaxRow, int iMaxCol) const
+{
+  return CRect(GetColLeft(iMinCol), GetRowTop(iMinRow),
+               GetColLeft(iMaxCol + 1), GetRowTop(iMaxRow + 1));
+}
@@ -0,0 +1,42 @@
+const int COL_WIDTH = 4000;
+const int ROW_HEIGHT = 1000;
+
+const int MIN_COL_WIDTH = 200;
+const int MIN_ROW_HEIGHT = 200;
+
+// The row heights and column widths are stored after the cells, preceded by
+// a marker holding the version of their format. Files saved before the sizes
+// could be altered end right after the cells.
+
+const DWORD GRID_INDEX_MARKER = 0x47524431; // "GRD1"
+
+class GridIndex
+{
+  public:
+    GridIndex();
+    void Reset();
+    void Serialize(CArchive& archive);
+
+    int GetRowHeight(int iRow) const {return m_rowHeightSum.Get(iRow);}
+    int GetColWidth(int iCol) const {return m_colWidthSum.Get(iCol);}
+
+    void SetRowHeight(int iRow, int iHeight);
+    void SetColWidth(int iCol, int iWidth);
+
+    int GetRowTop(int iRow) const {return m_rowHeightSum.Sum(iRow);}
+    int GetColLeft(int iCol) const {return m_colWidthSum.Sum(iCol);}
+
+    int GetTotalHeight() const {return m_rowHeightSum.GetTotal();}
+    int GetTotalWidth() const {return m_colWidthSum.GetTotal();}
+
+    int RowAt(int yPos) const;
+    int ColAt(int xPos) const;
+
+    CRect GetCellRect(int iRow, int iCol) const;
+    CRect GetCellRect(Reference rfCell) const;
+    CRect GetBlockRect(int iMinRow, int iMinCol,
+                       int iMaxRow, int iMaxCol) const;
+
+  private:
+    PrefixSum<int> m_rowHeightSum, m_colWidthSum;
+};
@@ -0,0 +1,22 @@
+#include "StdAfx.h"
+#include <charconv>
+
+#include "Number.h"
+
+// ToString converts a value to the shortest text that is read back as the
+// very same value; for instance, 0.1 becomes "0.1" and 100 becomes "100".
+// The conversion is done by std::to_chars, which avoids the locale and the
+// formatting machinery of Format, and the text never has trailing zeros or
+// a trailing dot that need to be trimmed. We use fixed notation, as the
+// scanner does not accept exponents. The buffer is large enough to hold
+// the longest fixed-notation text of any double value.
+
+CString Number::ToString(double dValue)
+{
+  char szBuffer[BUFFER_SIZE];
+  std::to_chars_result result =
+    std::to_chars(szBuffer, szBuffer + BUFFER_SIZE, dValue,
+                  std::chars_format::fixed);
+
+  return CString(szBuffer, (int) (result.ptr - szBuffer));
+}
@@ -0,0 +1,8 @@
+class Number
+{
+  public:
+    static CString ToString(double dValue);
+
+  private:
+    static const int BUFFER_SIZE = 512;
+};
@@ -7,6 +7,7 @@
 #include "Color.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
@@ -18,7 +19,9 @@
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "CalcView.h"
 #include "CalcDoc.h"
@@ -7,14 +7,18 @@
 #include "Color.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "Token.h"
 #include "SyntaxTree.h"
+#include "Number.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "CalcView.h"
 #include "CalcDoc.h"
@@ -375,11 +379,7 @@ CString SyntaxTree::ToString() const
       break;
 
     case ST_VALUE:
-      {
-        stResult.Format(TEXT("%f"), m_dValue);
-        stResult.TrimRight(TEXT('0'));
-        stResult.TrimRight(TEXT('.'));
-      }
+      stResult = Number::ToString(m_dValue);
       break;
   }
 
@@ -6,13 +6,16 @@
 #include "Color.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
 
 #include "Reference.h"
 #include "SyntaxTree.h"
 
 #include "Cell.h"
 #include "CellMatrix.h"
+#include "CellBlock.h"
 #include "TSetMatrix.h"
+#include "GridIndex.h"
 
 #include "CalcView.h"
 #include "CalcDoc.h"
@@ -21,6 +24,7 @@
 // object of this class.
 
 TSetMatrix::TSetMatrix()
+ :m_iEditCount(0)
 {
   // Empty.
 }
@@ -29,6 +33,7 @@ TSetMatrix::TSetMatrix()
 // one by one.
 
 TSetMatrix::TSetMatrix(const TSetMatrix& tSetMatrix)
+ :m_iEditCount(0)
 {
   for (int iRow = 0; iRow < ROWS; ++iRow)
   {
@@ -121,6 +126,57 @@ void TSetMatrix::CheckCircular(Reference home,
   }
 }
 
+// When a block of cells is pasted, several formulas are altered at once, and
+// a cycle may pass through pasted cells only, without reaching the cell the
+// search above starts from, in which case that search would never end.
+// Instead, the second version performs one depth-first search from every
+// cell of the set. Each visited cell is marked as active while its sources
+// are searched and as done afterwards. Reaching an active cell means that
+// we have found a cycle, and a done cell is not searched again, which makes
+// the search take time in proportion to the number of affected cells and
+// references.
+
+const int VISIT_ACTIVE = 1;
+const int VISIT_DONE = 2;
+
+void TSetMatrix::CheckCircular(const ReferenceSet& homeSet)
+{
+  CMap<int,int,int,int> stateMap;
+
+  for (POSITION position = homeSet.GetHeadPosition();
+       position != NULL; homeSet.GetNext(position))
+  {
+    VisitSources(homeSet.GetAt(position), stateMap);
+  }
+}
+
+void TSetMatrix::VisitSources(Reference cell,
+                              CMap<int,int,int,int>& stateMap)
+{
+  int iState;
+  if (stateMap.Lookup(GetKey(cell), iState))
+  {
+    if (iState == VISIT_ACTIVE)
+    {
+      CString stMessage = TEXT("Circular Reference.");
+      throw stMessage;
+    }
+
+    return;
+  }
+
+  check_memory(stateMap.SetAt(GetKey(cell), VISIT_ACTIVE));
+
+  ReferenceSet sourceSet = m_pCellMatrix->Get(cell)->GetSourceSet();
+  for (POSITION position = sourceSet.GetHeadPosition();
+       position != NULL; sourceSet.GetNext(position))
+  {
+    VisitSources(sourceSet.GetAt(position), stateMap);
+  }
+
+  stateMap.SetAt(GetKey(cell), VISIT_DONE);
+}
+
 // When the value of a cell is updated, it is essential that the formulas
 // having references to the cell are notified and that their value is re-
 // evaluated. EvaluateTargets performs a breath-first search by following the
@@ -155,38 +211,138 @@ ReferenceSet TSetMatrix::EvaluateTargets(Reference home)
   return resultSet;
 }
 
+// When a block of cells is pasted, every cell of the block may have been
+// altered. Instead of calling EvaluateTargets above once for each cell, which
+// would evaluate the cells that depend on several cells of the block over and
+// over again, we evaluate the whole affected area in one pass. First, we
+// collect the cells of the block together with every cell that depends on
+// them, directly or indirectly. Then we count, for each affected cell, the
+// number of its sources that are also affected. A cell whose count is zero
+// can be evaluated, and when it has been evaluated the counts of its targets
+// are decreased. In that way, every affected cell is evaluated exactly once
+// and after all of its sources. As the graph has no cycles, every cell will
+// eventually be evaluated. The counts are kept in a map of the affected
+// cells only.
+
+// Unlike the evaluation of a single edited cell, the cells are not evaluated
+// recursively. Every source of an affected cell is either affected itself,
+// and then evaluated before the cell, or unaffected, and then its value is
+// already up to date. A recursive evaluation would only evaluate the same
+// sources over again.
+
+ReferenceSet TSetMatrix::EvaluateTargets(const ReferenceSet& homeSet)
+{
+  ReferenceSet resultSet, updateSet = homeSet;
+
+  while (!updateSet.IsEmpty())
+  {
+    Reference target = updateSet.GetHead();
+    updateSet.RemoveHead();
+
+    if (!resultSet.Exists(target))
+    {
+      resultSet.Add(target);
+      updateSet.AddAll(*Get(target));
+    }
+  }
+
+  CMap<int,int,int,int> sourceCountMap;
+  ReferenceSet readySet;
+
+  for (POSITION position = resultSet.GetHeadPosition();
+       position != NULL; resultSet.GetNext(position))
+  {
+    Reference target = resultSet.GetAt(position);
+    ReferenceSet sourceSet = m_pCellMatrix->Get(target)->GetSourceSet();
+    int iCount = 0;
+
+    for (POSITION sourcePosition = sourceSet.GetHeadPosition();
+         sourcePosition != NULL; sourceSet.GetNext(sourcePosition))
+    {
+      if (resultSet.Exists(sourceSet.GetAt(sourcePosition)))
+      {
+        ++iCount;
+      }
+    }
+
+    check_memory(sourceCountMap.SetAt(GetKey(target), iCount));
+
+    if (iCount == 0)
+    {
+      readySet.Add(target);
+    }
+  }
+
+  while (!readySet.IsEmpty())
+  {
+    Reference target = readySet.GetHead();
+    readySet.RemoveHead();
+
+    Cell* pTarget = m_pCellMatrix->Get(target);
+    pTarget->EvaluateValue(FALSE);
+
+    ReferenceSet* pNextTargetSet = Get(target);
+    for (POSITION position = pNextTargetSet->GetHeadPosition();
+         position != NULL; pNextTargetSet->GetNext(position))
+    {
+      Reference next = pNextTargetSet->GetAt(position);
+      int& iCount = sourceCountMap[GetKey(next)];
+
+      if (--iCount == 0)
+      {
+        readySet.Add(next);
+      }
+    }
+  }
+
+  return resultSet;
+}
+
 // AddTargets traverses the source set of the cell with the given reference
 // in the cell matrix and, for each source cell, adds the given cell as a
-// target in the target set of the source cell.
+// target in the target set of the source cell. The second version does the
+// same for the given set of sources only, which is used when a formula has
+// been altered and only some of its sources are new. The number of edges
+// added or removed is counted in m_iEditCount, which makes it possible to
+// see how much the graph was changed by an edit.
 
 void TSetMatrix::AddTargets(Reference home)
 {
   Cell* pCell = m_pCellMatrix->Get(home);
-  ReferenceSet sourceSet = pCell->GetSourceSet();
+  AddTargets(home, pCell->GetSourceSet());
+}
 
+void TSetMatrix::AddTargets(Reference home, const ReferenceSet& sourceSet)
+{
   for (POSITION position = sourceSet.GetHeadPosition();
        position != NULL; sourceSet.GetNext(position))
   {
     Reference source = sourceSet.GetAt(position);
     ReferenceSet* pTargetSet = Get(source);
     pTargetSet->Add(home);
+    ++m_iEditCount;
   }
 }
 
 // RemoveTargets traverses the source set of the cell with the given
 // reference in the cell matrix and, for each source cell, removes the
-// given cell as a target in the target set of the source cell.
+// given cell as a target in the target set of the source cell. Similar to
+// AddTargets above, the second version removes the given sources only.
 
 void TSetMatrix::RemoveTargets(Reference home)
 {
   Cell* pCell = m_pCellMatrix->Get(home);
-  ReferenceSet sourceSet = pCell->GetSourceSet();
+  RemoveTargets(home, pCell->GetSourceSet());
+}
 
+void TSetMatrix::RemoveTargets(Reference home, const ReferenceSet& sourceSet)
+{
   for (POSITION position = sourceSet.GetHeadPosition();
        position != NULL; sourceSet.GetNext(position))
   {
     Reference source = sourceSet.GetAt(position);
     ReferenceSet* pTargetSet = Get(source);
     pTargetSet->Remove(home);
+    ++m_iEditCount;
   }
 }
@@ -13,11 +13,22 @@ class TSetMatrix
 
     void CheckCircular(Reference home,
                        ReferenceSet sourceSet);
+    void CheckCircular(const ReferenceSet& homeSet);
     ReferenceSet EvaluateTargets(Reference home);
+    ReferenceSet EvaluateTargets(const ReferenceSet& homeSet);
     void AddTargets(Reference home);
+    void AddTargets(Reference home, const ReferenceSet& sourceSet);
     void RemoveTargets(Reference home);
+    void RemoveTargets(Reference home, const ReferenceSet& sourceSet);
+
+    int GetEditCount() const {return m_iEditCount;}
 
   private:
+    static int GetKey(Reference cell) {return cell.GetRow() * COLS +
+                                              cell.GetCol();}
+    void VisitSources(Reference cell, CMap<int,int,int,int>& stateMap);
+
     ReferenceSet m_buffer[ROWS][COLS];
     CellMatrix* m_pCellMatrix;
+    int m_iEditCount;
 };
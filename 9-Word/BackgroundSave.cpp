@@ -0,0 +1,183 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Font.h"
+#include "Check.h"
+#include "PrefixSum.h"
+
+#include "RepaintRegion.h"
+#include "Line.h"
+#include "Position.h"
+#include "PieceTable.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "Paragraph.h"
+#include "WordFile.h"
+#include "BackgroundSave.h"
+#include "Threads.h"
+
+BackgroundSave::BackgroundSave()
+ :m_hNotifyWnd(NULL),
+  m_pThread(NULL),
+  m_iWritten(0),
+  m_bSuccess(FALSE),
+  m_lFinished(0)
+{
+  // Empty.
+}
+
+BackgroundSave::~BackgroundSave()
+{
+  Wait();
+}
+
+// Start takes the snapshot and starts the worker thread, which Wait waits
+// for. The time the snapshot takes is the time the user interface is
+// stalled by the save, which is reported in debug builds.
+
+void BackgroundSave::Start(ParagraphPtrArray* pParagraphArray,
+                           LPCTSTR lpszPathName, HWND hNotifyWnd)
+{
+  check(m_pThread == NULL);
+
+  StopWatch stopWatch;
+
+  int iParagraphs = (int) pParagraphArray->GetSize();
+  check_memory(m_snapshotArray.Copy(*pParagraphArray));
+
+  for (int iIndex = 0; iIndex < iParagraphs; ++iIndex)
+  {
+    m_snapshotArray[iIndex]->SetSnapshotIndex(iIndex);
+  }
+
+  TRACE(TEXT("Snapshot of %d paragraphs taken in %.2f ms.\n"), iParagraphs,
+        stopWatch.GetMilliseconds());
+
+  m_stPathName = lpszPathName;
+  m_hNotifyWnd = hNotifyWnd;
+  m_iWritten = 0;
+  m_bSuccess = FALSE;
+  m_lFinished = 0;
+
+  m_pThread = StartThread(SaveThread, this, THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+// Detach is called before the given paragraphs are changed or deleted. A
+// paragraph of the snapshot that has not yet been written is replaced by a
+// copy, and the paragraph is no longer part of the snapshot. A paragraph
+// that is not part of the snapshot is passed over at once, so only the first
+// change of a paragraph during a save costs a copy.
+
+void BackgroundSave::Detach(ParagraphPtrArray* pParagraphArray,
+                            int iFirstParagraph, int iLastParagraph)
+{
+  if (m_pThread == NULL)
+  {
+    return;
+  }
+
+  iLastParagraph = min(iLastParagraph, (int) pParagraphArray->GetSize() - 1);
+  for (int iParagraph = iFirstParagraph; iParagraph <= iLastParagraph;
+       ++iParagraph)
+  {
+    Paragraph* pParagraph = pParagraphArray->GetAt(iParagraph);
+    int iIndex = pParagraph->GetSnapshotIndex();
+
+    if (iIndex >= 0)
+    {
+      CSingleLock lock(&m_criticalSection, TRUE);
+
+      if (iIndex >= m_iWritten)
+      {
+        Paragraph* pCopy = pParagraph->ExtractText();
+        m_snapshotArray[iIndex] = pCopy;
+        check_memory(m_copyArray.Add(pCopy));
+      }
+
+      pParagraph->SetSnapshotIndex(-1);
+    }
+  }
+}
+
+// Wait waits for the worker thread to finish, and releases the snapshot. The
+// paragraphs still in the snapshot are the paragraphs of the document that
+// have not been detached; they are told that they are no longer part of it.
+// It returns whether the file was written, which is true if no save is
+// active.
+
+BOOL BackgroundSave::Wait()
+{
+  if (m_pThread == NULL)
+  {
+    return TRUE;
+  }
+
+  ::WaitForSingleObject(m_pThread->m_hThread, INFINITE);
+  delete m_pThread;
+  m_pThread = NULL;
+
+  int iParagraphs = (int) m_snapshotArray.GetSize();
+  for (int iIndex = 0; iIndex < iParagraphs; ++iIndex)
+  {
+    Paragraph* pParagraph = m_snapshotArray[iIndex];
+
+    if (pParagraph->GetSnapshotIndex() == iIndex)
+    {
+      pParagraph->SetSnapshotIndex(-1);
+    }
+  }
+
+  int iCopies = (int) m_copyArray.GetSize();
+  for (int iIndex = 0; iIndex < iCopies; ++iIndex)
+  {
+    delete m_copyArray[iIndex];
+  }
+
+  m_snapshotArray.RemoveAll();
+  m_copyArray.RemoveAll();
+  return m_bSuccess;
+}
+
+UINT BackgroundSave::SaveThread(LPVOID pParam)
+{
+  BackgroundSave* pSave = (BackgroundSave*) pParam;
+  pSave->m_bSuccess = pSave->WriteSnapshot();
+  ::InterlockedExchange(&pSave->m_lFinished, 1);
+
+  if (pSave->m_hNotifyWnd != NULL)
+  {
+    ::PostMessage(pSave->m_hNotifyWnd, WM_NULL, 0, 0);
+  }
+
+  return 0;
+}
+
+// WriteSnapshot is run by the worker thread. It writes the paragraphs chunk
+// by chunk, holding the critical section for one chunk at a time, and then
+// saves the file.
+
+BOOL BackgroundSave::WriteSnapshot()
+{
+  WordFileWriter writer;
+  int iParagraphs = (int) m_snapshotArray.GetSize();
+
+  while (TRUE)
+  {
+    CSingleLock lock(&m_criticalSection, TRUE);
+
+    if (m_iWritten >= iParagraphs)
+    {
+      break;
+    }
+
+    int iLastParagraph = min(m_iWritten + SAVE_CHUNK, iParagraphs);
+    for (int iIndex = m_iWritten; iIndex < iLastParagraph; ++iIndex)
+    {
+      m_snapshotArray[iIndex]->Write(writer);
+    }
+
+    m_iWritten = iLastParagraph;
+  }
+
+  return writer.Save(m_stPathName, iParagraphs);
+}
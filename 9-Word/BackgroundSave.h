@@ -0,0 +1,45 @@
+const int SAVE_CHUNK = 64;
+
+// A BackgroundSave writes a snapshot of the paragraphs of a document to a
+// file on a worker thread, while the user goes on editing the document. The
+// snapshot is an array of pointers to the paragraphs themselves, which is
+// taken in time proportional to the number of paragraphs, and each paragraph
+// in it remembers its index in the snapshot. The paragraphs are copied on
+// write: before an editing command changes or deletes a paragraph that has
+// not yet been written, Detach replaces it in the snapshot by a copy of its
+// text, which shares the characters of the paragraph. The worker writes the
+// paragraphs in chunks of SAVE_CHUNK, and a critical section keeps it from
+// writing a paragraph while it is being detached. When the file has been
+// written, a message is posted to the given window, which makes the
+// application idle and lets the document finish the save.
+
+class BackgroundSave
+{
+  public:
+    BackgroundSave();
+    ~BackgroundSave();
+
+    void Start(ParagraphPtrArray* pParagraphArray, LPCTSTR lpszPathName,
+               HWND hNotifyWnd);
+    void Detach(ParagraphPtrArray* pParagraphArray, int iFirstParagraph,
+                int iLastParagraph);
+    BOOL Wait();
+
+    BOOL IsActive() const {return (m_pThread != NULL);}
+    BOOL IsFinished() const {return (m_lFinished != 0);}
+    const CString& GetPathName() const {return m_stPathName;}
+
+  private:
+    static UINT SaveThread(LPVOID pParam);
+    BOOL WriteSnapshot();
+
+    ParagraphPtrArray m_snapshotArray, m_copyArray;
+    CString m_stPathName;
+    HWND m_hNotifyWnd;
+
+    CWinThread* m_pThread;
+    CCriticalSection m_criticalSection;
+    int m_iWritten;
+    BOOL m_bSuccess;
+    volatile LONG m_lFinished;
+};
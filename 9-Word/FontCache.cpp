@@ -0,0 +1,138 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Font.h"
+#include "Check.h"
+
+#include "StyleTable.h"
+#include "FontCache.h"
+
+// The entry creates the font of the style, translated from typographical
+// points to hundreds of millimeters, and selects it once into the device
+// context in order to read its text metrics and the widths of the first
+// CACHED_CHARS code units.
+
+FontEntry::FontEntry(int iStyle, CDC* pDC)
+{
+  Font font = StyleTable::GetFont(iStyle);
+  m_bItalic = font.IsItalic();
+  m_cFont.CreateFontIndirect(font.PointsToMeters());
+
+  CFont* pPrevFont = pDC->SelectObject(&m_cFont);
+  pDC->GetTextMetrics(&m_textMetric);
+  pDC->GetCharWidth(0, CACHED_CHARS - 1, m_widthArray);
+  pDC->SelectObject(pPrevFont);
+
+  for (int iChar = 0; iChar < CACHED_CHARS; ++iChar)
+  {
+    m_widthArray[iChar] = ScaleSize(m_widthArray[iChar]);
+  }
+}
+
+// Characters written in italic tend to request slightly more space, so we
+// increase the size with 20 percent. Also plain text tend to need a little
+// bit more space, why we increase the size with 10 percent.
+
+int FontEntry::ScaleSize(int iSize) const
+{
+  return (int) ((m_bItalic ? 1.2 : 1.1) * iSize);
+}
+
+// GetCharSize returns the size of the character. Every character of the
+// font has the same height. The width of a code unit outside the bulk
+// table is measured the first time it is asked for, in the device context
+// of the calling thread.
+
+CSize FontEntry::GetCharSize(TCHAR cChar, CDC* pDC)
+{
+  UINT uChar = (UINT) (_TUCHAR) cChar;
+  int iWidth;
+
+  if (uChar < CACHED_CHARS)
+  {
+    iWidth = m_widthArray[uChar];
+  }
+
+  else
+  {
+    CSingleLock lock(&m_criticalSection, TRUE);
+
+    if (!m_widthMap.Lookup(uChar, iWidth))
+    {
+      CFont* pPrevFont = pDC->SelectObject(&m_cFont);
+      iWidth = ScaleSize(pDC->GetTextExtent(CString(cChar)).cx);
+      pDC->SelectObject(pPrevFont);
+
+      m_widthMap.SetAt(uChar, iWidth);
+    }
+  }
+
+  return CSize(iWidth, ScaleSize(m_textMetric.tmHeight));
+}
+
+// GetClusterSize returns the size of a cluster of several code units, such
+// as a double-byte character or a character with combining marks. The
+// cluster is measured as a whole, as the widths of its code units do not
+// add up to its width. Such clusters are rare, so they are not cached.
+
+CSize FontEntry::GetClusterSize(const TCHAR* pCluster, int iLength,
+                                CDC* pDC)
+{
+  CSingleLock lock(&m_criticalSection, TRUE);
+
+  CFont* pPrevFont = pDC->SelectObject(&m_cFont);
+  int iWidth = ScaleSize(pDC->GetTextExtent(pCluster, iLength).cx);
+  pDC->SelectObject(pPrevFont);
+
+  return CSize(iWidth, ScaleSize(m_textMetric.tmHeight));
+}
+
+FontCache::FontCache()
+{
+  // Empty.
+}
+
+FontCache::~FontCache()
+{
+  int iSize = (int) m_entryArray.GetSize();
+  for (int iStyle = 0; iStyle < iSize; ++iStyle)
+  {
+    delete m_entryArray[iStyle];
+  }
+}
+
+// GetEntry returns the entry of the given style, which is created the first
+// time the style is used by the document. As the entry array may grow, it is
+// only accessed inside the critical section.
+
+FontEntry* FontCache::GetEntry(int iStyle, CDC* pDC)
+{
+  CSingleLock lock(&m_criticalSection, TRUE);
+
+  if (iStyle >= m_entryArray.GetSize())
+  {
+    check_memory(m_entryArray.SetSize(iStyle + 1));
+  }
+
+  if (m_entryArray[iStyle] == NULL)
+  {
+    check_memory(m_entryArray[iStyle] = new FontEntry(iStyle, pDC));
+  }
+
+  return m_entryArray[iStyle];
+}
+
+CFont* FontCache::GetFont(int iStyle, CDC* pDC)
+{
+  return GetEntry(iStyle, pDC)->GetFont();
+}
+
+const TEXTMETRIC& FontCache::GetTextMetrics(int iStyle, CDC* pDC)
+{
+  return GetEntry(iStyle, pDC)->GetTextMetrics();
+}
+
+CSize FontCache::GetCharSize(int iStyle, TCHAR cChar, CDC* pDC)
+{
+  return GetEntry(iStyle, pDC)->GetCharSize(cChar, pDC);
+}
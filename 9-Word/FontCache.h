@@ -0,0 +1,52 @@
+const int CACHED_CHARS = 256;
+
+// A FontEntry holds the font object of a style together with its text
+// metrics and the sizes of its characters. The sizes of the first
+// CACHED_CHARS code units are looked up in bulk the first time the entry is
+// used, the sizes of the other code units when they are first used. Once
+// created, only the map of the other code units changes, and it is guarded
+// by a critical section as the entry may be used by several layout threads.
+
+class FontEntry
+{
+  public:
+    FontEntry(int iStyle, CDC* pDC);
+
+    CFont* GetFont() {return &m_cFont;}
+    const TEXTMETRIC& GetTextMetrics() const {return m_textMetric;}
+    CSize GetCharSize(TCHAR cChar, CDC* pDC);
+    CSize GetClusterSize(const TCHAR* pCluster, int iLength, CDC* pDC);
+
+  private:
+    int ScaleSize(int iSize) const;
+
+    CFont m_cFont;
+    BOOL m_bItalic;
+    TEXTMETRIC m_textMetric;
+
+    int m_widthArray[CACHED_CHARS];
+    CMap<UINT,UINT,int,int> m_widthMap;
+    CCriticalSection m_criticalSection;
+};
+
+// A FontCache holds the font entries of a document, indexed by style. It
+// makes it possible to lay out a paragraph without creating any fonts or
+// asking the device context for the size of each character. An entry is
+// never removed until the cache is destroyed, so a layout thread may keep
+// the entry of a font run while it measures the characters of the run.
+
+class FontCache
+{
+  public:
+    FontCache();
+    ~FontCache();
+
+    CFont* GetFont(int iStyle, CDC* pDC);
+    const TEXTMETRIC& GetTextMetrics(int iStyle, CDC* pDC);
+    CSize GetCharSize(int iStyle, TCHAR cChar, CDC* pDC);
+    FontEntry* GetEntry(int iStyle, CDC* pDC);
+
+  private:
+    CArray<FontEntry*> m_entryArray;
+    CCriticalSection m_criticalSection;
+};
@@ -0,0 +1,329 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Font.h"
+#include "Check.h"
+#include "PrefixSum.h"
+
+#include "StyleTable.h"
+#include "FontRun.h"
+
+FontRun::FontRun()
+ :m_iStyle(0),
+  m_iLength(0)
+{
+  // Empty.
+}
+
+FontRun::FontRun(int iStyle, int iLength)
+ :m_iStyle(iStyle),
+  m_iLength(iLength)
+{
+  // Empty.
+}
+
+FontRunArray::FontRunArray()
+{
+  // Empty.
+}
+
+FontRunArray::FontRunArray(const FontRunArray& runArray)
+ :m_lengthSum(runArray.m_lengthSum)
+{
+  check_memory(m_runArray.Copy(runArray.m_runArray));
+}
+
+FontRunArray& FontRunArray::operator=(const FontRunArray& runArray)
+{
+  if (this != &runArray)
+  {
+    check_memory(m_runArray.Copy(runArray.m_runArray));
+    m_lengthSum = runArray.m_lengthSum;
+  }
+
+  return *this;
+}
+
+// GetStyle returns the style of the character at the given index, and
+// GetFont returns its font.
+
+int FontRunArray::GetStyle(int iIndex) const
+{
+  check((iIndex >= 0) && (iIndex < GetLength()));
+  return m_runArray[m_lengthSum.Find(iIndex)].GetStyle();
+}
+
+Font FontRunArray::GetFont(int iIndex) const
+{
+  return StyleTable::GetFont(GetStyle(iIndex));
+}
+
+// SplitAt makes sure a run starts at the given index, by splitting the run
+// holding the index in two if necessary. It returns the index of that run,
+// or the number of runs if the index is at the end of the text.
+
+int FontRunArray::SplitAt(int iIndex)
+{
+  if (iIndex == GetLength())
+  {
+    return GetRunCount();
+  }
+
+  int iRun = m_lengthSum.Find(iIndex);
+  int iOffset = iIndex - m_lengthSum.Sum(iRun);
+
+  if (iOffset == 0)
+  {
+    return iRun;
+  }
+
+  FontRun run = m_runArray[iRun];
+  int iRestLength = run.GetLength() - iOffset;
+
+  m_runArray[iRun].SetLength(iOffset);
+  m_lengthSum.Set(iRun, iOffset);
+
+  check_memory(m_runArray.InsertAt(iRun + 1,
+                                   FontRun(run.GetStyle(), iRestLength)));
+  m_lengthSum.InsertAt(iRun + 1, iRestLength);
+  return iRun + 1;
+}
+
+// MergeAt merges the given run with the preceding run, if they have the
+// same style.
+
+void FontRunArray::MergeAt(int iRun)
+{
+  if ((iRun > 0) && (iRun < GetRunCount()) &&
+      (m_runArray[iRun - 1].GetStyle() == m_runArray[iRun].GetStyle()))
+  {
+    int iLength = m_runArray[iRun - 1].GetLength() +
+                  m_runArray[iRun].GetLength();
+
+    m_runArray[iRun - 1].SetLength(iLength);
+    m_lengthSum.Set(iRun - 1, iLength);
+
+    m_runArray.RemoveAt(iRun);
+    m_lengthSum.RemoveAt(iRun);
+  }
+}
+
+// SetStyle gives the characters of the given range a new style. The runs
+// of the range are replaced by one single run, which is merged with its
+// neighbours if they have the same style.
+
+void FontRunArray::SetStyle(int iFirst, int iCount, int iStyle)
+{
+  if (iCount <= 0)
+  {
+    return;
+  }
+
+  int iFirstRun = SplitAt(iFirst);
+  int iLastRun = SplitAt(iFirst + iCount);
+
+  m_runArray.RemoveAt(iFirstRun, iLastRun - iFirstRun);
+  m_lengthSum.RemoveAt(iFirstRun, iLastRun - iFirstRun);
+
+  check_memory(m_runArray.InsertAt(iFirstRun, FontRun(iStyle, iCount)));
+  m_lengthSum.InsertAt(iFirstRun, iCount);
+
+  MergeAt(iFirstRun + 1);
+  MergeAt(iFirstRun);
+}
+
+// Append adds characters of the given style at the end of the array. If
+// the last run has the same style it is extended, otherwise a new run is
+// added. Either way, it takes logarithmic time.
+
+void FontRunArray::Append(int iStyle, int iCount)
+{
+  int iRuns = GetRunCount();
+
+  if ((iRuns > 0) && (m_runArray[iRuns - 1].GetStyle() == iStyle))
+  {
+    int iLength = m_runArray[iRuns - 1].GetLength() + iCount;
+    m_runArray[iRuns - 1].SetLength(iLength);
+    m_lengthSum.Set(iRuns - 1, iLength);
+  }
+
+  else
+  {
+    check_memory(m_runArray.Add(FontRun(iStyle, iCount)));
+    m_lengthSum.Add(iCount);
+  }
+}
+
+// Append adds the runs of the given range of another array at the end of
+// the array.
+
+void FontRunArray::Append(const FontRunArray& runArray, int iFirst,
+                          int iCount)
+{
+  if (iCount <= 0)
+  {
+    return;
+  }
+
+  if (&runArray == this)
+  {
+    FontRunArray copyArray(runArray);
+    Append(copyArray, iFirst, iCount);
+    return;
+  }
+
+  int iRun = runArray.m_lengthSum.Find(iFirst);
+  int iOffset = iFirst - runArray.m_lengthSum.Sum(iRun);
+
+  for (int iAppended = 0; iAppended < iCount; ++iRun)
+  {
+    const FontRun& run = runArray.m_runArray[iRun];
+    int iLength = min(run.GetLength() - iOffset, iCount - iAppended);
+
+    Append(run.GetStyle(), iLength);
+    iAppended += iLength;
+    iOffset = 0;
+  }
+}
+
+// Insert inserts characters of the given style at the given index. If the
+// character preceding or following the index has the same style, its run
+// is just extended, which takes logarithmic time.
+
+void FontRunArray::Insert(int iIndex, int iStyle, int iCount /* = 1 */)
+{
+  int iRun = -1;
+
+  if ((iIndex > 0) &&
+      (m_runArray[m_lengthSum.Find(iIndex - 1)].GetStyle() == iStyle))
+  {
+    iRun = m_lengthSum.Find(iIndex - 1);
+  }
+
+  else if ((iIndex < GetLength()) &&
+           (m_runArray[m_lengthSum.Find(iIndex)].GetStyle() == iStyle))
+  {
+    iRun = m_lengthSum.Find(iIndex);
+  }
+
+  if (iRun != -1)
+  {
+    int iLength = m_runArray[iRun].GetLength() + iCount;
+    m_runArray[iRun].SetLength(iLength);
+    m_lengthSum.Set(iRun, iLength);
+  }
+
+  else
+  {
+    iRun = SplitAt(iIndex);
+    check_memory(m_runArray.InsertAt(iRun, FontRun(iStyle, iCount)));
+    m_lengthSum.InsertAt(iRun, iCount);
+  }
+}
+
+// Insert inserts the runs of another array at the given index. The runs at
+// the borders of the inserted runs are merged if they have the same style.
+
+void FontRunArray::Insert(int iIndex, const FontRunArray& runArray)
+{
+  int iInsertRuns = runArray.GetRunCount();
+
+  if (iInsertRuns == 0)
+  {
+    return;
+  }
+
+  if (&runArray == this)
+  {
+    FontRunArray copyArray(runArray);
+    Insert(iIndex, copyArray);
+    return;
+  }
+
+  int iRun = SplitAt(iIndex);
+  check_memory(m_runArray.InsertAt(iRun,
+               (CArray<FontRun>*) &runArray.m_runArray));
+  m_lengthSum.InsertAt(iRun, runArray.m_lengthSum);
+
+  MergeAt(iRun + iInsertRuns);
+  MergeAt(iRun);
+}
+
+// Delete removes the runs of the given range, after the runs at its borders
+// have been split.
+
+void FontRunArray::Delete(int iIndex, int iCount)
+{
+  if (iCount <= 0)
+  {
+    return;
+  }
+
+  int iFirstRun = SplitAt(iIndex);
+  int iLastRun = SplitAt(iIndex + iCount);
+
+  m_runArray.RemoveAt(iFirstRun, iLastRun - iFirstRun);
+  m_lengthSum.RemoveAt(iFirstRun, iLastRun - iFirstRun);
+  MergeAt(iFirstRun);
+}
+
+// Extract returns a new array holding the runs of the given range.
+
+FontRunArray FontRunArray::Extract(int iFirst, int iCount) const
+{
+  FontRunArray runArray;
+  runArray.Append(*this, iFirst, iCount);
+  return runArray;
+}
+
+// Serialize stores or loads the runs in the format of the files saved
+// before the runs were introduced, where the paragraph holds an array of
+// one font for each character. As the styles are indexes in the style
+// table, which is not stored, the font of each character is stored. When
+// the array is loaded, each sequence of equal fonts becomes one run, and
+// its font is added to the style table.
+
+void FontRunArray::Serialize(CArchive& archive)
+{
+  if (archive.IsStoring())
+  {
+    CArray<Font> fontArray;
+    check_memory(fontArray.SetSize(GetLength()));
+
+    int iIndex = 0;
+    for (int iRun = 0; iRun < GetRunCount(); ++iRun)
+    {
+      const FontRun& run = m_runArray[iRun];
+      Font font = StyleTable::GetFont(run.GetStyle());
+
+      for (int iCount = 0; iCount < run.GetLength(); ++iCount)
+      {
+        fontArray[iIndex++] = font;
+      }
+    }
+
+    fontArray.Serialize(archive);
+  }
+
+  if (archive.IsLoading())
+  {
+    CArray<Font> fontArray;
+    fontArray.Serialize(archive);
+
+    m_runArray.RemoveAll();
+    m_lengthSum.SetSize(0, 0);
+
+    int iSize = (int) fontArray.GetSize();
+    for (int iFirst = 0, iLast; iFirst < iSize; iFirst = iLast + 1)
+    {
+      iLast = iFirst;
+      while ((iLast < (iSize - 1)) &&
+             (fontArray[iLast + 1] == fontArray[iFirst]))
+      {
+        ++iLast;
+      }
+
+      Append(StyleTable::GetStyle(fontArray[iFirst]), iLast - iFirst + 1);
+    }
+  }
+}
@@ -0,0 +1,53 @@
+// A FontRun is a sequence of characters with the same font, given by its
+// style in the style table.
+
+class FontRun
+{
+  public:
+    FontRun();
+    FontRun(int iStyle, int iLength);
+
+    int GetStyle() const {return m_iStyle;}
+    int GetLength() const {return m_iLength;}
+    void SetLength(int iLength) {m_iLength = iLength;}
+
+  private:
+    int m_iStyle, m_iLength;
+};
+
+// A FontRunArray holds the fonts of the characters of a paragraph as a
+// sequence of runs, where two neighbour runs never have the same style. The
+// lengths of the runs are stored in a prefix sum, which makes it possible to
+// find the run of a given character in logarithmic time.
+
+class FontRunArray
+{
+  public:
+    FontRunArray();
+    FontRunArray(const FontRunArray& runArray);
+    FontRunArray& operator=(const FontRunArray& runArray);
+
+    int GetLength() const {return m_lengthSum.GetTotal();}
+    int GetRunCount() const {return (int) m_runArray.GetSize();}
+    const FontRun& GetRun(int iRun) const {return m_runArray[iRun];}
+
+    int GetStyle(int iIndex) const;
+    Font GetFont(int iIndex) const;
+    void SetStyle(int iFirst, int iCount, int iStyle);
+
+    void Append(int iStyle, int iCount);
+    void Append(const FontRunArray& runArray, int iFirst, int iCount);
+    void Insert(int iIndex, int iStyle, int iCount = 1);
+    void Insert(int iIndex, const FontRunArray& runArray);
+    void Delete(int iIndex, int iCount);
+
+    FontRunArray Extract(int iFirst, int iCount) const;
+    void Serialize(CArchive& archive);
+
+  private:
+    int SplitAt(int iIndex);
+    void MergeAt(int iRun);
+
+    CArray<FontRun> m_runArray;
+    PrefixSum<int> m_lengthSum;
+};
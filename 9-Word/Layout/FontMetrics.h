@@ -0,0 +1,46 @@
+// A LayoutSize holds the width and height of a character in logical units
+// (hundredths of millimeters). Its fields are named like those of a CSize,
+// which lets the breaking rules of LayoutCore.h use either.
+
+struct LayoutSize
+{
+  int cx, cy;
+};
+
+// A LayoutStyle holds the fields of a logical font that affect the size of
+// its characters, as they are stored in the style table of a Word file. The
+// height is given in points.
+
+struct LayoutStyle
+{
+  int iHeight, iWeight;
+  bool bItalic;
+  string stFaceName;
+};
+
+// FontMetrics is the interface through which the layout engine measures the
+// characters, in place of the device context and font cache of the
+// application. A provider is given the style table of the document before
+// any character is measured. GetCharSize returns the size of a character,
+// scaled the way the application scales it, and GetClusterSize the size of
+// a cluster of several code units, measured as a whole like
+// FontEntry::GetClusterSize of the application. GetHeight returns the
+// unscaled height of a font, which is the height of an empty paragraph.
+// GetAscent returns the unscaled ascent of a font, which places the
+// characters of a line on a common baseline.
+
+class FontMetrics
+{
+  public:
+    virtual ~FontMetrics() {}
+
+    virtual void SetStyles(const vector<LayoutStyle>& styleArray) = 0;
+    virtual LayoutSize GetCharSize(int iStyle, char16_t cChar) const = 0;
+    virtual LayoutSize GetClusterSize(int iStyle, const char16_t* pCluster,
+                                      int iLength) const = 0;
+    virtual int GetHeight(int iStyle) const = 0;
+    virtual int GetAscent(int iStyle) const = 0;
+};
+
+int PointsToMeters(int iPoints);
+int ScaleSize(int iSize, bool bItalic);
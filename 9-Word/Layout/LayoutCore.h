@@ -0,0 +1,214 @@
+// The line and page breaking rules of the word processor. They are written
+// as templates over the containers of the text, the character sizes, and
+// the paragraph heights, so that the application applies them to its piece
+// tables, size arrays, and prefix sums, and the layout library to plain
+// vectors, with the same result. The text must return a character from
+// operator[], the sizes must have the cx and cy fields of a CSize, and the
+// heights must answer Sum and Find like a PrefixSum.
+
+// A cluster is a sequence of code units that is displayed, measured, and
+// edited as one character. In UTF-16 text, a surrogate pair is a cluster,
+// and so is a character followed by its combining marks, variation
+// selectors, emoji modifiers, and the characters joined to it by a zero
+// width joiner. Every other code unit is a cluster of its own. The
+// application applies these rules to its text in a Unicode build, and the
+// layout library to the text of the Word files. Either way, the width of a
+// cluster is given to its first code unit, and the rest of its code units
+// are given no width, which is how BreakLine tells the clusters apart.
+
+inline bool IsClusterExtender(unsigned int uChar)
+{
+  return ((uChar >= 0x0300) && (uChar <= 0x036F)) ||
+         ((uChar >= 0x1AB0) && (uChar <= 0x1AFF)) ||
+         ((uChar >= 0x1DC0) && (uChar <= 0x1DFF)) ||
+         ((uChar >= 0x20D0) && (uChar <= 0x20FF)) ||
+         ((uChar >= 0xFE00) && (uChar <= 0xFE0F)) ||
+         ((uChar >= 0xFE20) && (uChar <= 0xFE2F)) ||
+         (uChar == 0x200D);
+}
+
+// IsUtf16ClusterStart returns whether a cluster starts at the given index
+// of a UTF-16 text. The beginning and the end of the text are always
+// cluster starts. Text of plain characters, which is the common case, is
+// decided by looking at two code units.
+
+template<typename TextType>
+bool IsUtf16ClusterStart(const TextType& text, int iLength, int iIndex)
+{
+  if ((iIndex <= 0) || (iIndex >= iLength))
+  {
+    return true;
+  }
+
+  unsigned int uPrevious = (unsigned int) text[iIndex - 1];
+  unsigned int uChar = (unsigned int) text[iIndex];
+
+  if ((uChar < 0x0300) && (uPrevious < 0x0300))
+  {
+    return true;
+  }
+
+  if (((uPrevious & 0xFC00) == 0xD800) && ((uChar & 0xFC00) == 0xDC00))
+  {
+    return false;
+  }
+
+  // An emoji modifier is the surrogate pair of a code point from U+1F3FB to
+  // U+1F3FF.
+
+  if ((uChar == 0xD83C) && ((iIndex + 1) < iLength))
+  {
+    unsigned int uNext = (unsigned int) text[iIndex + 1];
+
+    if ((uNext >= 0xDFFB) && (uNext <= 0xDFFF))
+    {
+      return false;
+    }
+  }
+
+  return (uPrevious != 0x200D) && !IsClusterExtender(uChar);
+}
+
+// NextUtf16Cluster returns the index of the cluster following the cluster
+// that starts at the given index, or the length of the text.
+
+template<typename TextType>
+int NextUtf16Cluster(const TextType& text, int iLength, int iIndex)
+{
+  if (iIndex >= iLength)
+  {
+    return iLength;
+  }
+
+  int iNext = iIndex + 1;
+  while (!IsUtf16ClusterStart(text, iLength, iNext))
+  {
+    ++iNext;
+  }
+
+  return iNext;
+}
+
+// SkipCluster returns the index following the cluster that starts at the
+// given index, which is where the code units of no width that follow it
+// end.
+
+template<typename SizeArrayType>
+int SkipCluster(const SizeArrayType& sizeArray, int iIndex, int iSize)
+{
+  for (++iIndex; (iIndex < iSize) && (sizeArray[iIndex].cx == 0); ++iIndex)
+  {
+    // Empty.
+  }
+
+  return iIndex;
+}
+
+// BreakLine breaks the line that starts at the given index. It sets the last
+// character and the height of the line, and returns the index of the first
+// character of the next line. A line is broken at its latest space, which is
+// left out of both lines. If there is no space, it is broken at the first
+// character that does not fit, unless that is the first character of the
+// line, which then makes up a line of its own. A line is only broken at the
+// start of a cluster: a character that does not fit has a width, so it
+// starts a cluster, while the space left out and the character making up a
+// line of its own take the rest of their clusters with them.
+
+template<typename TextType, typename SizeArrayType>
+int BreakLine(const TextType& text, const SizeArrayType& sizeArray,
+              int iStartIndex, int iSize, int iPageWidth, int& iLastChar,
+              int& iHeight)
+{
+  bool bSpace = false;
+  int iSpaceIndex = 0, iLineWidth = 0, iLineHeight = 0, iSpaceLineHeight = 0;
+
+  for (int iIndex = iStartIndex; iIndex < iSize; ++iIndex)
+  {
+    int iCharWidth = sizeArray[iIndex].cx;
+    int iCharHeight = sizeArray[iIndex].cy;
+
+    // The latest space is a suitable point to break the line at.
+
+    if (text[iIndex] == ' ')
+    {
+      bSpace = true;
+      iSpaceIndex = iIndex;
+      iSpaceLineHeight = iLineHeight;
+    }
+
+    iLineWidth += iCharWidth;
+
+    // When no more characters fit on the line, we break it at the latest
+    // space. If there is no space, we break it at the current character,
+    // unless it is the first character of the line.
+
+    if (iLineWidth > iPageWidth)
+    {
+      if (bSpace)
+      {
+        iLastChar = iSpaceIndex - 1;
+        iHeight = iSpaceLineHeight;
+        return SkipCluster(sizeArray, iSpaceIndex, iSize);
+      }
+
+      else if (iStartIndex < iIndex)
+      {
+        iLastChar = iIndex - 1;
+        iHeight = iLineHeight;
+        return iIndex;
+      }
+
+      else
+      {
+        int iNextIndex = SkipCluster(sizeArray, iIndex, iSize);
+        iLastChar = iNextIndex - 1;
+        iHeight = iCharHeight;
+        return iNextIndex;
+      }
+    }
+
+    if (iCharHeight > iLineHeight)
+    {
+      iLineHeight = iCharHeight;
+    }
+  }
+
+  // If there are character left after the latest line break, they make up
+  // the last line.
+
+  iLastChar = iSize - 1;
+  iHeight = iLineHeight;
+  return iSize;
+}
+
+// BreakPage breaks the page that starts at the given paragraph. It sets the
+// last paragraph of the page, and returns the first paragraph of the next
+// page. The page holds the paragraphs that fit completely within its
+// height, looked up in the prefix sum of the paragraph heights. A paragraph
+// that is higher than a page makes up a page of its own.
+
+template<typename HeightSumType>
+int BreakPage(const HeightSumType& heightSum, int iFirstParagraph,
+              int iParagraphs, int iPageHeight, int& iLastParagraph)
+{
+  int iNextParagraph =
+    heightSum.Find(heightSum.Sum(iFirstParagraph) + iPageHeight);
+
+  if (iNextParagraph >= iParagraphs)
+  {
+    iLastParagraph = iParagraphs - 1;
+    return iParagraphs;
+  }
+
+  else if (iFirstParagraph < iNextParagraph)
+  {
+    iLastParagraph = iNextParagraph - 1;
+    return iNextParagraph;
+  }
+
+  else
+  {
+    iLastParagraph = iFirstParagraph;
+    return iFirstParagraph + 1;
+  }
+}
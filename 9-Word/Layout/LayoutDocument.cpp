@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "LayoutCore.h"
+#include "FontMetrics.h"
+#include "WordReader.h"
+#include "LayoutDocument.h"
+
+HeightSum::HeightSum()
+{
+  Clear();
+}
+
+void HeightSum::Clear()
+{
+  m_sumArray.assign(1, 0);
+}
+
+void HeightSum::Add(int iHeight)
+{
+  m_sumArray.push_back(m_sumArray.back() + iHeight);
+}
+
+// Find returns the index where Sum(index) <= position < Sum(index + 1), or
+// the number of heights if the position is beyond their total sum. As the
+// sums are sorted, we perform a binary search.
+
+int HeightSum::Find(int iPosition) const
+{
+  return (int) (upper_bound(m_sumArray.begin(), m_sumArray.end(),
+                            iPosition) - m_sumArray.begin()) - 1;
+}
+
+LayoutParagraph::LayoutParagraph()
+ :m_iAlignment(0),
+  m_iEmptyStyle(0),
+  m_iHeight(0)
+{
+  // Empty.
+}
+
+// Read reads a paragraph the way Paragraph::Read of the application does.
+// The lengths of the runs are stored in code points, and are converted into
+// UTF-16 units, where a surrogate pair is one code point. As ReadText only
+// makes whole surrogate pairs, a high surrogate is always followed by a low
+// one. It returns false if the file is corrupt, including the case where the
+// code points of the runs do not cover the text exactly.
+
+bool LayoutParagraph::Read(WordReader& reader)
+{
+  unsigned char bAlignment;
+  int iRuns;
+
+  if (!reader.ReadByte(bAlignment) ||
+      (bAlignment > LAYOUT_ALIGN_JUSTIFIED) ||
+      !reader.ReadStyle(m_iEmptyStyle) || !reader.ReadText(m_text) ||
+      !reader.ReadInt(iRuns) || (iRuns < 0))
+  {
+    return false;
+  }
+
+  m_iAlignment = bAlignment;
+  m_runArray.clear();
+
+  int iLength = 0;
+  for (int iRun = 0; iRun < iRuns; ++iRun)
+  {
+    LayoutRun run;
+    int iCodePoints;
+
+    if (!reader.ReadStyle(run.iStyle) || !reader.ReadInt(iCodePoints) ||
+        (iCodePoints <= 0) || (iCodePoints > (GetLength() - iLength)))
+    {
+      return false;
+    }
+
+    run.iLength = 0;
+    for (int iCount = 0; iCount < iCodePoints; ++iCount)
+    {
+      if (iLength == GetLength())
+      {
+        return false;
+      }
+
+      int iUnits = ((m_text[iLength] & 0xFC00) == 0xD800) ? 2 : 1;
+      run.iLength += iUnits;
+      iLength += iUnits;
+    }
+
+    m_runArray.push_back(run);
+  }
+
+  return iLength == GetLength();
+}
+
+// LayOut generates the size and ascent arrays run by run, and the line
+// array by breaking the lines one by one, like Paragraph::Recalculate. A
+// cluster of several code units is measured as a whole, like in
+// Paragraph::GenerateSizeArray; its first code unit is given its width, and
+// the rest of them no width. An empty paragraph has one empty line with the
+// unscaled height of its empty font.
+
+void LayoutParagraph::LayOut(const FontMetrics& metrics)
+{
+  m_sizeArray.clear();
+  m_xArray.clear();
+  m_lineArray.clear();
+  m_iHeight = 0;
+
+  if (m_text.empty())
+  {
+    m_iHeight = metrics.GetHeight(m_iEmptyStyle);
+    LayoutLine line = {0, 0, 0, 0, metrics.GetAscent(m_iEmptyStyle)};
+    m_lineArray.push_back(line);
+    return;
+  }
+
+  vector<int> ascentArray;
+  m_sizeArray.reserve(m_text.size());
+  ascentArray.reserve(m_text.size());
+
+  int iLength = GetLength(), iChar = 0;
+  for (const LayoutRun& run : m_runArray)
+  {
+    int iAscent = metrics.GetAscent(run.iStyle);
+    int iRunEnd = iChar + run.iLength;
+
+    while (iChar < iRunEnd)
+    {
+      int iNextChar = min(NextUtf16Cluster(m_text, iLength, iChar), iRunEnd);
+      LayoutSize szChar = (iNextChar == (iChar + 1))
+                          ? metrics.GetCharSize(run.iStyle, m_text[iChar])
+                          : metrics.GetClusterSize(run.iStyle,
+                                                   m_text.data() + iChar,
+                                                   iNextChar - iChar);
+      m_sizeArray.push_back(szChar);
+      ascentArray.push_back(iAscent);
+
+      for (++iChar; iChar < iNextChar; ++iChar)
+      {
+        m_sizeArray.push_back(LayoutSize{0, szChar.cy});
+        ascentArray.push_back(iAscent);
+      }
+    }
+  }
+
+  m_xArray.assign(m_text.size(), 0);
+
+  int iSize = GetLength(), iStartIndex = 0;
+  while (iStartIndex < iSize)
+  {
+    LayoutLine line;
+    line.iFirstChar = iStartIndex;
+    line.iTop = m_iHeight;
+    iStartIndex = BreakLine(m_text, m_sizeArray, iStartIndex, iSize,
+                            LAYOUT_PAGE_WIDTH, line.iLastChar, line.iHeight);
+
+    PlaceLine(line, ascentArray);
+    m_lineArray.push_back(line);
+    m_iHeight += line.iHeight;
+  }
+}
+
+// PlaceLine finds the ascent of the line, which is the highest ascent of
+// its characters, and the left side of each character. With justified
+// alignment, the spaces share the width left over by the other characters.
+
+void LayoutParagraph::PlaceLine(LayoutLine& line,
+                                const vector<int>& ascentArray)
+{
+  bool bJustified = (m_iAlignment == LAYOUT_ALIGN_JUSTIFIED);
+  int iLineWidth = 0, iSpaces = 0;
+  line.iAscent = 0;
+
+  for (int iIndex = line.iFirstChar; iIndex <= line.iLastChar; ++iIndex)
+  {
+    if (bJustified && (m_text[iIndex] == u' '))
+    {
+      ++iSpaces;
+    }
+
+    else
+    {
+      iLineWidth += m_sizeArray[iIndex].cx;
+    }
+
+    line.iAscent = max(line.iAscent, ascentArray[iIndex]);
+  }
+
+  int xPos = 0, iSpaceWidth = 0;
+  switch (m_iAlignment)
+  {
+    case LAYOUT_ALIGN_CENTER:
+      xPos = (LAYOUT_PAGE_WIDTH - iLineWidth) / 2;
+      break;
+
+    case LAYOUT_ALIGN_RIGHT:
+      xPos = LAYOUT_PAGE_WIDTH - iLineWidth;
+      break;
+
+    case LAYOUT_ALIGN_JUSTIFIED:
+      if (iSpaces > 0)
+      {
+        iSpaceWidth = (LAYOUT_PAGE_WIDTH - iLineWidth) / iSpaces;
+      }
+      break;
+  }
+
+  for (int iIndex = line.iFirstChar; iIndex <= line.iLastChar; ++iIndex)
+  {
+    m_xArray[iIndex] = xPos;
+    xPos += (bJustified && (m_text[iIndex] == u' '))
+            ? iSpaceWidth : m_sizeArray[iIndex].cx;
+  }
+}
+
+// Load reads the whole file into memory and reads the document from it. It
+// returns false if the file cannot be read or is not a Word file.
+
+bool LayoutDocument::Load(const string& stPath)
+{
+  ifstream inStream(stPath, ios::in | ios::binary);
+
+  if (!inStream)
+  {
+    return false;
+  }
+
+  vector<unsigned char> byteArray((istreambuf_iterator<char>(inStream)),
+                                  istreambuf_iterator<char>());
+  return Read(byteArray);
+}
+
+bool LayoutDocument::Read(const vector<unsigned char>& byteArray)
+{
+  WordReader reader(byteArray);
+  int iParagraphs;
+
+  m_paragraphArray.clear();
+  m_pageArray.clear();
+  m_heightSum.Clear();
+
+  if (!reader.ReadHeader(m_styleArray, iParagraphs))
+  {
+    return false;
+  }
+
+  // The number of paragraphs is not trusted to reserve space, as a corrupt
+  // file could give any number.
+
+  for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
+  {
+    LayoutParagraph paragraph;
+
+    if (!paragraph.Read(reader))
+    {
+      m_paragraphArray.clear();
+      return false;
+    }
+
+    m_paragraphArray.push_back(move(paragraph));
+  }
+
+  return true;
+}
+
+// LayOut lays out every paragraph, and breaks the pages the way
+// CWordDoc::UpdateParagraphAndPageArray does.
+
+void LayoutDocument::LayOut(FontMetrics& metrics)
+{
+  metrics.SetStyles(m_styleArray);
+  m_heightSum.Clear();
+  m_pageArray.clear();
+
+  for (LayoutParagraph& paragraph : m_paragraphArray)
+  {
+    paragraph.LayOut(metrics);
+    m_heightSum.Add(paragraph.GetHeight());
+  }
+
+  int iParagraphs = GetParagraphCount(), iStartParagraph = 0;
+  while (iStartParagraph < iParagraphs)
+  {
+    LayoutPage page;
+    page.iFirstParagraph = iStartParagraph;
+    iStartParagraph = BreakPage(m_heightSum, iStartParagraph, iParagraphs,
+                                LAYOUT_PAGE_HEIGHT, page.iLastParagraph);
+    m_pageArray.push_back(page);
+  }
+}
+
+int LayoutDocument::GetLineCount() const
+{
+  int iLines = 0;
+
+  for (const LayoutParagraph& paragraph : m_paragraphArray)
+  {
+    iLines += (int) paragraph.GetLines().size();
+  }
+
+  return iLines;
+}
+
+int LayoutDocument::GetHeight() const
+{
+  return m_heightSum.GetTotal();
+}
@@ -0,0 +1,120 @@
+// The size of a page and of its printable area in logical units, the same
+// as in the application: an A4 page with margins of 25 millimeters.
+
+const int LAYOUT_PAGE_TOTALWIDTH = 21000;
+const int LAYOUT_PAGE_TOTALHEIGHT = 29700;
+const int LAYOUT_PAGE_MARGIN = 2500;
+
+const int LAYOUT_PAGE_WIDTH = LAYOUT_PAGE_TOTALWIDTH - 2 * LAYOUT_PAGE_MARGIN;
+const int LAYOUT_PAGE_HEIGHT =
+  LAYOUT_PAGE_TOTALHEIGHT - 2 * LAYOUT_PAGE_MARGIN;
+
+const int LAYOUT_ALIGN_LEFT = 0;
+const int LAYOUT_ALIGN_RIGHT = 1;
+const int LAYOUT_ALIGN_CENTER = 2;
+const int LAYOUT_ALIGN_JUSTIFIED = 3;
+
+// A LayoutRun holds the style of a sequence of characters, and its length
+// in the UTF-16 units of the text.
+
+struct LayoutRun
+{
+  int iStyle, iLength;
+};
+
+// A LayoutLine holds the range of characters of a line, and its top and
+// baseline relative to the top of its paragraph.
+
+struct LayoutLine
+{
+  int iFirstChar, iLastChar, iHeight, iTop, iAscent;
+};
+
+struct LayoutPage
+{
+  int iFirstParagraph, iLastParagraph;
+};
+
+// A HeightSum holds the prefix sum of the paragraph heights, with the Sum
+// and Find of the PrefixSum of the application, which is what BreakPage
+// looks up the page breaks in. As the layout engine lays out a document
+// once, a plain array of sums is enough.
+
+class HeightSum
+{
+  public:
+    HeightSum();
+
+    void Clear();
+    void Add(int iHeight);
+    int Sum(int iIndex) const {return m_sumArray[iIndex];}
+    int GetTotal() const {return m_sumArray.back();}
+    int Find(int iPosition) const;
+
+  private:
+    vector<int> m_sumArray;
+};
+
+// A LayoutParagraph holds the text and font runs of a paragraph of a Word
+// file. LayOut measures its characters with the given metrics, breaks them
+// into lines by the rules of the application, and places them on the lines
+// according to the alignment, like Paragraph::GenerateLineRects. The left
+// side of each character is kept, relative to the printable area.
+
+class LayoutParagraph
+{
+  public:
+    LayoutParagraph();
+
+    bool Read(WordReader& reader);
+    void LayOut(const FontMetrics& metrics);
+
+    int GetLength() const {return (int) m_text.size();}
+    int GetHeight() const {return m_iHeight;}
+    const vector<LayoutLine>& GetLines() const {return m_lineArray;}
+
+    const u16string& GetText() const {return m_text;}
+    const vector<LayoutRun>& GetRuns() const {return m_runArray;}
+    const vector<LayoutSize>& GetSizes() const {return m_sizeArray;}
+    const vector<int>& GetPositions() const {return m_xArray;}
+
+  private:
+    void PlaceLine(LayoutLine& line, const vector<int>& ascentArray);
+
+    int m_iAlignment, m_iEmptyStyle, m_iHeight;
+    u16string m_text;
+    vector<LayoutRun> m_runArray;
+    vector<LayoutSize> m_sizeArray;
+    vector<int> m_xArray;
+    vector<LayoutLine> m_lineArray;
+};
+
+// A LayoutDocument lays out and paginates the paragraphs of a Word file
+// without a window, a device context, or MFC, which makes the layout
+// testable and usable on any platform. The fonts are measured by a
+// FontMetrics provider.
+
+class LayoutDocument
+{
+  public:
+    bool Load(const string& stPath);
+    bool Read(const vector<unsigned char>& byteArray);
+    void LayOut(FontMetrics& metrics);
+
+    int GetParagraphCount() const {return (int) m_paragraphArray.size();}
+    int GetLineCount() const;
+    int GetPageCount() const {return (int) m_pageArray.size();}
+    int GetHeight() const;
+    int GetTop(int iParagraph) const {return m_heightSum.Sum(iParagraph);}
+
+    const vector<LayoutStyle>& GetStyles() const {return m_styleArray;}
+    const vector<LayoutParagraph>& GetParagraphs() const
+                                   {return m_paragraphArray;}
+    const vector<LayoutPage>& GetPages() const {return m_pageArray;}
+
+  private:
+    vector<LayoutStyle> m_styleArray;
+    vector<LayoutParagraph> m_paragraphArray;
+    HeightSum m_heightSum;
+    vector<LayoutPage> m_pageArray;
+};
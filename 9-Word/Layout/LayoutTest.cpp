@@ -0,0 +1,790 @@
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "LayoutCore.h"
+#include "FontMetrics.h"
+#include "TableMetrics.h"
+#include "WordReader.h"
+#include "LayoutDocument.h"
+#include "PageImage.h"
+#include "PdfWriter.h"
+#include "PageExport.h"
+
+// LayoutTest checks the line and page breaking rules, the reading and
+// layout of Word files, and the export of the pages to images and PDF. Each
+// failed check is written with its line number, and the number of failed
+// checks is returned, so that zero means success.
+
+static int g_iFailures = 0;
+
+static void Check(bool bCondition, const char* pCondition, int iLine)
+{
+  if (!bCondition)
+  {
+    cerr << "LayoutTest.cpp(" << iLine << "): failed: " << pCondition << endl;
+    ++g_iFailures;
+  }
+}
+
+#define CHECK(condition) Check((condition), #condition, __LINE__)
+
+// A TestFile builds a Word file in memory, in the format read by
+// WordReader: the styles, followed by the paragraphs with their alignment,
+// empty style, UTF-8 text, and font runs.
+
+class TestFile
+{
+  public:
+    TestFile() :m_iStyles(0), m_iParagraphs(0) {}
+
+    void AddStyle(int iHeight, int iWeight, bool bItalic,
+                  const string& stFaceName);
+    void AddParagraph(int iAlignment, const string& stText,
+                      const vector<LayoutRun>& runArray, int iEmptyStyle = 0);
+    vector<unsigned char> GetBytes() const;
+
+  private:
+    static void AppendInt(vector<unsigned char>& byteArray, int iValue);
+    static void AppendString(vector<unsigned char>& byteArray,
+                             const string& stText);
+
+    int m_iStyles, m_iParagraphs;
+    vector<unsigned char> m_styleArray, m_paragraphArray;
+};
+
+void TestFile::AppendInt(vector<unsigned char>& byteArray, int iValue)
+{
+  for (int iByte = 0; iByte < 4; ++iByte)
+  {
+    byteArray.push_back((unsigned char) (((unsigned int) iValue) >>
+                                         (8 * iByte)));
+  }
+}
+
+void TestFile::AppendString(vector<unsigned char>& byteArray,
+                            const string& stText)
+{
+  AppendInt(byteArray, (int) stText.size());
+  byteArray.insert(byteArray.end(), stText.begin(), stText.end());
+}
+
+void TestFile::AddStyle(int iHeight, int iWeight, bool bItalic,
+                        const string& stFaceName)
+{
+  AppendInt(m_styleArray, iHeight);
+  AppendInt(m_styleArray, 0);
+  AppendInt(m_styleArray, 0);
+  AppendInt(m_styleArray, 0);
+  AppendInt(m_styleArray, iWeight);
+  m_styleArray.push_back(bItalic ? 1 : 0);
+  m_styleArray.insert(m_styleArray.end(), 7, 0);
+  AppendString(m_styleArray, stFaceName);
+  ++m_iStyles;
+}
+
+void TestFile::AddParagraph(int iAlignment, const string& stText,
+                            const vector<LayoutRun>& runArray,
+                            int iEmptyStyle /* = 0 */)
+{
+  m_paragraphArray.push_back((unsigned char) iAlignment);
+  AppendInt(m_paragraphArray, iEmptyStyle);
+  AppendString(m_paragraphArray, stText);
+  AppendInt(m_paragraphArray, (int) runArray.size());
+
+  for (const LayoutRun& run : runArray)
+  {
+    AppendInt(m_paragraphArray, run.iStyle);
+    AppendInt(m_paragraphArray, run.iLength);
+  }
+
+  ++m_iParagraphs;
+}
+
+vector<unsigned char> TestFile::GetBytes() const
+{
+  vector<unsigned char> byteArray = {'W', 'O', 'R', 'D'};
+  AppendInt(byteArray, WORD_FILE_VERSION);
+  AppendInt(byteArray, m_iStyles);
+  byteArray.insert(byteArray.end(), m_styleArray.begin(), m_styleArray.end());
+  AppendInt(byteArray, m_iParagraphs);
+  byteArray.insert(byteArray.end(), m_paragraphArray.begin(),
+                   m_paragraphArray.end());
+  return byteArray;
+}
+
+// A line is broken at its latest space, which belongs to neither line, and
+// its height is that of the characters before the space. Without a space,
+// it is broken before the first character that does not fit, and a single
+// character wider than the page makes up a line of its own.
+
+static void TestBreakLine()
+{
+  string stText = "aa bb cc";
+  vector<LayoutSize> sizeArray(stText.size(), LayoutSize{10, 5});
+  sizeArray[6].cy = 9;
+
+  int iLastChar, iHeight;
+  int iNext = BreakLine(stText, sizeArray, 0, 8, 45, iLastChar, iHeight);
+  CHECK((iNext == 3) && (iLastChar == 1) && (iHeight == 5));
+
+  iNext = BreakLine(stText, sizeArray, iNext, 8, 45, iLastChar, iHeight);
+  CHECK((iNext == 6) && (iLastChar == 4) && (iHeight == 5));
+
+  iNext = BreakLine(stText, sizeArray, iNext, 8, 45, iLastChar, iHeight);
+  CHECK((iNext == 8) && (iLastChar == 7) && (iHeight == 9));
+
+  string stWord = "abcdef";
+  vector<LayoutSize> wordSizeArray(stWord.size(), LayoutSize{10, 5});
+  iNext = BreakLine(stWord, wordSizeArray, 0, 6, 25, iLastChar, iHeight);
+  CHECK((iNext == 2) && (iLastChar == 1));
+
+  wordSizeArray[2] = LayoutSize{100, 7};
+  iNext = BreakLine(stWord, wordSizeArray, 2, 6, 25, iLastChar, iHeight);
+  CHECK((iNext == 3) && (iLastChar == 2) && (iHeight == 7));
+}
+
+// A surrogate pair, a character with its combining marks, an emoji with
+// its modifier, and characters joined by a zero width joiner are clusters.
+// A line is never broken inside a cluster: a cluster wider than the page
+// makes up a line of its own with all of its code units, and a space that
+// is left out takes its combining mark with it. A cluster measured by the
+// layout gives its width to its first code unit.
+
+static void TestClusters()
+{
+  u16string stText = u"e\u0301x\U0001F600\U0001F44D\U0001F3FBa\u200Db";
+  int iLength = (int) stText.size();
+
+  vector<int> startArray;
+  for (int iIndex = 0; iIndex < iLength;
+       iIndex = NextUtf16Cluster(stText, iLength, iIndex))
+  {
+    startArray.push_back(iIndex);
+  }
+
+  CHECK((startArray == vector<int>{0, 2, 3, 5, 9}));
+  CHECK(!IsUtf16ClusterStart(stText, iLength, 1));
+  CHECK(!IsUtf16ClusterStart(stText, iLength, 4));
+  CHECK(!IsUtf16ClusterStart(stText, iLength, 7));
+  CHECK(!IsUtf16ClusterStart(stText, iLength, 11));
+
+  u16string stWide = u"\U0001F600ab";
+  vector<LayoutSize> sizeArray = {{100, 7}, {0, 7}, {10, 5}, {10, 5}};
+  int iLastChar, iHeight;
+  int iNext = BreakLine(stWide, sizeArray, 0, 4, 25, iLastChar, iHeight);
+  CHECK((iNext == 2) && (iLastChar == 1) && (iHeight == 7));
+
+  u16string stMark = u"a \u0301b";
+  vector<LayoutSize> markSizeArray = {{60, 5}, {10, 5}, {0, 5}, {60, 5}};
+  iNext = BreakLine(stMark, markSizeArray, 0, 4, 100, iLastChar, iHeight);
+  CHECK((iNext == 3) && (iLastChar == 0));
+
+  TestFile file;
+  file.AddStyle(12, 400, false, "Times New Roman");
+  file.AddParagraph(LAYOUT_ALIGN_LEFT, "e\xCC\x81\xF0\x9F\x98\x80", {{0, 3}});
+
+  LayoutDocument document;
+  TableMetrics metrics;
+  CHECK(document.Read(file.GetBytes()));
+  document.LayOut(metrics);
+
+  const vector<LayoutSize>& paragraphSizeArray =
+    document.GetParagraphs()[0].GetSizes();
+  CHECK(paragraphSizeArray.size() == 4);
+  CHECK((paragraphSizeArray[0].cx > 0) && (paragraphSizeArray[1].cx == 0));
+  CHECK((paragraphSizeArray[2].cx > 0) && (paragraphSizeArray[3].cx == 0));
+}
+
+// A page holds the paragraphs that fit completely, and a paragraph higher
+// than a page makes up a page of its own.
+
+static void TestBreakPage()
+{
+  HeightSum heightSum;
+  for (int iHeight : {40, 40, 40, 150, 10})
+  {
+    heightSum.Add(iHeight);
+  }
+
+  int iLastParagraph;
+  int iNext = BreakPage(heightSum, 0, 5, 100, iLastParagraph);
+  CHECK((iNext == 2) && (iLastParagraph == 1));
+
+  iNext = BreakPage(heightSum, iNext, 5, 100, iLastParagraph);
+  CHECK((iNext == 3) && (iLastParagraph == 2));
+
+  iNext = BreakPage(heightSum, iNext, 5, 100, iLastParagraph);
+  CHECK((iNext == 4) && (iLastParagraph == 3));
+
+  iNext = BreakPage(heightSum, iNext, 5, 100, iLastParagraph);
+  CHECK((iNext == 5) && (iLastParagraph == 4));
+}
+
+// A document is read and laid out with the table metrics. An empty
+// paragraph has the unscaled height of its empty font, and a long
+// paragraph is broken into several lines. A file whose runs do not cover
+// the text, or which is cut short, is rejected.
+
+static void TestDocument()
+{
+  TestFile file;
+  file.AddStyle(12, 400, false, "Times New Roman");
+  file.AddStyle(24, 700, true, "Arial");
+  file.AddParagraph(LAYOUT_ALIGN_LEFT, "", {});
+
+  string stLong;
+  for (int iWord = 0; iWord < 20; ++iWord)
+  {
+    stLong += "lorem ipsum ";
+  }
+
+  file.AddParagraph(LAYOUT_ALIGN_LEFT, stLong, {{0, 120}, {1, 120}});
+
+  LayoutDocument document;
+  TableMetrics metrics;
+  CHECK(document.Read(file.GetBytes()));
+  document.LayOut(metrics);
+
+  CHECK(document.GetParagraphCount() == 2);
+  CHECK(document.GetParagraphs()[0].GetHeight() == PointsToMeters(12));
+  CHECK(document.GetParagraphs()[1].GetLines().size() > 1);
+  CHECK(document.GetPageCount() == 1);
+  CHECK(document.GetHeight() == (document.GetParagraphs()[0].GetHeight() +
+                                 document.GetParagraphs()[1].GetHeight()));
+
+  for (const LayoutLine& line : document.GetParagraphs()[1].GetLines())
+  {
+    int iWidth = 0;
+    for (int iChar = line.iFirstChar; iChar <= line.iLastChar; ++iChar)
+    {
+      iWidth += document.GetParagraphs()[1].GetSizes()[iChar].cx;
+    }
+
+    CHECK(iWidth <= LAYOUT_PAGE_WIDTH);
+  }
+
+  TestFile badFile;
+  badFile.AddStyle(12, 400, false, "Times New Roman");
+  badFile.AddParagraph(LAYOUT_ALIGN_LEFT, "abc", {{0, 2}});
+  CHECK(!document.Read(badFile.GetBytes()));
+
+  vector<unsigned char> byteArray = file.GetBytes();
+  byteArray.resize(byteArray.size() - 3);
+  CHECK(!document.Read(byteArray));
+}
+
+// The lengths of the runs are stored in code points, whatever the encoding
+// of the text in the application, and are converted into the UTF-16 units
+// of the text when read. The text holds a character of two, three, and four
+// UTF-8 bytes, the last of which is a surrogate pair in UTF-16. Run lengths
+// counted in UTF-16 units or in UTF-8 bytes do not cover the text.
+
+static void TestRunLengths()
+{
+  string stText = "a\xC3\xBC\xE6\x97\xA5\xF0\x9F\x98\x80" "b";
+
+  TestFile file;
+  file.AddStyle(12, 400, false, "Times New Roman");
+  file.AddStyle(24, 700, true, "Arial");
+  file.AddParagraph(LAYOUT_ALIGN_LEFT, stText, {{0, 3}, {1, 2}});
+
+  LayoutDocument document;
+  TableMetrics metrics;
+  CHECK(document.Read(file.GetBytes()));
+  document.LayOut(metrics);
+
+  const LayoutParagraph& paragraph = document.GetParagraphs()[0];
+  CHECK(paragraph.GetText() == u"a\u00FC\u65E5\U0001F600b");
+  CHECK(paragraph.GetRuns().size() == 2);
+  CHECK(paragraph.GetRuns()[0].iLength == 3);
+  CHECK(paragraph.GetRuns()[1].iLength == 3);
+  CHECK(paragraph.GetSizes().size() == paragraph.GetText().size());
+
+  TestFile unitFile;
+  unitFile.AddStyle(12, 400, false, "Times New Roman");
+  unitFile.AddParagraph(LAYOUT_ALIGN_LEFT, stText, {{0, 6}});
+  CHECK(!document.Read(unitFile.GetBytes()));
+
+  TestFile byteFile;
+  byteFile.AddStyle(12, 400, false, "Times New Roman");
+  byteFile.AddParagraph(LAYOUT_ALIGN_LEFT, stText, {{0, 11}});
+  CHECK(!document.Read(byteFile.GetBytes()));
+}
+
+// MakeDocument lays out a document of the given number of paragraphs,
+// each holding the given text in the first style. The run covers the code
+// points of the text, one for each byte that does not continue a UTF-8
+// sequence.
+
+static void MakeDocument(LayoutDocument& document, int iParagraphs,
+                         const string& stText, int iAlignment)
+{
+  TestFile file;
+  file.AddStyle(12, 400, false, "Times New Roman");
+  file.AddStyle(24, 700, true, "Courier New");
+
+  int iLength = (int) count_if(stText.begin(), stText.end(), [](char cByte)
+                               {return (cByte & 0xC0) != 0x80;});
+
+  for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
+  {
+    file.AddParagraph(iAlignment, stText, {{0, iLength}});
+  }
+
+  TableMetrics metrics;
+  CHECK(document.Read(file.GetBytes()));
+  document.LayOut(metrics);
+}
+
+static int GetLineWidth(const LayoutParagraph& paragraph,
+                        const LayoutLine& line)
+{
+  int iWidth = 0;
+  for (int iChar = line.iFirstChar; iChar <= line.iLastChar; ++iChar)
+  {
+    iWidth += paragraph.GetSizes()[iChar].cx;
+  }
+
+  return iWidth;
+}
+
+// The characters are placed on the lines according to the alignment: a
+// right aligned line ends at the right margin, a centered line has equal
+// space on both sides, and every justified line but the last ends at the
+// right margin, less the rounding of the space width. A line of two styles
+// has the ascent of the higher one.
+
+static void TestPlacement()
+{
+  LayoutDocument document;
+  MakeDocument(document, 1, "lorem ipsum", LAYOUT_ALIGN_RIGHT);
+  const LayoutParagraph& rightParagraph = document.GetParagraphs()[0];
+  const LayoutLine& rightLine = rightParagraph.GetLines()[0];
+  CHECK(rightParagraph.GetPositions()[rightLine.iLastChar] +
+        rightParagraph.GetSizes()[rightLine.iLastChar].cx ==
+        LAYOUT_PAGE_WIDTH);
+
+  MakeDocument(document, 1, "lorem ipsum", LAYOUT_ALIGN_CENTER);
+  const LayoutParagraph& centerParagraph = document.GetParagraphs()[0];
+  const LayoutLine& centerLine = centerParagraph.GetLines()[0];
+  CHECK(centerParagraph.GetPositions()[0] ==
+        (LAYOUT_PAGE_WIDTH - GetLineWidth(centerParagraph, centerLine)) / 2);
+
+  string stLong;
+  for (int iWord = 0; iWord < 40; ++iWord)
+  {
+    stLong += "lorem ipsum ";
+  }
+
+  MakeDocument(document, 1, stLong, LAYOUT_ALIGN_JUSTIFIED);
+  const LayoutParagraph& justifiedParagraph = document.GetParagraphs()[0];
+  const LayoutLine& justifiedLine = justifiedParagraph.GetLines()[0];
+  int xEnd = justifiedParagraph.GetPositions()[justifiedLine.iLastChar] +
+             justifiedParagraph.GetSizes()[justifiedLine.iLastChar].cx;
+  CHECK(justifiedParagraph.GetLines().size() > 1);
+  CHECK((xEnd <= LAYOUT_PAGE_WIDTH) && (xEnd > (LAYOUT_PAGE_WIDTH - 100)));
+
+  TestFile file;
+  file.AddStyle(12, 400, false, "Times New Roman");
+  file.AddStyle(24, 700, true, "Arial");
+  file.AddParagraph(LAYOUT_ALIGN_LEFT, "small LARGE", {{0, 6}, {1, 5}});
+
+  TableMetrics metrics;
+  CHECK(document.Read(file.GetBytes()));
+  document.LayOut(metrics);
+  CHECK(document.GetParagraphs()[0].GetLines()[0].iAscent ==
+        metrics.GetAscent(1));
+}
+
+// ReadBigEndian and CalculateCrc read the PNG format independently of the
+// exporter.
+
+static unsigned long ReadBigEndian(const string& stData, size_t iIndex)
+{
+  unsigned long uValue = 0;
+
+  for (int iByte = 0; iByte < 4; ++iByte)
+  {
+    uValue = (uValue << 8) | (unsigned char) stData[iIndex + iByte];
+  }
+
+  return uValue;
+}
+
+static unsigned long CalculateCrc(const string& stData)
+{
+  unsigned long uCrc = 0xFFFFFFFFUL;
+
+  for (char cByte : stData)
+  {
+    uCrc ^= (unsigned char) cByte;
+
+    for (int iBit = 0; iBit < 8; ++iBit)
+    {
+      uCrc = (uCrc & 1) ? (0xEDB88320UL ^ (uCrc >> 1)) : (uCrc >> 1);
+    }
+  }
+
+  return uCrc ^ 0xFFFFFFFFUL;
+}
+
+// A BitReader reads the bits of a deflate stream, the least significant
+// bit of each byte first.
+
+class BitReader
+{
+  public:
+    BitReader(const string& stData, size_t iStart)
+     :m_stData(stData), m_iBit(8 * iStart) {}
+
+    bool IsAtEnd() const {return (m_iBit / 8) >= m_stData.size();}
+    size_t GetBytePosition() const {return (m_iBit + 7) / 8;}
+
+    unsigned int Read(int iBits);
+
+  private:
+    const string& m_stData;
+    size_t m_iBit;
+};
+
+unsigned int BitReader::Read(int iBits)
+{
+  unsigned int uValue = 0;
+
+  for (int iBit = 0; (iBit < iBits) && !IsAtEnd(); ++iBit, ++m_iBit)
+  {
+    unsigned int uByte = (unsigned char) m_stData[m_iBit / 8];
+    uValue |= ((uByte >> (m_iBit % 8)) & 1) << iBit;
+  }
+
+  return uValue;
+}
+
+// ReadFixedSymbol decodes a literal or length symbol of the fixed Huffman
+// codes, whose bits come most significant first.
+
+static int ReadFixedSymbol(BitReader& reader)
+{
+  unsigned int uCode = 0;
+
+  for (int iBits = 1; (iBits <= 9) && !reader.IsAtEnd(); ++iBits)
+  {
+    uCode = (uCode << 1) | reader.Read(1);
+
+    if ((iBits == 7) && (uCode <= 0x17))
+    {
+      return 256 + uCode;
+    }
+
+    if ((iBits == 8) && (uCode >= 0x30) && (uCode <= 0xBF))
+    {
+      return uCode - 0x30;
+    }
+
+    if ((iBits == 8) && (uCode >= 0xC0) && (uCode <= 0xC7))
+    {
+      return 280 + (uCode - 0xC0);
+    }
+
+    if ((iBits == 9) && (uCode >= 0x190))
+    {
+      return 144 + (uCode - 0x190);
+    }
+  }
+
+  return -1;
+}
+
+// Inflate decodes a zlib stream of fixed Huffman blocks, which is what the
+// exporter writes, and checks its Adler-32. It returns false on any other
+// stream.
+
+static bool Inflate(const string& stStream, string& stData)
+{
+  static const int lengthBaseArray[29] =
+    {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+     59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const int lengthBitsArray[29] =
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+     5, 5, 5, 5, 0};
+  static const int distanceBaseArray[30] =
+    {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+     513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+     24577};
+
+  if ((stStream.size() < 6) || (stStream[0] != 0x78))
+  {
+    return false;
+  }
+
+  BitReader reader(stStream, 2);
+  bool bFinal = false;
+
+  while (!bFinal)
+  {
+    bFinal = (reader.Read(1) == 1);
+
+    if (reader.Read(2) != 1)
+    {
+      return false;
+    }
+
+    while (true)
+    {
+      int iSymbol = ReadFixedSymbol(reader);
+
+      if ((iSymbol < 0) || (iSymbol > 285))
+      {
+        return false;
+      }
+
+      if (iSymbol < 256)
+      {
+        stData += (char) iSymbol;
+        continue;
+      }
+
+      if (iSymbol == 256)
+      {
+        break;
+      }
+
+      int iCode = iSymbol - 257;
+      int iLength = lengthBaseArray[iCode] +
+                    (int) reader.Read(lengthBitsArray[iCode]);
+
+      unsigned int uDistanceCode = 0;
+      for (int iBit = 0; iBit < 5; ++iBit)
+      {
+        uDistanceCode = (uDistanceCode << 1) | reader.Read(1);
+      }
+
+      if (uDistanceCode >= 30)
+      {
+        return false;
+      }
+
+      int iDistance = distanceBaseArray[uDistanceCode] +
+                      (int) reader.Read(max(0, ((int) uDistanceCode / 2) - 1));
+
+      if (iDistance > (int) stData.size())
+      {
+        return false;
+      }
+
+      for (int iCopy = 0; iCopy < iLength; ++iCopy)
+      {
+        stData += stData[stData.size() - iDistance];
+      }
+    }
+  }
+
+  unsigned long uLow = 1, uHigh = 0;
+  for (char cByte : stData)
+  {
+    uLow = (uLow + (unsigned char) cByte) % 65521;
+    uHigh = (uHigh + uLow) % 65521;
+  }
+
+  size_t iAdler = reader.GetBytePosition();
+  return ((iAdler + 4) <= stStream.size()) &&
+         (ReadBigEndian(stStream, iAdler) == ((uHigh << 16) | uLow));
+}
+
+// A page is rendered with ink on the lines and paper in the margins. The
+// PPM file holds each gray pixel three times. The chunks of the PNG file
+// have correct checksums, and its decompressed scanlines are the pixels of
+// the page, each preceded by the filter type none.
+
+static void TestPageImage()
+{
+  LayoutDocument document;
+  MakeDocument(document, 3, "lorem ipsum dolor", LAYOUT_ALIGN_LEFT);
+
+  PageImage image(72);
+  image.Render(document, 0);
+
+  int iWidth = image.GetWidth(), iHeight = image.GetHeight();
+  const vector<unsigned char>& pixelArray = image.GetPixels();
+  CHECK((iWidth == 595) && (iHeight == 841));
+  CHECK(count(pixelArray.begin(), pixelArray.end(), IMAGE_INK) > 0);
+
+  int iMargin = LAYOUT_PAGE_MARGIN * 72 / 2540;
+  CHECK(all_of(pixelArray.begin(), pixelArray.begin() + iMargin * iWidth,
+               [](unsigned char bPixel) {return bPixel == IMAGE_PAPER;}));
+
+  string stPpm;
+  image.WritePpm(stPpm);
+  string stHeader = "P6\n595 841\n255\n";
+  CHECK(stPpm.compare(0, stHeader.size(), stHeader) == 0);
+  CHECK(stPpm.size() == (stHeader.size() + 3 * pixelArray.size()));
+  CHECK((unsigned char) stPpm[stHeader.size() + 3 * (pixelArray.size() - 1)]
+        == pixelArray.back());
+
+  string stPng;
+  image.WritePng(stPng);
+  CHECK(stPng.compare(0, 8, "\x89PNG\r\n\x1A\n") == 0);
+
+  string stStream, stTypes;
+  size_t iChunk = 8;
+  while ((iChunk + 12) <= stPng.size())
+  {
+    size_t iLength = ReadBigEndian(stPng, iChunk);
+    string stType = stPng.substr(iChunk + 4, 4);
+    string stChunk = stPng.substr(iChunk + 4, 4 + iLength);
+    CHECK(CalculateCrc(stChunk) == ReadBigEndian(stPng, iChunk + 8 + iLength));
+
+    if (stType == "IHDR")
+    {
+      CHECK((ReadBigEndian(stChunk, 4) == (unsigned long) iWidth) &&
+            (ReadBigEndian(stChunk, 8) == (unsigned long) iHeight));
+    }
+
+    else if (stType == "IDAT")
+    {
+      stStream += stChunk.substr(4);
+    }
+
+    stTypes += stType;
+    iChunk += 12 + iLength;
+  }
+
+  CHECK(stTypes == "IHDRIDATIEND");
+  CHECK(iChunk == stPng.size());
+
+  string stScanlines;
+  CHECK(Inflate(stStream, stScanlines));
+  CHECK(stScanlines.size() == (size_t) (iWidth + 1) * iHeight);
+
+  bool bEqual = (stScanlines.size() == (size_t) (iWidth + 1) * iHeight);
+  for (int yRow = 0; bEqual && (yRow < iHeight); ++yRow)
+  {
+    const char* pRow = stScanlines.data() + (size_t) yRow * (iWidth + 1);
+    bEqual = (pRow[0] == 0) &&
+             equal(pixelArray.begin() + (size_t) yRow * iWidth,
+                   pixelArray.begin() + (size_t) (yRow + 1) * iWidth,
+                   (const unsigned char*) pRow + 1);
+  }
+
+  CHECK(bEqual);
+}
+
+// A PDF file of several pages has one page object for each page, and every
+// entry of its cross reference table gives the position of its object.
+// Parentheses and backslashes are escaped, and characters outside the
+// Latin-1 encoding become question marks.
+
+static void TestPdf()
+{
+  LayoutDocument document;
+  MakeDocument(document, 200, "a(b)\\c \xE2\x82\xAC", LAYOUT_ALIGN_LEFT);
+  CHECK(document.GetPageCount() > 1);
+
+  PdfWriter writer;
+  CHECK(writer.Open("LayoutTest.pdf"));
+
+  for (int iPage = 0; iPage < document.GetPageCount(); ++iPage)
+  {
+    string stContent;
+    PdfWriter::RenderPage(document, iPage, stContent);
+    CHECK(stContent.find("(a\\(b\\)\\\\c) Tj") != string::npos);
+    CHECK(stContent.find("(?) Tj") != string::npos);
+    CHECK(writer.WritePage(stContent));
+  }
+
+  CHECK(writer.Close());
+
+  ifstream inStream("LayoutTest.pdf", ios::in | ios::binary);
+  string stPdf((istreambuf_iterator<char>(inStream)),
+               istreambuf_iterator<char>());
+  CHECK(stPdf.compare(0, 9, "%PDF-1.4\n") == 0);
+  CHECK(stPdf.find("/Count " + to_string(document.GetPageCount())) !=
+        string::npos);
+
+  size_t iStartXref = stPdf.rfind("startxref\n");
+  CHECK(iStartXref != string::npos);
+  if (iStartXref == string::npos)
+  {
+    return;
+  }
+
+  size_t iXref = stoul(stPdf.substr(iStartXref + 10));
+  CHECK(stPdf.compare(iXref, 5, "xref\n") == 0);
+
+  size_t iCountStart = iXref + 7;
+  int iObjects = stoi(stPdf.substr(iCountStart));
+  size_t iEntry = stPdf.find('\n', iCountStart) + 1 + 20;
+  CHECK(iObjects == (PDF_FONTS + 4 + 2 * document.GetPageCount()));
+
+  for (int iObject = 1; iObject < iObjects; ++iObject, iEntry += 20)
+  {
+    size_t iOffset = stoul(stPdf.substr(iEntry, 10));
+    string stObject = to_string(iObject) + " 0 obj\n";
+    CHECK(stPdf.compare(iOffset, stObject.size(), stObject) == 0);
+  }
+
+  remove("LayoutTest.pdf");
+}
+
+// RenderPages writes the pages in order however the threads finish them,
+// and stops at the first page that cannot be written.
+
+static void TestRenderPages()
+{
+  auto renderPage = [](int iPage, string& stPage)
+  {
+    stPage = to_string(iPage * iPage);
+  };
+
+  int iWritten = 0;
+  bool bInOrder = true;
+  auto writePage = [&](int iPage, const string& stPage)
+  {
+    bInOrder = bInOrder && (iPage == iWritten) &&
+               (stPage == to_string(iPage * iPage));
+    ++iWritten;
+    return true;
+  };
+
+  CHECK(RenderPages(500, 4, renderPage, writePage));
+  CHECK(bInOrder && (iWritten == 500));
+
+  iWritten = 0;
+  CHECK(RenderPages(0, 4, renderPage, writePage));
+  CHECK(iWritten == 0);
+
+  auto failPage = [&](int iPage, const string&)
+  {
+    ++iWritten;
+    return iPage < 10;
+  };
+
+  CHECK(!RenderPages(500, 4, renderPage, failPage));
+  CHECK(iWritten == 11);
+}
+
+int main()
+{
+  TestBreakLine();
+  TestClusters();
+  TestBreakPage();
+  TestDocument();
+  TestRunLengths();
+  TestPlacement();
+  TestPageImage();
+  TestPdf();
+  TestRenderPages();
+
+  if (g_iFailures == 0)
+  {
+    cout << "LayoutTest: all checks passed" << endl;
+  }
+
+  return g_iFailures;
+}
@@ -0,0 +1,234 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#ifdef WORD_LAYOUT_QT
+#include <QGuiApplication>
+#include <QFontMetrics>
+#endif
+
+#include "FontMetrics.h"
+#include "TableMetrics.h"
+#include "WordReader.h"
+#include "LayoutDocument.h"
+#include "PageImage.h"
+#include "PdfWriter.h"
+#include "PageExport.h"
+
+#ifdef WORD_LAYOUT_QT
+#include "QtMetrics.h"
+#endif
+
+// WordLayout lays out and paginates Word files without a window, and writes
+// the number of paragraphs, lines, and pages of each file, as well as its
+// height in logical units. The characters are measured by the table of
+// TableMetrics, or by the fonts of Qt if the -qt option is given.
+
+// The -pdf option exports each file to a PDF file, and the -png and -ppm
+// options to an image file for each page, next to the file. The pages are
+// rendered on the number of threads given by -threads, by default one for
+// each processor, and the images at the resolution given by -dpi. The
+// number of pages rendered per second is written after each export, which
+// allows the speed to be compared for different numbers of threads. It
+// returns zero if every file could be read and exported.
+
+enum ExportFormat {EXPORT_NONE, EXPORT_PDF, EXPORT_PNG, EXPORT_PPM};
+
+// ExportImages writes each page of a document to a file named after the
+// Word file and the page number, such as Report.word-0001.png.
+
+static bool ExportImages(const LayoutDocument& document, const string& stPath,
+                         ExportFormat eFormat, int iResolution, int iThreads)
+{
+  auto renderPage = [&](int iPage, string& stImage)
+  {
+    PageImage image(iResolution);
+    image.Render(document, iPage);
+
+    if (eFormat == EXPORT_PNG)
+    {
+      image.WritePng(stImage);
+    }
+
+    else
+    {
+      image.WritePpm(stImage);
+    }
+  };
+
+  auto writePage = [&](int iPage, const string& stImage)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof buffer, "-%04d.%s", iPage + 1,
+             (eFormat == EXPORT_PNG) ? "png" : "ppm");
+
+    ofstream outStream(stPath + buffer, ios::binary);
+    outStream.write(stImage.data(), stImage.size());
+    return (bool) outStream;
+  };
+
+  return RenderPages(document.GetPageCount(), iThreads, renderPage,
+                     writePage);
+}
+
+static bool ExportPdf(const LayoutDocument& document, const string& stPath,
+                      int iThreads)
+{
+  PdfWriter writer;
+
+  if (!writer.Open(stPath + ".pdf"))
+  {
+    return false;
+  }
+
+  auto renderPage = [&](int iPage, string& stContent)
+  {
+    PdfWriter::RenderPage(document, iPage, stContent);
+  };
+
+  auto writePage = [&](int, const string& stContent)
+  {
+    return writer.WritePage(stContent);
+  };
+
+  bool bWritten = RenderPages(document.GetPageCount(), iThreads, renderPage,
+                              writePage);
+  return writer.Close() && bWritten;
+}
+
+int main(int argc, char* argv[])
+{
+  bool bQt = false;
+  ExportFormat eFormat = EXPORT_NONE;
+  int iThreads = max(1, (int) thread::hardware_concurrency());
+  int iResolution = IMAGE_DEFAULT_RESOLUTION;
+  vector<string> pathArray;
+
+  for (int iArg = 1; iArg < argc; ++iArg)
+  {
+    string stArg = argv[iArg];
+
+    if (stArg == "-qt")
+    {
+      bQt = true;
+    }
+
+    else if (stArg == "-pdf")
+    {
+      eFormat = EXPORT_PDF;
+    }
+
+    else if (stArg == "-png")
+    {
+      eFormat = EXPORT_PNG;
+    }
+
+    else if (stArg == "-ppm")
+    {
+      eFormat = EXPORT_PPM;
+    }
+
+    else if ((stArg == "-threads") && ((iArg + 1) < argc))
+    {
+      iThreads = max(1, atoi(argv[++iArg]));
+    }
+
+    else if ((stArg == "-dpi") && ((iArg + 1) < argc))
+    {
+      iResolution = max(1, atoi(argv[++iArg]));
+    }
+
+    else
+    {
+      pathArray.push_back(stArg);
+    }
+  }
+
+  if (pathArray.empty())
+  {
+    cerr << "Usage: WordLayout [-qt] [-pdf | -png | -ppm] [-threads n] "
+            "[-dpi n] file..." << endl;
+    return 2;
+  }
+
+  unique_ptr<FontMetrics> pMetrics;
+
+  // The Qt fonts need an application object, which the offscreen platform
+  // lets us create without a display.
+
+#ifdef WORD_LAYOUT_QT
+  unique_ptr<QGuiApplication> pApplication;
+
+  if (bQt)
+  {
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    pApplication.reset(new QGuiApplication(argc, argv));
+    pMetrics.reset(new QtMetrics());
+  }
+#else
+  if (bQt)
+  {
+    cerr << "WordLayout was built without Qt." << endl;
+    return 2;
+  }
+#endif
+
+  if (!pMetrics)
+  {
+    pMetrics.reset(new TableMetrics());
+  }
+
+  int iResult = 0;
+  for (const string& stPath : pathArray)
+  {
+    LayoutDocument document;
+
+    if (!document.Load(stPath))
+    {
+      cerr << stPath << ": not a readable Word file" << endl;
+      iResult = 1;
+      continue;
+    }
+
+    document.LayOut(*pMetrics);
+    cout << stPath << ": " << document.GetParagraphCount()
+         << " paragraphs, " << document.GetLineCount() << " lines, "
+         << document.GetPageCount() << " pages, height "
+         << document.GetHeight() << endl;
+
+    if (eFormat == EXPORT_NONE)
+    {
+      continue;
+    }
+
+    auto start = chrono::steady_clock::now();
+    bool bExported = (eFormat == EXPORT_PDF)
+                     ? ExportPdf(document, stPath, iThreads)
+                     : ExportImages(document, stPath, eFormat, iResolution,
+                                    iThreads);
+    double dSeconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                               start).count();
+
+    if (!bExported)
+    {
+      cerr << stPath << ": could not be exported" << endl;
+      iResult = 1;
+      continue;
+    }
+
+    cout << stPath << ": " << document.GetPageCount() << " pages exported in "
+         << (int) (dSeconds * 1000) << " ms, "
+         << (int) (document.GetPageCount() / max(dSeconds, 1e-6))
+         << " pages/s on " << iThreads << " threads" << endl;
+  }
+
+  return iResult;
+}
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "PageExport.h"
+
+// The rendered pages are kept in a ring of slots, one for each page that
+// may be rendered ahead. A thread takes the next page only when its slot
+// has been written, and the calling thread waits for the slot of the page
+// to write to be filled. The strings are swapped in and out of the slots,
+// so that a page is never copied.
+
+bool RenderPages(int iPages, int iThreads,
+                 const function<void(int, string&)>& renderPage,
+                 const function<bool(int, const string&)>& writePage)
+{
+  iThreads = max(1, min(iThreads, iPages));
+  int iWindow = 2 * iThreads;
+
+  vector<string> slotArray(iWindow);
+  vector<bool> readyArray(iWindow, false);
+  mutex pageMutex;
+  condition_variable renderedCondition, writtenCondition;
+  int iNextPage = 0, iWritten = 0;
+  bool bStopped = false;
+
+  auto renderPages = [&]()
+  {
+    while (true)
+    {
+      int iPage;
+
+      {
+        unique_lock<mutex> lock(pageMutex);
+        writtenCondition.wait(lock, [&]() {return bStopped ||
+                                                  (iNextPage >= iPages) ||
+                                                  (iNextPage <
+                                                   (iWritten + iWindow));});
+
+        if (bStopped || (iNextPage >= iPages))
+        {
+          return;
+        }
+
+        iPage = iNextPage++;
+      }
+
+      string stPage;
+      renderPage(iPage, stPage);
+
+      {
+        lock_guard<mutex> lock(pageMutex);
+        slotArray[iPage % iWindow].swap(stPage);
+        readyArray[iPage % iWindow] = true;
+      }
+
+      renderedCondition.notify_all();
+    }
+  };
+
+  vector<thread> threadArray;
+  for (int iThread = 0; iThread < iThreads; ++iThread)
+  {
+    threadArray.push_back(thread(renderPages));
+  }
+
+  bool bWritten = true;
+  for (int iPage = 0; (iPage < iPages) && bWritten; ++iPage)
+  {
+    string stPage;
+
+    {
+      unique_lock<mutex> lock(pageMutex);
+      renderedCondition.wait(lock, [&]()
+                             {return readyArray[iPage % iWindow];});
+      stPage.swap(slotArray[iPage % iWindow]);
+      readyArray[iPage % iWindow] = false;
+    }
+
+    bWritten = writePage(iPage, stPage);
+
+    {
+      lock_guard<mutex> lock(pageMutex);
+      ++iWritten;
+      bStopped = !bWritten;
+    }
+
+    writtenCondition.notify_all();
+  }
+
+  for (thread& renderThread : threadArray)
+  {
+    renderThread.join();
+  }
+
+  return bWritten;
+}
@@ -0,0 +1,13 @@
+// RenderPages renders the pages of a document on a number of threads and
+// writes them in order. The renderPage function renders a page into a
+// string, and is called on the threads at once, so it must only read
+// shared data. The writePage function is called on the calling thread, one
+// page at a time from the first page to the last, and returns false if the
+// page could not be written, which stops the rendering. At most twice as
+// many pages as there are threads are rendered ahead of the page being
+// written, which keeps the memory bounded for documents of any length.
+// RenderPages returns true if every page was written.
+
+bool RenderPages(int iPages, int iThreads,
+                 const function<void(int, string&)>& renderPage,
+                 const function<bool(int, const string&)>& writePage);
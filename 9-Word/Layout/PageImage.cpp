@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "FontMetrics.h"
+#include "WordReader.h"
+#include "LayoutDocument.h"
+#include "PageImage.h"
+
+PageImage::PageImage(int iResolution /* = IMAGE_DEFAULT_RESOLUTION */)
+ :m_iResolution(max(iResolution, 1)),
+  m_iWidth(0),
+  m_iHeight(0)
+{
+  m_iWidth = ToPixels(LAYOUT_PAGE_TOTALWIDTH);
+  m_iHeight = ToPixels(LAYOUT_PAGE_TOTALHEIGHT);
+}
+
+// ToPixels converts logical units, which are hundredths of millimeters,
+// into pixels at the resolution of the image.
+
+int PageImage::ToPixels(int iLogical) const
+{
+  return (int) ((long long) iLogical * m_iResolution / 2540);
+}
+
+// Render draws the paragraphs of the page, which follow each other from the
+// top of the printable area. A bar is at least one pixel in each direction,
+// so that small text does not vanish at low resolutions.
+
+void PageImage::Render(const LayoutDocument& document, int iPage)
+{
+  m_pixelArray.assign((size_t) m_iWidth * m_iHeight, IMAGE_PAPER);
+
+  const LayoutPage& page = document.GetPages()[iPage];
+  int yPageTop = document.GetTop(page.iFirstParagraph);
+
+  for (int iParagraph = page.iFirstParagraph;
+       iParagraph <= page.iLastParagraph; ++iParagraph)
+  {
+    const LayoutParagraph& paragraph = document.GetParagraphs()[iParagraph];
+    const u16string& stText = paragraph.GetText();
+    const vector<LayoutSize>& sizeArray = paragraph.GetSizes();
+    const vector<int>& xArray = paragraph.GetPositions();
+    int yTop = LAYOUT_PAGE_MARGIN + document.GetTop(iParagraph) - yPageTop;
+
+    for (const LayoutLine& line : paragraph.GetLines())
+    {
+      int yBaseline = yTop + line.iTop + line.iAscent;
+
+      for (int iChar = line.iFirstChar;
+           (iChar <= line.iLastChar) && (iChar < paragraph.GetLength());
+           ++iChar)
+      {
+        if ((stText[iChar] == u' ') || (sizeArray[iChar].cx == 0))
+        {
+          continue;
+        }
+
+        int xLeft = LAYOUT_PAGE_MARGIN + xArray[iChar];
+        int iWidth = sizeArray[iChar].cx, iBar = sizeArray[iChar].cy / 2;
+        int xPixel = ToPixels(xLeft), yPixel = ToPixels(yBaseline);
+
+        FillRect(xPixel, min(ToPixels(yBaseline - iBar), yPixel - 1),
+                 max(ToPixels(xLeft + iWidth * 7 / 8), xPixel + 1), yPixel);
+      }
+    }
+  }
+}
+
+void PageImage::FillRect(int xLeft, int yTop, int xRight, int yBottom)
+{
+  xLeft = max(xLeft, 0);
+  yTop = max(yTop, 0);
+  xRight = min(xRight, m_iWidth);
+  yBottom = min(yBottom, m_iHeight);
+
+  for (int yRow = yTop; yRow < yBottom; ++yRow)
+  {
+    unsigned char* pRow = m_pixelArray.data() + (size_t) yRow * m_iWidth;
+
+    for (int xColumn = xLeft; xColumn < xRight; ++xColumn)
+    {
+      pRow[xColumn] = IMAGE_INK;
+    }
+  }
+}
+
+// WritePpm appends the image in the binary portable pixmap format, with
+// each gray pixel repeated for red, green, and blue.
+
+void PageImage::WritePpm(string& stOutput) const
+{
+  stOutput += "P6\n" + to_string(m_iWidth) + " " + to_string(m_iHeight) +
+              "\n255\n";
+
+  size_t iStart = stOutput.size();
+  stOutput.resize(iStart + 3 * m_pixelArray.size());
+
+  for (size_t iPixel = 0; iPixel < m_pixelArray.size(); ++iPixel)
+  {
+    char cGray = (char) m_pixelArray[iPixel];
+    stOutput[iStart + 3 * iPixel] = cGray;
+    stOutput[iStart + 3 * iPixel + 1] = cGray;
+    stOutput[iStart + 3 * iPixel + 2] = cGray;
+  }
+}
+
+// The PNG format needs a CRC-32 of each chunk and a zlib stream of the
+// scanlines. The stream is compressed by a small deflate encoder with the
+// fixed Huffman codes, which only repeats the previous byte. As a page is
+// mostly runs of paper and ink, that is enough to shrink it to a few
+// percent of its raw size, without depending on zlib.
+
+static vector<unsigned long> CreateCrcTable()
+{
+  vector<unsigned long> crcArray(256);
+
+  for (unsigned long uIndex = 0; uIndex < 256; ++uIndex)
+  {
+    unsigned long uCrc = uIndex;
+
+    for (int iBit = 0; iBit < 8; ++iBit)
+    {
+      uCrc = (uCrc & 1) ? (0xEDB88320UL ^ (uCrc >> 1)) : (uCrc >> 1);
+    }
+
+    crcArray[uIndex] = uCrc;
+  }
+
+  return crcArray;
+}
+
+// The table is created the first time it is needed, which the language
+// guarantees to happen once even if several threads need it at once.
+
+static unsigned long CalculateCrc(const string& stData, size_t iStart)
+{
+  static const vector<unsigned long> crcArray = CreateCrcTable();
+
+  unsigned long uCrc = 0xFFFFFFFFUL;
+  for (size_t iIndex = iStart; iIndex < stData.size(); ++iIndex)
+  {
+    uCrc = crcArray[(uCrc ^ (unsigned char) stData[iIndex]) & 0xFF] ^
+           (uCrc >> 8);
+  }
+
+  return uCrc ^ 0xFFFFFFFFUL;
+}
+
+static void AppendBigEndian(string& stOutput, unsigned long uValue)
+{
+  stOutput += (char) ((uValue >> 24) & 0xFF);
+  stOutput += (char) ((uValue >> 16) & 0xFF);
+  stOutput += (char) ((uValue >> 8) & 0xFF);
+  stOutput += (char) (uValue & 0xFF);
+}
+
+static void AppendChunk(string& stOutput, const char* pType,
+                        const string& stData)
+{
+  AppendBigEndian(stOutput, (unsigned long) stData.size());
+  size_t iStart = stOutput.size();
+  stOutput.append(pType, 4);
+  stOutput += stData;
+  AppendBigEndian(stOutput, CalculateCrc(stOutput, iStart));
+}
+
+// A BitWriter writes the bits of a deflate stream, the least significant
+// bit of each byte first. The Huffman codes are written with their most
+// significant bit first, and are therefore reversed.
+
+class BitWriter
+{
+  public:
+    BitWriter(string& stOutput) :m_stOutput(stOutput), m_uBits(0),
+                                 m_iCount(0) {}
+
+    void Write(unsigned int uValue, int iBits);
+    void WriteCode(unsigned int uCode, int iBits);
+    void Flush();
+
+  private:
+    string& m_stOutput;
+    unsigned int m_uBits;
+    int m_iCount;
+};
+
+void BitWriter::Write(unsigned int uValue, int iBits)
+{
+  m_uBits |= uValue << m_iCount;
+  m_iCount += iBits;
+
+  while (m_iCount >= 8)
+  {
+    m_stOutput += (char) (m_uBits & 0xFF);
+    m_uBits >>= 8;
+    m_iCount -= 8;
+  }
+}
+
+void BitWriter::WriteCode(unsigned int uCode, int iBits)
+{
+  unsigned int uReversed = 0;
+
+  for (int iBit = 0; iBit < iBits; ++iBit)
+  {
+    uReversed = (uReversed << 1) | ((uCode >> iBit) & 1);
+  }
+
+  Write(uReversed, iBits);
+}
+
+void BitWriter::Flush()
+{
+  if (m_iCount > 0)
+  {
+    m_stOutput += (char) (m_uBits & 0xFF);
+    m_uBits = 0;
+    m_iCount = 0;
+  }
+}
+
+// WriteSymbol writes a literal byte or a length code with the fixed Huffman
+// codes of deflate.
+
+static void WriteSymbol(BitWriter& writer, int iSymbol)
+{
+  if (iSymbol < 144)
+  {
+    writer.WriteCode(0x30 + iSymbol, 8);
+  }
+
+  else if (iSymbol < 256)
+  {
+    writer.WriteCode(0x190 + (iSymbol - 144), 9);
+  }
+
+  else if (iSymbol < 280)
+  {
+    writer.WriteCode(iSymbol - 256, 7);
+  }
+
+  else
+  {
+    writer.WriteCode(0xC0 + (iSymbol - 280), 8);
+  }
+}
+
+// WriteRepeat writes a match of the given length, from 3 to 258, at
+// distance one, which repeats the previous byte.
+
+static void WriteRepeat(BitWriter& writer, int iLength)
+{
+  static const int lengthBaseArray[29] =
+    {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+     59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const int lengthBitsArray[29] =
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+     5, 5, 5, 5, 0};
+
+  int iCode = 28;
+  while (lengthBaseArray[iCode] > iLength)
+  {
+    --iCode;
+  }
+
+  WriteSymbol(writer, 257 + iCode);
+  writer.Write(iLength - lengthBaseArray[iCode], lengthBitsArray[iCode]);
+  writer.WriteCode(0, 5);
+}
+
+static string Deflate(const string& stData)
+{
+  string stOutput;
+  stOutput += (char) 0x78;
+  stOutput += (char) 0x01;
+
+  BitWriter writer(stOutput);
+  writer.Write(1, 1);
+  writer.Write(1, 2);
+
+  size_t iIndex = 0, iSize = stData.size();
+  while (iIndex < iSize)
+  {
+    unsigned char bByte = (unsigned char) stData[iIndex];
+    WriteSymbol(writer, bByte);
+
+    size_t iRun = iIndex + 1;
+    while ((iRun < iSize) && ((unsigned char) stData[iRun] == bByte))
+    {
+      ++iRun;
+    }
+
+    // The repeats of the byte are written as matches, except for a tail
+    // too short for a match, which is written as literals.
+
+    size_t iRepeats = iRun - iIndex - 1;
+    while (iRepeats >= 3)
+    {
+      int iLength = (int) min<size_t>(iRepeats, 258);
+
+      if ((iRepeats - iLength) > 0 && (iRepeats - iLength) < 3)
+      {
+        iLength -= 3;
+      }
+
+      WriteRepeat(writer, iLength);
+      iRepeats -= iLength;
+    }
+
+    for (; iRepeats > 0; --iRepeats)
+    {
+      WriteSymbol(writer, bByte);
+    }
+
+    iIndex = iRun;
+  }
+
+  WriteSymbol(writer, 256);
+  writer.Flush();
+
+  unsigned long uLow = 1, uHigh = 0;
+  for (size_t iByte = 0; iByte < iSize; ++iByte)
+  {
+    uLow = (uLow + (unsigned char) stData[iByte]) % 65521;
+    uHigh = (uHigh + uLow) % 65521;
+  }
+
+  AppendBigEndian(stOutput, (uHigh << 16) | uLow);
+  return stOutput;
+}
+
+// WritePng appends the image as an 8-bit grayscale PNG file. Each scanline
+// is preceded by the filter type none.
+
+void PageImage::WritePng(string& stOutput) const
+{
+  static const char PNG_SIGNATURE[] = "\x89PNG\r\n\x1A\n";
+  stOutput.append(PNG_SIGNATURE, 8);
+
+  string stHeader;
+  AppendBigEndian(stHeader, m_iWidth);
+  AppendBigEndian(stHeader, m_iHeight);
+  stHeader += (char) 8;
+  stHeader.append(4, (char) 0);
+  AppendChunk(stOutput, "IHDR", stHeader);
+
+  string stScanlines;
+  stScanlines.reserve((size_t) (m_iWidth + 1) * m_iHeight);
+
+  for (int yRow = 0; yRow < m_iHeight; ++yRow)
+  {
+    stScanlines += (char) 0;
+    stScanlines.append((const char*) m_pixelArray.data() +
+                       (size_t) yRow * m_iWidth, m_iWidth);
+  }
+
+  AppendChunk(stOutput, "IDAT", Deflate(stScanlines));
+  AppendChunk(stOutput, "IEND", string());
+}
@@ -0,0 +1,33 @@
+const int IMAGE_DEFAULT_RESOLUTION = 96;
+const unsigned char IMAGE_PAPER = 255;
+const unsigned char IMAGE_INK = 64;
+
+// A PageImage is a grayscale raster of one page of a laid out document. As
+// the layout engine has no glyph outlines, the characters are rendered
+// greeked: each visible character becomes a bar from the baseline up to
+// about the height of its lower case letters, as wide as the character
+// less a small gap. This shows the lines, words, alignment, and fonts of
+// the pages exactly as they are laid out. The resolution is given in
+// pixels per inch.
+
+class PageImage
+{
+  public:
+    PageImage(int iResolution = IMAGE_DEFAULT_RESOLUTION);
+
+    void Render(const LayoutDocument& document, int iPage);
+
+    int GetWidth() const {return m_iWidth;}
+    int GetHeight() const {return m_iHeight;}
+    const vector<unsigned char>& GetPixels() const {return m_pixelArray;}
+
+    void WritePpm(string& stOutput) const;
+    void WritePng(string& stOutput) const;
+
+  private:
+    int ToPixels(int iLogical) const;
+    void FillRect(int xLeft, int yTop, int xRight, int yBottom);
+
+    int m_iResolution, m_iWidth, m_iHeight;
+    vector<unsigned char> m_pixelArray;
+};
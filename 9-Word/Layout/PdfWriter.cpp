@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "FontMetrics.h"
+#include "WordReader.h"
+#include "LayoutDocument.h"
+#include "PdfWriter.h"
+
+// The numbers of the objects written before the first page. The content
+// stream and the page object of page i are numbered PDF_FIRST_PAGE + 2i
+// and PDF_FIRST_PAGE + 2i + 1.
+
+const int PDF_CATALOG = 1;
+const int PDF_PAGES = 2;
+const int PDF_FIRST_FONT = 3;
+const int PDF_RESOURCES = PDF_FIRST_FONT + PDF_FONTS;
+const int PDF_FIRST_PAGE = PDF_RESOURCES + 1;
+
+// The standard fonts, four variants of each family: regular, bold, italic,
+// and bold italic.
+
+static const char* FontNameArray[PDF_FONTS] =
+  {"Times-Roman", "Times-Bold", "Times-Italic", "Times-BoldItalic",
+   "Helvetica", "Helvetica-Bold", "Helvetica-Oblique",
+   "Helvetica-BoldOblique", "Courier", "Courier-Bold", "Courier-Oblique",
+   "Courier-BoldOblique"};
+
+PdfWriter::PdfWriter()
+ :m_pFile(nullptr),
+  m_bFailed(false),
+  m_lPosition(0),
+  m_iPages(0)
+{
+  // Empty.
+}
+
+PdfWriter::~PdfWriter()
+{
+  if (m_pFile != nullptr)
+  {
+    fclose(m_pFile);
+  }
+}
+
+// ToPoints converts logical units, which are hundredths of millimeters,
+// into the points of the PDF coordinate system.
+
+string PdfWriter::ToPoints(int iLogical)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof buffer, "%.2f", iLogical * 72.0 / 2540);
+  return buffer;
+}
+
+void PdfWriter::Write(const string& stText)
+{
+  if (!m_bFailed &&
+      (fwrite(stText.data(), 1, stText.size(), m_pFile) != stText.size()))
+  {
+    m_bFailed = true;
+  }
+
+  m_lPosition += (long long) stText.size();
+}
+
+void PdfWriter::WriteObject(int iObject, const string& stBody)
+{
+  if ((int) m_offsetArray.size() <= iObject)
+  {
+    m_offsetArray.resize(iObject + 1, 0);
+  }
+
+  m_offsetArray[iObject] = m_lPosition;
+  Write(to_string(iObject) + " 0 obj\n" + stBody + "\nendobj\n");
+}
+
+// Open creates the file and writes the header, the fonts, and the resources
+// that every page refers to. The comment of the second line marks the file
+// as binary, as recommended by the PDF specification.
+
+bool PdfWriter::Open(const string& stPath)
+{
+  m_pFile = fopen(stPath.c_str(), "wb");
+
+  if (m_pFile == nullptr)
+  {
+    return false;
+  }
+
+  Write("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+
+  string stFonts;
+  for (int iFont = 0; iFont < PDF_FONTS; ++iFont)
+  {
+    WriteObject(PDF_FIRST_FONT + iFont,
+                string("<< /Type /Font /Subtype /Type1 /BaseFont /") +
+                FontNameArray[iFont] + " /Encoding /WinAnsiEncoding >>");
+    stFonts += " /F" + to_string(iFont) + " " +
+               to_string(PDF_FIRST_FONT + iFont) + " 0 R";
+  }
+
+  WriteObject(PDF_RESOURCES, "<< /Font <<" + stFonts + " >> >>");
+  return !m_bFailed;
+}
+
+// WritePage writes the content stream of the next page, as made by
+// RenderPage, followed by its page object.
+
+bool PdfWriter::WritePage(const string& stContent)
+{
+  int iContent = PDF_FIRST_PAGE + 2 * m_iPages;
+
+  WriteObject(iContent, "<< /Length " + to_string(stContent.size()) +
+                        " >>\nstream\n" + stContent + "\nendstream");
+  WriteObject(iContent + 1, "<< /Type /Page /Parent " +
+              to_string(PDF_PAGES) + " 0 R /MediaBox [0 0 " +
+              ToPoints(LAYOUT_PAGE_TOTALWIDTH) + " " +
+              ToPoints(LAYOUT_PAGE_TOTALHEIGHT) + "] /Resources " +
+              to_string(PDF_RESOURCES) + " 0 R /Contents " +
+              to_string(iContent) + " 0 R >>");
+
+  ++m_iPages;
+  return !m_bFailed;
+}
+
+// Close writes the page tree, the catalog, the cross reference table, and
+// the trailer, and closes the file. Each entry of the cross reference table
+// is exactly 20 bytes long, including its end of line.
+
+bool PdfWriter::Close()
+{
+  string stKids;
+  for (int iPage = 0; iPage < m_iPages; ++iPage)
+  {
+    stKids += (iPage > 0) ? " " : "";
+    stKids += to_string(PDF_FIRST_PAGE + 2 * iPage + 1) + " 0 R";
+  }
+
+  WriteObject(PDF_PAGES, "<< /Type /Pages /Kids [" + stKids +
+                         "] /Count " + to_string(m_iPages) + " >>");
+  WriteObject(PDF_CATALOG, "<< /Type /Catalog /Pages " +
+                           to_string(PDF_PAGES) + " 0 R >>");
+
+  long long lCrossReference = m_lPosition;
+  int iObjects = (int) m_offsetArray.size();
+
+  string stTable = "xref\n0 " + to_string(iObjects) +
+                   "\n0000000000 65535 f \n";
+  for (int iObject = 1; iObject < iObjects; ++iObject)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof buffer, "%010lld 00000 n \n",
+             m_offsetArray[iObject]);
+    stTable += buffer;
+  }
+
+  stTable += "trailer\n<< /Size " + to_string(iObjects) + " /Root " +
+             to_string(PDF_CATALOG) + " 0 R >>\nstartxref\n" +
+             to_string(lCrossReference) + "\n%%EOF\n";
+  Write(stTable);
+
+  bool bClosed = (fclose(m_pFile) == 0);
+  m_pFile = nullptr;
+  return bClosed && !m_bFailed;
+}
+
+// GetFont returns the number of the standard font that comes closest to a
+// style. Fixed pitch faces are set in Courier, faces with Times in their
+// name in Times, and every other face in Helvetica.
+
+int PdfWriter::GetFont(const LayoutStyle& style)
+{
+  string stFaceName = style.stFaceName;
+  transform(stFaceName.begin(), stFaceName.end(), stFaceName.begin(),
+            [](char cChar) {return (char) tolower((unsigned char) cChar);});
+
+  int iFamily = 1;
+  if ((stFaceName.find("courier") != string::npos) ||
+      (stFaceName.find("mono") != string::npos))
+  {
+    iFamily = 2;
+  }
+
+  else if (stFaceName.find("times") != string::npos)
+  {
+    iFamily = 0;
+  }
+
+  return 4 * iFamily + ((style.iWeight >= 600) ? 1 : 0) +
+         (style.bItalic ? 2 : 0);
+}
+
+// AppendString appends characters as a PDF string in the Windows Latin-1
+// encoding, escaping the parentheses and backslashes.
+
+static void AppendString(string& stContent, const u16string& stText,
+                         int iFirstChar, int iLastChar)
+{
+  stContent += '(';
+
+  for (int iChar = iFirstChar; iChar <= iLastChar; ++iChar)
+  {
+    char16_t cChar = stText[iChar];
+
+    if ((cChar == u'(') || (cChar == u')') || (cChar == u'\\'))
+    {
+      stContent += '\\';
+      stContent += (char) cChar;
+    }
+
+    else if (((cChar >= 0x20) && (cChar < 0x7F)) ||
+             ((cChar >= 0xA0) && (cChar <= 0xFF)))
+    {
+      stContent += (char) cChar;
+    }
+
+    else
+    {
+      stContent += '?';
+    }
+  }
+
+  stContent += ')';
+}
+
+// RenderPage makes the content stream of a page. Each word, that is each
+// run of non-space characters of the same style on a line, is placed at
+// the left side and baseline of its first character. The font is only
+// selected when it changes. As RenderPage only reads the document, the
+// pages can be rendered by several threads at once.
+
+void PdfWriter::RenderPage(const LayoutDocument& document, int iPage,
+                           string& stContent)
+{
+  const vector<LayoutStyle>& styleArray = document.GetStyles();
+  const LayoutPage& page = document.GetPages()[iPage];
+  int yPageTop = document.GetTop(page.iFirstParagraph);
+  int iCurrentStyle = -1;
+
+  stContent += "BT\n";
+
+  for (int iParagraph = page.iFirstParagraph;
+       iParagraph <= page.iLastParagraph; ++iParagraph)
+  {
+    const LayoutParagraph& paragraph = document.GetParagraphs()[iParagraph];
+    const u16string& stText = paragraph.GetText();
+    const vector<int>& xArray = paragraph.GetPositions();
+    int iLength = paragraph.GetLength();
+    int yTop = LAYOUT_PAGE_MARGIN + document.GetTop(iParagraph) - yPageTop;
+
+    vector<int> charStyleArray;
+    charStyleArray.reserve(iLength);
+    for (const LayoutRun& run : paragraph.GetRuns())
+    {
+      charStyleArray.insert(charStyleArray.end(), run.iLength, run.iStyle);
+    }
+
+    for (const LayoutLine& line : paragraph.GetLines())
+    {
+      int yBaseline = LAYOUT_PAGE_TOTALHEIGHT -
+                      (yTop + line.iTop + line.iAscent);
+      int iLastChar = min(line.iLastChar, iLength - 1);
+      int iChar = line.iFirstChar;
+
+      while (iChar <= iLastChar)
+      {
+        if (stText[iChar] == u' ')
+        {
+          ++iChar;
+          continue;
+        }
+
+        int iStyle = charStyleArray[iChar], iWordEnd = iChar;
+        while ((iWordEnd < iLastChar) && (stText[iWordEnd + 1] != u' ') &&
+               (charStyleArray[iWordEnd + 1] == iStyle))
+        {
+          ++iWordEnd;
+        }
+
+        if (iStyle != iCurrentStyle)
+        {
+          const LayoutStyle& style = styleArray[iStyle];
+          stContent += "/F" + to_string(GetFont(style)) + " " +
+                       to_string(abs(style.iHeight)) + " Tf\n";
+          iCurrentStyle = iStyle;
+        }
+
+        stContent += "1 0 0 1 " +
+                     ToPoints(LAYOUT_PAGE_MARGIN + xArray[iChar]) + " " +
+                     ToPoints(yBaseline) + " Tm ";
+        AppendString(stContent, stText, iChar, iWordEnd);
+        stContent += " Tj\n";
+
+        iChar = iWordEnd + 1;
+      }
+    }
+  }
+
+  stContent += "ET";
+}
@@ -0,0 +1,43 @@
+const int PDF_FONTS = 12;
+
+// A PdfWriter writes the pages of a laid out document to a PDF file, one
+// page at a time and in order, so that the pages need not be held in
+// memory. The text is set in the standard fonts that every PDF reader
+// provides, which need not be embedded: each style is mapped to Times,
+// Helvetica, or Courier by its face name, and to the bold and italic
+// variants by its weight and slant. As these fonts do not have the widths
+// the layout was made with, every word is placed separately at its laid
+// out position. Characters outside the Windows Latin-1 encoding of the
+// standard fonts are written as question marks.
+
+// The objects are numbered in advance: the catalog, the page tree, the
+// fonts, and the shared resources first, then the content stream and the
+// page object of each page. The page tree, the catalog, and the cross
+// reference table are written when the file is closed, when the number of
+// pages is known.
+
+class PdfWriter
+{
+  public:
+    PdfWriter();
+    ~PdfWriter();
+
+    bool Open(const string& stPath);
+    bool WritePage(const string& stContent);
+    bool Close();
+
+    static void RenderPage(const LayoutDocument& document, int iPage,
+                           string& stContent);
+
+  private:
+    void Write(const string& stText);
+    void WriteObject(int iObject, const string& stBody);
+    static int GetFont(const LayoutStyle& style);
+    static string ToPoints(int iLogical);
+
+    FILE* m_pFile;
+    bool m_bFailed;
+    long long m_lPosition;
+    vector<long long> m_offsetArray;
+    int m_iPages;
+};
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <QFont>
+#include <QFontMetrics>
+
+#include "FontMetrics.h"
+#include "QtMetrics.h"
+
+void QtMetrics::SetStyles(const vector<LayoutStyle>& styleArray)
+{
+  m_styleArray = styleArray;
+  m_metricsArray.clear();
+
+  for (const LayoutStyle& style : m_styleArray)
+  {
+    QFont font(QString::fromStdString(style.stFaceName));
+    font.setPixelSize(max(PointsToMeters(style.iHeight), 1));
+    font.setWeight((style.iWeight >= 600) ? QFont::Bold : QFont::Normal);
+    font.setItalic(style.bItalic);
+    m_metricsArray.push_back(QFontMetrics(font));
+  }
+}
+
+LayoutSize QtMetrics::GetCharSize(int iStyle, char16_t cChar) const
+{
+  const QFontMetrics& metrics = m_metricsArray[iStyle];
+  bool bItalic = m_styleArray[iStyle].bItalic;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+  int iWidth = metrics.horizontalAdvance(QChar(cChar));
+#else
+  int iWidth = metrics.width(QChar(cChar));
+#endif
+
+  LayoutSize szChar = {ScaleSize(iWidth, bItalic),
+                       ScaleSize(metrics.height(), bItalic)};
+  return szChar;
+}
+
+// GetClusterSize measures the code units of a cluster as one string, which
+// lets Qt shape them into one glyph.
+
+LayoutSize QtMetrics::GetClusterSize(int iStyle, const char16_t* pCluster,
+                                     int iLength) const
+{
+  const QFontMetrics& metrics = m_metricsArray[iStyle];
+  bool bItalic = m_styleArray[iStyle].bItalic;
+  QString stCluster((const QChar*) pCluster, iLength);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+  int iWidth = metrics.horizontalAdvance(stCluster);
+#else
+  int iWidth = metrics.width(stCluster);
+#endif
+
+  LayoutSize szCluster = {ScaleSize(iWidth, bItalic),
+                          ScaleSize(metrics.height(), bItalic)};
+  return szCluster;
+}
+
+int QtMetrics::GetHeight(int iStyle) const
+{
+  return m_metricsArray[iStyle].height();
+}
+
+int QtMetrics::GetAscent(int iStyle) const
+{
+  return m_metricsArray[iStyle].ascent();
+}
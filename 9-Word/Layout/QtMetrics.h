@@ -0,0 +1,20 @@
+// QtMetrics measures the characters with the fonts of Qt, which uses
+// FreeType on Linux, and works headless on the offscreen platform. The font
+// of a style is given a pixel size equal to its height in logical units, so
+// that the sizes come out in logical units, like those the application
+// gets from its mapping mode.
+
+class QtMetrics : public FontMetrics
+{
+  public:
+    void SetStyles(const vector<LayoutStyle>& styleArray);
+    LayoutSize GetCharSize(int iStyle, char16_t cChar) const;
+    LayoutSize GetClusterSize(int iStyle, const char16_t* pCluster,
+                              int iLength) const;
+    int GetHeight(int iStyle) const;
+    int GetAscent(int iStyle) const;
+
+  private:
+    vector<LayoutStyle> m_styleArray;
+    vector<QFontMetrics> m_metricsArray;
+};
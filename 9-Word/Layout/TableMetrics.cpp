@@ -0,0 +1,117 @@
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "FontMetrics.h"
+#include "TableMetrics.h"
+
+// PointsToMeters converts a font height in points into logical units, like
+// Font::PointsToMeters of the application. A negative height denotes the
+// character height rather than the cell height, which makes no difference
+// here.
+
+int PointsToMeters(int iPoints)
+{
+  if (iPoints < 0)
+  {
+    iPoints = -iPoints;
+  }
+
+  return (int) ((double) 2540 * iPoints / 72);
+}
+
+// Characters written in italic tend to request slightly more space, so we
+// increase the size with 20 percent, and plain text with 10 percent, like
+// FontEntry::ScaleSize of the application.
+
+int ScaleSize(int iSize, bool bItalic)
+{
+  return (int) ((bItalic ? 1.2 : 1.1) * iSize);
+}
+
+void TableMetrics::SetStyles(const vector<LayoutStyle>& styleArray)
+{
+  m_styleArray = styleArray;
+  m_heightArray.clear();
+
+  for (const LayoutStyle& style : m_styleArray)
+  {
+    m_heightArray.push_back(PointsToMeters(style.iHeight));
+  }
+}
+
+LayoutSize TableMetrics::GetCharSize(int iStyle, char16_t cChar) const
+{
+  const LayoutStyle& style = m_styleArray[iStyle];
+  int iHeight = m_heightArray[iStyle];
+  int iWidth = (int) ((long long) iHeight * GetWidthFactor(cChar) / 1000);
+
+  if (style.iWeight >= 600)
+  {
+    iWidth += iWidth / 10;
+  }
+
+  LayoutSize szChar = {ScaleSize(iWidth, style.bItalic),
+                       ScaleSize(iHeight, style.bItalic)};
+  return szChar;
+}
+
+// GetClusterSize gives a cluster the size of its first character, as the
+// marks and the joined characters of a cluster are drawn onto it. The first
+// code unit of a surrogate pair is measured as a character outside ASCII.
+
+LayoutSize TableMetrics::GetClusterSize(int iStyle, const char16_t* pCluster,
+                                        int /* iLength */) const
+{
+  return GetCharSize(iStyle, pCluster[0]);
+}
+
+int TableMetrics::GetHeight(int iStyle) const
+{
+  return m_heightArray[iStyle];
+}
+
+int TableMetrics::GetAscent(int iStyle) const
+{
+  return m_heightArray[iStyle] * 4 / 5;
+}
+
+// GetWidthFactor returns the width of the character in thousandths of the
+// font height.
+
+int TableMetrics::GetWidthFactor(char16_t cChar)
+{
+  if (cChar == u' ')
+  {
+    return 250;
+  }
+
+  else if (cChar >= 0x80)
+  {
+    return 600;
+  }
+
+  else if ((cChar == u'i') || (cChar == u'j') || (cChar == u'l') ||
+           (cChar == u't') || (cChar == u'f') || (cChar == u'I') ||
+           (cChar == u'.') || (cChar == u',') || (cChar == u'\'') ||
+           (cChar == u'!') || (cChar == u'|'))
+  {
+    return 280;
+  }
+
+  else if ((cChar == u'm') || (cChar == u'w') || (cChar == u'M') ||
+           (cChar == u'W') || (cChar == u'@'))
+  {
+    return 830;
+  }
+
+  else if ((cChar >= u'A') && (cChar <= u'Z'))
+  {
+    return 670;
+  }
+
+  else
+  {
+    return 500;
+  }
+}
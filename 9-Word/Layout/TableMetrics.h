@@ -0,0 +1,25 @@
+// TableMetrics is a deterministic font metrics provider, which gives the
+// same layout on every machine and needs no fonts installed. The width of a
+// character is the height of its font times a factor that depends on the
+// class of the character: spaces, narrow letters and punctuation, wide
+// letters, upper case letters, other ASCII characters, and characters
+// outside ASCII. A cluster is as wide as its first character. Bold fonts
+// are a tenth wider. The ascent is four fifths of the height. The sizes are
+// scaled like in the application.
+
+class TableMetrics : public FontMetrics
+{
+  public:
+    void SetStyles(const vector<LayoutStyle>& styleArray);
+    LayoutSize GetCharSize(int iStyle, char16_t cChar) const;
+    LayoutSize GetClusterSize(int iStyle, const char16_t* pCluster,
+                              int iLength) const;
+    int GetHeight(int iStyle) const;
+    int GetAscent(int iStyle) const;
+
+  private:
+    static int GetWidthFactor(char16_t cChar);
+
+    vector<LayoutStyle> m_styleArray;
+    vector<int> m_heightArray;
+};
@@ -0,0 +1,240 @@
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "FontMetrics.h"
+#include "WordReader.h"
+
+static const unsigned char WORD_FILE_MAGIC[] = {'W', 'O', 'R', 'D'};
+
+WordReader::WordReader(const vector<unsigned char>& byteArray)
+ :m_byteArray(byteArray),
+  m_iSize((int) byteArray.size()),
+  m_iPosition(0),
+  m_iStyles(0)
+{
+  // Empty.
+}
+
+// ReadHeader checks the magic bytes and the version, and reads the style
+// table and the number of paragraphs. It returns false if the buffer does
+// not hold a Word file of this version.
+
+bool WordReader::ReadHeader(vector<LayoutStyle>& styleArray,
+                            int& iParagraphs)
+{
+  if (m_iSize < (int) sizeof WORD_FILE_MAGIC)
+  {
+    return false;
+  }
+
+  for (int iIndex = 0; iIndex < (int) sizeof WORD_FILE_MAGIC; ++iIndex)
+  {
+    if (m_byteArray[iIndex] != WORD_FILE_MAGIC[iIndex])
+    {
+      return false;
+    }
+  }
+
+  m_iPosition = sizeof WORD_FILE_MAGIC;
+
+  int iVersion;
+  if (!ReadInt(iVersion) || (iVersion != WORD_FILE_VERSION) ||
+      !ReadInt(m_iStyles) || (m_iStyles < 0))
+  {
+    return false;
+  }
+
+  styleArray.clear();
+  for (int iStyle = 0; iStyle < m_iStyles; ++iStyle)
+  {
+    LayoutStyle style;
+
+    if (!ReadStyle(style))
+    {
+      return false;
+    }
+
+    styleArray.push_back(style);
+  }
+
+  return ReadInt(iParagraphs) && (iParagraphs > 0);
+}
+
+bool WordReader::ReadByte(unsigned char& bValue)
+{
+  if (m_iPosition >= m_iSize)
+  {
+    return false;
+  }
+
+  bValue = m_byteArray[m_iPosition++];
+  return true;
+}
+
+bool WordReader::ReadInt(int& iValue)
+{
+  if ((m_iSize - m_iPosition) < 4)
+  {
+    return false;
+  }
+
+  const unsigned char* pValue = m_byteArray.data() + m_iPosition;
+  iValue = (int) (pValue[0] | (pValue[1] << 8) | (pValue[2] << 16) |
+                  ((unsigned int) pValue[3] << 24));
+  m_iPosition += 4;
+  return true;
+}
+
+// ReadString reads the bytes of a string without converting them, which is
+// what the face names of the styles need.
+
+bool WordReader::ReadString(string& stText)
+{
+  int iBytes;
+  if (!ReadInt(iBytes) || (iBytes < 0) || (iBytes > (m_iSize - m_iPosition)))
+  {
+    return false;
+  }
+
+  const char* pBytes = (const char*) (m_byteArray.data() + m_iPosition);
+  stText.assign(pBytes, iBytes);
+  m_iPosition += iBytes;
+  return true;
+}
+
+// ReadText reads a string and converts it from UTF-8 into UTF-16, which is
+// what the metrics measure. Characters beyond the basic multilingual plane
+// become surrogate pairs. Like the conversion of the application, it fails
+// on malformed UTF-8, including overlong forms and encoded surrogates.
+
+bool WordReader::ReadText(u16string& stText)
+{
+  string stBytes;
+  if (!ReadString(stBytes))
+  {
+    return false;
+  }
+
+  stText.clear();
+  stText.reserve(stBytes.size());
+
+  int iBytes = (int) stBytes.size(), iIndex = 0;
+  while (iIndex < iBytes)
+  {
+    unsigned char bFirst = (unsigned char) stBytes[iIndex++];
+
+    if (bFirst < 0x80)
+    {
+      stText.push_back(bFirst);
+      continue;
+    }
+
+    int iFollowing;
+    unsigned int uChar, uMinChar;
+
+    if ((bFirst & 0xE0) == 0xC0)
+    {
+      iFollowing = 1;
+      uChar = bFirst & 0x1F;
+      uMinChar = 0x80;
+    }
+
+    else if ((bFirst & 0xF0) == 0xE0)
+    {
+      iFollowing = 2;
+      uChar = bFirst & 0x0F;
+      uMinChar = 0x800;
+    }
+
+    else if ((bFirst & 0xF8) == 0xF0)
+    {
+      iFollowing = 3;
+      uChar = bFirst & 0x07;
+      uMinChar = 0x10000;
+    }
+
+    else
+    {
+      return false;
+    }
+
+    if (iFollowing > (iBytes - iIndex))
+    {
+      return false;
+    }
+
+    for (int iByte = 0; iByte < iFollowing; ++iByte)
+    {
+      unsigned char bNext = (unsigned char) stBytes[iIndex++];
+
+      if ((bNext & 0xC0) != 0x80)
+      {
+        return false;
+      }
+
+      uChar = (uChar << 6) | (bNext & 0x3F);
+    }
+
+    if ((uChar < uMinChar) || (uChar > 0x10FFFF) ||
+        ((uChar >= 0xD800) && (uChar <= 0xDFFF)))
+    {
+      return false;
+    }
+
+    if (uChar < 0x10000)
+    {
+      stText.push_back((char16_t) uChar);
+    }
+
+    else
+    {
+      uChar -= 0x10000;
+      stText.push_back((char16_t) (0xD800 | (uChar >> 10)));
+      stText.push_back((char16_t) (0xDC00 | (uChar & 0x3FF)));
+    }
+  }
+
+  return true;
+}
+
+// ReadStyle reads the index of a style, which must be within the style
+// table of the file.
+
+bool WordReader::ReadStyle(int& iStyle)
+{
+  return ReadInt(iStyle) && (iStyle >= 0) && (iStyle < m_iStyles);
+}
+
+// The second ReadStyle reads a style of the style table, which holds the
+// fields of a logical font followed by its face name. Only the fields that
+// affect the layout are kept.
+
+bool WordReader::ReadStyle(LayoutStyle& style)
+{
+  int iHeight, iWidth, iEscapement, iOrientation, iWeight;
+  if (!ReadInt(iHeight) || !ReadInt(iWidth) || !ReadInt(iEscapement) ||
+      !ReadInt(iOrientation) || !ReadInt(iWeight))
+  {
+    return false;
+  }
+
+  unsigned char bItalic, bOther;
+  if (!ReadByte(bItalic))
+  {
+    return false;
+  }
+
+  for (int iByte = 0; iByte < 7; ++iByte)
+  {
+    if (!ReadByte(bOther))
+    {
+      return false;
+    }
+  }
+
+  style.iHeight = iHeight;
+  style.iWeight = iWeight;
+  style.bItalic = (bItalic != 0);
+  return ReadString(style.stFaceName);
+}
@@ -0,0 +1,27 @@
+const int WORD_FILE_VERSION = 1;
+
+// A WordReader reads the values of a Word file, saved by the application,
+// from a buffer in memory. Every read is checked against the end of the
+// buffer and returns false if the value does not fit, so a corrupt file
+// makes the reading fail rather than overrun the buffer. The integers are
+// stored as four bytes in little-endian order, and the strings as their
+// number of bytes followed by the bytes in UTF-8.
+
+class WordReader
+{
+  public:
+    WordReader(const vector<unsigned char>& byteArray);
+
+    bool ReadHeader(vector<LayoutStyle>& styleArray, int& iParagraphs);
+    bool ReadByte(unsigned char& bValue);
+    bool ReadInt(int& iValue);
+    bool ReadString(string& stText);
+    bool ReadText(u16string& stText);
+    bool ReadStyle(int& iStyle);
+
+  private:
+    bool ReadStyle(LayoutStyle& style);
+
+    const vector<unsigned char>& m_byteArray;
+    int m_iSize, m_iPosition, m_iStyles;
+};
@@ -17,11 +17,19 @@ IMPLEMENT_DYNAMIC(CMainFrame, CMDIFrameWnd)
 
 BEGIN_MESSAGE_MAP(CMainFrame, CMDIFrameWnd)
 	ON_WM_CREATE()
+	ON_WM_TIMER()
+	ON_WM_DESTROY()
 END_MESSAGE_MAP()
 
+// The open documents are autosaved every five minutes.
+
+static const UINT_PTR AUTOSAVE_TIMER = 1;
+static const UINT AUTOSAVE_INTERVAL = 5 * 60 * 1000;
+
 static UINT indicators[] =
 {
 	ID_SEPARATOR,           // status line indicator
+	ID_INDICATOR_STATISTICS,
 	ID_INDICATOR_CAPS,
 	ID_INDICATOR_NUM,
 	ID_INDICATOR_SCRL,
@@ -66,9 +74,26 @@ int CMainFrame::OnCreate(LPCREATESTRUCT lpCreateStruct)
 	EnableDocking(CBRS_ALIGN_ANY);
 	DockControlBar(&m_wndToolBar);
 
+	SetTimer(AUTOSAVE_TIMER, AUTOSAVE_INTERVAL, NULL);
 	return 0;
 }
 
+void CMainFrame::OnTimer(UINT_PTR nIDEvent)
+{
+	if (nIDEvent == AUTOSAVE_TIMER)
+	{
+		theApp.AutoSaveDocuments();
+	}
+
+	CMDIFrameWnd::OnTimer(nIDEvent);
+}
+
+void CMainFrame::OnDestroy()
+{
+	KillTimer(AUTOSAVE_TIMER);
+	CMDIFrameWnd::OnDestroy();
+}
+
 BOOL CMainFrame::PreCreateWindow(CREATESTRUCT& cs)
 {
 	if( !CMDIFrameWnd::PreCreateWindow(cs) )
@@ -1,17 +1,29 @@
 #include "StdAfx.h"
 #include <AfxTempl.h>
 
-#include "Set.h"
 #include "Color.h"
 #include "Font.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
+#include "Layout/LayoutCore.h"
 
+#include "RepaintRegion.h"
 #include "Line.h"
 #include "Position.h"
+#include "PieceTable.h"
+#include "TextCluster.h"
+#include "TextSearch.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "FontCache.h"
 #include "Paragraph.h"
+#include "WordFile.h"
 
 #include "Page.h"
+#include "UndoLog.h"
+#include "BackgroundSave.h"
+#include "TextFile.h"
 #include "WordView.h"
 #include "WordDoc.h"
 
@@ -21,7 +33,15 @@
 Paragraph::Paragraph()
  :m_yStartPos(0),
   m_iHeight(0),
-  m_eAlignment(ALIGN_LEFT)
+  m_iWords(0),
+  m_iEstimatedLines(0),
+  m_iSnapshotIndex(-1),
+  m_eAlignment(ALIGN_LEFT),
+  m_bLayoutValid(FALSE),
+  m_bLayoutPending(FALSE),
+  m_iFirstDirty(-1),
+  m_iLastDirty(-1),
+  m_iDirtyDelta(0)
 {
   // Empty.
 }
@@ -31,7 +51,15 @@ Paragraph::Paragraph(Font emptyFont, Alignment eAlignment)
   m_iHeight(0),
   m_eAlignment(eAlignment),
   m_emptyFont(emptyFont),
-  m_iEmptyAverageWidth(0)
+  m_iEmptyAverageWidth(0),
+  m_iWords(0),
+  m_iEstimatedLines(0),
+  m_iSnapshotIndex(-1),
+  m_bLayoutValid(FALSE),
+  m_bLayoutPending(FALSE),
+  m_iFirstDirty(-1),
+  m_iLastDirty(-1),
+  m_iDirtyDelta(0)
 {
   // Empty.
 }
@@ -39,47 +67,199 @@ Paragraph::Paragraph(Font emptyFont, Alignment eAlignment)
 // The copy constructor initializes the fields of the class, it is called when
 // a paragraph is copied or pasted. Note that the assignment operator is not
 // defined on the MFC class CArray, for which reason Copy must be called
-// instead.
+// instead. The text is not copied, the pieces of the copy share their
+// characters with the pieces of this paragraph. The copy is not part of any
+// snapshot.
 
 Paragraph::Paragraph(const Paragraph &paragraph)
- :m_stText(paragraph.m_stText),
+ :m_text(paragraph.m_text),
   m_yStartPos(paragraph.m_yStartPos),
   m_iHeight(paragraph.m_iHeight),
   m_eAlignment(paragraph.m_eAlignment),
   m_emptyFont(paragraph.m_emptyFont),
-  m_iEmptyAverageWidth(paragraph.m_iEmptyAverageWidth)
+  m_iEmptyAverageWidth(paragraph.m_iEmptyAverageWidth),
+  m_iWords(paragraph.m_iWords),
+  m_iEstimatedLines(paragraph.m_iEstimatedLines),
+  m_iSnapshotIndex(-1),
+  m_fontRunArray(paragraph.m_fontRunArray),
+  m_lineHeightSum(paragraph.m_lineHeightSum),
+  m_bLayoutValid(paragraph.m_bLayoutValid),
+  m_bLayoutPending(paragraph.m_bLayoutPending),
+  m_iFirstDirty(paragraph.m_iFirstDirty),
+  m_iLastDirty(paragraph.m_iLastDirty),
+  m_iDirtyDelta(paragraph.m_iDirtyDelta)
 {
-  m_fontArray.Copy(paragraph.m_fontArray);
+  m_sizeArray.Copy(paragraph.m_sizeArray);
+  m_ascentArray.Copy(paragraph.m_ascentArray);
   m_lineArray.Copy(paragraph.m_lineArray);
   m_rectArray.Copy(paragraph.m_rectArray);
 }
 
 // Serialize reads or writes the values of the class fields, respectively.
-// Note that the Font and CArray classes have Serialize implementations of
-// their own.
+// Note that the Font, FontRunArray, PieceTable, and CArray classes have
+// Serialize implementations of their own, which store the fonts as one font
+// for each character and the text as one string, so the layout of the
+// archive is the same as before the runs and the piece table were
+// introduced. The sizes of the characters are not stored, so a loaded
+// paragraph is laid out from scratch. The prefix sum of the line heights is
+// generated from the loaded lines.
 
 void Paragraph::Serialize(CArchive& archive)
 {
   m_emptyFont.Serialize(archive);
-  m_fontArray.Serialize(archive);
+  m_fontRunArray.Serialize(archive);
   m_lineArray.Serialize(archive);
   m_rectArray.Serialize(archive);
 
   if (archive.IsStoring())
   {
-    archive << m_yStartPos << m_iHeight << (int) m_eAlignment
-            << m_stText << m_iEmptyAverageWidth;
+    archive << m_yStartPos << m_iHeight << (int) m_eAlignment;
+    m_text.Serialize(archive);
+    archive << m_iEmptyAverageWidth;
   }
 
   if (archive.IsLoading())
   {
     int eAlignment;
-    archive >> m_yStartPos >> m_iHeight >> eAlignment
-            >> m_stText >> m_iEmptyAverageWidth;
+    archive >> m_yStartPos >> m_iHeight >> eAlignment;
+    m_text.Serialize(archive);
+    archive >> m_iEmptyAverageWidth;
     m_eAlignment = (Alignment) eAlignment;
+    m_iWords = CountWordStarts(0, GetLength());
+    GenerateLineHeightSum();
+
+    m_bLayoutValid = FALSE;
+    m_bLayoutPending = FALSE;
+    m_iFirstDirty = -1;
+    m_iLastDirty = -1;
+    m_iDirtyDelta = 0;
   }
 }
 
+// Write writes the paragraph to a Word file. Unlike Serialize, it writes
+// neither the lines, the rectangles, nor the positions and heights, as they
+// are derived from the text and its fonts when the paragraph is laid out.
+// Write only reads the paragraph, which lets a background save call it
+// while the user interface thread reads the same paragraph.
+
+void Paragraph::Write(WordFileWriter& writer) const
+{
+  CString stText = m_text.ToString();
+  int iLength = stText.GetLength();
+
+  writer.WriteByte((BYTE) m_eAlignment);
+  writer.WriteStyle(StyleTable::GetStyle(m_emptyFont));
+  writer.WriteString(stText);
+
+  int iRuns = m_fontRunArray.GetRunCount();
+  writer.WriteInt(iRuns);
+
+  // The lengths of the runs are written in code points. As a run never
+  // ends inside a character, each run starts at the index reached by the
+  // code points of the runs before it.
+
+  int iIndex = 0;
+  for (int iRun = 0; iRun < iRuns; ++iRun)
+  {
+    const FontRun& run = m_fontRunArray.GetRun(iRun);
+    int iRunEnd = min(iIndex + run.GetLength(), iLength), iCodePoints = 0;
+
+    while (iIndex < iRunEnd)
+    {
+      iIndex = NextCodePoint(stText, iLength, iIndex);
+      ++iCodePoints;
+    }
+
+    writer.WriteStyle(run.GetStyle());
+    writer.WriteInt(iCodePoints);
+  }
+}
+
+// Read reads a paragraph written by Write. It returns false if the file is
+// corrupt, including the case where the code points of the runs do not
+// cover the text exactly. The lengths of the runs are converted from code
+// points into the characters of the text in memory, which ReadString
+// converts one character for each code point. The paragraph is not laid
+// out; that is left to the caller.
+
+BOOL Paragraph::Read(WordFileReader& reader)
+{
+  BYTE bAlignment;
+  int iEmptyStyle, iRuns;
+  CString stText;
+
+  if (!reader.ReadByte(bAlignment) || (bAlignment > ALIGN_JUSTIFIED) ||
+      !reader.ReadStyle(iEmptyStyle) || !reader.ReadString(stText) ||
+      !reader.ReadInt(iRuns) || (iRuns < 0))
+  {
+    return FALSE;
+  }
+
+  FontRunArray fontRunArray;
+  int iLength = stText.GetLength(), iIndex = 0;
+
+  for (int iRun = 0; iRun < iRuns; ++iRun)
+  {
+    int iStyle, iCodePoints;
+
+    if (!reader.ReadStyle(iStyle) || !reader.ReadInt(iCodePoints) ||
+        (iCodePoints <= 0) || (iCodePoints > (iLength - iIndex)))
+    {
+      return FALSE;
+    }
+
+    int iRunStart = iIndex;
+    for (int iCount = 0; iCount < iCodePoints; ++iCount)
+    {
+      if (iIndex == iLength)
+      {
+        return FALSE;
+      }
+
+      iIndex = NextCodePoint(stText, iLength, iIndex);
+    }
+
+    fontRunArray.Append(iStyle, iIndex - iRunStart);
+  }
+
+  if (iIndex != iLength)
+  {
+    return FALSE;
+  }
+
+  m_eAlignment = (Alignment) bAlignment;
+  m_emptyFont = StyleTable::GetFont(iEmptyStyle);
+  SetText(stText, fontRunArray);
+  return TRUE;
+}
+
+// SetText gives the paragraph the given text and fonts, whose runs must
+// cover the text exactly. Like Read, it leaves the layout to the caller.
+
+void Paragraph::SetText(const CString& stText,
+                        const FontRunArray& fontRunArray)
+{
+  m_text = PieceTable(stText);
+  m_fontRunArray = fontRunArray;
+  m_iWords = CountWordStarts(0, GetLength());
+
+  // The rectangle array is kept in line with the text, even though its
+  // rectangles are not generated until the paragraph is laid out.
+
+  m_rectArray.RemoveAll();
+  if (!m_text.IsEmpty())
+  {
+    CRect rcEmpty(0, 0, 0, 0);
+    m_rectArray.InsertAt(0, rcEmpty, m_text.GetLength());
+  }
+
+  m_bLayoutValid = FALSE;
+  m_bLayoutPending = FALSE;
+  m_iFirstDirty = -1;
+  m_iLastDirty = -1;
+  m_iDirtyDelta = 0;
+}
+
 // Draw is called by the view class every time it needs to be redrawn, partly
 // or completely. Some part of the document may be marked. If this particular
 // paragraph is marked, the parameters iFirstMarkedChar and iLastMarkedChar
@@ -87,47 +267,70 @@ void Paragraph::Serialize(CArchive& archive)
 // Note that it only applies to this paragraph, other paragraphs may also be
 // marked. If the paragraph is completely unmarked, the view class calls this
 // method with the values 0 and -1, respectively. This method also need a
-// pointer to a device context in order to write the characters.
+// pointer to a device context in order to write the characters, and the
+// font cache of the document that holds the fonts.
 
-void Paragraph::Draw(CDC* pDC, int iFirstMarkedChar, int iLastMarkedChar)const
+void Paragraph::Draw(CDC* pDC, FontCache* pFontCache, int iFirstMarkedChar,
+                     int iLastMarkedChar) const
 {
   CSize szUpperLeft(0, m_yStartPos);
-  int iSize = m_stText.GetLength();
 
-  if (!m_stText.IsEmpty())
-  {
-    for (int iChar = 0; iChar < iSize; ++iChar)
-    {
-      // If the character is inside the marked area, we inverse the text and
-      // background color.
+  // Only the lines overlapping the clip box of the device context need to be
+  // drawn. If the paragraph is outside the clip box, we do nothing. Neither
+  // do we draw a paragraph whose layout is pending, as its lines and
+  // rectangles are out of date; it is drawn when it has been laid out.
 
-      if ((iChar >= iFirstMarkedChar) && (iChar < iLastMarkedChar))
-      {
-          pDC->SetTextColor(WHITE);
-          pDC->SetBkColor(BLACK);
-      }
+  CRect rcClip;
+  pDC->GetClipBox(&rcClip);
 
-      else
-      {
-          pDC->SetTextColor(BLACK);
-          pDC->SetBkColor(WHITE);
-      }
+  if (m_bLayoutPending || (m_yStartPos >= rcClip.bottom) ||
+      ((m_yStartPos + m_iHeight) <= rcClip.top))
+  {
+    return;
+  }
 
-      // We select the font of the character. Every character of the paragraph
-      // have its own font. We have to translate the size of the font from
-      // typographical points to logical units (hundreds of millimeters).
+  if (!m_text.IsEmpty())
+  {
+    // The first visible line is found in the prefix sum of the line heights,
+    // and we stop at the first line starting below the clip box.
 
-      CFont cFont;
-      Font font = m_fontArray[iChar];
-      cFont.CreateFontIndirect(font.PointsToMeters());
-      CFont* pPrevFont = pDC->SelectObject(&cFont);
+    int iLines = (int) m_lineArray.GetSize();
+    int iFirstLine = min(m_lineHeightSum.Find(rcClip.top - m_yStartPos),
+                         iLines - 1);
+
+    IntArray widthArray;
+    for (int iLine = iFirstLine; (iLine < iLines) &&
+         ((m_yStartPos + m_lineHeightSum.Sum(iLine)) < rcClip.bottom);
+         ++iLine)
+    {
+      Line line = m_lineArray[iLine];
+      int iLastChar = line.GetLastChar();
 
-      // The charactr is written relative its top left corner.
+      // The line is divided into segments of characters with the same style
+      // that are either all marked or all unmarked. As the characters of a
+      // segment share font and top position, each segment is written by a
+      // single call.
 
-      CString stChar = m_stText.Mid(iChar, 1);
-      pDC->DrawText(stChar, m_rectArray[iChar] + szUpperLeft, TA_LEFT|TA_TOP);
+      int iFirstChar = line.GetFirstChar();
+      while (iFirstChar <= iLastChar)
+      {
+        int iStyle = m_fontRunArray.GetStyle(iFirstChar);
+        BOOL bMarked = (iFirstChar >= iFirstMarkedChar) &&
+                       (iFirstChar < iLastMarkedChar);
+
+        int iEndChar = iFirstChar + 1;
+        while ((iEndChar <= iLastChar) &&
+               (m_fontRunArray.GetStyle(iEndChar) == iStyle) &&
+               (((iEndChar >= iFirstMarkedChar) &&
+                 (iEndChar < iLastMarkedChar)) == bMarked))
+        {
+          ++iEndChar;
+        }
 
-      pDC->SelectObject(pPrevFont);
+        DrawSegment(pDC, pFontCache, iFirstChar, iEndChar, iStyle, bMarked,
+                    widthArray);
+        iFirstChar = iEndChar;
+      }
     }
   }
 
@@ -151,6 +354,48 @@ void Paragraph::Draw(CDC* pDC, int iFirstMarkedChar, int iLastMarkedChar)const
   }
 }
 
+// DrawSegment writes the characters from iFirstChar up to (but not
+// including) iEndChar with one text output call. The distance to the next
+// character is given for each character, since the rectangles of justified
+// lines are wider than the characters. The background of the segment is
+// filled with the background color.
+
+void Paragraph::DrawSegment(CDC* pDC, FontCache* pFontCache, int iFirstChar,
+                            int iEndChar, int iStyle, BOOL bMarked,
+                            IntArray& widthArray) const
+{
+  int iCount = iEndChar - iFirstChar;
+  CSize szUpperLeft(0, m_yStartPos);
+
+  CRect rcFirstChar = m_rectArray[iFirstChar] + szUpperLeft;
+  CRect rcLastChar = m_rectArray[iEndChar - 1] + szUpperLeft;
+  CRect rcSegment(rcFirstChar.left, rcFirstChar.top, rcLastChar.right,
+                  rcFirstChar.bottom);
+
+  check_memory(widthArray.SetSize(iCount));
+  for (int iIndex = 0; iIndex < iCount; ++iIndex)
+  {
+    CRect rcChar = m_rectArray[iFirstChar + iIndex];
+    widthArray[iIndex] = rcChar.Width();
+
+    if (iIndex < (iCount - 1))
+    {
+      widthArray[iIndex] = m_rectArray[iFirstChar + iIndex + 1].left -
+                           rcChar.left;
+    }
+  }
+
+  // If the segment is marked, we inverse the text and background color.
+
+  pDC->SetTextColor(bMarked ? WHITE : BLACK);
+  pDC->SetBkColor(bMarked ? BLACK : WHITE);
+
+  CFont* pPrevFont = pDC->SelectObject(pFontCache->GetFont(iStyle, pDC));
+  pDC->ExtTextOut(rcSegment.left, rcSegment.top, ETO_OPAQUE, &rcSegment,
+                  m_text.Mid(iFirstChar, iCount), widthArray.GetData());
+  pDC->SelectObject(pPrevFont);
+}
+
 // AddChar is called every time the user adds a character to this particular
 // paragraph. Its first task is to decide the font of the new character. The
 // document class has a field m_pNextFont, which is set to a new font when the
@@ -160,7 +405,7 @@ void Paragraph::Draw(CDC* pDC, int iFirstMarkedChar, int iLastMarkedChar)const
 
 // If the pointer is not null, we simply set the font of the new character to
 // that value. Otherwise, we have to examine the text. If the paragraph lacks
-// text (m_stText.IsEmpty()) we use the empty font. If it has text, but the
+// text (m_text.IsEmpty()) we use the empty font. If it has text, but the
 // new character is to be inserted at the beginning of the paragraph (iIndex
 // == 0), we use the font of the first character. Finally, if the paragraph
 // has text and the new character is not to be inserted at the beginning of
@@ -175,21 +420,21 @@ void Paragraph::Draw(CDC* pDC, int iFirstMarkedChar, int iLastMarkedChar)const
 void Paragraph::AddChar(int iIndex, UINT uNewChar, Font* pNextFont,
                         KeyboardState eKeyboardState)
 {
-  Font newFont;
+  int iNewStyle;
 
   // If they user has chosen a new font by a Font Dialog, the new character is
   // given that font.
 
   if (pNextFont != NULL)
   {
-    newFont = *pNextFont;
+    iNewStyle = StyleTable::GetStyle(*pNextFont);
   }
 
   // If the text is empty, we use the empty font.
 
-  else if (m_stText.IsEmpty())
+  else if (m_text.IsEmpty())
   {
-    newFont = m_emptyFont;
+    iNewStyle = StyleTable::GetStyle(m_emptyFont);
   }
 
   // If the input index is at the beginning of the text, we use the font of
@@ -197,7 +442,7 @@ void Paragraph::AddChar(int iIndex, UINT uNewChar, Font* pNextFont,
 
   else if (iIndex == 0)
   {
-    newFont = m_fontArray[0];
+    iNewStyle = m_fontRunArray.GetStyle(0);
   }
 
   // If the input index is not at the beginning of the text, we use the font 
@@ -205,65 +450,81 @@ void Paragraph::AddChar(int iIndex, UINT uNewChar, Font* pNextFont,
 
   else
   {
-    newFont = m_fontArray[iIndex - 1];
+    iNewStyle = m_fontRunArray.GetStyle(iIndex - 1);
   }
 
-  CRect emptyRect(0, 0, 0, 0);
-
   switch (eKeyboardState)
   {
     // If the keyboard is in insert mode, we insert the character at the given
     // index. The InsertAt method works also if the input index is one step to
-    // the right of the text.
+    // the right of the text. The character is appended to the add block of
+    // the piece table, which does not move the rest of the text.
 
     case KM_INSERT:
-      m_stText.Insert(iIndex, (TCHAR) uNewChar);
-      m_fontArray.InsertAt(iIndex, newFont);
-      m_rectArray.InsertAt(iIndex, emptyRect);
+      {
+        int iOldStarts = CountWordStarts(iIndex, iIndex + 1);
+        m_text.Insert(iIndex, (TCHAR) uNewChar);
+        m_fontRunArray.Insert(iIndex, iNewStyle);
+        UpdateWordCount(iIndex, 1, iOldStarts);
+        InvalidateLayout(iIndex, 0, 1);
+      }
       break;
 
     case KM_OVERWRITE:
       // In overwrite mode, we overwrite the character at the input index with
-      // SetAt if it is not at the end of the text. In that case, we use
-      // AppendChar and Add instead.
+      // SetAt if it is not at the end of the text. In that case, we insert
+      // the character at the end of the text and use Add instead.
 
-      if (iIndex < m_stText.GetLength())
+      if (iIndex < m_text.GetLength())
       {
-        m_stText.SetAt(iIndex, (TCHAR) uNewChar);
-        m_fontArray.SetAt(iIndex, newFont);
-        m_rectArray.SetAt(iIndex, emptyRect);
+        int iOldStarts = CountWordStarts(iIndex, iIndex + 2);
+        m_text.SetAt(iIndex, (TCHAR) uNewChar);
+        m_fontRunArray.SetStyle(iIndex, 1, iNewStyle);
+        UpdateWordCount(iIndex, 1, iOldStarts);
+        InvalidateLayout(iIndex, 1, 1);
       }
 
       else
       {
-        m_stText.AppendChar((TCHAR) uNewChar);
-        m_fontArray.Add(newFont);
-        m_rectArray.Add(emptyRect);
+        int iOldStarts = CountWordStarts(iIndex, iIndex + 1);
+        m_text.Insert(iIndex, (TCHAR) uNewChar);
+        m_fontRunArray.Insert(iIndex, iNewStyle);
+        UpdateWordCount(iIndex, 1, iOldStarts);
+        InvalidateLayout(iIndex, 0, 1);
       }
       break;
   }
 }
 
-// GetRepaintSet is called when a part of the text is to be marked or
-// unmarked. It adds to repaintSet the rectangles (from m_rectArray) of the
+// GetRepaintRegion is called when a part of the text is to be marked or
+// unmarked. It adds to repaintRegion the rectangles (from m_rectArray) of the
 // characters in question. The index parameters have default value 0 and -1.
 // If the last index is -1, the rest of the paragraph's rectangles shall be
 // included in the set. In that case, it is set to the length of the text.
+// If the layout of the paragraph is pending, the whole paragraph is added.
 
-void Paragraph::GetRepaintSet(RectSet& repaintSet, int iFirstIndex
-                                 /*= 0 */, int iLastIndex /* = -1 */)
+void Paragraph::GetRepaintRegion(RepaintRegion& repaintRegion,
+                                 int iFirstIndex /* = 0 */,
+                                 int iLastIndex /* = -1 */)
 {
   if (iLastIndex == -1)
   {
-    iLastIndex = m_stText.GetLength();
+    iLastIndex = m_text.GetLength();
   }
 
   CSize szUpperLeft(0, m_yStartPos);
 
+  if (m_bLayoutPending)
+  {
+    CRect rcParagraph(0, 0, PAGE_WIDTH, m_iHeight);
+    repaintRegion.Add(rcParagraph + szUpperLeft);
+    return;
+  }
+
   for (int iIndex = iFirstIndex; iIndex < iLastIndex; ++iIndex)
   {
     CRect rcChar = m_rectArray[iIndex];
-    repaintSet.Add(rcChar + szUpperLeft);
+    repaintRegion.Add(rcChar + szUpperLeft);
   }
 }
 
@@ -283,7 +544,7 @@ void Paragraph::GetRepaintSet(RectSet& repaintSet, int iFirstIndex
 
 void Paragraph::DeleteText(int iFirstIndex /* = 0*/, int iLastIndex /* = -1*/)
 {
-  int iLength = m_stText.GetLength();
+  int iLength = m_text.GetLength();
 
   if (iLastIndex == -1)
   {
@@ -292,12 +553,14 @@ void Paragraph::DeleteText(int iFirstIndex /* = 0*/, int iLastIndex /* = -1*/)
 
   if ((iFirstIndex == 0) && (iLastIndex == iLength))
   {
-    m_emptyFont = m_fontArray[0];
+    m_emptyFont = m_fontRunArray.GetFont(0);
   }
 
-  m_stText.Delete(iFirstIndex, iLastIndex - iFirstIndex);
-  m_fontArray.RemoveAt(iFirstIndex, iLastIndex - iFirstIndex);
-  m_rectArray.RemoveAt(iFirstIndex, iLastIndex - iFirstIndex);
+  int iOldStarts = CountWordStarts(iFirstIndex, iLastIndex + 1);
+  m_text.Delete(iFirstIndex, iLastIndex - iFirstIndex);
+  m_fontRunArray.Delete(iFirstIndex, iLastIndex - iFirstIndex);
+  UpdateWordCount(iFirstIndex, 0, iOldStarts);
+  InvalidateLayout(iFirstIndex, iLastIndex - iFirstIndex, 0);
 }
 
 // GetFont is called by the document class in order to set the default font in
@@ -308,41 +571,51 @@ void Paragraph::DeleteText(int iFirstIndex /* = 0*/, int iLastIndex /* = -1*/)
 
 Font Paragraph::GetFont(int iCaretIndex) const
 {
-  if (m_stText.IsEmpty())
+  if (m_text.IsEmpty())
   {
     return m_emptyFont;
   }
 
   else if (iCaretIndex == 0)
   {
-    return m_fontArray[0];
+    return m_fontRunArray.GetFont(0);
   }
 
   else
   {
-    return m_fontArray[iCaretIndex - 1];
+    return m_fontRunArray.GetFont(iCaretIndex - 1);
   }
 }
 
 // SetFont is called when one or several characters of the paragraph is given
 // a new font. Unlike GetFont above, SetFont may affect more than one
 // character in case the user has marked a portion of the text and then change
-// the font. Like GetRepaintSet above, the two indexes parameters are
+// the font. Like GetRepaintRegion above, the two indexes parameters are
 // default parameters. If the second of them is omitted in the call, the rest
-// of the text is updated with the new font.
+// of the text is updated with the new font. The font runs of the range are
+// replaced by a single run, regardless of the number of characters.
 
 void Paragraph::SetFont(Font newFont, int iFirstIndex /* = 0 */,
                         int iLastIndex /* = -1 */)
+{
+  SetStyle(StyleTable::GetStyle(newFont), iFirstIndex, iLastIndex);
+}
+
+// SetStyle does the work of SetFont with a style that has already been
+// looked up in the style table, which lets a font be set on many
+// paragraphs with only one lookup.
+
+void Paragraph::SetStyle(int iStyle, int iFirstIndex /* = 0 */,
+                         int iLastIndex /* = -1 */)
 {
   if (iLastIndex == -1)
   {
-    iLastIndex = m_stText.GetLength();
+    iLastIndex = m_text.GetLength();
   }
 
-  for (int iIndex = iFirstIndex; iIndex < iLastIndex; ++iIndex)
-  {
-    m_fontArray[iIndex] = newFont;
-  }
+  m_fontRunArray.SetStyle(iFirstIndex, iLastIndex - iFirstIndex, iStyle);
+  InvalidateLayout(iFirstIndex, iLastIndex - iFirstIndex,
+                   iLastIndex - iFirstIndex);
 }
 
 // GetWord is called when the user double clicks on a word. It starts at the
@@ -360,16 +633,16 @@ BOOL Paragraph::GetWord(int iEditChar, int& iFirstChar,
   int iChar;
 
   for (iChar = iEditChar; (iChar >= 0) &&
-       isalnum(m_stText[iChar]); --iChar)
+       isalnum(m_text[iChar]); --iChar)
   {
     // Empty.
   }
 
   iFirstChar = (iChar + 1);
-  int iLength = m_stText.GetLength();
+  int iLength = m_text.GetLength();
 
   for (iChar = iEditChar; (iChar < iLength) &&
-       isalnum(m_stText[iChar]); ++iChar)
+       isalnum(m_text[iChar]); ++iChar)
   {
     // Empty.
   }
@@ -379,37 +652,15 @@ BOOL Paragraph::GetWord(int iEditChar, int& iFirstChar,
 }
 
 // GetHomeChar is called when the user presses the home key. It first finds
-// out which line the current index holds. Then it returns the index of the
-// first key on that line. This method always finds the right line, of which
-// reason an check watch is added to the end of the method.
+// out which line the current index holds by calling FindLine. Then it
+// returns the index of the first key on that line. Every character belongs
+// to a line of the paragraph, of which reason an check watch is added.
 
 int Paragraph::GetHomeChar(int iChar) const
 {
-  int iLines = (int) m_lineArray.GetSize();
-
-  for (int iIndex = 0; iIndex < iLines; ++iIndex)
-  {
-    // We extract the last character of each line in the paragraph.
-
-    Line line = m_lineArray[iIndex];
-    int iFirstChar = line.GetFirstChar();
-    int iLastChar = line.GetLastChar();
-
-    // If the given character is on this line, we return the first index of
-    // the line.
-
-    if (iChar <= (iLastChar + 1))
-    {
-      return iFirstChar;
-    }
-  }
-
-  // As the loop above always will find the correct index (every character
-  // belong to a line of the paragraph), this point of the code will never be
-  // reached. The check is for debugging purposes only.
-
-  check(FALSE);
-  return 0;
+  Line line = m_lineArray[FindLine(iChar)];
+  check(iChar <= (line.GetLastChar() + 1));
+  return line.GetFirstChar();
 }
 
 // GetEndChar is called when the user presses the end. Similar to GethomeKey
@@ -418,67 +669,83 @@ int Paragraph::GetHomeChar(int iChar) const
 
 int Paragraph::GetEndChar(int iChar) const
 {
-  int iLines = (int) m_lineArray.GetSize();
-
-  for (int iIndex = 0; iIndex < iLines; ++iIndex)
-  {
-    // We extract the last character of each line in the paragraph.
-
-    Line line = m_lineArray[iIndex];
-    int iLastChar = line.GetLastChar();
+  Line line = m_lineArray[FindLine(iChar)];
+  check(iChar <= (line.GetLastChar() + 1));
+  return (line.GetLastChar() + 1);
+}
 
-    // If the given character is on this line, we return the first index of
-    // the line.
+// NextCluster and PreviousCluster return the index of the cluster following
+// and preceding the given index, which is where the caret moves when the
+// user presses the arrow keys. The search for the preceding cluster goes no
+// further back than the start of the line.
 
-    if (iChar <= (iLastChar + 1))
-    {
-      return (iLastChar + 1);
-    }
-  }
-
-  // As the loop above always will find the correct index (every character
-  // belong to a line of the paragraph), this point of the code will never be
-  // reached. The check is for debugging purposes only.
+int Paragraph::NextCluster(int iChar) const
+{
+  return ::NextCluster(m_text, m_text.GetLength(), iChar);
+}
 
-  check(FALSE);
-  return 0;
+int Paragraph::PreviousCluster(int iChar) const
+{
+  return ::PreviousCluster(m_text, m_text.GetLength(), iChar,
+                           FindClusterBound(iChar - 1));
 }
 
 // ExtractText is called when the user marks one portion of the documents
 // text and then copies it. It creates a new paragraph and fills it with the
-// text and fonts of the marked area. Like GetRepaintSet and SetFont above,
+// text and fonts of the marked area. Like GetRepaintRegion and SetFont above,
 // its two indexes are default parameters. If the last index is -1, the rest
 // of the text shall be extracted. The text is easy to extract with the
-// CString Mid method. Unfortunately, there is no similar method for arrays,
-// of which reason we must traverse the font array and add fonts one by one to
-// the new paragraph. We also need to set the empty font of the paragraph. If
-// the first index of the extracted text is less than the length of the text,
-// we set the font of the first marked character. Otherwise, we use the font
-// of the character preceding the first one. If the text is empty, we just
-// set the empty font.
+// CString Mid method, and the fonts are extracted as font runs. The
+// extracted text shares its characters with this paragraph, only the pieces
+// are copied. The layout is not copied either, as the new paragraph is laid
+// out anew wherever it is inserted. We also need to set the empty font of
+// the paragraph. If the first index of the extracted text is less than the
+// length of the text, we set the font of the first marked character.
+// Otherwise, we use the font of the character preceding the first one. If
+// the text is empty, we just set the empty font.
 
 Paragraph* Paragraph::ExtractText(int iFirstIndex /* = 0 */,
                                   int iLastIndex /* = -1 */) const
 {
   Paragraph* pNewParagraph;
-  check_memory(pNewParagraph = new Paragraph(*this));
+  check_memory(pNewParagraph = new Paragraph(m_emptyFont, m_eAlignment));
 
-  if (!m_stText.IsEmpty())
+  if (!m_text.IsEmpty())
   {
-    int iLength = m_stText.GetLength();
+    int iLength = m_text.GetLength();
 
     if (iLastIndex == -1)
     {
       iLastIndex = iLength;
     }
 
-    pNewParagraph->m_stText = m_stText.Mid(iFirstIndex,
-                                           iLastIndex - iFirstIndex);
-    CRect rcEmpty(0, 0, 0, 0);
-    for (int iChar = iFirstIndex; iChar < iLastIndex; ++iChar)
+    int iCount = iLastIndex - iFirstIndex;
+    pNewParagraph->m_text = m_text.Extract(iFirstIndex, iCount);
+    pNewParagraph->m_fontRunArray = m_fontRunArray.Extract(iFirstIndex,
+                                                           iCount);
+
+    // The marked area may be empty, when the mark starts at the end of the
+    // paragraph or ends at its beginning, and InsertAt does not accept a
+    // count of zero.
+
+    if (iCount > 0)
+    {
+      CRect rcEmpty(0, 0, 0, 0);
+      pNewParagraph->m_rectArray.InsertAt(0, rcEmpty, iCount);
+    }
+
+    // The words of the whole text are already counted, which makes a copy of
+    // the whole paragraph, such as the copies of the undo log, take time in
+    // proportion to the number of pieces rather than characters.
+
+    if (iCount == iLength)
+    {
+      pNewParagraph->m_iWords = m_iWords;
+    }
+
+    else
     {
-      pNewParagraph->m_fontArray.Add(m_fontArray[iChar]);
-      pNewParagraph->m_rectArray.Add(rcEmpty);
+      pNewParagraph->m_iWords = pNewParagraph->CountWordStarts(0, iCount);
     }
 
     // The empty font is set to the one of the first index, unless the first
@@ -487,29 +754,22 @@ Paragraph* Paragraph::ExtractText(int iFirstIndex /* = 0 */,
 
     if (iFirstIndex < iLength)
     {
-      pNewParagraph->m_emptyFont = m_fontArray[iFirstIndex];
+      pNewParagraph->m_emptyFont = m_fontRunArray.GetFont(iFirstIndex);
     }
 
     else
     {
-      pNewParagraph->m_emptyFont = m_fontArray[iFirstIndex - 1];
+      pNewParagraph->m_emptyFont = m_fontRunArray.GetFont(iFirstIndex - 1);
     }
   }
 
-  // If the text is empty, we just set the empty font. A succeeding call to
-  // Recalculate will initialize the rest of the fields.
-
-  else
-  {
-    pNewParagraph->m_emptyFont = m_emptyFont;
-  }
-
   return pNewParagraph;
 }
 
 // Insert inserts a character in the paragraph. Unless the paragraph to insert
-// in empty, we just insert its text and font array. Append adds a paragraph
-// to the end of the paragraph simple by calling Insert.
+// in empty, we just insert its text and font runs. The pieces of the text
+// are inserted, not the characters. Append adds a paragraph to the end of
+// the paragraph simple by calling Insert.
 
 void Paragraph::Insert(int iChar, Paragraph* pInsertParagraph)
 {
@@ -517,11 +777,11 @@ void Paragraph::Insert(int iChar, Paragraph* pInsertParagraph)
 
   if (iInsertLength > 0)
   {
-    m_stText.Insert(iChar, pInsertParagraph->m_stText);
-    m_fontArray.InsertAt(iChar, &pInsertParagraph->m_fontArray);
-
-    CRect rcEmpty(0, 0, 0, 0);
-    m_rectArray.InsertAt(iChar, rcEmpty, iInsertLength);
+    int iOldStarts = CountWordStarts(iChar, iChar + 1);
+    m_text.Insert(iChar, pInsertParagraph->m_text);
+    m_fontRunArray.Insert(iChar, pInsertParagraph->m_fontRunArray);
+    UpdateWordCount(iChar, iInsertLength, iOldStarts);
+    InvalidateLayout(iChar, 0, iInsertLength);
   }
 }
 
@@ -539,18 +799,117 @@ Paragraph* Paragraph::Split(int iChar)
   Paragraph* pNewParagraph;
   check_memory(pNewParagraph = new Paragraph());
 
-  pNewParagraph->m_stText = m_stText.Mid(iChar);
-  m_stText = m_stText.Left(iChar);
+  int iRestLength = m_text.GetLength() - iChar;
+  int iOldStarts = CountWordStarts(iChar, iChar + iRestLength);
+  pNewParagraph->m_text = m_text.Extract(iChar, iRestLength);
+  m_text.Delete(iChar, iRestLength);
 
-  pNewParagraph->m_fontArray.Copy(m_fontArray);
-  pNewParagraph->m_fontArray.RemoveAt(0, iChar);
-  m_fontArray.SetSize(iChar);
+  pNewParagraph->m_fontRunArray = m_fontRunArray.Extract(iChar, iRestLength);
+  m_fontRunArray.Delete(iChar, iRestLength);
+  UpdateWordCount(iChar, 0, iOldStarts);
+  InvalidateLayout(iChar, iRestLength, 0);
+
+  pNewParagraph->m_iWords = pNewParagraph->CountWordStarts(0, iRestLength);
 
   pNewParagraph->m_eAlignment = m_eAlignment;
   pNewParagraph->m_emptyFont = GetFont(iChar);
   return pNewParagraph;
 }
 
+// Find returns the index of the first occurrence of the search pattern
+// within the given range of the text, or minus one if there is none. The
+// characters are searched where they are stored, unless the text is held
+// by several pieces, in which case it is first copied into one buffer.
+
+int Paragraph::Find(const TextSearch& search, int iFirstIndex /* = 0 */,
+                    int iLastIndex /* = -1 */) const
+{
+  if (iLastIndex == -1)
+  {
+    iLastIndex = GetLength();
+  }
+
+  CString stBuffer;
+  const TCHAR* pText = m_text.GetText(stBuffer);
+  return search.Find(pText, iLastIndex, iFirstIndex);
+}
+
+// Replace replaces every occurrence of the search pattern within the given
+// range of the text with the replacement text, and returns the number of
+// replaced occurrences. Instead of deleting and inserting each occurrence,
+// which would split the pieces and runs of the text over and over again,
+// the new text and runs are built from the parts between the occurrences
+// in one pass. The replacement text is stored in one block, which is shared
+// by all the occurrences, and it is given the font of the first character
+// of each occurrence. The layout is invalidated from the first to the last
+// occurrence.
+
+int Paragraph::Replace(const TextSearch& search, const CString& stReplace,
+                       int iFirstIndex /* = 0 */, int iLastIndex /* = -1 */)
+{
+  int iLength = GetLength();
+
+  if (iLastIndex == -1)
+  {
+    iLastIndex = iLength;
+  }
+
+  CString stBuffer;
+  const TCHAR* pText = m_text.GetText(stBuffer);
+  int iMatch = search.Find(pText, iLastIndex, iFirstIndex);
+
+  if (iMatch == -1)
+  {
+    return 0;
+  }
+
+  int iMatchLength = search.GetLength();
+  int iReplaceLength = stReplace.GetLength();
+  PieceTable replaceText(stReplace);
+
+  PieceTable newText;
+  FontRunArray newRunArray;
+  int iFirstMatch = iMatch, iCopied = 0, iReplaced = 0;
+
+  while (iMatch != -1)
+  {
+    newText.Append(m_text, iCopied, iMatch - iCopied);
+    newRunArray.Append(m_fontRunArray, iCopied, iMatch - iCopied);
+
+    if (iReplaceLength > 0)
+    {
+      newText.Append(replaceText, 0, iReplaceLength);
+      newRunArray.Append(m_fontRunArray.GetStyle(iMatch), iReplaceLength);
+    }
+
+    iCopied = iMatch + iMatchLength;
+    ++iReplaced;
+    iMatch = search.Find(pText, iLastIndex, iCopied);
+  }
+
+  int iOldEnd = iCopied;
+  int iOldStarts = CountWordStarts(iFirstMatch, iOldEnd + 1);
+  newText.Append(m_text, iCopied, iLength - iCopied);
+  newRunArray.Append(m_fontRunArray, iCopied, iLength - iCopied);
+
+  // If the whole text is replaced by nothing, the paragraph keeps the font
+  // of its first character as its empty font.
+
+  if (newText.IsEmpty())
+  {
+    m_emptyFont = m_fontRunArray.GetFont(0);
+  }
+
+  m_text = newText;
+  m_fontRunArray = newRunArray;
+
+  int iNewEnd = iOldEnd + iReplaced * (iReplaceLength - iMatchLength);
+  UpdateWordCount(iFirstMatch, iNewEnd - iFirstMatch, iOldStarts);
+  InvalidateLayout(iFirstMatch, iOldEnd - iFirstMatch,
+                   iNewEnd - iFirstMatch);
+  return iReplaced;
+}
+
 // When the users click the mouse, we have to decide which paragraph and
 // character they clicked at. The mouse position in device units is caught by
 // the view classes, converted to logical units, send to the document class,
@@ -559,13 +918,13 @@ Paragraph* Paragraph::Split(int iChar)
 
 int Paragraph::PointToChar(CPoint ptMouse)
 {
-  // If the text is empty, we just return index 0. Otherwise, we traverse the
-  // lines of the paragraph one by one in order to find the correct line. Then
-  // we traverse the line in order to find the correct character. To start
-  // with, we subtract the start position of the paragraph from the mouse
-  // position, which is relative the beginning of the document.
+  // If the text is empty, we just return index 0. Otherwise, we search the
+  // lines of the paragraph in order to find the correct line. Then we search
+  // the line in order to find the correct character. To start with, we
+  // subtract the start position of the paragraph from the mouse position,
+  // which is relative the beginning of the document.
 
-  if (m_stText.IsEmpty())
+  if (m_text.IsEmpty())
   {
     return 0;
   }
@@ -581,81 +940,76 @@ int Paragraph::PointToChar(CPoint ptMouse)
   ptMouse.y -= m_yStartPos;
   ptMouse.y = min(ptMouse.y, m_iHeight - 1);
 
+  // The line holding the mouse position is found by a binary search in the
+  // prefix sum of the line heights.
+
   int iLines = (int) m_lineArray.GetSize();
+  int iLine = min(m_lineHeightSum.Find(ptMouse.y), iLines - 1);
 
-  int iParagraphHeight = 0;
-  for (int iLine = 0; iLine < iLines; ++iLine)
+  // When we have found the right line, the search continues for the right
+  // character. We first check if the mouse position is to the left of the
+  // first character of the line; in that case, we return the first index of
+  // the first character of the line. If it instead is to the right of the
+  // last character of the line, we return the index of the character to the
+  // right of the last character.
+
+  Line line = m_lineArray[iLine];
+  int iFirstChar = line.GetFirstChar();
+  int iLastChar = line.GetLastChar();
+
+  CRect rcFirstChar = m_rectArray[iFirstChar];
+  CRect rcLastChar = m_rectArray[iLastChar];
+
+  if (ptMouse.x <= rcFirstChar.left)
   {
-    Line line = m_lineArray[iLine];
-    int iLineHeight = line.GetHeight();
-    iParagraphHeight += iLineHeight;
-
-    // When we find the right line, the search continues for the right
-    // character. We cannot fail in finding the right line; therefore, there
-    // is an check watch at the end of the method. When we look for the
-    // correct character, we first check if the mouse position is to the left
-    // of the first character of the line; in that case, we return the first
-    // index of the first character of the line. If it instead is to the right
-    // of the last character of the line, we return the index of the character
-    // to the right of the last character.
-
-    if (ptMouse.y < iParagraphHeight)
-    {
-      int iFirstChar = line.GetFirstChar();
-      int iLastChar = line.GetLastChar();
+    return iFirstChar;
+  }
 
-      CRect rcFirstChar = m_rectArray[iFirstChar];
-      CRect rcLastChar = m_rectArray[iLastChar];
+  else if (ptMouse.x >= rcLastChar.right)
+  {
+    return (iLastChar + 1);
+  }
+
+  // In none of the above cases applies, we perform a binary search for the
+  // first character of the line whose right side is to the right of the
+  // mouse position; the right sides of the characters of a line are sorted.
+  // Then we check whether the mouse position if is mostly to the left or the
+  // right of the character, and return the index of the character to the
+  // left or to the right, respectively.
+
+  else
+  {
+    int iMinChar = iFirstChar, iMaxChar = iLastChar;
+
+    while (iMinChar < iMaxChar)
+    {
+      int iMiddleChar = (iMinChar + iMaxChar) / 2;
 
-      if (ptMouse.x <= rcFirstChar.left)
+      if (ptMouse.x < m_rectArray[iMiddleChar].right)
       {
-        return iFirstChar;
+        iMaxChar = iMiddleChar;
       }
 
-      else if (ptMouse.x >= rcLastChar.right)
+      else
       {
-        return (iLastChar + 1);
+        iMinChar = iMiddleChar + 1;
       }
+    }
 
-      // In none of the above cases applies, we traverses through the line and
-      // when we find the correct character, we check whether the mouse
-      // position if is mostly to the left or the right character, then we
-      // return the index of the character to the left to the right,
-      // respectively. We cannot fail in finding the correct character once we
-      // have found the correct line. Therefore, we have an check watch at
-      // the end of the character search.
+    CRect rcChar = m_rectArray[iMinChar];
+    int cxLeft = ptMouse.x - rcChar.left;
+    int cxRight = rcChar.right - ptMouse.x;
 
-      else
-      {
-        for (int iChar = iFirstChar; iChar <= iLastChar; ++iChar)
-        {
-          CRect rcChar = m_rectArray[iChar];
-
-          if (ptMouse.x < rcChar.right)
-          {
-            int cxLeft = ptMouse.x - rcChar.left;
-            int cxRight = rcChar.right - ptMouse.x;
-
-            if (cxLeft < cxRight)
-            {
-              return iChar;
-            }
-
-            else
-            {
-              return iChar + 1;
-            }
-          }
-        }
+    if (cxLeft < cxRight)
+    {
+      return iMinChar;
+    }
 
-        check(FALSE);
-        return 0;
-      }
+    else
+    {
+      return NextCluster(iMinChar);
     }
   }
-
-  check(FALSE);
-  return 0;
 }
 
 // CharToRect returns the rectangle of the character at the given index in the
@@ -668,7 +1022,7 @@ CRect Paragraph::CharToRect(int iChar)
   // We have two special cases. First, the paragraph may be empty. In that
   // case, we use the average size of the paragraphs empty font.
 
-  if (m_stText.IsEmpty())
+  if (m_text.IsEmpty())
   {
     return szUpperLeft + CRect(0, 0, m_iEmptyAverageWidth, m_iHeight);
   }
@@ -678,9 +1032,9 @@ CRect Paragraph::CharToRect(int iChar)
   // the dimensions of the characters beyond the text using the size of the
   // last character.
 
-  else if (iChar == m_stText.GetLength())
+  else if (iChar == m_text.GetLength())
   {
-    CRect rcChar = m_rectArray[iChar - 1];
+    CRect rcChar = m_rectArray[PreviousCluster(iChar)];
     CRect rcCaret(rcChar.right, rcChar.top, rcChar.right + rcChar.Width(),
                   rcChar.bottom);
     return szUpperLeft + rcCaret;
@@ -699,7 +1053,7 @@ CRect Paragraph::CharToRect(int iChar)
 CRect Paragraph::GetCaretRect(int iChar)
 {
   CSize szUpperLeft(0, m_yStartPos);
-  int iSize = m_stText.GetLength();
+  int iSize = m_text.GetLength();
 
   // If the text is empty, we return a caret rectangle based on the empty
   // font.
@@ -727,428 +1081,824 @@ CRect Paragraph::GetCaretRect(int iChar)
     return szUpperLeft + rcCaret;
   }
 
-  // Otherwise, we find the preceding character and return a caret rectangle
+  // Otherwise, we find the preceding cluster and return a caret rectangle
   // based on its size.
 
   else
   {
-    CRect rcChar = m_rectArray[iChar - 1];
+    CRect rcChar = m_rectArray[PreviousCluster(iChar)];
     CRect rcCaret(rcChar.right, rcChar.top, rcChar.right + rcChar.Width(),
                   rcChar.bottom);
     return szUpperLeft + rcCaret;
   }
 }
 
+// isHomeChar returns true if the given character is the first character of
+// its line. FindLine returns the first line whose last character precedes
+// the given one at most by one, so the given character may also be the
+// first character of the next line.
+
 BOOL Paragraph::isHomeChar(int iChar)
 {
-  int iLines = (int) m_lineArray.GetSize();
+  int iLine = FindLine(iChar);
 
-  for (int iIndex = 0; iIndex < iLines; ++iIndex)
+  if (m_lineArray[iLine].GetFirstChar() == iChar)
   {
-    // We extract the last character of each line in the paragraph.
-
-    Line line = m_lineArray[iIndex];
-    int iFirstChar = line.GetFirstChar();
-
-    // If the given character is on this line, we return the first index of
-    // the line.
-
-    if (iChar == iFirstChar)
-    {
-      return TRUE;
-    }
+    return TRUE;
   }
 
-  return FALSE;
+  return ((iLine + 1) < m_lineArray.GetSize()) &&
+         (m_lineArray[iLine + 1].GetFirstChar() == iChar);
 }
 
 // When the user walks up and down through the document with the up and down
 // arrows, we need to know the size of the current line. CharToLineRect
-// returns a rectangle holding the dimensions of the line. Like CharToRect
+// returns a rectangle holding the dimensions of the line. Like GetHomeChar
 // above, we cannot fail in finding the correct line, so we have an check
-// watch at the end of the method.
+// watch. The top of the line is looked up in the prefix sum of the line
+// heights.
 
 CRect Paragraph::CharToLineRect(int iChar)
 {
-  int iParagraphHeight = 0;
-  int iLines = (int) m_lineArray.GetSize();
+  int iLine = FindLine(iChar);
+  Line line = m_lineArray[iLine];
+  check(iChar <= (line.GetLastChar() + 1));
+
+  int yLine = m_yStartPos + m_lineHeightSum.Sum(iLine);
+  return CRect(0, yLine, PAGE_WIDTH, yLine + line.GetHeight());
+}
+
+// SetAlignment sets the alignment of the paragraph. As every line has to be
+// positioned anew, the next call to Recalculate lays out the whole paragraph.
+
+void Paragraph::SetAlignment(Alignment eAlignment)
+{
+  m_eAlignment = eAlignment;
+  m_bLayoutValid = FALSE;
+}
+
+// A word starts at every character that is not a space and follows a space
+// or begins the text, so the number of words is the number of word starts.
+// CountWordStarts counts the word starts in the given range of the text,
+// which may extend beyond its end.
 
-  for (int iIndex = 0; iIndex < iLines; ++iIndex)
+int Paragraph::CountWordStarts(int iFirstIndex, int iLastIndex) const
+{
+  iLastIndex = min(iLastIndex, GetLength());
+  BOOL bPreviousSpace = (iFirstIndex == 0) ||
+                        _istspace((_TUCHAR) m_text[iFirstIndex - 1]);
+  int iStarts = 0;
+
+  for (int iIndex = iFirstIndex; iIndex < iLastIndex; ++iIndex)
   {
-    Line line = m_lineArray[iIndex];
-    int iLastChar = line.GetLastChar();
-    int iLineHeight = line.GetHeight();
+    BOOL bSpace = _istspace((_TUCHAR) m_text[iIndex]);
 
-    if (iChar <= (iLastChar + 1))
+    if (bPreviousSpace && !bSpace)
     {
-      return CRect(0, m_yStartPos + iParagraphHeight, PAGE_WIDTH,
-                   m_yStartPos + iParagraphHeight + iLineHeight);
+      ++iStarts;
     }
 
-    iParagraphHeight += iLineHeight;
+    bPreviousSpace = bSpace;
   }
 
-  check(FALSE);
-  return CRect();
+  return iStarts;
 }
 
-// Recalculate is called in order to recalculate the rectangle (m_rectArray)
-// and line (m_lineArray) arrays every time one or several character have be
-// added or removed, or when the font or the alignment has been changed.
+// When the characters of a range of the text are replaced, the word starts
+// that may change are those of the range and of the character following
+// it. Before the change, the word starts of the old range and its following
+// character are counted. UpdateWordCount is called after the change with
+// that count, and replaces it with the count of the new range and its
+// following character. Therefore, typing a character takes constant time,
+// however long the paragraph is.
 
-void Paragraph::Recalculate(CDC* pDC, RectSet* pRepaintSet /* = NULL */)
+void Paragraph::UpdateWordCount(int iIndex, int iInserted, int iOldStarts)
 {
-  RectArray oldRectArray;
+  m_iWords += CountWordStarts(iIndex, iIndex + iInserted + 1) - iOldStarts;
+}
 
-  if (pRepaintSet != NULL)
+// GetLineCount returns the number of lines of the paragraph. While its
+// layout is pending, it returns the number of lines of the estimated
+// height.
+
+int Paragraph::GetLineCount() const
+{
+  return m_bLayoutPending ? m_iEstimatedLines : (int) m_lineArray.GetSize();
+}
+
+// InvalidateLayout is called every time iRemoved characters at the given
+// index have been replaced by iInserted characters. It keeps the size,
+// ascent, and rectangle arrays in line with the text, and extends the dirty
+// range that the next call to Recalculate needs to lay out. The entries of
+// characters that are replaced rather than removed or inserted are kept, as
+// their old rectangles are needed when the repaint region is generated.
+
+void Paragraph::InvalidateLayout(int iIndex, int iRemoved, int iInserted)
+{
+  int iKept = min(iRemoved, iInserted);
+  int iKeptIndex = iIndex + iKept;
+
+  if (iRemoved > iKept)
   {
-    oldRectArray.Copy(m_rectArray);
+    m_rectArray.RemoveAt(iKeptIndex, iRemoved - iKept);
   }
 
-  m_iHeight = 0;
-  m_lineArray.RemoveAll();
-  m_rectArray.RemoveAll();
+  if (iInserted > iKept)
+  {
+    CRect rcEmpty(0, 0, 0, 0);
+    m_rectArray.InsertAt(iKeptIndex, rcEmpty, iInserted - iKept);
+  }
 
-  // If the paragraph is empty, we find the height and average width of a
-  // character of the empty font. 
+  // If the layout is not valid, the whole paragraph will be laid out anyway,
+  // and there is no point in keeping track of the sizes or the dirty range.
 
-  if (m_stText.IsEmpty())
+  if (!m_bLayoutValid)
   {
-    CFont cFont;
-    cFont.CreateFontIndirect(m_emptyFont.PointsToMeters());
-    CFont* pPrevFont = pDC->SelectObject(&cFont);
+    return;
+  }
 
-    TEXTMETRIC textMetric;
-    pDC->GetTextMetrics(&textMetric);
-    pDC->SelectObject(pPrevFont);
+  if (iRemoved > iKept)
+  {
+    m_sizeArray.RemoveAt(iKeptIndex, iRemoved - iKept);
+    m_ascentArray.RemoveAt(iKeptIndex, iRemoved - iKept);
+  }
+
+  if (iInserted > iKept)
+  {
+    m_sizeArray.InsertAt(iKeptIndex, CSize(0, 0), iInserted - iKept);
+    m_ascentArray.InsertAt(iKeptIndex, 0, iInserted - iKept);
+  }
+
+  // The end of a previous dirty range is moved the same way as the text
+  // following it. Then the range is extended to cover the new characters.
+
+  if (m_iFirstDirty == -1)
+  {
+    m_iFirstDirty = iIndex;
+    m_iLastDirty = iIndex + iInserted;
+  }
+
+  else
+  {
+    if (m_iLastDirty >= (iIndex + iRemoved))
+    {
+      m_iLastDirty += iInserted - iRemoved;
+    }
+
+    else if (m_iLastDirty > iIndex)
+    {
+      m_iLastDirty = iIndex + iInserted;
+    }
+
+    m_iFirstDirty = min(m_iFirstDirty, iIndex);
+    m_iLastDirty = max(m_iLastDirty, iIndex + iInserted);
+  }
+
+  m_iDirtyDelta += iInserted - iRemoved;
+}
+
+// Recalculate is called in order to recalculate the rectangle (m_rectArray)
+// and line (m_lineArray) arrays every time one or several character have be
+// added or removed, or when the font or the alignment has been changed. If
+// the previous layout is still valid, only the lines around the dirty range
+// are laid out anew by RecalculateDirtyLines. Otherwise, the whole
+// paragraph is laid out.
+
+void Paragraph::Recalculate(CDC* pDC, FontCache* pFontCache,
+                            RepaintRegion* pRepaintRegion /* = NULL */)
+{
+  // If the paragraph is empty, we find the height and average width of a
+  // character of the empty font. The whole paragraph is repainted.
+
+  if (m_text.IsEmpty())
+  {
+    const TEXTMETRIC& textMetric =
+      pFontCache->GetTextMetrics(StyleTable::GetStyle(m_emptyFont), pDC);
 
     m_iHeight = textMetric.tmHeight;
     m_iEmptyAverageWidth = textMetric.tmAveCharWidth;
 
+    m_sizeArray.RemoveAll();
+    m_ascentArray.RemoveAll();
+    m_rectArray.RemoveAll();
+
     Line line(0, 0, 0);
+    m_lineArray.RemoveAll();
     m_lineArray.Add(line);
+    GenerateLineHeightSum();
+
+    if (pRepaintRegion != NULL)
+    {
+      CRect rcTotalBlock(0, 0, PAGE_WIDTH, m_iHeight);
+      pRepaintRegion->Add(rcTotalBlock + CSize(0, m_yStartPos));
+    }
+
+    m_bLayoutValid = FALSE;
   }
 
-  // If the paragraph is not empty we generate arrays of size and ascent lines
-  // for every character as well as the line and rectangle array by calling
-  // GenerateSizeArray, GenerateAscentArray, GenerateLineArray, and
-  // GenerateRectArray.
+  // If the paragraph is not empty and its layout is not valid, we generate
+  // arrays of size and ascent lines for every character as well as the line
+  // and rectangle array by calling GenerateSizeArray, GenerateAscentArray,
+  // GenerateLineArray, and GenerateRectArray.
 
-  else
+  else if (!m_bLayoutValid)
   {
-    SizeArray sizeArray;
-    GenerateSizeArray(sizeArray, pDC);
+    RectArray oldRectArray;
+
+    if (pRepaintRegion != NULL)
+    {
+      oldRectArray.Copy(m_rectArray);
+    }
+
+    GenerateSizeArray(pDC, pFontCache);
+    GenerateAscentArray(pDC, pFontCache);
+    GenerateLineArray();
+    GenerateRectArray();
+
+    if (pRepaintRegion != NULL)
+    {
+      GenerateRepaintRegion(oldRectArray, 0, (int) m_lineArray.GetSize(), 0,
+                            pRepaintRegion);
+    }
 
-    IntArray ascentArray;
-    GenerateAscentArray(ascentArray, pDC);
+    m_bLayoutValid = TRUE;
+  }
 
-    GenerateLineArray(sizeArray);
-    GenerateRectArray(sizeArray, ascentArray);
+  else if (m_iFirstDirty != -1)
+  {
+    RecalculateDirtyLines(pDC, pFontCache, pRepaintRegion);
   }
 
-  // Finally, if the pointer to the repaint set is not null, we also call
-  // GenerateRepaintSet.
+  m_bLayoutPending = FALSE;
+  m_iFirstDirty = -1;
+  m_iLastDirty = -1;
+  m_iDirtyDelta = 0;
+}
+
+// DeferLayout postpones the layout of the paragraph until it is needed,
+// which is when it becomes visible, is printed or saved, or is laid out in
+// the background. Until then, its height is estimated from the size of a
+// typical character of its first font, as if the text filled every line.
+// An empty paragraph is cheap to lay out, so it is laid out at once.
 
-  if (pRepaintSet != NULL)
+void Paragraph::DeferLayout(CDC* pDC, FontCache* pFontCache)
+{
+  if (m_text.IsEmpty())
   {
-    GenerateRepaintSet(oldRectArray, pRepaintSet);
+    Recalculate(pDC, pFontCache);
+    return;
   }
+
+  int iStyle = m_fontRunArray.GetStyle(0);
+  CSize szChar = pFontCache->GetCharSize(iStyle, TEXT('n'), pDC);
+
+  int iTextWidth = m_text.GetLength() * szChar.cx;
+  m_iEstimatedLines = max(1, (iTextWidth + PAGE_WIDTH - 1) / PAGE_WIDTH);
+  m_iHeight = m_iEstimatedLines * szChar.cy;
+
+  m_bLayoutValid = FALSE;
+  m_bLayoutPending = TRUE;
+  m_iFirstDirty = -1;
+  m_iLastDirty = -1;
+  m_iDirtyDelta = 0;
 }
 
-// ClearRectArray sets the rectangle array of the paragraph to empty.
+// RecalculateDirtyLines lays out the lines around the dirty range. Only the
+// characters of the dirty range are measured anew. The line breaking
+// restarts at the line preceding the line holding the first dirty
+// character, since the first word of that line may now fit on the preceding
+// line. As the break of a line depends on nothing but its first character
+// and the characters following it, the breaking stops as soon as a line
+// beyond the dirty range starts where an old line started, moved by the
+// number of inserted or removed characters. The old lines from that point on
+// are kept, and the rectangles are generated for the new lines only.
+
+void Paragraph::RecalculateDirtyLines(CDC* pDC, FontCache* pFontCache,
+                                      RepaintRegion* pRepaintRegion)
+{
+  MeasureChars(m_iFirstDirty, m_iLastDirty, pDC, pFontCache);
+
+  int iOldLines = (int) m_lineArray.GetSize();
+  int iFirstLine = max(0, FindLine(m_iFirstDirty) - 1);
+  int iFirstChar = m_lineArray[iFirstLine].GetFirstChar();
+
+  int yFirstLine = m_lineHeightSum.Sum(iFirstLine);
+
+  // We break new lines until they converge with the old ones. If they never
+  // do, the new lines replace the rest of the old lines.
+
+  LineArray newLineArray;
+  int iLength = m_text.GetLength(), iStartIndex = iFirstChar;
+  int iOldLine = iFirstLine + 1, iLastOldLine = iOldLines;
+
+  while (iStartIndex < iLength)
+  {
+    if (iStartIndex >= m_iLastDirty)
+    {
+      int iOldStartIndex = iStartIndex - m_iDirtyDelta;
+
+      while ((iOldLine < iOldLines) &&
+             (m_lineArray[iOldLine].GetFirstChar() < iOldStartIndex))
+      {
+        ++iOldLine;
+      }
+
+      if ((iOldLine < iOldLines) &&
+          (m_lineArray[iOldLine].GetFirstChar() == iOldStartIndex))
+      {
+        iLastOldLine = iOldLine;
+        break;
+      }
+    }
+
+    Line line;
+    iStartIndex = BreakLine(iStartIndex, line);
+    newLineArray.Add(line);
+  }
+
+  int iLastChar = iStartIndex;
+  int iOldHeight = m_lineHeightSum.Sum(iLastOldLine) - yFirstLine;
+
+  // The new lines replace the old ones, and the kept lines are moved by the
+  // number of inserted or removed characters. The heights of the lines that
+  // replace other lines are set in the prefix sum, while the heights of the
+  // remaining old or new lines are removed or inserted.
+
+  int iOldLineCount = iLastOldLine - iFirstLine;
+  int iNewLines = (int) newLineArray.GetSize();
+  int iReplacedLines = min(iOldLineCount, iNewLines);
+
+  m_lineArray.RemoveAt(iFirstLine, iOldLineCount);
+  m_lineArray.InsertAt(iFirstLine, &newLineArray);
+
+  for (int iLine = 0; iLine < iReplacedLines; ++iLine)
+  {
+    m_lineHeightSum.Set(iFirstLine + iLine, newLineArray[iLine].GetHeight());
+  }
+
+  if (iOldLineCount > iReplacedLines)
+  {
+    m_lineHeightSum.RemoveAt(iFirstLine + iReplacedLines,
+                             iOldLineCount - iReplacedLines);
+  }
+
+  else if (iNewLines > iReplacedLines)
+  {
+    PrefixSum<int> insertSum;
+
+    for (int iLine = iReplacedLines; iLine < iNewLines; ++iLine)
+    {
+      insertSum.Add(newLineArray[iLine].GetHeight());
+    }
+
+    m_lineHeightSum.InsertAt(iFirstLine + iReplacedLines, insertSum);
+  }
+
+  if (m_iDirtyDelta != 0)
+  {
+    int iLines = (int) m_lineArray.GetSize();
+    for (int iLine = iFirstLine + iNewLines; iLine < iLines; ++iLine)
+    {
+      Line line = m_lineArray[iLine];
+      m_lineArray[iLine] = Line(line.GetFirstChar() + m_iDirtyDelta,
+                                line.GetLastChar() + m_iDirtyDelta,
+                                line.GetHeight());
+    }
+  }
+
+  // The old rectangles of the new lines are saved for the repaint region
+  // before the new rectangles are generated.
+
+  RectArray oldRectArray;
+
+  if (pRepaintRegion != NULL)
+  {
+    for (int iIndex = iFirstChar; iIndex < iLastChar; ++iIndex)
+    {
+      oldRectArray.Add(m_rectArray[iIndex]);
+    }
+  }
+
+  int yLineTop = yFirstLine;
+  for (int iLine = iFirstLine; iLine < (iFirstLine + iNewLines); ++iLine)
+  {
+    Line line = m_lineArray[iLine];
+    GenerateLineRects(line, yLineTop);
+    yLineTop += line.GetHeight();
+  }
+
+  int iNewHeight = yLineTop - yFirstLine;
+
+  // If the new lines are higher or lower than the old ones, the kept lines
+  // are moved vertically.
+
+  int iHeightDelta = iNewHeight - iOldHeight;
+  m_iHeight += iHeightDelta;
+
+  if (iHeightDelta != 0)
+  {
+    for (int iIndex = iLastChar; iIndex < iLength; ++iIndex)
+    {
+      m_rectArray[iIndex].OffsetRect(0, iHeightDelta);
+    }
+  }
+
+  if (pRepaintRegion != NULL)
+  {
+    GenerateRepaintRegion(oldRectArray, iFirstLine, iFirstLine + iNewLines,
+                          yFirstLine, pRepaintRegion);
+
+    // If the kept lines have been moved, the area from the end of the new
+    // lines to the end of the paragraph, at its old or new height, is also
+    // repainted.
+
+    if (iHeightDelta != 0)
+    {
+      CRect rcMovedBlock(0, yFirstLine + min(iOldHeight, iNewHeight),
+                         PAGE_WIDTH, max(m_iHeight, m_iHeight - iHeightDelta));
+      pRepaintRegion->Add(rcMovedBlock + CSize(0, m_yStartPos));
+    }
+  }
+}
+
+// ClearRectArray sets the rectangle array of the paragraph to empty. As the
+// whole paragraph needs to be repainted, the next call to Recalculate lays
+// out the whole paragraph.
 
 void Paragraph::ClearRectArray()
 {
   CRect emptyRect(0, 0, 0, 0);
   int iSize = (int) m_rectArray.GetSize();
-  
+
   for (int iIndex = 0; iIndex < iSize; ++iIndex)
   {
     m_rectArray[iIndex] = emptyRect;
   }
+
+  m_bLayoutValid = FALSE;
 }
 
-// GenerateSizeArray fills the given array with the size (width and height) of
-// every character in the paragraph (in logical units). For every character,
-// we load the device context with the font. Note that we have to translate
-// the font from typographical points at hundreds of millimeters by calling
-// PointToMeters.
+// GenerateSizeArray fills the size array with the size (width and height) of
+// every character in the paragraph (in logical units). The sizes are looked
+// up in the font cache of the document, which measures each font once. The
+// entry of each font run is looked up once for the whole run. A cluster of
+// several code units is measured as a whole; its first code unit is given
+// its width, and the rest of them no width.
 
-void Paragraph::GenerateSizeArray(SizeArray& sizeArray, CDC* pDC)
+void Paragraph::GenerateSizeArray(CDC* pDC, FontCache* pFontCache)
 {
-  int iLength = m_stText.GetLength();
-  for (int iChar = 0; iChar < iLength; ++iChar)
-  {
-    CFont cFont;
-    Font font = m_fontArray[iChar];
-    cFont.CreateFontIndirect(font.PointsToMeters());
-    CFont* pPrevFont = pDC->SelectObject(&cFont);
-
-    CString stChar = m_stText.Mid(iChar, 1);
-    CSize szChar = pDC->GetTextExtent(stChar);
+  m_sizeArray.RemoveAll();
 
-    // Characters written in italic tend to request slightly more space, so we
-    // increase the size with 20 percent. Also plain text tend to need a
-    // little bit more space, why we increase the size with 10 percent.
+  CString stBuffer;
+  const TCHAR* pText = m_text.GetText(stBuffer);
+  int iLength = m_text.GetLength();
 
-    szChar.cx = (int) ((font.IsItalic() ? 1.2 : 1.1) * szChar.cx);
-    szChar.cy = (int) ((font.IsItalic() ? 1.2 : 1.1) * szChar.cy);
+  int iRuns = m_fontRunArray.GetRunCount(), iChar = 0;
+  for (int iRun = 0; iRun < iRuns; ++iRun)
+  {
+    const FontRun& run = m_fontRunArray.GetRun(iRun);
+    int iRunEnd = iChar + run.GetLength();
+    FontEntry* pEntry = pFontCache->GetEntry(run.GetStyle(), pDC);
 
-    sizeArray.Add(szChar);
-    pDC->SelectObject(pPrevFont);
+    while (iChar < iRunEnd)
+    {
+      int iNextChar = min(::NextCluster(pText, iLength, iChar), iRunEnd);
+      CSize szChar = (iNextChar == (iChar + 1))
+                     ? pEntry->GetCharSize(pText[iChar], pDC)
+                     : pEntry->GetClusterSize(pText + iChar,
+                                              iNextChar - iChar, pDC);
+      m_sizeArray.Add(szChar);
+
+      for (++iChar; iChar < iNextChar; ++iChar)
+      {
+        m_sizeArray.Add(CSize(0, szChar.cy));
+      }
+    }
   }
 }
 
-// GenerateAscentArray fills the given array with the ascent line of every
-// character in the paragraph (in logical units). For every character, we load
-// the device context with the font. Note that we have to translate the font
-// from typographical points at hundreds of millimeters by calling
-// PointToMeters.
+// GenerateAscentArray fills the ascent array with the ascent line of every
+// character in the paragraph (in logical units). As every character of a
+// font run has the same ascent line, we look it up in the font cache once
+// for every run.
 
-void Paragraph::GenerateAscentArray(IntArray& ascentArray, CDC* pDC)
+void Paragraph::GenerateAscentArray(CDC* pDC, FontCache* pFontCache)
 {
-  int iSize = (int) m_fontArray.GetSize();
-  for (int iIndex = 0; iIndex < iSize; ++iIndex)
-  {
-    CFont cFont;
-    Font font = m_fontArray[iIndex];
-    cFont.CreateFontIndirect(font.PointsToMeters());
-    CFont* pPrevFont = pDC->SelectObject(&cFont);
+  m_ascentArray.RemoveAll();
 
-    TEXTMETRIC textMetric;
-    pDC->GetTextMetrics(&textMetric);
-    pDC->SelectObject(pPrevFont);
+  int iRuns = m_fontRunArray.GetRunCount();
+  for (int iRun = 0; iRun < iRuns; ++iRun)
+  {
+    const FontRun& run = m_fontRunArray.GetRun(iRun);
+    int iAscent = pFontCache->GetTextMetrics(run.GetStyle(), pDC).tmAscent;
 
-    ascentArray.Add(textMetric.tmAscent);
+    for (int iChar = 0; iChar < run.GetLength(); ++iChar)
+    {
+      m_ascentArray.Add(iAscent);
+    }
   }
 }
 
-// GenerateLineArray generates the line array. We have to decide how many
-// words each line can hold. We traverse through the text, calculate the size
-// of each word and when the next word does not fit on the line, we start a
-// new line and save the index of the first and last character on the line as
-// well as the height of the line (the height of the highest character).
+// MeasureChars looks up the size and ascent line of the characters from the
+// first index up to, but not including, the last index. The range is first
+// widened to whole clusters, as a code unit inserted into a cluster or
+// removed from it changes the width of the whole cluster.
 
-void Paragraph::GenerateLineArray(SizeArray& sizeArray)
+void Paragraph::MeasureChars(int iFirstIndex, int iLastIndex, CDC* pDC,
+                             FontCache* pFontCache)
 {
-  BOOL bSpace = FALSE;
-  int iSpaceIndex = 0, iStartIndex = 0, iLineWidth = 0, iLineHeight = 0,
-      iSpaceLineHeight = 0;
-  int iSize = m_stText.GetLength(), iIndex = 0;
+  int iLength = m_text.GetLength();
+
+  if (!::IsClusterStart(m_text, iLength, iFirstIndex,
+                        FindClusterBound(iFirstIndex)))
+  {
+    iFirstIndex = PreviousCluster(iFirstIndex);
+  }
 
-  while (iIndex < iSize)
+  if (!::IsClusterStart(m_text, iLength, iLastIndex,
+                        FindClusterBound(iLastIndex)))
   {
-    CSize szChar = sizeArray[iIndex];
-    iLineHeight = max(iLineHeight, szChar.cy);
+    iLastIndex = NextCluster(PreviousCluster(iLastIndex));
+  }
 
-    // The latest space is a suitable point to break the line at.
+  int iIndex = iFirstIndex;
+  while (iIndex < iLastIndex)
+  {
+    int iStyle = m_fontRunArray.GetStyle(iIndex);
+    int iNextIndex = NextCluster(iIndex);
+    int iAscent = pFontCache->GetTextMetrics(iStyle, pDC).tmAscent;
+    CSize szChar;
 
-    if (m_stText[iIndex] == TEXT(' '))
+    if (iNextIndex == (iIndex + 1))
     {
-      bSpace = TRUE;
-      iSpaceIndex = iIndex;
-      iSpaceLineHeight = iLineHeight;
+      szChar = pFontCache->GetCharSize(iStyle, m_text[iIndex], pDC);
     }
 
-    iLineWidth += szChar.cx;
-
-    // When no more characters fit on the line, we break it and look up the
-    // latest space. 
-
-    if (iLineWidth > PAGE_WIDTH)
+    else
     {
-      if (bSpace)
-      {
-        Line line(iStartIndex, iSpaceIndex - 1,
-                  iSpaceLineHeight);
-        m_lineArray.Add(line);
+      CString stCluster = m_text.Mid(iIndex, iNextIndex - iIndex);
+      szChar = pFontCache->GetEntry(iStyle, pDC)->
+               GetClusterSize(stCluster, stCluster.GetLength(), pDC);
+    }
 
-        iStartIndex = iSpaceIndex + 1;
-        iLineWidth = 0;
-        iLineHeight = 0;
+    m_sizeArray[iIndex] = szChar;
+    m_ascentArray[iIndex] = iAscent;
 
-        bSpace = FALSE;
-        iIndex = iStartIndex;
-      }
+    for (++iIndex; iIndex < iNextIndex; ++iIndex)
+    {
+      m_sizeArray[iIndex] = CSize(0, szChar.cy);
+      m_ascentArray[iIndex] = iAscent;
+    }
+  }
+}
 
-      else if (iStartIndex < iIndex)
-      {
-        Line line(iStartIndex, iIndex - 1, iLineHeight);
-        m_lineArray.Add(line);
+// FindLine returns the index of the line holding the given character, where
+// a character following the last character of a line also belongs to that
+// line. As the lines are sorted, we perform a binary search.
 
-        iStartIndex = iIndex;
-        iLineWidth = 0;
-        iLineHeight = 0;
-      }
+int Paragraph::FindLine(int iChar) const
+{
+  int iMinLine = 0, iMaxLine = (int) m_lineArray.GetSize() - 1;
 
-      else
-      {
-        Line line(iStartIndex, iIndex, iLineHeight);
-        m_lineArray.Add(line);
+  while (iMinLine < iMaxLine)
+  {
+    int iMiddleLine = (iMinLine + iMaxLine) / 2;
 
-        ++iIndex;
-        iStartIndex = iIndex;
-        iLineWidth = 0;
-        iLineHeight = 0;
-      }
+    if ((m_lineArray[iMiddleLine].GetLastChar() + 1) >= iChar)
+    {
+      iMaxLine = iMiddleLine;
     }
 
     else
     {
-      ++iIndex;
+      iMinLine = iMiddleLine + 1;
     }
   }
 
-  // If there are character left after the latest line break, we add them too.
+  return iMinLine;
+}
+
+// FindClusterBound returns a cluster start at or before the given index,
+// beyond which the search for the start of the cluster holding the index
+// need not look. As a line is never broken inside a cluster, the first
+// character of a line is a cluster start, and it remains one as long as the
+// text before it is unchanged; that is, if the layout is valid and the
+// line does not begin after the dirty range. Otherwise, the beginning of the
+// paragraph is returned.
 
-  if (iStartIndex < iSize)
+int Paragraph::FindClusterBound(int iIndex) const
+{
+  if (!m_bLayoutValid || m_lineArray.IsEmpty() || (iIndex <= 0))
   {
-    Line line(iStartIndex, iSize - 1, iLineHeight);
+    return 0;
+  }
+
+  int iLimit = (m_iFirstDirty == -1) ? iIndex : min(iIndex, m_iFirstDirty);
+  int iFirstChar = m_lineArray[FindLine(iLimit)].GetFirstChar();
+  return ((iFirstChar >= 0) && (iFirstChar <= iLimit)) ? iFirstChar : 0;
+}
+
+// BreakLine finds the line starting at the given index. We traverse the text,
+// calculate the size of each word and when the next word does not fit on the
+// line, we break the line and save the index of the first and last character
+// on the line as well as the height of the line (the height of the highest
+// character). The breaking rules are shared with the layout library in
+// LayoutCore.h. BreakLine returns the index of the first character of the
+// next line.
+
+int Paragraph::BreakLine(int iStartIndex, Line& line) const
+{
+  int iLastChar, iHeight;
+  int iNextIndex = ::BreakLine(m_text, m_sizeArray, iStartIndex,
+                               m_text.GetLength(), PAGE_WIDTH, iLastChar,
+                               iHeight);
+
+  line = Line(iStartIndex, iLastChar, iHeight);
+  return iNextIndex;
+}
+
+// GenerateLineArray generates the line array by breaking the lines of the
+// paragraph one by one.
+
+void Paragraph::GenerateLineArray()
+{
+  m_lineArray.RemoveAll();
+  int iSize = m_text.GetLength(), iStartIndex = 0;
+
+  while (iStartIndex < iSize)
+  {
+    Line line;
+    iStartIndex = BreakLine(iStartIndex, line);
     m_lineArray.Add(line);
   }
+
+  GenerateLineHeightSum();
 }
 
-// GenerateRectArray generates the rectangle array. With the size, ascent, and
-// line arrays, we calculate the rectangle of each character.
+// GenerateLineHeightSum generates the prefix sum of the line heights, which
+// gives the top of each line.
 
-void Paragraph::GenerateRectArray(SizeArray& sizeArray, IntArray& ascentArray)
+void Paragraph::GenerateLineHeightSum()
 {
+  m_lineHeightSum.SetSize(0, 0);
   int iLines = (int) m_lineArray.GetSize();
 
-  // First, we traverse the lines of the paragraph, one by one.
-  // We find the first and last character of the first line,
-  // the paragraphs has always at least one line.
+  for (int iLine = 0; iLine < iLines; ++iLine)
+  {
+    m_lineHeightSum.Add(m_lineArray[iLine].GetHeight());
+  }
+}
+
+// GenerateRectArray generates the rectangle array. With the size, ascent, and
+// line arrays, we calculate the rectangle of each character, line by line.
+// The height of the paragraph is the sum of the heights of its lines.
+
+void Paragraph::GenerateRectArray()
+{
+  CRect rcEmpty(0, 0, 0, 0);
+  m_rectArray.RemoveAll();
+  m_rectArray.InsertAt(0, rcEmpty, m_text.GetLength());
+
+  m_iHeight = 0;
+  int iLines = (int) m_lineArray.GetSize();
 
   for (int iLineIndex = 0; iLineIndex < iLines; ++iLineIndex)
   {
-    // First, we need to find the height, ascent line and width of the line.
-
     Line line = m_lineArray[iLineIndex];
-    int iFirstChar = line.GetFirstChar();
-    int iLastChar = line.GetLastChar();
+    GenerateLineRects(line, m_iHeight);
+    m_iHeight += line.GetHeight();
+  }
+}
 
-    int iLineWidth = 0, iLineHeight = 0, iLineAscent = 0;
-    for (int iIndex = iFirstChar; iIndex <= iLastChar; ++iIndex)
-    {
-      TCHAR cChar = m_stText[iIndex];
-      CSize szChar = sizeArray[iIndex];
-
-      // The width of the line is the sum of the width of all characters. If
-      // the character is a space and the paragraph has justified alignment,
-      // we do not include its width into the total width because later on we
-      // need to compute the width of the line without the spaces.
- 
-      if (!((cChar == TEXT(' ')) && (m_eAlignment == ALIGN_JUSTIFIED)))
-      {
-        iLineWidth += szChar.cx;
-      }
+// GenerateLineRects calculates the rectangles of the characters of the given
+// line, whose top is at the given position.
+
+void Paragraph::GenerateLineRects(const Line& line, int yLineTop)
+{
+  // First, we need to find the ascent line and width of the line.
 
-      // The height of the line is the height of the highest character.
-      iLineHeight = max(iLineHeight, szChar.cy);
+  int iFirstChar = line.GetFirstChar();
+  int iLastChar = line.GetLastChar();
 
-      // The accent line of the line is the ascent line of the character with
-      // the highest ascent.
-      iLineAscent = max(iLineAscent, ascentArray[iIndex]);
-    }
+  int iLineWidth = 0, iLineAscent = 0;
+  for (int iIndex = iFirstChar; iIndex <= iLastChar; ++iIndex)
+  {
+    TCHAR cChar = m_text[iIndex];
+    CSize szChar = m_sizeArray[iIndex];
 
-    // We find the start position of the line by considering the alignment of
-    // the paragraph and the width of the line.
+    // The width of the line is the sum of the width of all characters. If
+    // the character is a space and the paragraph has justified alignment,
+    // we do not include its width into the total width because later on we
+    // need to compute the width of the line without the spaces.
 
-    int xStartPos = 0, iSpaceWidth = 0;
-    switch (m_eAlignment)
+    if (!((cChar == TEXT(' ')) && (m_eAlignment == ALIGN_JUSTIFIED)))
     {
-      // If left alignment, the line start at the left side.
-
-      case ALIGN_LEFT:
-        xStartPos = 0;
-        break;
+      iLineWidth += szChar.cx;
+    }
 
-      // If center and right alignment, we compute the start position by
-      // comparing width of the line with the width of the page.
+    // The accent line of the line is the ascent line of the character with
+    // the highest ascent.
+    iLineAscent = max(iLineAscent, m_ascentArray[iIndex]);
+  }
 
-      case ALIGN_CENTER:
-        xStartPos = (PAGE_WIDTH - iLineWidth) / 2;
-        break;
+  // We find the start position of the line by considering the alignment of
+  // the paragraph and the width of the line.
 
-      case ALIGN_RIGHT:
-        xStartPos = PAGE_WIDTH - iLineWidth;
-        break;
+  int xStartPos = 0, iSpaceWidth = 0;
+  switch (m_eAlignment)
+  {
+    // If left alignment, the line start at the left side.
 
-      // If justified alignment, we need to find the number of spaces on the
-      // line and calculate the width of each space in order for the line to
-      // completely fill the width of the page.
+    case ALIGN_LEFT:
+      xStartPos = 0;
+      break;
 
-      case ALIGN_JUSTIFIED:
-        xStartPos = 0;
-        CString stTemp = m_stText.Mid(iFirstChar, iLastChar - iFirstChar + 1);
-        int iSpaces = stTemp.Remove(TEXT(' '));
+    // If center and right alignment, we compute the start position by
+    // comparing width of the line with the width of the page.
 
-        if (iSpaces > 0)
-        {
-            iSpaceWidth = (PAGE_WIDTH - iLineWidth) / iSpaces;
-        }
-        break;
-    }
+    case ALIGN_CENTER:
+      xStartPos = (PAGE_WIDTH - iLineWidth) / 2;
+      break;
 
-    // Finally, we calculate the rectangle for each character. We traverse the
-    // line and with the sizes of the characters and the height and ascent
-    // line of the line we find each rectangle. We start by the start position
-    // we found above and increase the position for each character on the
-    // line.
+    case ALIGN_RIGHT:
+      xStartPos = PAGE_WIDTH - iLineWidth;
+      break;
 
-    int xLeftPos = xStartPos, iWidth = 0, yTopPos = 0, iHeight = 0;
-    for (int iIndex = iFirstChar; iIndex <= iLastChar; ++iIndex)
-    {
-      CSize szChar = sizeArray[iIndex];
-      int iAscent = ascentArray[iIndex];         
+    // If justified alignment, we need to find the number of spaces on the
+    // line and calculate the width of each space in order for the line to
+    // completely fill the width of the page.
 
-      // If the paragraph has justified alignment and the character is a
-      // space, we use the space width calculated above.
+    case ALIGN_JUSTIFIED:
+      xStartPos = 0;
+      CString stTemp = m_text.Mid(iFirstChar, iLastChar - iFirstChar + 1);
+      int iSpaces = stTemp.Remove(TEXT(' '));
 
-      if ((m_stText[iIndex] == TEXT(' ')) && (m_eAlignment == ALIGN_JUSTIFIED))
-      {
-        iWidth = iSpaceWidth;
-      }
-  
-      else
+      if (iSpaces > 0)
       {
-        iWidth = szChar.cx;
+          iSpaceWidth = (PAGE_WIDTH - iLineWidth) / iSpaces;
       }
+      break;
+  }
 
-      yTopPos = m_iHeight + iLineAscent - iAscent;
-      iHeight = szChar.cy;
+  // Finally, we calculate the rectangle for each character. We traverse the
+  // line and with the sizes of the characters and the ascent line of the
+  // line we find each rectangle. We start by the start position we found
+  // above and increase the position for each character on the line.
 
-      CRect rcChar(xLeftPos, yTopPos, xLeftPos + iWidth, yTopPos + iHeight);
-      m_rectArray.Add(rcChar);
-      xLeftPos += iWidth;
-    }
+  int xLeftPos = xStartPos, iWidth = 0, yTopPos = yLineTop, iHeight = 0;
+  for (int iIndex = iFirstChar; iIndex <= iLastChar; ++iIndex)
+  {
+    CSize szChar = m_sizeArray[iIndex];
+    int iAscent = m_ascentArray[iIndex];
 
-    // If we are not on the last line in of the paragraph and if there is a
-    // blank character between this line and the next one, we add a rectangle
-    // for it.
+    // If the paragraph has justified alignment and the character is a
+    // space, we use the space width calculated above.
 
-    if ((iLastChar < (m_stText.GetLength() - 1)) &&
-        (m_stText[iLastChar + 1] == ' '))
+    if ((m_text[iIndex] == TEXT(' ')) && (m_eAlignment == ALIGN_JUSTIFIED))
+    {
+      iWidth = iSpaceWidth;
+    }
+
+    else
     {
-      CSize szChar = sizeArray[iLastChar + 1];
-      CRect rcChar(xLeftPos, yTopPos, xLeftPos + szChar.cx,
-                   yTopPos + iHeight);
-      m_rectArray.Add(rcChar);
+      iWidth = szChar.cx;
     }
 
-    // The height of the paragraph is increased with the height of this line.
-    m_iHeight += iLineHeight;
+    yTopPos = yLineTop + iLineAscent - iAscent;
+    iHeight = szChar.cy;
+
+    CRect rcChar(xLeftPos, yTopPos, xLeftPos + iWidth, yTopPos + iHeight);
+    m_rectArray[iIndex] = rcChar;
+    xLeftPos += iWidth;
+  }
+
+  // If we are not on the last line in of the paragraph and if there is a
+  // blank character between this line and the next one, we add a rectangle
+  // for it.
+
+  if ((iLastChar < (m_text.GetLength() - 1)) &&
+      (m_text[iLastChar + 1] == ' '))
+  {
+    CSize szChar = m_sizeArray[iLastChar + 1];
+    CRect rcChar(xLeftPos, yTopPos, xLeftPos + szChar.cx,
+                 yTopPos + iHeight);
+    m_rectArray[iLastChar + 1] = rcChar;
   }
 }
 
 // When a paragraph has been altered, we have to repaint the altered area of
 // the client area. However, we do not want to repaint the whole paragraph,
-// just the characters that need to be updated. GenerateRepaintSet
-// compares the original rectangle array with the newly generated one and
-// fills the repaint set with every rectangle that has been altered.
-
-void Paragraph::GenerateRepaintSet(RectArray& oldRectArray,
-                                      RectSet* pRepaintSet)
+// just the characters that need to be updated. GenerateRepaintRegion
+// compares the original rectangles of the given lines with the newly
+// generated ones and fills the repaint region with every rectangle that has
+// been altered. The old rectangle array holds the rectangles from the first
+// character of the first line, and the first line starts at the given
+// vertical position.
+
+void Paragraph::GenerateRepaintRegion(RectArray& oldRectArray,
+                                      int iFirstLine, int iLastLine,
+                                      int yFirstLine,
+                                      RepaintRegion* pRepaintRegion)
 {
   // Rememember that the positio of each character is relative its own
   // paragraph, we start by defining the top left corner of the paragraph
@@ -1156,82 +1906,73 @@ void Paragraph::GenerateRepaintSet(RectArray& oldRectArray,
 
   CSize szUpperLeft(0, m_yStartPos);
 
-  // We traverse the characters and add those that has been given new
-  // dimensions.
+  // We traverse the characters of the lines and add those that has been
+  // given new dimensions.
 
-  int iSize = (int) m_rectArray.GetSize();
-  for (int iIndex = 0; iIndex < iSize; ++iIndex)
+  int iFirstIndex = m_lineArray[iFirstLine].GetFirstChar();
+  int iLastIndex = (iLastLine < m_lineArray.GetSize())
+                   ? m_lineArray[iLastLine].GetFirstChar()
+                   : m_text.GetLength();
+
+  for (int iIndex = iFirstIndex; iIndex < iLastIndex; ++iIndex)
   {
-    CRect rcOldChar = oldRectArray[iIndex];
+    CRect rcOldChar = oldRectArray[iIndex - iFirstIndex];
     CRect rcNewChar = m_rectArray[iIndex];
 
     if (rcOldChar != rcNewChar)
     {
       if (!rcOldChar.IsRectEmpty())
       {
-        pRepaintSet->Add(rcOldChar + szUpperLeft);
+        pRepaintRegion->Add(rcOldChar + szUpperLeft);
       }
 
       if (!rcNewChar.IsRectEmpty())
       {
-        pRepaintSet->Add(rcNewChar + szUpperLeft);
+        pRepaintRegion->Add(rcNewChar + szUpperLeft);
       }
     }
   }
 
-  // If the paragraph in non-empty we add for each line the area to the left
-  // and to the right of the line.
+  // We traverse the lines and for each line find the before and after
+  // areas.
 
-  if (!m_stText.IsEmpty())
+  int iTotalHeight = yFirstLine;
+  for (int iLineIndex = iFirstLine; iLineIndex < iLastLine; ++iLineIndex)
   {
-    int iTotalHeight = 0;
-    int iLines = (int) m_lineArray.GetSize();
+    // We need the position of the first character of the line. We
+    // create and add the left area. We also need the height of the line.
+    // An empty line, which occurs when a space is followed by a word too
+    // long for the page, has no characters and no height, and is skipped.
 
-    // We traverse the lines and for each line find the before and after
-    // areas.
+    Line line = m_lineArray[iLineIndex];
+    int iFirstChar = line.GetFirstChar();
+    int iLastChar = line.GetLastChar();
+    int iHeight = line.GetHeight();
 
-    for (int iLineIndex = 0; iLineIndex < iLines; ++iLineIndex)
+    if (iFirstChar <= iLastChar)
     {
-      // We need the position of the first character of the line. We
-      // create and add the left area. We also need the height of the line.
-
-      Line line = m_lineArray[iLineIndex];
-      int iFirstChar = line.GetFirstChar();
-      int iHeight = line.GetHeight();
-
       CRect rcFirstChar = m_rectArray[iFirstChar];
       CRect rcLeftBlock(0, iTotalHeight, rcFirstChar.left,
                         iTotalHeight + iHeight);
 
       if (!rcLeftBlock.IsRectEmpty())
       {
-        pRepaintSet->Add(rcLeftBlock + szUpperLeft);
+        pRepaintRegion->Add(rcLeftBlock + szUpperLeft);
       }
 
-      // Finally, we look up the position of the first character of the line.
+      // Finally, we look up the position of the last character of the line.
       // We create and add the right area.
 
-      int iLastChar = line.GetLastChar();
       CRect rcLastChar = m_rectArray[iLastChar];
       CRect rcRightBlock(rcLastChar.right, iTotalHeight, PAGE_WIDTH,
                          iTotalHeight + iHeight);
 
       if (!rcRightBlock.IsRectEmpty())
       {
-        pRepaintSet->Add(rcRightBlock + szUpperLeft);
+        pRepaintRegion->Add(rcRightBlock + szUpperLeft);
       }
-
-      iTotalHeight += iHeight;
     }
-  }
 
-  // If the paragraph is empty, we just create and add an area holding the
-  // whole paragraph. Remember that even though the paragraph is empty, it
-  // still holds a height.
-
-  else
-  {
-    CRect rcTotalBlock(0, 0, PAGE_WIDTH, m_iHeight);
-    pRepaintSet->Add(rcTotalBlock + szUpperLeft);
+    iTotalHeight += iHeight;
   }
 }
@@ -1,14 +1,17 @@
 typedef CArray<int> IntArray;
 typedef CArray<CSize> SizeArray;
 typedef CArray<CRect> RectArray;
-typedef CArray<Font> FontArray;
 typedef CArray<Line> LineArray;
-typedef Set<CRect> RectSet;
 
 enum Alignment {ALIGN_LEFT, ALIGN_RIGHT, ALIGN_CENTER, ALIGN_JUSTIFIED};
 enum KeyboardState {KM_INSERT, KM_OVERWRITE};
+enum WordState {WS_EDIT, WS_MARK};
 
 class CWordDoc;
+class FontCache;
+class TextSearch;
+class WordFileReader;
+class WordFileWriter;
 
 class Paragraph
 {
@@ -18,12 +21,32 @@ class Paragraph
 
     Paragraph(const Paragraph& paragraph);
     void Serialize(CArchive& archive);
+    void Write(WordFileWriter& writer) const;
+    BOOL Read(WordFileReader& reader);
 
-    void Draw(CDC* pDC, int iFirstMarkedChar, int iLastMarkedChar) const;
+    CString GetText() const {return m_text.ToString();}
+    const FontRunArray& GetFontRuns() const {return m_fontRunArray;}
+    void SetText(const CString& stText, const FontRunArray& fontRunArray);
 
-    int GetLength() const {return m_stText.GetLength();}
+    void Draw(CDC* pDC, FontCache* pFontCache, int iFirstMarkedChar,
+              int iLastMarkedChar) const;
+
+  private:
+    void DrawSegment(CDC* pDC, FontCache* pFontCache, int iFirstChar,
+                     int iEndChar, int iStyle, BOOL bMarked,
+                     IntArray& widthArray) const;
+
+  public:
+
+    int GetLength() const {return m_text.GetLength();}
     int GetHeight() const {return m_iHeight;}
 
+    int GetWordCount() const {return m_iWords;}
+    int GetLineCount() const;
+
+    int GetSnapshotIndex() const {return m_iSnapshotIndex;}
+    void SetSnapshotIndex(int iIndex) {m_iSnapshotIndex = iIndex;}
+
     void SetStartPos(int yPos) {m_yStartPos = yPos;}
     int GetStartPos() const {return m_yStartPos;}
 
@@ -32,51 +55,93 @@ class Paragraph
     void DeleteText(int iFirstIndex = 0, int iLastIndex = -1);
 
     Alignment GetAlignment() const {return m_eAlignment;}
-    void SetAlignment(Alignment eAlignment) {m_eAlignment = eAlignment;}
+    void SetAlignment(Alignment eAlignment);
 
     Font GetFont(int iChar) const;
     void SetFont(Font font, int iFirstIndex = 0, int iLastindex = -1);
+    void SetStyle(int iStyle, int iFirstIndex = 0, int iLastIndex = -1);
 
-    void GetRepaintSet(RectSet& repaintSet, int iFirstIndex = 0,
+    void GetRepaintRegion(RepaintRegion& repaintRegion, int iFirstIndex = 0,
                           int iLastIndex = -1);
     BOOL GetWord(int iEditChar, int& iFirstChar, int& iLastChar);
 
     int GetHomeChar(int iChar) const;
     int GetEndChar(int iChar) const;
 
+    int NextCluster(int iChar) const;
+    int PreviousCluster(int iChar) const;
+
     Paragraph* ExtractText(int iFirstIndex = 0, int iLastIndex = -1) const;
     void Insert(int iChar, Paragraph* pInsertParagraph);
 
     void Append(Paragraph* pSecondParagraph);
     Paragraph* Split(int iChar);
 
+    int Find(const TextSearch& search, int iFirstIndex = 0,
+             int iLastIndex = -1) const;
+    int Replace(const TextSearch& search, const CString& stReplace,
+                int iFirstIndex = 0, int iLastIndex = -1);
+
     int PointToChar(CPoint ptMouse);
     CRect CharToRect(int iChar);
     CRect GetCaretRect(int iChar);
     BOOL isHomeChar(int iChar);
     CRect CharToLineRect(int iChar);
 
-    void Recalculate(CDC* pDC, RectSet* pRepaintSet = NULL);
+    void Recalculate(CDC* pDC, FontCache* pFontCache,
+                     RepaintRegion* pRepaintRegion = NULL);
+    void DeferLayout(CDC* pDC, FontCache* pFontCache);
+    BOOL IsLayoutPending() const {return m_bLayoutPending;}
     void ClearRectArray();
 
   private:
-    void GenerateSizeArray(SizeArray& sizeArray, CDC* pDC);
-    void GenerateAscentArray(IntArray& ascentArray, CDC* pDC);
-    void GenerateLineArray(SizeArray& sizeArray);
-    void GenerateRectArray(SizeArray& sizeArray, IntArray& ascentArray);
-    void GenerateRepaintSet(RectArray& oldRectArray,
-                               RectSet* pRepaintSet);
+    int CountWordStarts(int iFirstIndex, int iLastIndex) const;
+    void UpdateWordCount(int iIndex, int iInserted, int iOldStarts);
+
+    void InvalidateLayout(int iIndex, int iRemoved, int iInserted);
+    void RecalculateDirtyLines(CDC* pDC, FontCache* pFontCache,
+                               RepaintRegion* pRepaintRegion);
+
+    void GenerateSizeArray(CDC* pDC, FontCache* pFontCache);
+    void GenerateAscentArray(CDC* pDC, FontCache* pFontCache);
+    void MeasureChars(int iFirstIndex, int iLastIndex, CDC* pDC,
+                      FontCache* pFontCache);
+
+    int FindLine(int iChar) const;
+    int FindClusterBound(int iIndex) const;
+    int BreakLine(int iStartIndex, Line& line) const;
+    void GenerateLineArray();
+    void GenerateLineHeightSum();
+    void GenerateRectArray();
+    void GenerateLineRects(const Line& line, int yLineTop);
+    void GenerateRepaintRegion(RectArray& oldRectArray, int iFirstLine,
+                               int iLastLine, int yFirstLine,
+                               RepaintRegion* pRepaintRegion);
 
   private:
-    CString m_stText;
+    PieceTable m_text;
 
     Font m_emptyFont;
     int m_yStartPos, m_iEmptyAverageWidth, m_iHeight;
+    int m_iWords, m_iEstimatedLines, m_iSnapshotIndex;
     Alignment m_eAlignment;
 
-    FontArray m_fontArray;
+    FontRunArray m_fontRunArray;
     LineArray m_lineArray;
+    PrefixSum<int> m_lineHeightSum;
     RectArray m_rectArray;
+
+    // The sizes and ascent lines of the characters are kept between the
+    // layouts. The dirty range holds the characters that have been changed
+    // since the latest layout, and the delta the number of characters that
+    // have been inserted (or removed, if negative) since then. While the
+    // layout is pending, the height is an estimate and the lines and
+    // rectangles are out of date.
+
+    SizeArray m_sizeArray;
+    IntArray m_ascentArray;
+    BOOL m_bLayoutValid, m_bLayoutPending;
+    int m_iFirstDirty, m_iLastDirty, m_iDirtyDelta;
 };
 
 typedef CArray<Paragraph*> ParagraphPtrArray;
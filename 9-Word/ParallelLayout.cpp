@@ -0,0 +1,88 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Color.h"
+#include "Font.h"
+#include "Caret.h"
+#include "Check.h"
+#include "PrefixSum.h"
+
+#include "RepaintRegion.h"
+#include "Line.h"
+#include "Position.h"
+#include "PieceTable.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "FontCache.h"
+#include "Paragraph.h"
+
+#include "Page.h"
+#include "WordView.h"
+#include "ParallelLayout.h"
+#include "Threads.h"
+
+ParallelLayout::ParallelLayout(ParagraphPtrArray* pParagraphArray,
+                               FontCache* pFontCache)
+ :m_pParagraphArray(pParagraphArray),
+  m_pFontCache(pFontCache),
+  m_lNextParagraph(0),
+  m_iLastParagraph(-1)
+{
+  // Empty.
+}
+
+// LayOut runs the layout on one thread for each processor, but on no more
+// threads than there are chunks, and waits for all of them to finish.
+
+void ParallelLayout::LayOut(int iFirstParagraph, int iLastParagraph)
+{
+  m_lNextParagraph = iFirstParagraph;
+  m_iLastParagraph = iLastParagraph;
+
+  int iChunks = (iLastParagraph - iFirstParagraph + LAYOUT_CHUNK) /
+                LAYOUT_CHUNK;
+  RunThreads(LayoutThread, this, iChunks);
+}
+
+UINT ParallelLayout::LayoutThread(LPVOID pParam)
+{
+  ParallelLayout* pLayout = (ParallelLayout*) pParam;
+  pLayout->LayOutChunks();
+  return 0;
+}
+
+// LayOutChunks is run by each thread. It creates a memory device context
+// with the same logical units as the view, and takes the next chunk of
+// paragraphs by atomically advancing the index of the next paragraph.
+
+void ParallelLayout::LayOutChunks()
+{
+  CDC dc;
+  check(dc.CreateCompatibleDC(NULL));
+  CWordView::SetLogicalUnits(&dc);
+
+  while (TRUE)
+  {
+    int iFirstParagraph =
+      (int) ::InterlockedExchangeAdd(&m_lNextParagraph, LAYOUT_CHUNK);
+
+    if (iFirstParagraph > m_iLastParagraph)
+    {
+      break;
+    }
+
+    int iLastParagraph = min(iFirstParagraph + LAYOUT_CHUNK - 1,
+                             m_iLastParagraph);
+
+    for (int iParagraph = iFirstParagraph; iParagraph <= iLastParagraph;
+         ++iParagraph)
+    {
+      Paragraph* pParagraph = m_pParagraphArray->GetAt(iParagraph);
+
+      if (pParagraph->IsLayoutPending())
+      {
+        pParagraph->Recalculate(&dc, m_pFontCache);
+      }
+    }
+  }
+}
@@ -0,0 +1,26 @@
+const int LAYOUT_CHUNK = 64;
+
+// ParallelLayout lays out the pending paragraphs of a range on a number of
+// worker threads, one for each processor. The layout of a paragraph depends
+// on nothing but its own text and fonts, so the paragraphs are laid out
+// independently. The threads take chunks of LAYOUT_CHUNK paragraphs at a
+// time until the range is exhausted. Each thread measures the characters in
+// a memory device context of its own, while the fonts are shared through the
+// font cache of the document. The pagination is left to the caller.
+
+class ParallelLayout
+{
+  public:
+    ParallelLayout(ParagraphPtrArray* pParagraphArray, FontCache* pFontCache);
+    void LayOut(int iFirstParagraph, int iLastParagraph);
+
+  private:
+    static UINT LayoutThread(LPVOID pParam);
+    void LayOutChunks();
+
+    ParagraphPtrArray* m_pParagraphArray;
+    FontCache* m_pFontCache;
+
+    volatile LONG m_lNextParagraph;
+    int m_iLastParagraph;
+};
@@ -0,0 +1,519 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Check.h"
+#include "PrefixSum.h"
+#include "PieceTable.h"
+
+// Create allocates a new block with the given capacity. The block has no
+// references until a piece or a piece table refers to it.
+
+TextBlock* TextBlock::Create(int iCapacity)
+{
+  TextBlock* pBlock;
+  check_memory(pBlock = new TextBlock(iCapacity));
+  return pBlock;
+}
+
+TextBlock::TextBlock(int iCapacity)
+ :m_iLength(0),
+  m_iCapacity(iCapacity),
+  m_lRefCount(0)
+{
+  check_memory(m_pBuffer = new TCHAR[iCapacity]);
+}
+
+TextBlock::~TextBlock()
+{
+  delete [] m_pBuffer;
+}
+
+// The reference count is updated with interlocked operations, as a block may
+// be shared by piece tables that are used by different threads.
+
+void TextBlock::AddRef()
+{
+  ::InterlockedIncrement(&m_lRefCount);
+}
+
+void TextBlock::Release()
+{
+  if (::InterlockedDecrement(&m_lRefCount) == 0)
+  {
+    delete this;
+  }
+}
+
+// Append adds the text to the end of the block, if it fits. The characters
+// already in the block are never moved.
+
+BOOL TextBlock::Append(const TCHAR* pText, int iLength)
+{
+  if ((m_iLength + iLength) > m_iCapacity)
+  {
+    return FALSE;
+  }
+
+  memcpy(m_pBuffer + m_iLength, pText, iLength * sizeof(TCHAR));
+  m_iLength += iLength;
+  return TRUE;
+}
+
+Piece::Piece()
+ :m_pBlock(NULL),
+  m_iStart(0),
+  m_iLength(0)
+{
+  // Empty.
+}
+
+Piece::Piece(TextBlock* pBlock, int iStart, int iLength)
+ :m_pBlock(pBlock),
+  m_iStart(iStart),
+  m_iLength(iLength)
+{
+  if (m_pBlock != NULL)
+  {
+    m_pBlock->AddRef();
+  }
+}
+
+Piece::Piece(const Piece& piece)
+ :m_pBlock(piece.m_pBlock),
+  m_iStart(piece.m_iStart),
+  m_iLength(piece.m_iLength)
+{
+  if (m_pBlock != NULL)
+  {
+    m_pBlock->AddRef();
+  }
+}
+
+Piece& Piece::operator=(const Piece& piece)
+{
+  if (piece.m_pBlock != NULL)
+  {
+    piece.m_pBlock->AddRef();
+  }
+
+  if (m_pBlock != NULL)
+  {
+    m_pBlock->Release();
+  }
+
+  m_pBlock = piece.m_pBlock;
+  m_iStart = piece.m_iStart;
+  m_iLength = piece.m_iLength;
+  return *this;
+}
+
+Piece::~Piece()
+{
+  if (m_pBlock != NULL)
+  {
+    m_pBlock->Release();
+  }
+}
+
+// Mid returns a piece referring to a part of this piece, in the same block.
+
+Piece Piece::Mid(int iFirst, int iCount) const
+{
+  return Piece(m_pBlock, m_iStart + iFirst, iCount);
+}
+
+// Extend appends a character to the piece. It is possible only if the piece
+// ends at the end of its block and the block has room for another character,
+// in which case no other piece can refer to the new character.
+
+BOOL Piece::Extend(TCHAR cChar)
+{
+  if ((m_pBlock != NULL) &&
+      (m_pBlock->GetLength() == (m_iStart + m_iLength)) &&
+      m_pBlock->Append(&cChar, 1))
+  {
+    ++m_iLength;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+// A new piece table is empty. The add block, where typed characters are
+// stored, is allocated when the first character is inserted.
+
+PieceTable::PieceTable()
+ :m_pAddBlock(NULL),
+  m_iCachePiece(0),
+  m_iCacheStart(0)
+{
+  // Empty.
+}
+
+// The text of a string is stored in a block of its own, which is sized to
+// the text.
+
+PieceTable::PieceTable(const CString& stText)
+ :m_pAddBlock(NULL),
+  m_iCachePiece(0),
+  m_iCacheStart(0)
+{
+  int iLength = stText.GetLength();
+
+  if (iLength > 0)
+  {
+    TextBlock* pBlock = TextBlock::Create(iLength);
+    pBlock->Append((LPCTSTR) stText, iLength);
+
+    check_memory(m_pieceArray.Add(Piece(pBlock, 0, iLength)));
+    m_lengthSum.Add(iLength);
+  }
+}
+
+// When a piece table is copied, the pieces are copied but the characters are
+// shared. The copy gets an add block of its own when a character is
+// inserted, so that the tables never append to the same block.
+
+PieceTable::PieceTable(const PieceTable& text)
+ :m_lengthSum(text.m_lengthSum),
+  m_pAddBlock(NULL),
+  m_iCachePiece(0),
+  m_iCacheStart(0)
+{
+  check_memory(m_pieceArray.Copy(text.m_pieceArray));
+}
+
+PieceTable& PieceTable::operator=(const PieceTable& text)
+{
+  if (this != &text)
+  {
+    check_memory(m_pieceArray.Copy(text.m_pieceArray));
+    m_lengthSum = text.m_lengthSum;
+    ReleaseAddBlock();
+
+    m_iCachePiece = 0;
+    m_iCacheStart = 0;
+  }
+
+  return *this;
+}
+
+PieceTable::~PieceTable()
+{
+  ReleaseAddBlock();
+}
+
+void PieceTable::ReleaseAddBlock()
+{
+  if (m_pAddBlock != NULL)
+  {
+    m_pAddBlock->Release();
+    m_pAddBlock = NULL;
+  }
+}
+
+// FindPiece returns the index of the piece holding the character at the
+// given index, and sets m_iCacheStart to the index of the first character
+// of the piece. As the text is most often traversed from the beginning to
+// the end, we first look at the latest found piece and the piece following
+// it. Otherwise, the piece is looked up in the prefix sum of the lengths.
+
+int PieceTable::FindPiece(int iIndex) const
+{
+  int iPieces = (int) m_pieceArray.GetSize();
+
+  if (m_iCachePiece < iPieces)
+  {
+    int iCacheEnd = m_iCacheStart + m_pieceArray[m_iCachePiece].GetLength();
+
+    if ((iIndex >= m_iCacheStart) && (iIndex < iCacheEnd))
+    {
+      return m_iCachePiece;
+    }
+
+    if ((iIndex >= iCacheEnd) && ((m_iCachePiece + 1) < iPieces) &&
+        (iIndex < (iCacheEnd + m_pieceArray[m_iCachePiece + 1].GetLength())))
+    {
+      m_iCacheStart = iCacheEnd;
+      return ++m_iCachePiece;
+    }
+  }
+
+  m_iCachePiece = m_lengthSum.Find(iIndex);
+  m_iCacheStart = m_lengthSum.Sum(m_iCachePiece);
+  return m_iCachePiece;
+}
+
+TCHAR PieceTable::GetAt(int iIndex) const
+{
+  check((iIndex >= 0) && (iIndex < GetLength()));
+  int iPiece = FindPiece(iIndex);
+  return m_pieceArray[iPiece].GetAt(iIndex - m_iCacheStart);
+}
+
+// SetAt overwrites a character, which is the same as deleting it and
+// inserting the new character.
+
+void PieceTable::SetAt(int iIndex, TCHAR cChar)
+{
+  Delete(iIndex, 1);
+  Insert(iIndex, cChar);
+}
+
+// SplitAt makes sure a piece starts at the given index, by splitting the
+// piece holding the index in two if necessary. It returns the index of that
+// piece, or the number of pieces if the index is at the end of the text.
+
+int PieceTable::SplitAt(int iIndex)
+{
+  if (iIndex == GetLength())
+  {
+    return (int) m_pieceArray.GetSize();
+  }
+
+  int iPiece = FindPiece(iIndex);
+  int iOffset = iIndex - m_iCacheStart;
+
+  if (iOffset == 0)
+  {
+    return iPiece;
+  }
+
+  Piece piece = m_pieceArray[iPiece];
+  int iRestLength = piece.GetLength() - iOffset;
+
+  m_pieceArray[iPiece] = piece.Mid(0, iOffset);
+  m_lengthSum.Set(iPiece, iOffset);
+
+  check_memory(m_pieceArray.InsertAt(iPiece + 1,
+                                     piece.Mid(iOffset, iRestLength)));
+  m_lengthSum.InsertAt(iPiece + 1, iRestLength);
+  return iPiece + 1;
+}
+
+// Insert inserts a character at the given index. When the user types, the
+// characters are appended to the add block, and if the preceding character
+// is the last one of the add block, its piece is just extended. In that
+// case, the insertion takes logarithmic time regardless of the length of the
+// text. Otherwise, a new piece is created for the character, which takes
+// linear time in the number of pieces, as the prefix sum is rebuilt.
+
+void PieceTable::Insert(int iIndex, TCHAR cChar)
+{
+  if ((iIndex > 0) && (m_pAddBlock != NULL))
+  {
+    int iPiece = FindPiece(iIndex - 1);
+    Piece& piece = m_pieceArray[iPiece];
+
+    if ((piece.GetBlock() == m_pAddBlock) &&
+        ((m_iCacheStart + piece.GetLength()) == iIndex) &&
+        piece.Extend(cChar))
+    {
+      m_lengthSum.Set(iPiece, piece.GetLength());
+      return;
+    }
+  }
+
+  if ((m_pAddBlock == NULL) ||
+      !m_pAddBlock->Append(&cChar, 1))
+  {
+    ReleaseAddBlock();
+    m_pAddBlock = TextBlock::Create(TEXT_BLOCK_SIZE);
+    m_pAddBlock->AddRef();
+    m_pAddBlock->Append(&cChar, 1);
+  }
+
+  Piece piece(m_pAddBlock, m_pAddBlock->GetLength() - 1, 1);
+  int iPiece = SplitAt(iIndex);
+
+  check_memory(m_pieceArray.InsertAt(iPiece, piece));
+  m_lengthSum.InsertAt(iPiece, 1);
+
+  m_iCachePiece = 0;
+  m_iCacheStart = 0;
+}
+
+// Insert inserts the pieces of another table at the given index. No
+// characters are copied, but the prefix sum is rebuilt, which takes linear
+// time in the number of pieces.
+
+void PieceTable::Insert(int iIndex, const PieceTable& text)
+{
+  if (text.IsEmpty())
+  {
+    return;
+  }
+
+  if (&text == this)
+  {
+    PieceTable copyText(text);
+    Insert(iIndex, copyText);
+    return;
+  }
+
+  int iPiece = SplitAt(iIndex);
+  check_memory(m_pieceArray.InsertAt(iPiece,
+               (CArray<Piece>*) &text.m_pieceArray));
+  m_lengthSum.InsertAt(iPiece, text.m_lengthSum);
+
+  m_iCachePiece = 0;
+  m_iCacheStart = 0;
+}
+
+// Delete removes the pieces of the given range, after the pieces at its
+// borders have been split. The characters are left in their blocks, which
+// are deleted when no piece refers to them anymore. Like the insertions of
+// new pieces, it takes linear time in the number of pieces.
+
+void PieceTable::Delete(int iIndex, int iCount)
+{
+  if (iCount <= 0)
+  {
+    return;
+  }
+
+  int iFirstPiece = SplitAt(iIndex);
+  int iLastPiece = SplitAt(iIndex + iCount);
+
+  m_pieceArray.RemoveAt(iFirstPiece, iLastPiece - iFirstPiece);
+  m_lengthSum.RemoveAt(iFirstPiece, iLastPiece - iFirstPiece);
+
+  m_iCachePiece = 0;
+  m_iCacheStart = 0;
+}
+
+// Append adds the pieces of the given range of another table to the end of
+// this table. No characters are copied, and as the pieces are added to the
+// end, each of them takes logarithmic time.
+
+void PieceTable::Append(const PieceTable& text, int iFirst, int iCount)
+{
+  if (iCount <= 0)
+  {
+    return;
+  }
+
+  if (&text == this)
+  {
+    PieceTable copyText(text);
+    Append(copyText, iFirst, iCount);
+    return;
+  }
+
+  int iPiece = text.FindPiece(iFirst);
+  int iOffset = iFirst - text.m_iCacheStart;
+
+  for (int iAppended = 0; iAppended < iCount; ++iPiece)
+  {
+    const Piece& piece = text.m_pieceArray[iPiece];
+    int iLength = min(piece.GetLength() - iOffset, iCount - iAppended);
+
+    check_memory(m_pieceArray.Add(piece.Mid(iOffset, iLength)));
+    m_lengthSum.Add(iLength);
+
+    iAppended += iLength;
+    iOffset = 0;
+  }
+}
+
+// Extract returns a new piece table holding the given range of the text.
+// The pieces of the range are copied, but not the characters.
+
+PieceTable PieceTable::Extract(int iFirst, int iCount) const
+{
+  PieceTable text;
+  text.Append(*this, iFirst, iCount);
+  return text;
+}
+
+// Mid returns the given range of the text as a string.
+
+CString PieceTable::Mid(int iFirst, int iCount) const
+{
+  CString stText;
+
+  if (iCount > 0)
+  {
+    TCHAR* pBuffer = stText.GetBuffer(iCount);
+    int iPiece = FindPiece(iFirst);
+    int iOffset = iFirst - m_iCacheStart;
+
+    for (int iCopied = 0; iCopied < iCount; ++iPiece)
+    {
+      const Piece& piece = m_pieceArray[iPiece];
+      int iLength = min(piece.GetLength() - iOffset, iCount - iCopied);
+
+      memcpy(pBuffer + iCopied, piece.GetText() + iOffset,
+             iLength * sizeof(TCHAR));
+
+      iCopied += iLength;
+      iOffset = 0;
+    }
+
+    stText.ReleaseBuffer(iCount);
+  }
+
+  return stText;
+}
+
+// ToString returns the whole text. Unlike Mid, it walks the pieces from the
+// first one and leaves the piece cache alone, so it does not write to the
+// table and can be called on another thread than the one reading it.
+
+CString PieceTable::ToString() const
+{
+  CString stText;
+  int iLength = GetLength();
+
+  if (iLength > 0)
+  {
+    TCHAR* pBuffer = stText.GetBuffer(iLength);
+    int iPieces = (int) m_pieceArray.GetSize(), iCopied = 0;
+
+    for (int iPiece = 0; iPiece < iPieces; ++iPiece)
+    {
+      const Piece& piece = m_pieceArray[iPiece];
+      memcpy(pBuffer + iCopied, piece.GetText(),
+             piece.GetLength() * sizeof(TCHAR));
+      iCopied += piece.GetLength();
+    }
+
+    stText.ReleaseBuffer(iLength);
+  }
+
+  return stText;
+}
+
+// GetText returns a pointer to the characters of the whole text. If the text
+// is held by one piece, which is the case for a text that has been loaded
+// and not edited, the pointer refers to its block and no characters are
+// copied. Otherwise, the text is copied into the given buffer.
+
+const TCHAR* PieceTable::GetText(CString& stBuffer) const
+{
+  if (m_pieceArray.GetSize() == 1)
+  {
+    return m_pieceArray[0].GetText();
+  }
+
+  stBuffer = ToString();
+  return stBuffer;
+}
+
+// Serialize stores or loads the text as one string, which keeps the format
+// of the file unaltered. A loaded text is held by a single piece.
+
+void PieceTable::Serialize(CArchive& archive)
+{
+  if (archive.IsStoring())
+  {
+    archive << ToString();
+  }
+
+  if (archive.IsLoading())
+  {
+    CString stText;
+    archive >> stText;
+    *this = PieceTable(stText);
+  }
+}
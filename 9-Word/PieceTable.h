@@ -0,0 +1,115 @@
+const int TEXT_BLOCK_SIZE = 4096;
+
+// A TextBlock is a buffer of characters of fixed capacity. Characters are
+// only appended to the block, never altered or removed, and the buffer is
+// never reallocated. Therefore, a piece referring to a range of the block
+// remains valid even when new characters are appended to it. The block is
+// reference counted and deletes itself when the last piece referring to it
+// is removed.
+
+class TextBlock
+{
+  public:
+    static TextBlock* Create(int iCapacity);
+
+    void AddRef();
+    void Release();
+
+    int GetLength() const {return m_iLength;}
+    int GetCapacity() const {return m_iCapacity;}
+    const TCHAR* GetBuffer() const {return m_pBuffer;}
+
+    BOOL Append(const TCHAR* pText, int iLength);
+
+  private:
+    TextBlock(int iCapacity);
+    ~TextBlock();
+
+    TCHAR* m_pBuffer;
+    int m_iLength, m_iCapacity;
+    volatile LONG m_lRefCount;
+};
+
+// A Piece refers to a range of characters in a text block, and holds a
+// reference to the block as long as it exists.
+
+class Piece
+{
+  public:
+    Piece();
+    Piece(TextBlock* pBlock, int iStart, int iLength);
+    Piece(const Piece& piece);
+    Piece& operator=(const Piece& piece);
+    ~Piece();
+
+    TextBlock* GetBlock() const {return m_pBlock;}
+    int GetStart() const {return m_iStart;}
+    int GetLength() const {return m_iLength;}
+
+    const TCHAR* GetText() const {return m_pBlock->GetBuffer() + m_iStart;}
+    TCHAR GetAt(int iIndex) const {return GetText()[iIndex];}
+
+    Piece Mid(int iFirst, int iCount) const;
+    BOOL Extend(TCHAR cChar);
+
+  private:
+    TextBlock* m_pBlock;
+    int m_iStart, m_iLength;
+};
+
+typedef CArray<Piece> PieceArray;
+
+// A PieceTable holds the text of a paragraph as a sequence of pieces. The
+// lengths of the pieces are stored in a prefix sum, which makes it possible
+// to find the piece of a given character in logarithmic time. Copying a
+// piece table, or extracting a part of it, copies the pieces but not the
+// characters, which are shared between the tables.
+
+// Typing at the end of the latest inserted characters, which is by far the
+// most common edit, extends a piece and takes logarithmic time. Any other
+// insertion or deletion adds or removes pieces, which shifts the piece
+// array and rebuilds the prefix sum, and takes time in proportion to the
+// number of pieces, not to the number of characters. As a paragraph seldom
+// holds more than a few hundred pieces, that is still cheap, but it is not
+// logarithmic.
+
+class PieceTable
+{
+  public:
+    PieceTable();
+    PieceTable(const CString& stText);
+    PieceTable(const PieceTable& text);
+    PieceTable& operator=(const PieceTable& text);
+    ~PieceTable();
+
+    int GetLength() const {return m_lengthSum.GetTotal();}
+    BOOL IsEmpty() const {return (GetLength() == 0);}
+
+    TCHAR GetAt(int iIndex) const;
+    TCHAR operator[](int iIndex) const {return GetAt(iIndex);}
+    void SetAt(int iIndex, TCHAR cChar);
+
+    void Insert(int iIndex, TCHAR cChar);
+    void Insert(int iIndex, const PieceTable& text);
+    void Delete(int iIndex, int iCount);
+
+    void Append(const PieceTable& text, int iFirst, int iCount);
+    PieceTable Extract(int iFirst, int iCount) const;
+
+    CString Mid(int iFirst, int iCount) const;
+    CString ToString() const;
+    const TCHAR* GetText(CString& stBuffer) const;
+
+    void Serialize(CArchive& archive);
+
+  private:
+    int FindPiece(int iIndex) const;
+    int SplitAt(int iIndex);
+    void ReleaseAddBlock();
+
+    PieceArray m_pieceArray;
+    PrefixSum<int> m_lengthSum;
+    TextBlock* m_pAddBlock;
+
+    mutable int m_iCachePiece, m_iCacheStart;
+};
@@ -0,0 +1,107 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Check.h"
+#include "RepaintRegion.h"
+
+RepaintRegion::RepaintRegion()
+ :m_iAddCount(0)
+{
+  // Empty.
+}
+
+// Add adds a rectangle to the region. As neighbouring characters are usually
+// added one after another, the rectangles are searched from the latest one.
+// When the new rectangle has been merged with a rectangle, the merged
+// rectangle may in turn be mergeable with another one, so the search starts
+// over. As the number of rectangles is bounded, each call takes constant
+// time.
+
+void RepaintRegion::Add(CRect rcArea)
+{
+  ++m_iAddCount;
+
+  if (rcArea.IsRectEmpty())
+  {
+    return;
+  }
+
+  int iIndex = GetSize() - 1;
+  while (iIndex >= 0)
+  {
+    if (IsMergeable(m_rectArray[iIndex], rcArea))
+    {
+      rcArea.UnionRect(rcArea, m_rectArray[iIndex]);
+      m_rectArray.RemoveAt(iIndex);
+      iIndex = GetSize() - 1;
+    }
+
+    else
+    {
+      --iIndex;
+    }
+  }
+
+  if (GetSize() < MAX_REPAINT_RECTS)
+  {
+    check_memory(m_rectArray.Add(rcArea));
+  }
+
+  // If the region is full, the rectangle is merged with the closest one,
+  // which makes the region cover some area that has not been changed.
+
+  else
+  {
+    int iClosest = FindClosest(rcArea);
+    m_rectArray[iClosest].UnionRect(m_rectArray[iClosest], rcArea);
+  }
+}
+
+// Two rectangles are mergeable if they overlap vertically and overlap or
+// touch horizontally, which is the case for the characters of the same line,
+// or if they have the same horizontal extent and overlap or touch vertically,
+// which is the case for the blocks of consecutive lines or paragraphs.
+
+BOOL RepaintRegion::IsMergeable(const CRect& rcFirst, const CRect& rcSecond)
+{
+  int yTop = max(rcFirst.top, rcSecond.top);
+  int yBottom = min(rcFirst.bottom, rcSecond.bottom);
+  int xLeft = max(rcFirst.left, rcSecond.left);
+  int xRight = min(rcFirst.right, rcSecond.right);
+
+  if ((yTop < yBottom) && (xLeft <= xRight))
+  {
+    return TRUE;
+  }
+
+  return (rcFirst.left == rcSecond.left) &&
+         (rcFirst.right == rcSecond.right) && (yTop <= yBottom);
+}
+
+// FindClosest returns the index of the rectangle whose area grows the least
+// when it is merged with the given rectangle.
+
+int RepaintRegion::FindClosest(const CRect& rcArea) const
+{
+  int iClosest = 0;
+  LONGLONG lMinGrowth = 0;
+
+  for (int iIndex = 0; iIndex < GetSize(); ++iIndex)
+  {
+    const CRect& rcOld = m_rectArray[iIndex];
+    CRect rcUnion;
+    rcUnion.UnionRect(rcOld, rcArea);
+
+    LONGLONG lGrowth =
+      ((LONGLONG) rcUnion.Width() * rcUnion.Height()) -
+      ((LONGLONG) rcOld.Width() * rcOld.Height());
+
+    if ((iIndex == 0) || (lGrowth < lMinGrowth))
+    {
+      iClosest = iIndex;
+      lMinGrowth = lGrowth;
+    }
+  }
+
+  return iClosest;
+}
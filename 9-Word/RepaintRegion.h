@@ -0,0 +1,29 @@
+const int MAX_REPAINT_RECTS = 16;
+
+// A RepaintRegion collects the areas of the document that need to be
+// repainted. Instead of keeping one rectangle for each changed character, it
+// merges a new rectangle with the rectangles it overlaps or touches on the
+// same line, which makes the characters of a changed line form one band.
+// The number of rectangles is bounded: when it is reached, a new rectangle
+// is merged with the rectangle whose bounding box grows the least. The view
+// invalidates the whole region at once.
+
+class RepaintRegion
+{
+  public:
+    RepaintRegion();
+
+    void Add(CRect rcArea);
+    BOOL IsEmpty() const {return m_rectArray.IsEmpty();}
+
+    int GetSize() const {return (int) m_rectArray.GetSize();}
+    const CRect& GetAt(int iIndex) const {return m_rectArray[iIndex];}
+    int GetAddCount() const {return m_iAddCount;}
+
+  private:
+    static BOOL IsMergeable(const CRect& rcFirst, const CRect& rcSecond);
+    int FindClosest(const CRect& rcArea) const;
+
+    CArray<CRect> m_rectArray;
+    int m_iAddCount;
+};
@@ -31,13 +31,16 @@
 #define IDC_ZOOM                        1009
 #define ID_FORMAT_FOREGROUNDCOLOR       32775
 #define ID_FORMAT_BACKGROUNDCOLOR       32776
+#define ID_INDICATOR_STATISTICS         32777
+#define ID_FILE_IMPORT                  32778
+#define ID_FILE_EXPORT                  32779
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        140
-#define _APS_NEXT_COMMAND_VALUE         32777
+#define _APS_NEXT_COMMAND_VALUE         32780
 #define _APS_NEXT_CONTROL_VALUE         1010
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
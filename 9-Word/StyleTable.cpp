@@ -0,0 +1,37 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Font.h"
+#include "Check.h"
+#include "StyleTable.h"
+
+CArray<Font> StyleTable::m_fontArray;
+CCriticalSection StyleTable::m_criticalSection;
+
+// GetStyle returns the style of the given font. If the font is not yet in
+// the table, it is added. A document seldom uses more than a handful of
+// fonts, so we simply search the table.
+
+int StyleTable::GetStyle(const Font& font)
+{
+  CSingleLock lock(&m_criticalSection, TRUE);
+  int iSize = (int) m_fontArray.GetSize();
+
+  for (int iStyle = 0; iStyle < iSize; ++iStyle)
+  {
+    if (m_fontArray[iStyle] == font)
+    {
+      return iStyle;
+    }
+  }
+
+  check_memory(m_fontArray.Add(font));
+  return iSize;
+}
+
+Font StyleTable::GetFont(int iStyle)
+{
+  CSingleLock lock(&m_criticalSection, TRUE);
+  check((iStyle >= 0) && (iStyle < m_fontArray.GetSize()));
+  return m_fontArray[iStyle];
+}
@@ -0,0 +1,16 @@
+// The StyleTable holds every font used by the paragraphs of the application,
+// each of them only once. A font is referred to by its style, which is its
+// index in the table. As the table is shared by every document, text can be
+// copied between documents without translating the styles. As the table
+// is also used by the layout threads, it is guarded by a critical section.
+
+class StyleTable
+{
+  public:
+    static int GetStyle(const Font& font);
+    static Font GetFont(int iStyle);
+
+  private:
+    static CArray<Font> m_fontArray;
+    static CCriticalSection m_criticalSection;
+};
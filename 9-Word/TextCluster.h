@@ -0,0 +1,122 @@
+// A cluster is a sequence of code units that is displayed, measured, and
+// edited as one character. In a multibyte build, a double-byte character
+// is a cluster of a lead byte and a trail byte, and every other byte is a
+// cluster of its own. In a Unicode build, the clusters are given by the
+// rules of LayoutCore.h, which the layout library applies as well. The
+// caret is only placed at the start of a cluster, and the width of a
+// cluster is given to its first code unit.
+
+// The functions are written as templates over the text, which must return
+// a code unit from operator[], so that they apply to piece tables as well
+// as plain buffers. Text of plain ASCII characters, which is the common
+// case, is decided by looking at one or two code units.
+
+// IsClusterStart returns whether a cluster starts at the given index. The
+// beginning and the end of the text are always cluster starts. A double-
+// byte character is recognized by counting the lead bytes preceding the
+// index, since a trail byte may have the value of a lead byte. The count
+// stops at the given index of a known cluster start, such as the start of
+// a line, which keeps the cost of a call to the length of the line rather
+// than that of the text.
+
+template<typename TextType>
+BOOL IsClusterStart(const TextType& text, int iLength, int iIndex,
+                    int iKnownStart = 0)
+{
+#ifdef _UNICODE
+  return IsUtf16ClusterStart(text, iLength, iIndex) ? TRUE : FALSE;
+#else
+  if ((iIndex <= 0) || (iIndex >= iLength) ||
+      ((UINT) (_TUCHAR) text[iIndex - 1] < 0x80))
+  {
+    return TRUE;
+  }
+
+  int iLeadBytes = 0;
+  for (int iIndexBefore = iIndex - 1;
+       (iIndexBefore >= iKnownStart) &&
+       ::IsDBCSLeadByte((BYTE) text[iIndexBefore]);
+       --iIndexBefore)
+  {
+    ++iLeadBytes;
+  }
+
+  return ((iLeadBytes % 2) == 0);
+#endif
+}
+
+// NextCluster returns the index of the cluster following the cluster that
+// starts at the given index, or the length of the text. In a multibyte
+// build, the next cluster follows directly from the lead byte.
+
+template<typename TextType>
+int NextCluster(const TextType& text, int iLength, int iIndex)
+{
+  if (iIndex >= iLength)
+  {
+    return iLength;
+  }
+
+#ifdef _UNICODE
+  return NextUtf16Cluster(text, iLength, iIndex);
+#else
+  if (::IsDBCSLeadByte((BYTE) text[iIndex]))
+  {
+    return min(iIndex + 2, iLength);
+  }
+
+  return iIndex + 1;
+#endif
+}
+
+// NextCodePoint returns the index following the code point that starts at
+// the given index, which is where the run lengths of a Word file are
+// counted. A double-byte character of a multibyte build and a surrogate
+// pair of a Unicode build are one code point, while the characters of a
+// cluster are code points of their own.
+
+template<typename TextType>
+int NextCodePoint(const TextType& text, int iLength, int iIndex)
+{
+  if ((iIndex + 1) >= iLength)
+  {
+    return iLength;
+  }
+
+#ifdef _UNICODE
+  if (IS_HIGH_SURROGATE((UINT) (_TUCHAR) text[iIndex]) &&
+      IS_LOW_SURROGATE((UINT) (_TUCHAR) text[iIndex + 1]))
+  {
+    return iIndex + 2;
+  }
+#else
+  if (::IsDBCSLeadByte((BYTE) text[iIndex]))
+  {
+    return iIndex + 2;
+  }
+#endif
+
+  return iIndex + 1;
+}
+
+// PreviousCluster returns the index of the cluster preceding the given
+// index, which need not be a cluster start itself, or zero. The known
+// cluster start is passed on to IsClusterStart.
+
+template<typename TextType>
+int PreviousCluster(const TextType& text, int iLength, int iIndex,
+                    int iKnownStart = 0)
+{
+  if (iIndex <= 0)
+  {
+    return 0;
+  }
+
+  int iPrevious = iIndex - 1;
+  while (!IsClusterStart(text, iLength, iPrevious, iKnownStart))
+  {
+    --iPrevious;
+  }
+
+  return iPrevious;
+}
@@ -0,0 +1,788 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Color.h"
+#include "Font.h"
+#include "Caret.h"
+#include "Check.h"
+#include "PrefixSum.h"
+
+#include "RepaintRegion.h"
+#include "Line.h"
+#include "Position.h"
+#include "PieceTable.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "FontCache.h"
+#include "Paragraph.h"
+#include "WordFile.h"
+#include "TextFile.h"
+#include "Threads.h"
+
+#include "Page.h"
+#include "WordView.h"
+
+static const int HEADING_SIZES[MAX_HEADING_LEVEL + 1] =
+  {TEXT_FONT_SIZE, 24, 18, 15, TEXT_FONT_SIZE, TEXT_FONT_SIZE,
+   TEXT_FONT_SIZE};
+
+static BOOL IsWordChar(TCHAR cChar)
+{
+  return ((cChar >= TEXT('0')) && (cChar <= TEXT('9'))) ||
+         ((cChar >= TEXT('A')) && (cChar <= TEXT('Z'))) ||
+         ((cChar >= TEXT('a')) && (cChar <= TEXT('z')));
+}
+
+static BOOL IsSpace(TCHAR cChar)
+{
+  return (cChar == TEXT(' ')) || (cChar == TEXT('\t'));
+}
+
+static BOOL IsMarkdownChar(TCHAR cChar)
+{
+  return (cChar == TEXT('\\')) || (cChar == TEXT('*')) ||
+         (cChar == TEXT('_')) || (cChar == TEXT('#'));
+}
+
+// The styles of each heading level and emphasis are added to the style
+// table. As a heading is bold anyway, its bold styles are the same as its
+// plain ones; the plain emphasis is found first when a style is looked up.
+
+TextStyles::TextStyles()
+{
+  for (int iLevel = 0; iLevel <= MAX_HEADING_LEVEL; ++iLevel)
+  {
+    for (int iEmphasis = EM_NONE; iEmphasis <= EM_BOTH; ++iEmphasis)
+    {
+      LOGFONT logFont = Font(TEXT("Times New Roman"), HEADING_SIZES[iLevel]);
+      logFont.lfWeight = ((iLevel > 0) || ((iEmphasis & EM_BOLD) != 0))
+                         ? FW_BOLD : FW_DONTCARE;
+      logFont.lfItalic = (BYTE) ((iEmphasis & EM_ITALIC) != 0);
+
+      Font font(logFont);
+      int iStyle = StyleTable::GetStyle(font);
+      m_styleArray[iLevel][iEmphasis] = iStyle;
+
+      if (iEmphasis == EM_NONE)
+      {
+        m_emptyFontArray[iLevel] = font;
+      }
+
+      int iCode;
+      if (!m_codeMap.Lookup(iStyle, iCode))
+      {
+        check_memory(m_codeMap.SetAt(iStyle, iLevel * (EM_BOTH + 1) +
+                                             iEmphasis));
+      }
+    }
+  }
+}
+
+void TextStyles::GetEmphasis(int iStyle, int& iLevel, int& iEmphasis) const
+{
+  int iCode;
+
+  if (m_codeMap.Lookup(iStyle, iCode))
+  {
+    iLevel = iCode / (EM_BOTH + 1);
+    iEmphasis = iCode % (EM_BOTH + 1);
+  }
+
+  else
+  {
+    LOGFONT logFont = StyleTable::GetFont(iStyle);
+    iLevel = 0;
+    iEmphasis = ((logFont.lfWeight >= FW_BOLD) ? EM_BOLD : EM_NONE) |
+                (logFont.lfItalic ? EM_ITALIC : EM_NONE);
+  }
+}
+
+TextImporter::TextImporter(FontCache* pFontCache, TextFormat eFormat)
+ :m_pFontCache(pFontCache),
+  m_eFormat(eFormat),
+  m_pBuffer(NULL),
+  m_lNextChunk(0)
+{
+  // Empty.
+}
+
+// The paragraphs of the chunks are deleted only if the import did not
+// complete; otherwise, they have been handed over to the caller.
+
+TextImporter::~TextImporter()
+{
+  int iChunks = (int) m_chunkArray.GetSize();
+  for (int iChunk = 0; iChunk < iChunks; ++iChunk)
+  {
+    ParagraphPtrArray* pParagraphArray = m_chunkArray[iChunk];
+    int iParagraphs = (int) pParagraphArray->GetSize();
+
+    for (int iIndex = 0; iIndex < iParagraphs; ++iIndex)
+    {
+      delete pParagraphArray->GetAt(iIndex);
+    }
+
+    delete pParagraphArray;
+  }
+}
+
+// Import reads the file into the given array. An empty file gives one empty
+// paragraph, as a document always holds at least one paragraph. A byte
+// order mark at the beginning of the file is skipped. It returns false if
+// the file cannot be read.
+
+BOOL TextImporter::Import(LPCTSTR lpszPathName,
+                          ParagraphPtrArray& paragraphArray)
+{
+  StopWatch stopWatch;
+
+  MappedFile mappedFile;
+  int iSize = 0, iStart = 0;
+
+  if (mappedFile.Open(lpszPathName))
+  {
+    m_pBuffer = (const char*) mappedFile.GetBuffer();
+    iSize = mappedFile.GetSize();
+  }
+
+  // The file could not be mapped, which is fine only if it is empty.
+
+  else
+  {
+    CFileStatus fileStatus;
+    if (!CFile::GetStatus(lpszPathName, fileStatus) ||
+        (fileStatus.m_size != 0))
+    {
+      return FALSE;
+    }
+  }
+
+  if ((iSize >= 3) && ((BYTE) m_pBuffer[0] == 0xEF) &&
+      ((BYTE) m_pBuffer[1] == 0xBB) && ((BYTE) m_pBuffer[2] == 0xBF))
+  {
+    iStart = 3;
+  }
+
+  DivideChunks(iStart, iSize);
+  int iChunks = (int) m_chunkArray.GetSize();
+
+  if (iChunks > 0)
+  {
+    m_lNextChunk = 0;
+    RunThreads(ImportThread, this, iChunks);
+  }
+
+  // The paragraphs of the chunks are gathered in one array, which is then
+  // handed over to the caller.
+
+  int iParagraphs = 0;
+  for (int iChunk = 0; iChunk < iChunks; ++iChunk)
+  {
+    iParagraphs += (int) m_chunkArray[iChunk]->GetSize();
+  }
+
+  ParagraphPtrArray importArray;
+  check_memory(importArray.SetSize(0, max(1, iParagraphs)));
+
+  for (int iChunk = 0; iChunk < iChunks; ++iChunk)
+  {
+    check_memory(importArray.Append(*m_chunkArray[iChunk]));
+    delete m_chunkArray[iChunk];
+  }
+
+  m_chunkArray.RemoveAll();
+
+  if (importArray.IsEmpty())
+  {
+    Paragraph* pParagraph;
+    check_memory(pParagraph = new Paragraph(m_styles.GetEmptyFont(0),
+                                            ALIGN_LEFT));
+
+    CDC dc;
+    check(dc.CreateCompatibleDC(NULL));
+    CWordView::SetLogicalUnits(&dc);
+
+    pParagraph->DeferLayout(&dc, m_pFontCache);
+    check_memory(importArray.Add(pParagraph));
+  }
+
+  paragraphArray.RemoveAll();
+  check_memory(paragraphArray.Append(importArray));
+
+  TRACE(TEXT("Imported %d bytes into %d paragraphs in %.1f ms.\n"), iSize,
+        (int) paragraphArray.GetSize(), stopWatch.GetMilliseconds());
+  return TRUE;
+}
+
+// DivideChunks divides the bytes of the file into chunks. Each chunk but
+// the last one ends right after the first line break following its
+// nominal end, which is found by searching forward from there.
+
+void TextImporter::DivideChunks(int iStart, int iSize)
+{
+  m_boundaryArray.RemoveAll();
+  check_memory(m_boundaryArray.Add(iStart));
+
+  int iBoundary = iStart;
+  while (iBoundary < iSize)
+  {
+    int iNominalEnd = iBoundary + IMPORT_CHUNK_SIZE;
+
+    if (iNominalEnd >= iSize)
+    {
+      iBoundary = iSize;
+    }
+
+    else
+    {
+      const char* pNewline =
+        (const char*) memchr(m_pBuffer + iNominalEnd, '\n',
+                             iSize - iNominalEnd);
+      iBoundary = (pNewline != NULL) ? ((int) (pNewline - m_pBuffer) + 1)
+                                     : iSize;
+    }
+
+    check_memory(m_boundaryArray.Add(iBoundary));
+
+    ParagraphPtrArray* pParagraphArray;
+    check_memory(pParagraphArray = new ParagraphPtrArray());
+    check_memory(m_chunkArray.Add(pParagraphArray));
+  }
+}
+
+UINT TextImporter::ImportThread(LPVOID pParam)
+{
+  TextImporter* pImporter = (TextImporter*) pParam;
+  pImporter->ImportChunks();
+  return 0;
+}
+
+// ImportChunks is run by each thread. It creates a memory device context
+// with the same logical units as the view, which is needed to estimate the
+// heights of the paragraphs, and takes the next chunk by atomically
+// advancing the index of the next chunk.
+
+void TextImporter::ImportChunks()
+{
+  CDC dc;
+  check(dc.CreateCompatibleDC(NULL));
+  CWordView::SetLogicalUnits(&dc);
+
+  int iChunks = (int) m_chunkArray.GetSize();
+  while (TRUE)
+  {
+    int iChunk = (int) ::InterlockedExchangeAdd(&m_lNextChunk, 1);
+
+    if (iChunk >= iChunks)
+    {
+      break;
+    }
+
+    ImportChunk(iChunk, &dc);
+  }
+}
+
+// ImportChunk splits the chunk into lines, each of which becomes a
+// paragraph whose layout is deferred. A carriage return before the line
+// feed is dropped. A line break at the end of the file does not begin
+// another paragraph.
+
+void TextImporter::ImportChunk(int iChunk, CDC* pDC)
+{
+  ParagraphPtrArray* pParagraphArray = m_chunkArray[iChunk];
+  check_memory(pParagraphArray->SetSize(0, 1024));
+
+  const char* pText = m_pBuffer + m_boundaryArray[iChunk];
+  const char* pEnd = m_pBuffer + m_boundaryArray[iChunk + 1];
+
+  while (pText < pEnd)
+  {
+    const char* pNewline = (const char*) memchr(pText, '\n', pEnd - pText);
+    const char* pLineEnd = (pNewline != NULL) ? pNewline : pEnd;
+    int iBytes = (int) (pLineEnd - pText);
+
+    if ((iBytes > 0) && (pText[iBytes - 1] == '\r'))
+    {
+      --iBytes;
+    }
+
+    Paragraph* pParagraph = CreateParagraph(pText, iBytes);
+    pParagraph->DeferLayout(pDC, m_pFontCache);
+    check_memory(pParagraphArray->Add(pParagraph));
+
+    pText = (pNewline != NULL) ? (pNewline + 1) : pEnd;
+  }
+}
+
+// CreateParagraph converts a line from UTF-8 and builds its paragraph. A
+// line of ASCII characters, which is the common case, is copied character
+// by character without a conversion. Invalid UTF-8 is replaced rather than
+// rejected, as a text file has no structure to be corrupt.
+
+Paragraph* TextImporter::CreateParagraph(const char* pLine, int iBytes) const
+{
+  CString stLine;
+
+  if (iBytes > 0)
+  {
+    BYTE bBits = 0;
+    for (int iByte = 0; iByte < iBytes; ++iByte)
+    {
+      bBits |= (BYTE) pLine[iByte];
+    }
+
+    if (bBits < 0x80)
+    {
+      TCHAR* pBuffer = stLine.GetBuffer(iBytes);
+
+      for (int iByte = 0; iByte < iBytes; ++iByte)
+      {
+        pBuffer[iByte] = (TCHAR) pLine[iByte];
+      }
+
+      stLine.ReleaseBuffer(iBytes);
+    }
+
+    else
+    {
+      int iChars = ::MultiByteToWideChar(CP_UTF8, 0, pLine, iBytes, NULL, 0);
+      CStringW stWide;
+
+      ::MultiByteToWideChar(CP_UTF8, 0, pLine, iBytes,
+                            stWide.GetBuffer(iChars), iChars);
+      stWide.ReleaseBuffer(iChars);
+      stLine = CString(stWide);
+    }
+  }
+
+  int iLevel = 0;
+  CString stText;
+  FontRunArray fontRunArray;
+
+  if (m_eFormat == TF_MARKDOWN)
+  {
+    ParseMarkdown(stLine, iLevel, stText, fontRunArray);
+  }
+
+  else if (!stLine.IsEmpty())
+  {
+    stText = stLine;
+    fontRunArray.Append(m_styles.GetStyle(0, EM_NONE), stText.GetLength());
+  }
+
+  Paragraph* pParagraph;
+  check_memory(pParagraph = new Paragraph(m_styles.GetEmptyFont(iLevel),
+                                          ALIGN_LEFT));
+  pParagraph->SetText(stText, fontRunArray);
+  return pParagraph;
+}
+
+// ParseMarkdown finds the heading level of the line, and removes the marks
+// from its text while building its font runs. The emphasis is toggled at
+// each mark, and a run ends wherever the emphasis changes. An emphasis that
+// is not closed lasts to the end of the line.
+
+void TextImporter::ParseMarkdown(const CString& stLine, int& iLevel,
+                                 CString& stText,
+                                 FontRunArray& fontRunArray) const
+{
+  int iLength = stLine.GetLength(), iIndex = 0;
+
+  while ((iIndex < iLength) && (stLine[iIndex] == TEXT('#')) &&
+         (iIndex <= MAX_HEADING_LEVEL))
+  {
+    ++iIndex;
+  }
+
+  if ((iIndex > 0) && (iIndex <= MAX_HEADING_LEVEL) &&
+      ((iIndex == iLength) || IsSpace(stLine[iIndex])))
+  {
+    iLevel = iIndex;
+
+    while ((iIndex < iLength) && IsSpace(stLine[iIndex]))
+    {
+      ++iIndex;
+    }
+  }
+
+  else
+  {
+    iLevel = 0;
+    iIndex = 0;
+  }
+
+  TCHAR* pBuffer = stText.GetBuffer(max(1, iLength));
+  int iTextLength = 0, iRunStart = 0, iEmphasis = EM_NONE;
+
+  while (iIndex < iLength)
+  {
+    TCHAR cChar = stLine[iIndex];
+
+    if ((cChar == TEXT('\\')) && ((iIndex + 1) < iLength) &&
+        IsMarkdownChar(stLine[iIndex + 1]))
+    {
+      pBuffer[iTextLength++] = stLine[iIndex + 1];
+      iIndex += 2;
+      continue;
+    }
+
+    if ((cChar == TEXT('*')) || (cChar == TEXT('_')))
+    {
+      BOOL bDouble = ((iIndex + 1) < iLength) &&
+                     (stLine[iIndex + 1] == cChar);
+      int iMarkLength = bDouble ? 2 : 1;
+      int iFlag = bDouble ? EM_BOLD : EM_ITALIC;
+
+      TCHAR cBefore = (iIndex > 0) ? stLine[iIndex - 1] : TEXT(' ');
+      TCHAR cAfter = ((iIndex + iMarkLength) < iLength)
+                     ? stLine[iIndex + iMarkLength] : TEXT(' ');
+
+      // An opening mark must be followed by a non-space, and a closing mark
+      // preceded by one. An underscore must not be inside a word.
+
+      BOOL bMark = ((iEmphasis & iFlag) == 0)
+                   ? (!IsSpace(cAfter) &&
+                      ((cChar == TEXT('*')) || !IsWordChar(cBefore)))
+                   : (!IsSpace(cBefore) &&
+                      ((cChar == TEXT('*')) || !IsWordChar(cAfter)));
+
+      if (bMark)
+      {
+        if (iTextLength > iRunStart)
+        {
+          fontRunArray.Append(m_styles.GetStyle(iLevel, iEmphasis),
+                              iTextLength - iRunStart);
+          iRunStart = iTextLength;
+        }
+
+        iEmphasis ^= iFlag;
+        iIndex += iMarkLength;
+        continue;
+      }
+    }
+
+    pBuffer[iTextLength++] = cChar;
+    ++iIndex;
+  }
+
+  stText.ReleaseBuffer(iTextLength);
+
+  if (iTextLength > iRunStart)
+  {
+    fontRunArray.Append(m_styles.GetStyle(iLevel, iEmphasis),
+                        iTextLength - iRunStart);
+  }
+}
+
+TextExporter::TextExporter(TextFormat eFormat)
+ :m_eFormat(eFormat),
+  m_pParagraphArray(NULL),
+  m_iFirstChunk(0),
+  m_iLastChunk(-1),
+  m_lNextChunk(0)
+{
+  // Empty.
+}
+
+// Export writes the paragraphs to the file, round by round. It returns
+// false if the file cannot be written.
+
+BOOL TextExporter::Export(LPCTSTR lpszPathName,
+                          const ParagraphPtrArray& paragraphArray)
+{
+  StopWatch stopWatch;
+
+  m_pParagraphArray = &paragraphArray;
+  int iParagraphs = (int) paragraphArray.GetSize();
+  int iChunks = (iParagraphs + EXPORT_CHUNK - 1) / EXPORT_CHUNK;
+  ULONGLONG uBytes = 0;
+
+  try
+  {
+    CFile file(lpszPathName, CFile::modeCreate | CFile::modeWrite |
+                             CFile::shareExclusive);
+
+    for (int iFirstChunk = 0; iFirstChunk < iChunks;
+         iFirstChunk += EXPORT_ROUND)
+    {
+      m_iFirstChunk = iFirstChunk;
+      m_iLastChunk = min(iFirstChunk + EXPORT_ROUND, iChunks) - 1;
+      m_lNextChunk = iFirstChunk;
+
+      RunThreads(ExportThread, this, m_iLastChunk - iFirstChunk + 1);
+
+      for (int iChunk = iFirstChunk; iChunk <= m_iLastChunk; ++iChunk)
+      {
+        CStringA& stBuffer = m_bufferArray[iChunk - iFirstChunk];
+        file.Write((LPCSTR) stBuffer, stBuffer.GetLength());
+        uBytes += stBuffer.GetLength();
+        stBuffer.Empty();
+      }
+    }
+
+    file.Close();
+  }
+
+  catch (CFileException* pException)
+  {
+    pException->Delete();
+    return FALSE;
+  }
+
+  TRACE(TEXT("Exported %d paragraphs into %I64u bytes in %.1f ms.\n"),
+        iParagraphs, uBytes, stopWatch.GetMilliseconds());
+  return TRUE;
+}
+
+UINT TextExporter::ExportThread(LPVOID pParam)
+{
+  TextExporter* pExporter = (TextExporter*) pParam;
+  pExporter->ExportChunks();
+  return 0;
+}
+
+// ExportChunks is run by each thread, which takes the next chunk of the
+// round by atomically advancing the index of the next chunk. The heading
+// levels and emphases of the styles of other fonts are cached by each
+// thread, which saves looking up their fonts in the style table.
+
+void TextExporter::ExportChunks()
+{
+  CMap<int,int,int,int> codeMap;
+
+  while (TRUE)
+  {
+    int iChunk = (int) ::InterlockedExchangeAdd(&m_lNextChunk, 1);
+
+    if (iChunk > m_iLastChunk)
+    {
+      break;
+    }
+
+    ExportChunk(iChunk, m_bufferArray[iChunk - m_iFirstChunk], codeMap);
+  }
+}
+
+// ExportChunk converts the paragraphs of the chunk into lines of UTF-8,
+// each ended by a carriage return and a line feed.
+
+void TextExporter::ExportChunk(int iChunk, CStringA& stBuffer,
+                               CMap<int,int,int,int>& codeMap) const
+{
+  int iParagraphs = (int) m_pParagraphArray->GetSize();
+  int iFirstParagraph = iChunk * EXPORT_CHUNK;
+  int iLastParagraph = min(iFirstParagraph + EXPORT_CHUNK, iParagraphs) - 1;
+
+  for (int iParagraph = iFirstParagraph; iParagraph <= iLastParagraph;
+       ++iParagraph)
+  {
+    const Paragraph* pParagraph = m_pParagraphArray->GetAt(iParagraph);
+
+    if (m_eFormat == TF_MARKDOWN)
+    {
+      CString stLine;
+      AppendMarkdown(pParagraph, stLine, codeMap);
+      AppendUtf8(stLine, stBuffer);
+    }
+
+    else
+    {
+      AppendUtf8(pParagraph->GetText(), stBuffer);
+    }
+
+    stBuffer += "\r\n";
+  }
+}
+
+// AppendMarkdown writes the paragraph with its marks. The heading level is
+// given by the style of its first character, or by the empty font of an
+// empty paragraph, which has no runs. The marks are written where
+// the emphasis changes between two runs, the closing marks before the
+// opening ones. As a mark must not be next to a space on its inner side,
+// the spaces at the edges of a run are moved outside its marks, and a run
+// of spaces only keeps the emphasis of the previous run.
+
+void TextExporter::AppendMarkdown(const Paragraph* pParagraph,
+                                  CString& stLine,
+                                  CMap<int,int,int,int>& codeMap) const
+{
+  CString stText = pParagraph->GetText();
+  const FontRunArray& fontRunArray = pParagraph->GetFontRuns();
+
+  int iRuns = fontRunArray.GetRunCount();
+  int iParagraphLevel = 0, iEmphasis = EM_NONE, iChar = 0;
+  CString stSpaces;
+
+  if (iRuns == 0)
+  {
+    m_styles.GetEmphasis(StyleTable::GetStyle(pParagraph->GetFont(0)),
+                         iParagraphLevel, iEmphasis);
+    stLine += CString(TEXT('#'), iParagraphLevel);
+    return;
+  }
+
+  for (int iRun = 0; iRun < iRuns; ++iRun)
+  {
+    const FontRun& run = fontRunArray.GetRun(iRun);
+    int iStyle = run.GetStyle(), iCode, iLevel, iRunEmphasis;
+
+    if (codeMap.Lookup(iStyle, iCode))
+    {
+      iLevel = iCode / (EM_BOTH + 1);
+      iRunEmphasis = iCode % (EM_BOTH + 1);
+    }
+
+    else
+    {
+      m_styles.GetEmphasis(iStyle, iLevel, iRunEmphasis);
+      check_memory(codeMap.SetAt(iStyle, iLevel * (EM_BOTH + 1) +
+                                         iRunEmphasis));
+    }
+
+    // The first run decides the heading level, whose number signs are
+    // written first. A number sign at the beginning of any other paragraph
+    // is escaped, as it would otherwise make it a heading.
+
+    if (iRun == 0)
+    {
+      iParagraphLevel = iLevel;
+
+      if (iParagraphLevel > 0)
+      {
+        stLine += CString(TEXT('#'), iParagraphLevel) + TEXT(' ');
+      }
+
+      else if (stText[0] == TEXT('#'))
+      {
+        stLine += TEXT('\\');
+      }
+    }
+
+    CString stRun = stText.Mid(iChar, run.GetLength());
+    iChar += run.GetLength();
+
+    int iLength = stRun.GetLength(), iFirst = 0, iLast = iLength - 1;
+    while ((iFirst < iLength) && IsSpace(stRun[iFirst]))
+    {
+      ++iFirst;
+    }
+
+    if (iFirst == iLength)
+    {
+      stSpaces += stRun;
+      continue;
+    }
+
+    while (IsSpace(stRun[iLast]))
+    {
+      --iLast;
+    }
+
+    int iClose = iEmphasis & ~iRunEmphasis;
+    int iOpen = iRunEmphasis & ~iEmphasis;
+
+    if ((iClose & EM_ITALIC) != 0)
+    {
+      stLine += TEXT('*');
+    }
+
+    if ((iClose & EM_BOLD) != 0)
+    {
+      stLine += TEXT("**");
+    }
+
+    stLine += stSpaces + stRun.Left(iFirst);
+
+    if ((iOpen & EM_BOLD) != 0)
+    {
+      stLine += TEXT("**");
+    }
+
+    if ((iOpen & EM_ITALIC) != 0)
+    {
+      stLine += TEXT('*');
+    }
+
+    AppendEscaped(stRun.Mid(iFirst, iLast - iFirst + 1), stLine);
+    stSpaces = stRun.Mid(iLast + 1);
+    iEmphasis = iRunEmphasis;
+  }
+
+  if ((iEmphasis & EM_ITALIC) != 0)
+  {
+    stLine += TEXT('*');
+  }
+
+  if ((iEmphasis & EM_BOLD) != 0)
+  {
+    stLine += TEXT("**");
+  }
+
+  stLine += stSpaces;
+}
+
+// AppendEscaped writes the text with a backslash before every character
+// that would otherwise be taken for a mark.
+
+void TextExporter::AppendEscaped(const CString& stText, CString& stLine)
+{
+  int iLength = stText.GetLength();
+
+  for (int iIndex = 0; iIndex < iLength; ++iIndex)
+  {
+    TCHAR cChar = stText[iIndex];
+
+    if ((cChar == TEXT('\\')) || (cChar == TEXT('*')) ||
+        (cChar == TEXT('_')))
+    {
+      stLine += TEXT('\\');
+    }
+
+    stLine += cChar;
+  }
+}
+
+// AppendUtf8 converts the text into UTF-8 at the end of the buffer. Text of
+// ASCII characters only is copied character by character.
+
+void TextExporter::AppendUtf8(const CString& stText, CStringA& stBuffer)
+{
+  int iLength = stText.GetLength();
+  if (iLength == 0)
+  {
+    return;
+  }
+
+  int iOldLength = stBuffer.GetLength();
+  UINT uBits = 0;
+
+  for (int iIndex = 0; iIndex < iLength; ++iIndex)
+  {
+    uBits |= (UINT) (_TUCHAR) stText[iIndex];
+  }
+
+  if (uBits < 0x80)
+  {
+    char* pBuffer = stBuffer.GetBuffer(iOldLength + iLength) + iOldLength;
+
+    for (int iIndex = 0; iIndex < iLength; ++iIndex)
+    {
+      pBuffer[iIndex] = (char) stText[iIndex];
+    }
+
+    stBuffer.ReleaseBuffer(iOldLength + iLength);
+  }
+
+  else
+  {
+    CStringW stWide(stText);
+    int iChars = stWide.GetLength();
+    int iBytes = ::WideCharToMultiByte(CP_UTF8, 0, stWide, iChars, NULL, 0,
+                                       NULL, NULL);
+
+    char* pBuffer = stBuffer.GetBuffer(iOldLength + iBytes) + iOldLength;
+    ::WideCharToMultiByte(CP_UTF8, 0, stWide, iChars, pBuffer, iBytes, NULL,
+                          NULL);
+    stBuffer.ReleaseBuffer(iOldLength + iBytes);
+  }
+}
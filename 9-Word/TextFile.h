@@ -0,0 +1,112 @@
+const int IMPORT_CHUNK_SIZE = 1024 * 1024;
+const int EXPORT_CHUNK = 1024;
+const int EXPORT_ROUND = 64;
+
+const int TEXT_FONT_SIZE = 12;
+const int MAX_HEADING_LEVEL = 6;
+
+enum TextFormat {TF_PLAIN, TF_MARKDOWN};
+enum Emphasis {EM_NONE = 0, EM_BOLD = 1, EM_ITALIC = 2, EM_BOTH = 3};
+
+// A text file holds one paragraph on each line, in UTF-8. A Markdown file
+// may also begin a line with one to six number signs followed by a space,
+// which makes the paragraph a heading of that level, and mark bold text
+// with double asterisks or underscores and italic text with single ones.
+// A backslash makes the following mark an ordinary character. A marker opens
+// emphasis only if it is followed by a non-space, and closes it only if it
+// is preceded by one; underscores inside words are ordinary characters.
+
+// TextStyles holds the styles of the text formats: the body text and the
+// headings of each level, each of them plain, bold, italic, or both. The
+// headings are bold and larger than the body text. The styles are looked up
+// in the style table once, which lets the import threads build the font
+// runs without locking it. GetEmphasis finds the heading level and emphasis
+// of a style, which for a style of another font is found from its weight
+// and slant.
+
+class TextStyles
+{
+  public:
+    TextStyles();
+
+    int GetStyle(int iLevel, int iEmphasis) const
+                {return m_styleArray[iLevel][iEmphasis];}
+    const Font& GetEmptyFont(int iLevel) const
+                {return m_emptyFontArray[iLevel];}
+    void GetEmphasis(int iStyle, int& iLevel, int& iEmphasis) const;
+
+  private:
+    int m_styleArray[MAX_HEADING_LEVEL + 1][EM_BOTH + 1];
+    Font m_emptyFontArray[MAX_HEADING_LEVEL + 1];
+    CMap<int,int,int,int> m_codeMap;
+};
+
+// A TextImporter reads a text file into paragraphs. The file is mapped into
+// memory and divided into chunks of about IMPORT_CHUNK_SIZE bytes, each of
+// which ends with a line break, so that no line is shared by two chunks.
+// The chunks are imported on one thread for each processor: each thread
+// takes the next chunk, splits it into lines, converts them, builds their
+// paragraphs with their font runs, and defers their layout. The paragraphs
+// of the chunks are then gathered in order.
+
+class TextImporter
+{
+  public:
+    TextImporter(FontCache* pFontCache, TextFormat eFormat);
+    ~TextImporter();
+
+    BOOL Import(LPCTSTR lpszPathName, ParagraphPtrArray& paragraphArray);
+
+  private:
+    void DivideChunks(int iStart, int iSize);
+    static UINT ImportThread(LPVOID pParam);
+    void ImportChunks();
+    void ImportChunk(int iChunk, CDC* pDC);
+
+    Paragraph* CreateParagraph(const char* pLine, int iBytes) const;
+    void ParseMarkdown(const CString& stLine, int& iLevel, CString& stText,
+                       FontRunArray& fontRunArray) const;
+
+    FontCache* m_pFontCache;
+    TextFormat m_eFormat;
+    TextStyles m_styles;
+
+    const char* m_pBuffer;
+    CArray<int> m_boundaryArray;
+    CArray<ParagraphPtrArray*> m_chunkArray;
+    volatile LONG m_lNextChunk;
+};
+
+// A TextExporter writes paragraphs to a text file. The paragraphs are
+// divided into chunks of EXPORT_CHUNK paragraphs, which are converted into
+// UTF-8 in parallel, EXPORT_ROUND chunks at a time, and written to the file
+// in order. Only one round of text is held in memory, so the export streams
+// the document to the file. The alignment of the paragraphs is not written,
+// and neither are fonts other than bold and italic and the headings.
+
+class TextExporter
+{
+  public:
+    TextExporter(TextFormat eFormat);
+
+    BOOL Export(LPCTSTR lpszPathName, const ParagraphPtrArray& paragraphArray);
+
+  private:
+    static UINT ExportThread(LPVOID pParam);
+    void ExportChunks();
+    void ExportChunk(int iChunk, CStringA& stBuffer,
+                     CMap<int,int,int,int>& codeMap) const;
+
+    void AppendMarkdown(const Paragraph* pParagraph, CString& stLine,
+                        CMap<int,int,int,int>& codeMap) const;
+    static void AppendEscaped(const CString& stText, CString& stLine);
+    static void AppendUtf8(const CString& stText, CStringA& stBuffer);
+
+    TextFormat m_eFormat;
+    TextStyles m_styles;
+
+    const ParagraphPtrArray* m_pParagraphArray;
+    CStringA m_bufferArray[EXPORT_ROUND];
+    int m_iFirstChunk, m_iLastChunk;
+    volatile LONG m_lNextChunk;
+};
@@ -0,0 +1,180 @@
+#include "StdAfx.h"
+
+#include "Layout/LayoutCore.h"
+#include "TextCluster.h"
+#include "TextSearch.h"
+
+// The constructor folds the pattern and sets up the skip table. The last
+// character of the pattern is left out of the table, as the search always
+// skips at least one character.
+
+TextSearch::TextSearch(const CString& stPattern, BOOL bMatchCase)
+ :m_bMatchCase(bMatchCase)
+{
+  int iLength = stPattern.GetLength();
+  const TCHAR* pText = stPattern;
+  TCHAR* pPattern = m_stPattern.GetBuffer(iLength);
+
+  for (int iIndex = 0; iIndex < iLength;)
+  {
+    int iNextIndex = NextCluster(pText, iLength, iIndex);
+    FoldCluster(pText + iIndex, iNextIndex - iIndex, pPattern + iIndex);
+    iIndex = iNextIndex;
+  }
+
+  m_stPattern.ReleaseBuffer(iLength);
+
+  for (int iByte = 0; iByte < SKIP_TABLE_SIZE; ++iByte)
+  {
+    m_skipArray[iByte] = max(1, iLength);
+  }
+
+  for (int iIndex = 0; iIndex < (iLength - 1); ++iIndex)
+  {
+    int iByte = ((_TUCHAR) m_stPattern[iIndex]) & (SKIP_TABLE_SIZE - 1);
+    m_skipArray[iByte] = iLength - 1 - iIndex;
+  }
+}
+
+// Fold returns the character in lower case, unless the case shall be
+// matched. The ASCII letters, which make up most of a typical text, are
+// folded directly; other characters are left to the runtime library.
+
+TCHAR TextSearch::Fold(TCHAR cChar) const
+{
+  _TUCHAR uChar = (_TUCHAR) cChar;
+
+  if (m_bMatchCase)
+  {
+    return cChar;
+  }
+
+  if ((uChar >= TEXT('A')) && (uChar <= TEXT('Z')))
+  {
+    return (TCHAR) (uChar + (TEXT('a') - TEXT('A')));
+  }
+
+  if (uChar < 128)
+  {
+    return cChar;
+  }
+
+  return (TCHAR) _totlower(uChar);
+}
+
+// FoldCluster writes the code units of a cluster in lower case, unless the
+// case shall be matched. A double-byte character is folded as a whole, and
+// is kept as it is if its lower case is not a double-byte character, which
+// keeps the number of code units. In a Unicode build, the code units are
+// folded one by one.
+
+void TextSearch::FoldCluster(const TCHAR* pCluster, int iLength,
+                             TCHAR* pFolded) const
+{
+#ifndef _UNICODE
+  if (iLength > 1)
+  {
+    UINT uChar = (((UINT) (BYTE) pCluster[0]) << 8) | (BYTE) pCluster[1];
+    UINT uLower = m_bMatchCase ? uChar : _mbctolower(uChar);
+
+    if (uLower <= 0xFF)
+    {
+      uLower = uChar;
+    }
+
+    pFolded[0] = (TCHAR) (uLower >> 8);
+    pFolded[1] = (TCHAR) (uLower & 0xFF);
+    return;
+  }
+#endif
+
+  for (int iIndex = 0; iIndex < iLength; ++iIndex)
+  {
+    pFolded[iIndex] = Fold(pCluster[iIndex]);
+  }
+}
+
+// Find returns the index of the first occurrence of the pattern in the text
+// that starts at or after the given index, or minus one if there is none.
+// The given index must be a cluster start, and the occurrence must end
+// before the given length of the text.
+
+// The text is folded into a buffer from the given index, one cluster at a
+// time, only as far as the search window has reached. The cluster starts
+// are found by walking forward from the given index, which is only done
+// when the last character of the window matches. As the window only moves
+// forward, each code unit is folded and walked over once, which keeps the
+// search linear in the length of the text even though a cluster start can
+// not be recognized by looking backward in a multibyte text.
+
+int TextSearch::Find(const TCHAR* pText, int iLength,
+                     int iStart /* = 0 */) const
+{
+  int iPatternLength = GetLength();
+  iStart = max(0, iStart);
+
+  if ((iPatternLength == 0) || (iPatternLength > (iLength - iStart)))
+  {
+    return -1;
+  }
+
+  const TCHAR* pPattern = m_stPattern;
+  TCHAR cLast = pPattern[iPatternLength - 1];
+
+  CString stFolded;
+  TCHAR* pFolded = stFolded.GetBuffer(iLength - iStart);
+  int iFolded = iStart, iClusterStart = iStart;
+
+  for (int iIndex = iStart; iIndex <= (iLength - iPatternLength);)
+  {
+    int iLastIndex = iIndex + iPatternLength - 1;
+
+    while (iFolded <= iLastIndex)
+    {
+      int iNextIndex = NextCluster(pText, iLength, iFolded);
+      FoldCluster(pText + iFolded, iNextIndex - iFolded,
+                  pFolded + (iFolded - iStart));
+      iFolded = iNextIndex;
+    }
+
+    TCHAR cChar = pFolded[iLastIndex - iStart];
+
+    if (cChar == cLast)
+    {
+      while (iClusterStart < iIndex)
+      {
+        iClusterStart = NextCluster(pText, iLength, iClusterStart);
+      }
+
+      int iMatched = iPatternLength - 1;
+
+      while ((iMatched > 0) &&
+             (pFolded[iIndex + iMatched - 1 - iStart] ==
+              pPattern[iMatched - 1]))
+      {
+        --iMatched;
+      }
+
+      // The occurrence is only accepted if both its first character and
+      // the character following it are cluster starts.
+
+      if ((iMatched == 0) && (iClusterStart == iIndex))
+      {
+        int iEnd = iIndex;
+        while (iEnd <= iLastIndex)
+        {
+          iEnd = NextCluster(pText, iLength, iEnd);
+        }
+
+        if (iEnd == (iLastIndex + 1))
+        {
+          return iIndex;
+        }
+      }
+    }
+
+    iIndex += m_skipArray[((_TUCHAR) cChar) & (SKIP_TABLE_SIZE - 1)];
+  }
+
+  return -1;
+}
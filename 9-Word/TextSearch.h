@@ -0,0 +1,35 @@
+const int SKIP_TABLE_SIZE = 256;
+
+// A TextSearch finds the occurrences of a pattern in a text with the
+// Boyer-Moore-Horspool algorithm. The pattern is compared from its last
+// character, and when a character of the text does not match, the search
+// skips ahead by the distance from the last occurrence of that character in
+// the pattern to its end, which is the length of the whole pattern for a
+// character that does not occur in it. Therefore, the longer the pattern,
+// the fewer characters of the text are examined. The skip table is indexed
+// by the low byte of the character, which keeps it small; characters
+// sharing a low byte share the shortest of their distances. Unless the case
+// shall be matched, the pattern and the text are compared in lower case.
+// The text is folded one cluster at a time as the search advances, so that
+// a double-byte character is folded as a whole, and an occurrence must
+// start and end on a cluster boundary, so that the pattern never matches
+// the trail byte of a character or a part of a cluster.
+
+class TextSearch
+{
+  public:
+    TextSearch(const CString& stPattern, BOOL bMatchCase);
+
+    int GetLength() const {return m_stPattern.GetLength();}
+    BOOL IsEmpty() const {return m_stPattern.IsEmpty();}
+    int Find(const TCHAR* pText, int iLength, int iStart = 0) const;
+
+  private:
+    TCHAR Fold(TCHAR cChar) const;
+    void FoldCluster(const TCHAR* pCluster, int iLength,
+                     TCHAR* pFolded) const;
+
+    CString m_stPattern;
+    BOOL m_bMatchCase;
+    int m_skipArray[SKIP_TABLE_SIZE];
+};
@@ -0,0 +1,51 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Check.h"
+#include "Threads.h"
+
+CWinThread* StartThread(AFX_THREADPROC pfnThreadProc, LPVOID pParam,
+                        int nPriority /* = THREAD_PRIORITY_NORMAL */)
+{
+  CWinThread* pThread = AfxBeginThread(pfnThreadProc, pParam, nPriority, 0,
+                                       CREATE_SUSPENDED);
+  check(pThread != NULL);
+
+  pThread->m_bAutoDelete = FALSE;
+  pThread->ResumeThread();
+  return pThread;
+}
+
+void RunThreads(AFX_THREADPROC pfnThreadProc, LPVOID pParam, int iTasks)
+{
+  SYSTEM_INFO systemInfo;
+  ::GetSystemInfo(&systemInfo);
+  int iThreads = max(1, min((int) systemInfo.dwNumberOfProcessors, iTasks));
+
+  CArray<CWinThread*> threadArray;
+  for (int iThread = 0; iThread < iThreads; ++iThread)
+  {
+    check_memory(threadArray.Add(StartThread(pfnThreadProc, pParam)));
+  }
+
+  for (int iThread = 0; iThread < iThreads; ++iThread)
+  {
+    CWinThread* pThread = threadArray[iThread];
+    ::WaitForSingleObject(pThread->m_hThread, INFINITE);
+    delete pThread;
+  }
+}
+
+StopWatch::StopWatch()
+{
+  ::QueryPerformanceCounter(&m_liStart);
+}
+
+double StopWatch::GetMilliseconds() const
+{
+  LARGE_INTEGER liFrequency, liStop;
+  ::QueryPerformanceFrequency(&liFrequency);
+  ::QueryPerformanceCounter(&liStop);
+  return 1000.0 * (liStop.QuadPart - m_liStart.QuadPart) /
+         liFrequency.QuadPart;
+}
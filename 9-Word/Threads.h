@@ -0,0 +1,28 @@
+// StartThread begins the given thread function on a new thread. The thread
+// is created suspended in order to prevent it from deleting itself before we
+// have waited for it; it is then resumed. The caller waits for its handle
+// and deletes it.
+
+CWinThread* StartThread(AFX_THREADPROC pfnThreadProc, LPVOID pParam,
+                        int nPriority = THREAD_PRIORITY_NORMAL);
+
+// RunThreads runs the given thread function on one thread for each
+// processor, but on no more threads than there are tasks, and waits for all
+// of them to finish. The threads share the parameter, from which they take
+// the tasks themselves.
+
+void RunThreads(AFX_THREADPROC pfnThreadProc, LPVOID pParam, int iTasks);
+
+// A StopWatch measures the time elapsed since it was created with the
+// performance counter, which is how the time of the operations whose speed
+// matters is reported in debug builds.
+
+class StopWatch
+{
+  public:
+    StopWatch();
+    double GetMilliseconds() const;
+
+  private:
+    LARGE_INTEGER m_liStart;
+};
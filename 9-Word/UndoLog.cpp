@@ -0,0 +1,236 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Font.h"
+#include "Check.h"
+#include "PrefixSum.h"
+
+#include "RepaintRegion.h"
+#include "Line.h"
+#include "Position.h"
+#include "PieceTable.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "Paragraph.h"
+#include "UndoLog.h"
+
+// The constructor copies the paragraphs of the range before they are
+// changed. The number of paragraphs of the document is saved, as the
+// difference between it and the number of paragraphs when the entry is
+// closed gives the number of paragraphs the range holds after the change.
+
+UndoEntry::UndoEntry(ParagraphPtrArray* pParagraphArray,
+                     int iFirstParagraph, int iLastParagraph, BOOL bTyping,
+                     WordState eWordState, Position psEdit,
+                     Position psFirstMark, Position psLastMark)
+ :m_iFirstParagraph(iFirstParagraph),
+  m_iOldParagraphs(iLastParagraph - iFirstParagraph + 1),
+  m_iOldTotal((int) pParagraphArray->GetSize()),
+  m_iSize(0),
+  m_bTyping(bTyping),
+  m_bClosed(FALSE),
+  m_eWordState(eWordState),
+  m_psEdit(psEdit),
+  m_psFirstMark(psFirstMark),
+  m_psLastMark(psLastMark),
+  m_psEditAfter(psEdit)
+{
+  m_iSize = CopyParagraphs(pParagraphArray, m_iFirstParagraph,
+                           m_iOldParagraphs, m_oldArray);
+}
+
+UndoEntry::~UndoEntry()
+{
+  int iOldParagraphs = (int) m_oldArray.GetSize();
+  for (int iIndex = 0; iIndex < iOldParagraphs; ++iIndex)
+  {
+    delete m_oldArray[iIndex];
+  }
+
+  int iNewParagraphs = (int) m_newArray.GetSize();
+  for (int iIndex = 0; iIndex < iNewParagraphs; ++iIndex)
+  {
+    delete m_newArray[iIndex];
+  }
+}
+
+// Close copies the paragraphs of the range after the change. It is called
+// when no more changes are to be coalesced into the entry, at which point
+// the paragraphs of the document are the same as right after the change.
+
+void UndoEntry::Close(ParagraphPtrArray* pParagraphArray)
+{
+  if (!m_bClosed)
+  {
+    int iNewParagraphs = m_iOldParagraphs +
+                         ((int) pParagraphArray->GetSize() - m_iOldTotal);
+    m_iSize += CopyParagraphs(pParagraphArray, m_iFirstParagraph,
+                              iNewParagraphs, m_newArray);
+    m_bClosed = TRUE;
+  }
+}
+
+// CopyParagraphs copies the given paragraphs by extracting their text, which
+// copies the pieces and font runs but not the characters. It returns the
+// size of the copies, which is the number of characters and paragraphs.
+
+int UndoEntry::CopyParagraphs(ParagraphPtrArray* pParagraphArray,
+                              int iFirstParagraph, int iCount,
+                              ParagraphPtrArray& copyArray)
+{
+  int iSize = 0;
+  copyArray.SetSize(iCount);
+
+  for (int iIndex = 0; iIndex < iCount; ++iIndex)
+  {
+    Paragraph* pParagraph = (*pParagraphArray)[iFirstParagraph + iIndex];
+    copyArray[iIndex] = pParagraph->ExtractText();
+    iSize += pParagraph->GetLength() + 1;
+  }
+
+  return iSize;
+}
+
+UndoLog::UndoLog(ParagraphPtrArray* pParagraphArray)
+ :m_pParagraphArray(pParagraphArray),
+  m_iSize(0)
+{
+  // Empty.
+}
+
+UndoLog::~UndoLog()
+{
+  Clear();
+}
+
+// Continue returns true if a character typed at the given position can be
+// coalesced into the latest entry, which is the case if that entry is open,
+// records typing into the same paragraph, and ended at the same position.
+
+BOOL UndoLog::Continue(int iParagraph, Position psEdit)
+{
+  if (m_undoList.IsEmpty())
+  {
+    return FALSE;
+  }
+
+  UndoEntry* pEntry = m_undoList.GetTail();
+  return !pEntry->IsClosed() && pEntry->IsTyping() &&
+         (pEntry->GetFirstParagraph() == iParagraph) &&
+         (pEntry->GetEditAfter() == psEdit);
+}
+
+// Begin closes the latest entry and begins a new one, holding the paragraphs
+// of the given range as they are before the change. As the change makes the
+// undone entries obsolete, they are removed.
+
+void UndoLog::Begin(int iFirstParagraph, int iLastParagraph, BOOL bTyping,
+                    WordState eWordState, Position psEdit,
+                    Position psFirstMark, Position psLastMark)
+{
+  Close();
+
+  for (POSITION position = m_redoList.GetHeadPosition();
+       position != NULL; m_redoList.GetNext(position))
+  {
+    m_iSize -= m_redoList.GetAt(position)->GetSize();
+  }
+
+  ClearList(m_redoList);
+
+  UndoEntry* pEntry;
+  check_memory(pEntry = new UndoEntry(m_pParagraphArray, iFirstParagraph,
+                                      iLastParagraph, bTyping, eWordState,
+                                      psEdit, psFirstMark, psLastMark));
+  m_undoList.AddTail(pEntry);
+  m_iSize += pEntry->GetSize();
+  Trim();
+}
+
+// End is called when the change has been made, with the edit position
+// after the change.
+
+void UndoLog::End(Position psEdit)
+{
+  if (!m_undoList.IsEmpty())
+  {
+    m_undoList.GetTail()->SetEditAfter(psEdit);
+  }
+}
+
+// Undo closes the latest entry and moves it to the redone entries. Redo
+// moves the latest undone entry back. Both return the moved entry, or null
+// if there is none; it is up to the document to apply it.
+
+UndoEntry* UndoLog::Undo()
+{
+  Close();
+
+  if (m_undoList.IsEmpty())
+  {
+    return NULL;
+  }
+
+  UndoEntry* pEntry = m_undoList.RemoveTail();
+  m_redoList.AddTail(pEntry);
+  return pEntry;
+}
+
+UndoEntry* UndoLog::Redo()
+{
+  if (m_redoList.IsEmpty())
+  {
+    return NULL;
+  }
+
+  UndoEntry* pEntry = m_redoList.RemoveTail();
+  m_undoList.AddTail(pEntry);
+  return pEntry;
+}
+
+void UndoLog::Clear()
+{
+  ClearList(m_undoList);
+  ClearList(m_redoList);
+  m_iSize = 0;
+}
+
+void UndoLog::Close()
+{
+  if (!m_undoList.IsEmpty() && !m_undoList.GetTail()->IsClosed())
+  {
+    UndoEntry* pEntry = m_undoList.GetTail();
+    int iOldSize = pEntry->GetSize();
+
+    pEntry->Close(m_pParagraphArray);
+    m_iSize += pEntry->GetSize() - iOldSize;
+    Trim();
+  }
+}
+
+// Trim drops the oldest entries while the log is too large. The latest
+// entry is always kept, so that even a change larger than the limit can be
+// undone.
+
+void UndoLog::Trim()
+{
+  while (((m_iSize > UNDO_MAX_SIZE) ||
+          ((m_undoList.GetCount() + m_redoList.GetCount()) >
+           UNDO_MAX_ENTRIES)) && (m_undoList.GetCount() > 1))
+  {
+    UndoEntry* pEntry = m_undoList.RemoveHead();
+    m_iSize -= pEntry->GetSize();
+    delete pEntry;
+  }
+}
+
+void UndoLog::ClearList(UndoEntryList& entryList)
+{
+  for (POSITION position = entryList.GetHeadPosition();
+       position != NULL; entryList.GetNext(position))
+  {
+    delete entryList.GetAt(position);
+  }
+
+  entryList.RemoveAll();
+}
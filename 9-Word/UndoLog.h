@@ -0,0 +1,89 @@
+const int UNDO_MAX_SIZE = 1000000;
+const int UNDO_MAX_ENTRIES = 1000;
+
+// An UndoEntry records one change of the document as the replacement of a
+// range of consecutive paragraphs by another. It holds copies of the
+// paragraphs of the range before the change and, once the entry has been
+// closed, after the change. The copies share their characters with the
+// paragraphs of the document, so an entry takes space in proportion to the
+// size of the change rather than the size of the document. It also holds
+// the edit and mark positions before the change, and the edit position
+// after it.
+
+class UndoEntry
+{
+  public:
+    UndoEntry(ParagraphPtrArray* pParagraphArray, int iFirstParagraph,
+              int iLastParagraph, BOOL bTyping, WordState eWordState,
+              Position psEdit, Position psFirstMark, Position psLastMark);
+    ~UndoEntry();
+
+    void Close(ParagraphPtrArray* pParagraphArray);
+    BOOL IsClosed() const {return m_bClosed;}
+    BOOL IsTyping() const {return m_bTyping;}
+    int GetSize() const {return m_iSize;}
+
+    int GetFirstParagraph() const {return m_iFirstParagraph;}
+    ParagraphPtrArray& GetOldArray() {return m_oldArray;}
+    ParagraphPtrArray& GetNewArray() {return m_newArray;}
+
+    WordState GetWordState() const {return m_eWordState;}
+    Position GetEditBefore() const {return m_psEdit;}
+    Position GetFirstMark() const {return m_psFirstMark;}
+    Position GetLastMark() const {return m_psLastMark;}
+
+    Position GetEditAfter() const {return m_psEditAfter;}
+    void SetEditAfter(Position psEdit) {m_psEditAfter = psEdit;}
+
+  private:
+    static int CopyParagraphs(ParagraphPtrArray* pParagraphArray,
+                              int iFirstParagraph, int iCount,
+                              ParagraphPtrArray& copyArray);
+
+    int m_iFirstParagraph, m_iOldParagraphs, m_iOldTotal, m_iSize;
+    BOOL m_bTyping, m_bClosed;
+    ParagraphPtrArray m_oldArray, m_newArray;
+
+    WordState m_eWordState;
+    Position m_psEdit, m_psFirstMark, m_psLastMark, m_psEditAfter;
+};
+
+typedef CList<UndoEntry*> UndoEntryList;
+
+// The UndoLog holds the entries that can be undone and redone. Each editing
+// command begins an entry before it changes the paragraphs and ends it
+// afterwards. The paragraphs after the change are not copied until the entry
+// is closed, which happens when the next entry begins or the entry is
+// undone. Consecutive characters typed into the same paragraph are
+// coalesced into the open entry, which makes typing cost constant time per
+// character. The sizes of the entries are summed, and the oldest entries are
+// dropped when the sum or the number of entries exceeds its limit.
+
+class UndoLog
+{
+  public:
+    UndoLog(ParagraphPtrArray* pParagraphArray);
+    ~UndoLog();
+
+    BOOL Continue(int iParagraph, Position psEdit);
+    void Begin(int iFirstParagraph, int iLastParagraph, BOOL bTyping,
+               WordState eWordState, Position psEdit, Position psFirstMark,
+               Position psLastMark);
+    void End(Position psEdit);
+
+    BOOL CanUndo() const {return !m_undoList.IsEmpty();}
+    BOOL CanRedo() const {return !m_redoList.IsEmpty();}
+
+    UndoEntry* Undo();
+    UndoEntry* Redo();
+    void Clear();
+
+  private:
+    void Close();
+    void Trim();
+    static void ClearList(UndoEntryList& entryList);
+
+    ParagraphPtrArray* m_pParagraphArray;
+    UndoEntryList m_undoList, m_redoList;
+    int m_iSize;
+};
@@ -7,14 +7,23 @@
 
 #include "ChildFrm.h"
 
-#include "Set.h"
 #include "Font.h"
 #include "Caret.h"
+#include "Check.h"
+#include "PrefixSum.h"
 
+#include "RepaintRegion.h"
 #include "Line.h"
 #include "Position.h"
+#include "PieceTable.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "FontCache.h"
 #include "Paragraph.h"
 #include "Page.h"
+#include "UndoLog.h"
+#include "BackgroundSave.h"
+#include "TextFile.h"
 
 #include "WordView.h"
 #include "WordDoc.h"
@@ -31,6 +40,7 @@ BEGIN_MESSAGE_MAP(CWordApp, CWinApp)
 	// Standard file based document commands
 	ON_COMMAND(ID_FILE_NEW, &CWinApp::OnFileNew)
 	ON_COMMAND(ID_FILE_OPEN, &CWinApp::OnFileOpen)
+	ON_COMMAND(ID_FILE_IMPORT, &CWordApp::OnFileImport)
 	// Standard print setup command
 	ON_COMMAND(ID_FILE_PRINT_SETUP, &CWinApp::OnFilePrintSetup)
 END_MESSAGE_MAP()
@@ -168,3 +178,93 @@ void CWordApp::OnAppAbout()
 
 // CWordApp message handlers
 
+// OnIdle lets every open document lay out its pending paragraphs in the
+// background, and asks for more idle time as long as any of them has more
+// to do.
+
+BOOL CWordApp::OnIdle(LONG lCount)
+{
+	BOOL bMore = CWinApp::OnIdle(lCount);
+
+	POSITION templatePosition = GetFirstDocTemplatePosition();
+	while (templatePosition != NULL)
+	{
+		CDocTemplate* pTemplate = GetNextDocTemplate(templatePosition);
+
+		POSITION docPosition = pTemplate->GetFirstDocPosition();
+		while (docPosition != NULL)
+		{
+			CWordDoc* pWordDoc = (CWordDoc*) pTemplate->GetNextDoc(docPosition);
+
+			if (pWordDoc->OnIdle())
+			{
+				bMore = TRUE;
+			}
+		}
+	}
+
+	return bMore;
+}
+
+// AutoSaveDocuments is called by the main frame at regular intervals, and
+// lets every open document save itself in the background.
+
+void CWordApp::AutoSaveDocuments()
+{
+	POSITION templatePosition = GetFirstDocTemplatePosition();
+	while (templatePosition != NULL)
+	{
+		CDocTemplate* pTemplate = GetNextDocTemplate(templatePosition);
+
+		POSITION docPosition = pTemplate->GetFirstDocPosition();
+		while (docPosition != NULL)
+		{
+			CWordDoc* pWordDoc = (CWordDoc*) pTemplate->GetNextDoc(docPosition);
+			pWordDoc->AutoSave();
+		}
+	}
+}
+
+// OnFileImport lets the user choose a text file, and imports it into a new
+// document, which is given the title of the file but no path, so that it is
+// saved in the format of the application. Like OnFileExport, the file is
+// imported as Markdown if the Markdown type is chosen or the file has its
+// extension, otherwise as plain text.
+
+void CWordApp::OnFileImport()
+{
+	CFileDialog fileDialog(TRUE, NULL, NULL,
+	                       OFN_FILEMUSTEXIST | OFN_HIDEREADONLY,
+	                       TEXT("Text Files (*.txt)|*.txt|")
+	                       TEXT("Markdown Files (*.md)|*.md;*.markdown|")
+	                       TEXT("All Files (*.*)|*.*||"));
+
+	if (fileDialog.DoModal() != IDOK)
+	{
+		return;
+	}
+
+	CString stExtension = fileDialog.GetFileExt();
+	TextFormat eFormat = ((fileDialog.m_ofn.nFilterIndex == 2) ||
+	                      (stExtension.CompareNoCase(TEXT("md")) == 0) ||
+	                      (stExtension.CompareNoCase(TEXT("markdown")) == 0))
+	                     ? TF_MARKDOWN : TF_PLAIN;
+
+	POSITION templatePosition = GetFirstDocTemplatePosition();
+	CDocTemplate* pTemplate = GetNextDocTemplate(templatePosition);
+
+	CWordDoc* pWordDoc = (CWordDoc*) pTemplate->OpenDocumentFile(NULL);
+	if (pWordDoc == NULL)
+	{
+		return;
+	}
+
+	if (!pWordDoc->ImportText(fileDialog.GetPathName(), eFormat))
+	{
+		AfxMessageBox(AFX_IDP_FAILED_TO_OPEN_DOC);
+		pWordDoc->OnCloseDocument();
+		return;
+	}
+
+	pWordDoc->SetTitle(fileDialog.GetFileTitle());
+}
@@ -22,6 +22,10 @@ public:
 // Overrides
 public:
 	virtual BOOL InitInstance();
+	virtual BOOL OnIdle(LONG lCount);
+
+	void AutoSaveDocuments();
+	afx_msg void OnFileImport();
 
 // Implementation
 	afx_msg void OnAppAbout();
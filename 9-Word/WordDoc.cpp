@@ -1,15 +1,28 @@
 #include "StdAfx.h"
 #include <AfxTempl.h>
 
-#include "Set.h"
 #include "Font.h"
 #include "Caret.h"
 #include "Check.h"
+#include "PrefixSum.h"
+#include "Layout/LayoutCore.h"
 
+#include "RepaintRegion.h"
 #include "Line.h"
 #include "Position.h"
+#include "PieceTable.h"
+#include "TextSearch.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "FontCache.h"
 #include "Paragraph.h"
 #include "Page.h"
+#include "UndoLog.h"
+#include "ParallelLayout.h"
+#include "WordFile.h"
+#include "BackgroundSave.h"
+#include "TextFile.h"
+#include "Threads.h"
 
 #include "WordView.h"
 #include "WordDoc.h"
@@ -39,7 +52,15 @@ BEGIN_MESSAGE_MAP(CWordDoc, CDocument)
   ON_UPDATE_COMMAND_UI(ID_EDIT_PASTE, OnUpdatePaste)
   ON_COMMAND(ID_EDIT_PASTE, OnPaste)
 
+  ON_UPDATE_COMMAND_UI(ID_EDIT_UNDO, OnUpdateUndo)
+  ON_COMMAND(ID_EDIT_UNDO, OnUndo)
+
+  ON_UPDATE_COMMAND_UI(ID_EDIT_REDO, OnUpdateRedo)
+  ON_COMMAND(ID_EDIT_REDO, OnRedo)
+
   ON_COMMAND(ID_FORMAT_FONT, OnFont)
+  ON_COMMAND(ID_FILE_EXPORT, OnFileExport)
+  ON_UPDATE_COMMAND_UI(ID_INDICATOR_STATISTICS, OnUpdateStatistics)
 END_MESSAGE_MAP()
 
 // This class must have a default constructor because it will be created
@@ -55,13 +76,29 @@ CWordDoc::CWordDoc()
   m_psEdit(0, 0),
   m_psFirstMark(0, 0),
   m_psLastMark(0, 0),
-  m_pNextFont(NULL)
+  m_pNextFont(NULL),
+  m_undoLog(&m_paragraphArray),
+  m_bLayingOut(FALSE),
+  m_bIdleLayout(FALSE),
+  m_iIdleParagraph(0),
+  m_bAutoSaving(FALSE),
+  m_bAutoSaveDirty(FALSE)
 {
   // Empty.
 }
 
 CWordDoc::~CWordDoc()
 {
+  // A save in progress may still be writing the paragraphs, so we wait for
+  // it before deleting them. The autosave file is no longer needed.
+
+  m_backgroundSave.Wait();
+
+  if (!GetPathName().IsEmpty())
+  {
+    ::DeleteFile(GetPathName() + AUTOSAVE_EXTENSION);
+  }
+
   int iParagraphs = (int) m_paragraphArray.GetSize();
   for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
   {
@@ -88,8 +125,12 @@ BOOL CWordDoc::OnNewDocument()
   CClientDC dc(m_pView);
   m_pView->OnPrepareDC(&dc);
 
-  pNewParagraph->Recalculate(&dc);
+  pNewParagraph->Recalculate(&dc, &m_fontCache);
   m_paragraphArray.Add(pNewParagraph);
+  m_heightSum.Add(pNewParagraph->GetHeight());
+  m_wordSum.Add(0);
+  m_charSum.Add(0);
+  m_lineSum.Add(pNewParagraph->GetLineCount());
 
   Page page(0, 0);
   m_pageArray.Add(page);
@@ -97,31 +138,250 @@ BOOL CWordDoc::OnNewDocument()
   return CDocument::OnNewDocument();
 }
 
-// Serialize reads from and writes to the file connected to the parameter
-// archive the paragraph array. As this method is called by the Application
-// Framework every time the user loads or saves a document, we first of all
-// have to call Serialize in the MFC base class CDocument.
+// OnOpenDocument maps the file into memory and reads the paragraphs from
+// it. As the file holds no layout, each paragraph is given an estimated
+// height and its layout is deferred until it is painted or the application
+// is idle, which makes the document open in time proportional to the size
+// of its text rather than the cost of its layout. If the file does not
+// begin with the header of the current format, it is a document saved in
+// the previous format, and it is left to the Application Framework, which
+// calls Serialize.
 
-// We cannot serialize the paragraph array itself, as it holds pointers to
-// paragraph objects, not the object themselves. Instead, we first read or
-// write the size of the array, and then we serialize the paragraphs
-// one-by-one. When we read from the archive, we have to create the paragraph
-// first, and then serialize it. Finally, we add it to the array.
+BOOL CWordDoc::OnOpenDocument(LPCTSTR lpszPathName)
+{
+  MappedFile mappedFile;
+  if (!mappedFile.Open(lpszPathName))
+  {
+    return CDocument::OnOpenDocument(lpszPathName);
+  }
 
-void CWordDoc::Serialize(CArchive& archive)
+  WordFileReader reader(mappedFile.GetBuffer(), mappedFile.GetSize());
+  if (!reader.ReadHeader())
+  {
+    mappedFile.Close();
+    return CDocument::OnOpenDocument(lpszPathName);
+  }
+
+  DeleteContents();
+
+  CDC dc;
+  check(dc.CreateCompatibleDC(NULL));
+  CWordView::SetLogicalUnits(&dc);
+
+  int iParagraphs = reader.GetParagraphCount();
+  for (int iCount = 0; iCount < iParagraphs; ++iCount)
+  {
+    Paragraph* pParagraph;
+    check_memory(pParagraph = new Paragraph());
+
+    if (!pParagraph->Read(reader))
+    {
+      delete pParagraph;
+      AfxMessageBox(AFX_IDP_FAILED_INVALID_FORMAT);
+      return FALSE;
+    }
+
+    pParagraph->DeferLayout(&dc, &m_fontCache);
+    m_paragraphArray.Add(pParagraph);
+  }
+
+  UpdateParagraphAndPageArray();
+  m_bIdleLayout = TRUE;
+
+  SetModifiedFlag(FALSE);
+  return TRUE;
+}
+
+// OnSaveDocument saves the paragraphs in the background, which stalls the
+// user interface only for the time it takes to snapshot the paragraph array.
+// Only the text, the fonts and the alignment are written, so the paragraphs
+// whose layout is pending need not be laid out first. A previous save is
+// finished first. The document is marked as unmodified at once; if the save
+// fails, FinishSave marks it as modified again and reports the failure.
+
+BOOL CWordDoc::OnSaveDocument(LPCTSTR lpszPathName)
 {
-  CDocument::Serialize(archive);
+  FinishSave();
+
+  m_backgroundSave.Start(&m_paragraphArray, lpszPathName,
+                         AfxGetMainWnd()->GetSafeHwnd());
+  m_bAutoSaving = FALSE;
+  m_bAutoSaveDirty = FALSE;
+
+  SetModifiedFlag(FALSE);
+  return TRUE;
+}
+
+// AutoSave is called by the main frame at regular intervals. A document
+// that has a file and has been changed since it was last saved or
+// autosaved is saved in the background to the autosave file next to its
+// file, which leaves the file itself and the modified flag alone. Nothing
+// is done while another save is in progress.
+
+void CWordDoc::AutoSave()
+{
+  if (IsModified() && m_bAutoSaveDirty && !GetPathName().IsEmpty() &&
+      !m_backgroundSave.IsActive())
+  {
+    m_backgroundSave.Start(&m_paragraphArray,
+                           GetPathName() + AUTOSAVE_EXTENSION,
+                           AfxGetMainWnd()->GetSafeHwnd());
+    m_bAutoSaving = TRUE;
+    m_bAutoSaveDirty = FALSE;
+  }
+}
+
+// FinishSave waits for a save in progress and releases its snapshot, which
+// takes no time when the worker thread has already finished. When a save of
+// the document succeeds, its autosave file is deleted. When it fails, the
+// document is marked as modified and the user is told; FinishSave then
+// returns false. A failed autosave is only traced, and is tried again at the
+// next interval.
 
-  if (archive.IsStoring())
+BOOL CWordDoc::FinishSave()
+{
+  if (!m_backgroundSave.IsActive())
   {
-    int iSize = (int) m_paragraphArray.GetSize();
-    archive << iSize;
+    return TRUE;
+  }
 
-    for (int iIndex = 0; iIndex < iSize; ++iIndex)
+  CString stPathName = m_backgroundSave.GetPathName();
+
+  if (m_backgroundSave.Wait())
+  {
+    if (!m_bAutoSaving)
     {
-      m_paragraphArray[iIndex]->Serialize(archive);
+      ::DeleteFile(stPathName + AUTOSAVE_EXTENSION);
     }
+
+    return TRUE;
+  }
+
+  else if (m_bAutoSaving)
+  {
+    TRACE(TEXT("Autosave to %s failed.\n"), (LPCTSTR) stPathName);
+    m_bAutoSaveDirty = TRUE;
+    return TRUE;
+  }
+
+  else
+  {
+    SetModifiedFlag(TRUE);
+    AfxMessageBox(AFX_IDP_FAILED_TO_SAVE_DOC);
+    return FALSE;
+  }
+}
+
+// SaveModified is called by the Application Framework before the document
+// is closed. A save in progress is finished before the user is asked to
+// save the changes, and a save started by the answer is finished before the
+// document is closed, so that a failed save keeps the document open.
+
+BOOL CWordDoc::SaveModified()
+{
+  return FinishSave() && CDocument::SaveModified() && FinishSave();
+}
+
+// ImportText replaces the paragraphs of the document by the paragraphs of
+// the given text file. Like OnOpenDocument, it leaves the layout of the
+// paragraphs to the idle time. The undo log refers to the old paragraphs,
+// so it is cleared. A save in progress is finished first, as it writes the
+// old paragraphs. It returns false if the save fails or the file cannot be
+// read, in which case the document is left unchanged.
+
+BOOL CWordDoc::ImportText(LPCTSTR lpszPathName, TextFormat eFormat)
+{
+  if (!FinishSave())
+  {
+    return FALSE;
+  }
+
+  ParagraphPtrArray importArray;
+  TextImporter importer(&m_fontCache, eFormat);
+
+  if (!importer.Import(lpszPathName, importArray))
+  {
+    return FALSE;
+  }
+
+  m_undoLog.Clear();
+
+  int iParagraphs = (int) m_paragraphArray.GetSize();
+  for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
+  {
+    delete m_paragraphArray[iParagraph];
+  }
+
+  m_paragraphArray.RemoveAll();
+  check_memory(m_paragraphArray.Append(importArray));
+
+  m_eWordState = WS_EDIT;
+  m_psEdit = Position(0, 0);
+  m_psFirstMark = m_psEdit;
+  m_psLastMark = m_psEdit;
+
+  delete m_pNextFont;
+  m_pNextFont = NULL;
+
+  UpdateParagraphAndPageArray();
+  m_bIdleLayout = TRUE;
+  m_iIdleParagraph = 0;
+
+  SetModifiedFlag();
+  UpdateAllViews(NULL);
+  return TRUE;
+}
+
+// OnFileExport lets the user choose a file and exports the paragraphs to
+// it, as Markdown if the Markdown type is chosen or the file has its
+// extension, otherwise as plain text. The document itself stays connected
+// to its own file.
+
+void CWordDoc::OnFileExport()
+{
+  CFileDialog fileDialog(FALSE, TEXT("txt"), GetTitle(),
+                         OFN_OVERWRITEPROMPT | OFN_HIDEREADONLY,
+                         TEXT("Text Files (*.txt)|*.txt|")
+                         TEXT("Markdown Files (*.md)|*.md;*.markdown||"));
+
+  if (fileDialog.DoModal() != IDOK)
+  {
+    return;
+  }
+
+  CString stExtension = fileDialog.GetFileExt();
+  TextFormat eFormat = ((fileDialog.m_ofn.nFilterIndex == 2) ||
+                        (stExtension.CompareNoCase(TEXT("md")) == 0) ||
+                        (stExtension.CompareNoCase(TEXT("markdown")) == 0))
+                       ? TF_MARKDOWN : TF_PLAIN;
+
+  CWaitCursor waitCursor;
+  TextExporter exporter(eFormat);
+
+  if (!exporter.Export(fileDialog.GetPathName(), m_paragraphArray))
+  {
+    AfxMessageBox(AFX_IDP_FAILED_TO_SAVE_DOC);
   }
+}
+
+// Serialize reads a document saved in the previous format from the file
+// connected to the parameter archive. Documents are always saved in the
+// current format by OnSaveDocument, so Serialize is only called by the
+// Application Framework when such a document is loaded, which OnOpenDocument
+// tells by the missing header and version of the current format. The
+// paragraphs read the fonts and the text in the layout of the previous
+// format. We first of all have to call Serialize in the MFC base class
+// CDocument.
+
+// We cannot serialize the paragraph array itself, as it holds pointers to
+// paragraph objects, not the object themselves. Instead, we first read the
+// size of the array, and then we serialize the paragraphs one-by-one. We
+// have to create each paragraph first, and then serialize it. Finally, we
+// add it to the array.
+
+void CWordDoc::Serialize(CArchive& archive)
+{
+  CDocument::Serialize(archive);
 
   if (archive.IsLoading())
   {
@@ -136,6 +396,10 @@ void CWordDoc::Serialize(CArchive& archive)
 
       pParagraph->Serialize(archive);
       m_paragraphArray.Add(pParagraph);
+      m_heightSum.Add(pParagraph->GetHeight());
+      m_wordSum.Add(pParagraph->GetWordCount());
+      m_charSum.Add(pParagraph->GetLength());
+      m_lineSum.Add(pParagraph->GetLineCount());
     }
   }
 
@@ -276,13 +540,13 @@ void CWordDoc::EnsureEditStatus()
 {
   if (m_eWordState == WS_MARK)
   {
-    RectSet repaintSet;
-    GetRepaintSet(repaintSet, m_psFirstMark, m_psLastMark);
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, m_psFirstMark, m_psLastMark);
 
     m_eWordState = WS_EDIT;
     m_psEdit = m_psLastMark;
 
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
   }
 }
 
@@ -309,7 +573,8 @@ void CWordDoc::LeftArrowKey()
 
   if (m_psEdit.Character() > 0)
   {
-    --m_psEdit.Character();
+    Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
+    m_psEdit.Character() = pParagraph->PreviousCluster(m_psEdit.Character());
   }
 
   else if (m_psEdit.Paragraph() > 0)
@@ -324,9 +589,10 @@ void CWordDoc::LeftArrowKey()
 // characters. Then we move position of the last marked character one step to
 // the left unless it already is at the beginning of the paragraph. If it is,
 // we set the position to the last character of the preceding paragraph, if
-// there is one. In both cases, we need to update the marked area, and we call
-// SymmetricDifference in order to pick out only the characters that actually
-// has been marked or unmarked. We do not want to update the characters that
+// there is one. In both cases, we need to update the marked area. As the first
+// marked position stays put, the characters that actually has been marked or
+// unmarked are exactly those between the old and new last marked position,
+// and only they are repainted. We do not want to update the characters that
 // was marked before and after the operation. Finally, if this operation sets
 // first and last marked character equal, we change to edit mode.
 
@@ -334,12 +600,13 @@ void CWordDoc::ShiftLeftArrowKey()
 {
   EnsureMarkStatus();
 
-  RectSet unmarkRepaintSet;
-  GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+  Position psOldLastMark = m_psLastMark;
 
   if (m_psLastMark.Character() > 0)
   {
-    --m_psLastMark.Character();
+    Paragraph* pParagraph = m_paragraphArray[m_psLastMark.Paragraph()];
+    m_psLastMark.Character() =
+      pParagraph->PreviousCluster(m_psLastMark.Character());
   }
 
   else if (m_psLastMark.Paragraph() > 0)
@@ -350,12 +617,9 @@ void CWordDoc::ShiftLeftArrowKey()
     m_psLastMark.Character() = pPreviousParagraph->GetLength();
   }
 
-  RectSet markRepaintSet;
-  GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-  RectSet resultRepaintSet =
-  RectSet::SymmetricDifference(unmarkRepaintSet, markRepaintSet);
-  UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+  RepaintRegion repaintRegion;
+  GetRepaintRegion(repaintRegion, psOldLastMark, m_psLastMark);
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
   if (m_psFirstMark == m_psLastMark)
   {
@@ -377,7 +641,7 @@ void CWordDoc::RightArrowKey()
 
   if (m_psEdit.Character() < pParagraph->GetLength())
   {
-    ++m_psEdit.Character();
+    m_psEdit.Character() = pParagraph->NextCluster(m_psEdit.Character());
   }
 
   else if (m_psEdit.Paragraph() < (m_paragraphArray.GetSize() - 1))
@@ -389,21 +653,21 @@ void CWordDoc::RightArrowKey()
 
 // ShiftRightArrowKey moves the position of the last marked character in a way
 // similar to ShiftLeftKey above. We move the position one step to the right
-// or the beginning of the next paragraph, is there is one. We also use
-// the symmetric difference between the new and old marked set.
+// or the beginning of the next paragraph, is there is one. We also repaint
+// only the characters between the old and new last marked position.
 
 void CWordDoc::ShiftRightArrowKey()
 {
   EnsureMarkStatus();
 
-  RectSet unmarkRepaintSet;
-  GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+  Position psOldLastMark = m_psLastMark;
 
   Paragraph* pParagraph = m_paragraphArray[m_psLastMark.Paragraph()];
 
   if (m_psLastMark.Character() < pParagraph->GetLength())
   {
-    ++m_psLastMark.Character();
+    m_psLastMark.Character() =
+      pParagraph->NextCluster(m_psLastMark.Character());
   }
 
   else if (m_psLastMark.Paragraph() < m_paragraphArray.GetSize() - 1)
@@ -414,12 +678,9 @@ void CWordDoc::ShiftRightArrowKey()
     m_psLastMark.Character() = pNextParagraph->GetLength();
   }
 
-  RectSet markRepaintSet;
-  GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-  RectSet resultRepaintSet =
-      RectSet::SymmetricDifference(unmarkRepaintSet, markRepaintSet);
-  UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+  RepaintRegion repaintRegion;
+  GetRepaintRegion(repaintRegion, psOldLastMark, m_psLastMark);
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
   if (m_psFirstMark == m_psLastMark)
   {
@@ -456,18 +717,17 @@ void CWordDoc::UpArrowKey()
 // mode, and then we simulate a mouse click one logical unit above the current
 // line by calling PointToChar. We only want to update characters marked or
 // unmarked by this operation. Characters not affected are not updated. With
-// this in view, we call SymmetricDifference to sort out the characters to be
-// updated. Finally, we check if the first and last marked positions are
-// equal. If so, the application is set to edit mode.
+// this in view, we repaint only the characters between the old and new
+// marked position. Finally, we check if the first and last marked positions
+// are equal. If so, the application is set to edit mode.
 
 void CWordDoc::ShiftUpArrowKey()
 {
   // We make sure the application is in mark mode.
   EnsureMarkStatus();
 
-  // We extract the set of unmarked character rectangles.
-  RectSet unmarkRepaintSet;
-  GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+  // We save the marked position that is about to move.
+  Position psOldFirstMark = m_psFirstMark;
   
   // We find the dimensions of the current line and character.
   Paragraph* pParagraph = m_paragraphArray[m_psFirstMark.Paragraph()];
@@ -481,14 +741,11 @@ void CWordDoc::ShiftUpArrowKey()
   {
     m_psFirstMark = PointToChar(CPoint(rcChar.left, rcLine.top - 1));
 
-    // We extract the set of marked character rectangles.
-    RectSet markRepaintSet;
-    GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-    // We extract the affected character rectangles.
-    RectSet resultRepaintSet =
-        RectSet::SymmetricDifference(unmarkRepaintSet, markRepaintSet);
-    UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+    // We extract the rectangles of the characters between the old and new
+    // marked position, which are the only ones marked or unmarked.
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, psOldFirstMark, m_psFirstMark);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
     // We set the application in edit mode if the first and last marked
     // positions are equal.
@@ -542,8 +799,8 @@ void CWordDoc::DownArrowKey()
 // the application is in mark mode, and then we simulate a mouse click one
 // logical unit below the current line by calling PointToChar. We only want to
 // update characters marked or unmarked by this operation. Characters not
-// affected are not updated. With this in view, we call SymmetricDifference to
-// sort out the characters to be updated. Finally, we check if the first and
+// affected are not updated. With this in view, we repaint only the characters
+// between the old and new marked position. Finally, we check if the first and
 // last marked positions are equal. If so, the application is set to edit
 // mode.
 
@@ -559,9 +816,8 @@ void CWordDoc::ShiftDownArrowKey()
   // We make sure the application is in mark mode.
   EnsureMarkStatus();
 
-  // We extract the set of unmarked character rectangles.
-  RectSet unmarkRepaintSet;
-  GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+  // We save the marked position that is about to move.
+  Position psOldLastMark = m_psLastMark;
 
   // We find the dimensions of the current line and character.
   Paragraph* pParagraph = m_paragraphArray[m_psLastMark.Paragraph()];
@@ -589,14 +845,11 @@ void CWordDoc::ShiftDownArrowKey()
     m_psLastMark = PointToChar(CPoint(rcChar.left, iNextStartPos));
   }
 
-  // We extract the set of marked character rectangles.
-  RectSet markRepaintSet;
-  GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-  // We extract the affected character rectangles.
-  RectSet resultRepaintSet =
-          RectSet::SymmetricDifference(unmarkRepaintSet,markRepaintSet);
-  UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+  // We extract the rectangles of the characters between the old and new
+  // marked position, which are the only ones marked or unmarked.
+  RepaintRegion repaintRegion;
+  GetRepaintRegion(repaintRegion, psOldLastMark, m_psLastMark);
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
   // We set the application in edit mode if the first and last marked
   // positions are equal.
@@ -706,7 +959,7 @@ void CWordDoc::HomeKey()
 // shift key. It makes sure the application is in mark mode and sets the last
 // marked position to the first one of the current line unless it is already
 // at the first position. It only extracts and updates the rectangles of those
-// affected by the operation by calling SymmetricDifference.
+// affected by the operation, which lie between the old and new position.
 
 void CWordDoc::ShiftHomeKey()
 {
@@ -716,17 +969,13 @@ void CWordDoc::ShiftHomeKey()
 
   if (iHomeChar < m_psLastMark.Character())
   {
-    RectSet unmarkRepaintSet;
-    GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+    Position psOldLastMark = m_psLastMark;
 
     m_psLastMark.Character() = iHomeChar;
 
-    RectSet markRepaintSet;
-    GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-    RectSet resultRepaintSet =
-          RectSet::SymmetricDifference(unmarkRepaintSet,markRepaintSet);
-    UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, psOldLastMark, m_psLastMark);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
     if (m_psFirstMark == m_psLastMark)
     {
@@ -757,7 +1006,7 @@ void CWordDoc::EndKey()
 // shift key. It makes sure the application is in mark mode and sets the last
 // marked position to the last one of the current line unless it is already
 // at the last position. It only extracts and updates the rectangles of those
-// affected by the operation by calling SymmetricDifference.
+// affected by the operation, which lie between the old and new position.
 
 void CWordDoc::ShiftEndKey()
 {
@@ -767,17 +1016,13 @@ void CWordDoc::ShiftEndKey()
 
   if (iEndChar > m_psLastMark.Character())
   {
-    RectSet unmarkRepaintSet;
-    GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+    Position psOldLastMark = m_psLastMark;
 
     m_psLastMark.Character() = iEndChar;
 
-    RectSet markRepaintSet;
-    GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-    RectSet resultRepaintSet =
-          RectSet::SymmetricDifference(unmarkRepaintSet,markRepaintSet);
-    UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, psOldLastMark, m_psLastMark);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
   }
 }
 
@@ -791,26 +1036,29 @@ void CWordDoc::ShiftEndKey()
 
 void CWordDoc::ReturnKey(CDC* pDC)
 {
+  BeginUndo();
+
   if (m_eWordState == WS_MARK)
   {
     m_eWordState = WS_EDIT;
     m_psEdit = min(m_psFirstMark, m_psLastMark);
 
-    RectSet repaintSet;
-    DeleteText(repaintSet, pDC, m_psFirstMark, m_psLastMark);
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    RepaintRegion repaintRegion;
+    DeleteText(repaintRegion, pDC, m_psFirstMark, m_psLastMark);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
   }
 
   Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
   Paragraph* pNewParagraph = pParagraph->Split(m_psEdit.Character());
 
-  pParagraph->Recalculate(pDC);
-  pNewParagraph->Recalculate(pDC);
+  pParagraph->Recalculate(pDC, &m_fontCache);
+  pNewParagraph->Recalculate(pDC, &m_fontCache);
 
   m_paragraphArray.InsertAt(++m_psEdit.Paragraph(), pNewParagraph);
   m_psEdit.Character() = 0;
 
-  UpdateParagraphAndPageArray();
+  UpdateParagraphAndPageArray(m_psEdit.Paragraph() - 1, m_psEdit.Paragraph());
+  EndUndo();
   SetModifiedFlag();
 }
 
@@ -846,19 +1094,22 @@ void CWordDoc::DeleteKey(CDC* pDC)
   {
     case WS_EDIT:
       {
-        // In edit mode, we delete the current character unless it is at the
-        // end of the paragraph.
+        // In edit mode, we delete the current character, with the rest of its
+        // cluster, unless it is at the end of the paragraph.
 
         Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
 
         if (m_psEdit.Character() < pParagraph->GetLength())
         {
-          pParagraph->DeleteText(m_psEdit.Character(), m_psEdit.Character() + 1);
+          BeginUndo();
+          pParagraph->DeleteText(m_psEdit.Character(),
+                                 pParagraph->NextCluster(m_psEdit.Character()));
 
-          RectSet repaintSet;
-          pParagraph->Recalculate(pDC, &repaintSet);
-          UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+          RepaintRegion repaintRegion;
+          pParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
+          UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
+          EndUndo();
           SetModifiedFlag();
         }
 
@@ -867,17 +1118,20 @@ void CWordDoc::DeleteKey(CDC* pDC)
 
         else if (m_psEdit.Paragraph() < (m_paragraphArray.GetSize() - 1))
         {
+          BeginUndo(m_psEdit.Paragraph(), m_psEdit.Paragraph() + 1);
+
           Paragraph* pNextParagraph =
                      m_paragraphArray[m_psEdit.Paragraph() +1 ];
           pParagraph->Append(pNextParagraph);
 
-          RectSet repaintSet;
-          pParagraph->Recalculate(pDC, &repaintSet);
-          UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+          RepaintRegion repaintRegion;
+          pParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
+          UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
           m_paragraphArray.RemoveAt(m_psEdit.Paragraph()+1);
           delete pNextParagraph;
 
+          EndUndo();
           SetModifiedFlag();
         }
       }
@@ -887,18 +1141,20 @@ void CWordDoc::DeleteKey(CDC* pDC)
     // application in edit mode.
 
     case WS_MARK:
+      BeginUndo();
       m_eWordState = WS_EDIT;
       m_psEdit = min(m_psFirstMark, m_psLastMark);
 
-      RectSet repaintSet;
-      DeleteText(repaintSet, pDC, m_psFirstMark, m_psLastMark);
-      UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+      RepaintRegion repaintRegion;
+      DeleteText(repaintRegion, pDC, m_psFirstMark, m_psLastMark);
+      UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
+      EndUndo();
       SetModifiedFlag();
       break;
   }
 
-  UpdateParagraphAndPageArray();
+  UpdateParagraphAndPageArray(m_psEdit.Paragraph(), m_psEdit.Paragraph());
 }
 
 // BackSpace is quite simple, it just calls DeleteKey. In edit mode, it first
@@ -934,18 +1190,33 @@ void CWordDoc::CharDown(UINT uChar, CDC* pDC)
 {
   if (isprint(uChar))
   {
-    RectSet repaintSet;
+    // A character typed right after the previous one in the same paragraph
+    // is coalesced into the latest undo entry, but the paragraph may still
+    // need to be detached from a save started since the entry began.
+
+    if ((m_eWordState == WS_MARK) ||
+        !m_undoLog.Continue(m_psEdit.Paragraph(), m_psEdit))
+    {
+      BeginUndo(TRUE);
+    }
+
+    else
+    {
+      PrepareChange(m_psEdit.Paragraph(), m_psEdit.Paragraph());
+    }
+
+    RepaintRegion repaintRegion;
 
     if (m_eWordState == WS_MARK)
     {
-      DeleteText(repaintSet, pDC, m_psFirstMark, m_psLastMark);
+      DeleteText(repaintRegion, pDC, m_psFirstMark, m_psLastMark);
       m_eWordState = WS_EDIT;
       m_psEdit = min(m_psFirstMark, m_psLastMark);
     }
 
     Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
     pParagraph->AddChar(m_psEdit.Character(), uChar, m_pNextFont, m_eKeyboardState);
-    pParagraph->Recalculate(pDC, &repaintSet);
+    pParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
 
     ++m_psEdit.Character();
 
@@ -953,43 +1224,56 @@ void CWordDoc::CharDown(UINT uChar, CDC* pDC)
     m_pNextFont = NULL;
 
     SetModifiedFlag();
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
+
+    UpdateParagraphAndPageArray(m_psEdit.Paragraph(), m_psEdit.Paragraph());
+    EndUndo();
 
-    UpdateParagraphAndPageArray();
     MakeVisible();
     UpdateCaret();
   }
 }
 
 // When the users click with the mouse, we first have to decide which
-// paragraph they hit. PointToParagraph traverses the paragraph array to find
-// the correct paragraph. If the user clicks beyond the last paragraph, the
-// last one is returned. Likewise, if the user clicks at the end of a page,
-// beyond the last paragraph of the page, the last paragraph of that page is
-// returned.
+// paragraph they hit. As the start positions of the paragraphs are sorted,
+// PointToParagraph performs a binary search in the paragraph array for the
+// last paragraph starting at or above the mouse position. If the user clicks
+// beyond the last paragraph, the last one is returned. Likewise, if the user
+// clicks at the end of a page, beyond the last paragraph of the page, the
+// last paragraph of that page is returned.
 
 int CWordDoc::PointToParagraph(const CPoint& ptMouse) const
 {
-  int iParagraphs = (int) m_paragraphArray.GetSize();
-  for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
+  int iMinParagraph = 0, iMaxParagraph = (int) m_paragraphArray.GetSize();
+
+  // The paragraphs before the minimum index start at or above the mouse
+  // position, and the paragraphs from the maximum index start below it.
+
+  while (iMinParagraph < iMaxParagraph)
   {
-    Paragraph* pParagraph = m_paragraphArray[iParagraph];
+    int iMiddleParagraph = (iMinParagraph + iMaxParagraph) / 2;
 
-    if (ptMouse.y < pParagraph->GetStartPos())
+    if (ptMouse.y < m_paragraphArray[iMiddleParagraph]->GetStartPos())
     {
-      return iParagraph - 1;
+      iMaxParagraph = iMiddleParagraph;
+    }
+
+    else
+    {
+      iMinParagraph = iMiddleParagraph + 1;
     }
   }
 
-  return iParagraphs - 1;
+  return iMinParagraph - 1;
 }
 
 // PointToChar returns the position the right paragraph and character index by
 // calling PointToParagraph.
 
-Position CWordDoc::PointToChar(const CPoint& ptMouse) const
+Position CWordDoc::PointToChar(const CPoint& ptMouse)
 {
   int iParagraph = PointToParagraph(ptMouse);
+  LayOutParagraphs(iParagraph, iParagraph);
   Paragraph* pParagraph = m_paragraphArray[iParagraph];
   int iChar = pParagraph->PointToChar(ptMouse);
   return Position(iParagraph, iChar);
@@ -1006,9 +1290,9 @@ void CWordDoc::MouseDown(const CPoint& ptMouse)
     m_eWordState = WS_EDIT;
     m_psEdit = m_psFirstMark;
 
-    RectSet repaintSet;
-    GetRepaintSet(repaintSet, m_psFirstMark, m_psLastMark);
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, m_psFirstMark, m_psLastMark);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
   }
 
   m_eWordState = WS_MARK;
@@ -1032,17 +1316,11 @@ void CWordDoc::MouseDrag(const CPoint& ptMouse)
 
   if (m_psLastMark != psNewLastMark)
   {
-    RectSet unmarkRepaintSet;
-    GetRepaintSet(unmarkRepaintSet, m_psFirstMark, m_psLastMark);
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, m_psLastMark, psNewLastMark);
 
     m_psLastMark = psNewLastMark;
-
-    RectSet markRepaintSet;
-    GetRepaintSet(markRepaintSet, m_psFirstMark, m_psLastMark);
-
-    RectSet resultRepaintSet =
-        RectSet::SymmetricDifference(unmarkRepaintSet, markRepaintSet);
-    UpdateAllViews(NULL, 0, (CObject*) &resultRepaintSet);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
     MakeVisible();
   }
@@ -1077,7 +1355,7 @@ void CWordDoc::MouseUp()
 
 void CWordDoc::DoubleClick()
 {
-  RectSet repaintSet;
+  RepaintRegion repaintRegion;
   Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
 
   int iFirstChar, iLastChar;
@@ -1091,9 +1369,9 @@ void CWordDoc::DoubleClick()
     m_psLastMark.Paragraph() = m_psEdit.Paragraph();
     m_psLastMark.Character() = iLastChar;
 
-    RectSet repaintSet;
-    GetRepaintSet(repaintSet, m_psFirstMark, m_psLastMark);
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    RepaintRegion repaintRegion;
+    GetRepaintRegion(repaintRegion, m_psFirstMark, m_psLastMark);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
     MakeVisible();
   }
@@ -1102,7 +1380,8 @@ void CWordDoc::DoubleClick()
 }
 
 // MakeVisible makes sure the caret (in edit mode) or the last marked position
-// (in mark mode) is visible in the view window.
+// (in mark mode) is visible in the view window. The paragraph of the position
+// is laid out first, in case its layout is pending.
 
 void CWordDoc::MakeVisible()
 {
@@ -1113,6 +1392,7 @@ void CWordDoc::MakeVisible()
 
     case WS_EDIT:
       {
+        LayOutParagraphs(m_psEdit.Paragraph(), m_psEdit.Paragraph());
         Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
         CRect rcChar = pParagraph->CharToRect(m_psEdit.Character());
         rcChar.right = min(rcChar.right, PAGE_WIDTH);
@@ -1123,6 +1403,7 @@ void CWordDoc::MakeVisible()
     // In mark mode, we call MakeVisible with the first marked position.
 
     case WS_MARK:
+      LayOutParagraphs(m_psLastMark.Paragraph(), m_psLastMark.Paragraph());
       Paragraph* pParagraph = m_paragraphArray[m_psLastMark.Paragraph()];
       CRect rcChar = pParagraph->CharToRect(m_psLastMark.Character());
       rcChar.right = min(rcChar.right, PAGE_WIDTH);
@@ -1131,7 +1412,9 @@ void CWordDoc::MakeVisible()
     }
 }
 
-// UpdateCaret updates the visibility and position of the caret.
+// UpdateCaret updates the visibility and position of the caret. As the
+// paragraph of the caret is edited next, it is laid out first, in case its
+// layout is pending.
 
 void CWordDoc::UpdateCaret()
 {
@@ -1141,6 +1424,7 @@ void CWordDoc::UpdateCaret()
   
     case WS_EDIT:
       {
+        LayOutParagraphs(m_psEdit.Paragraph(), m_psEdit.Paragraph());
         Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
         CRect rcCaret = pParagraph->GetCaretRect(m_psEdit.Character());
 
@@ -1177,8 +1461,8 @@ void CWordDoc::UpdateCaret()
 // When a portion of the area becomes marked or unmarked, we need the areas of
 // the characters in question in order to repaint them.
 
-void CWordDoc::GetRepaintSet(RectSet& repaintSet, Position psFirst,
-                                Position psLast)
+void CWordDoc::GetRepaintRegion(RepaintRegion& repaintRegion,
+                                Position psFirst, Position psLast)
 {
   Position psMin = min(psFirst, psLast);
   Position psMax = max(psFirst, psLast);
@@ -1186,30 +1470,31 @@ void CWordDoc::GetRepaintSet(RectSet& repaintSet, Position psFirst,
   if (psMin.Paragraph() == psMax.Paragraph())
   {
     Paragraph* pParagraph = m_paragraphArray[psMin.Paragraph()];
-    pParagraph->GetRepaintSet(repaintSet, psMin.Character(), psMax.Character());
+    pParagraph->GetRepaintRegion(repaintRegion, psMin.Character(),
+                                 psMax.Character());
   }
 
   else
   {
     Paragraph* pMinParagraph = m_paragraphArray[psMin.Paragraph()];
-    pMinParagraph->GetRepaintSet(repaintSet, psMin.Character());
+    pMinParagraph->GetRepaintRegion(repaintRegion, psMin.Character());
 
     for (int iParagraph = psMin.Paragraph() + 1;
          iParagraph < psMax.Paragraph(); ++iParagraph)
     {
       Paragraph* pParagraph = m_paragraphArray[iParagraph];
-      pParagraph->GetRepaintSet(repaintSet);
+      pParagraph->GetRepaintRegion(repaintRegion);
     }
 
     Paragraph* pMaxParagraph = m_paragraphArray[psMax.Paragraph()];
-    pMaxParagraph->GetRepaintSet(repaintSet, 0, psMax.Character());
+    pMaxParagraph->GetRepaintRegion(repaintRegion, 0, psMax.Character());
   }
 }
 // DeleteText removes the text between the two positions. It is quite
 // complicated as we have several different special cases.
 
-void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
-                          Position psLast)
+void CWordDoc::DeleteText(RepaintRegion& repaintRegion, CDC* pDC,
+                          Position psFirst, Position psLast)
 {
   Position psMin = min(psFirst, psLast);
   Position psMax = max(psFirst, psLast);
@@ -1244,7 +1529,7 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
       Paragraph* pMaxParagraph = m_paragraphArray[psMax.Paragraph()];
       pMinParagraph->Append(pMaxParagraph);
       m_paragraphArray.RemoveAt(psMax.Paragraph());
-      pMinParagraph->Recalculate(pDC, &repaintSet);
+      pMinParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
     }
 
     // If the last character position of the last paragraph is zero, and the
@@ -1257,7 +1542,7 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
       Paragraph* pMinParagraph = m_paragraphArray[psMin.Paragraph()];
 
       pMinParagraph->DeleteText(psMax.Character());
-      pMinParagraph->Recalculate(pDC, &repaintSet);
+      pMinParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
 
       for (int iParagraph = psMin.Paragraph() + 1;
            iParagraph <= psMin.Paragraph(); ++iParagraph)
@@ -1269,7 +1554,7 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
                                 psMax.Paragraph() - psMin.Paragraph() + 1);
     }
 
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
   }
 
   else
@@ -1283,7 +1568,7 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
       Paragraph* pParagraph = m_paragraphArray[psMin.Paragraph()];
 
       pParagraph->DeleteText(psMin.Character(), psMax.Character());
-      pParagraph->Recalculate(pDC, &repaintSet);
+      pParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
     }
 
     // If the marked area does not start at the beginning of the paragraph,
@@ -1310,7 +1595,7 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
       pMaxParagraph->ClearRectArray();
 
       pMinParagraph->Append(pMaxParagraph);
-      pMinParagraph->Recalculate(pDC, &repaintSet);
+      pMinParagraph->Recalculate(pDC, &m_fontCache, &repaintRegion);
 
       for (int iParagraph = psMin.Paragraph() + 1;
            iParagraph < psMin.Paragraph(); ++iParagraph)
@@ -1322,7 +1607,7 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
                                 psMax.Paragraph() - psMin.Paragraph());
     }
 
-    UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
   }
 }
 
@@ -1332,216 +1617,545 @@ void CWordDoc::DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
 // page. Moreover, we need to examine the pages and update the first and last
 // paragraph on each page.
 
-void CWordDoc::UpdateParagraphAndPageArray()
+// The parameters give the paragraphs that have been altered, inserted, or
+// removed; every paragraph before the first one and after the last one is
+// unchanged. By default, the whole document is paginated. Otherwise, the
+// pagination restarts at the page preceding the page holding the first
+// altered paragraph, since the first paragraph of that page may now fit on
+// the preceding page. As the break of a page depends on nothing but its
+// first paragraph and the paragraphs following it, the pagination stops as
+// soon as a page beyond the altered paragraphs starts at the same paragraph
+// as an old page, moved by the number of inserted or removed paragraphs.
+
+void CWordDoc::ResizeSum(PrefixSum<int>& prefixSum, int iIndex, int iDelta)
 {
-  int iOldPages = (int) m_pageArray.GetSize();
-  m_pageArray.RemoveAll();
+  if (iDelta < 0)
+  {
+    prefixSum.RemoveAt(iIndex, -iDelta);
+  }
+
+  else if (iDelta > 0)
+  {
+    PrefixSum<int> insertSum;
+    insertSum.SetSize(iDelta, 0);
+    prefixSum.InsertAt(iIndex, insertSum);
+  }
+}
 
-  int iPageHeight = 0, iStartParagraph = 0;
+void CWordDoc::UpdateParagraphAndPageArray(int iFirstParagraph /* = 0 */,
+                                           int iLastParagraph /* = -1 */)
+{
   int iParagraphes = (int) m_paragraphArray.GetSize();
+  int iOldPages = (int) m_pageArray.GetSize();
+
+  if (iLastParagraph == -1)
+  {
+    iLastParagraph = iParagraphes - 1;
+  }
 
-  // We traverse the paragraphs and divide them into pages of the document by
-  // examine their height.
+  // The heights of the paragraphs are stored in a prefix sum, and so are
+  // their numbers of words, characters, and lines, which gives the totals of
+  // the document statistics. We first insert or remove the values of the
+  // inserted or removed paragraphs, and then set the values of the altered
+  // paragraphs.
 
-  for (int iParagraph = 0; iParagraph < iParagraphes; ++iParagraph)
+  int iDelta = iParagraphes - m_heightSum.GetSize();
+  ResizeSum(m_heightSum, iFirstParagraph, iDelta);
+  ResizeSum(m_wordSum, iFirstParagraph, iDelta);
+  ResizeSum(m_charSum, iFirstParagraph, iDelta);
+  ResizeSum(m_lineSum, iFirstParagraph, iDelta);
+
+  for (int iParagraph = iFirstParagraph; iParagraph <= iLastParagraph;
+       ++iParagraph)
   {
     Paragraph* pParagraph = m_paragraphArray[iParagraph];
-    int iHeight = pParagraph->GetHeight();
+    m_heightSum.Set(iParagraph, pParagraph->GetHeight());
+    m_wordSum.Set(iParagraph, pParagraph->GetWordCount());
+    m_charSum.Set(iParagraph, pParagraph->GetLength());
+    m_lineSum.Set(iParagraph, pParagraph->GetLineCount());
+  }
 
-    if ((iPageHeight + iHeight) <= PAGE_HEIGHT)
-    {
-      iPageHeight += iHeight;
-    }
+  // We break new pages until they converge with the old ones. If they never
+  // do, the new pages replace the rest of the old pages.
 
-    // When the current height exceeds the height of the page, we start a new
-    // page. If this page holds at least one paragraph, we adds them to the page. 
+  int iFirstPage = max(0, FindPage(iFirstParagraph) - 1);
+  int iStartParagraph = (iFirstPage < iOldPages)
+                        ? m_pageArray[iFirstPage].GetFirstParagraph() : 0;
 
-    else if (iStartParagraph < iParagraph)
+  PageArray newPageArray;
+  int iOldPage = iFirstPage + 1, iLastOldPage = iOldPages;
+
+  while (iStartParagraph < iParagraphes)
+  {
+    if (iStartParagraph > iLastParagraph)
     {
-      Page page(iStartParagraph, iParagraph - 1);
-      m_pageArray.Add(page);
+      int iOldStartParagraph = iStartParagraph - iDelta;
 
-      iStartParagraph = iParagraph;
-      iPageHeight = iHeight;
+      while ((iOldPage < iOldPages) &&
+             (m_pageArray[iOldPage].GetFirstParagraph() < iOldStartParagraph))
+      {
+        ++iOldPage;
+      }
+
+      if ((iOldPage < iOldPages) &&
+          (m_pageArray[iOldPage].GetFirstParagraph() == iOldStartParagraph))
+      {
+        iLastOldPage = iOldPage;
+        break;
+      }
     }
 
-    // If a single paragraph is higher than the page, we include it
-    // on the page and start the new page with the next paragraph.
+    Page page;
+    iStartParagraph = BreakPage(iStartParagraph, page);
+    newPageArray.Add(page);
+  }
 
-    else
-    {
-      Page page(iStartParagraph, iStartParagraph);
-      m_pageArray.Add(page);
+  // The new pages replace the old ones, and the kept pages are moved by the
+  // number of inserted or removed paragraphs.
 
-      iStartParagraph = iParagraph + 1;
-      iPageHeight = 0;
+  int iNewPages = (int) newPageArray.GetSize();
+  int iPageDelta = iNewPages - (iLastOldPage - iFirstPage);
+
+  m_pageArray.RemoveAt(iFirstPage, iLastOldPage - iFirstPage);
+  m_pageArray.InsertAt(iFirstPage, &newPageArray);
+  int iPages = (int) m_pageArray.GetSize();
+
+  if (iDelta != 0)
+  {
+    for (int iPage = iFirstPage + iNewPages; iPage < iPages; ++iPage)
+    {
+      Page page = m_pageArray[iPage];
+      m_pageArray[iPage] = Page(page.GetFirstParagraph() + iDelta,
+                                page.GetLastParagraph() + iDelta);
     }
   }
 
-  Page page(iStartParagraph, iParagraphes - 1);
-  m_pageArray.Add(page);
-
-  // The repaint set is used to collect the parts of the documents area
-  // that need to be repainted. 
+  // The repaint region is used to collect the parts of the documents area
+  // that need to be repainted.
 
-  RectSet repaintSet;
-  int iNewPages = (int) m_pageArray.GetSize();
+  RepaintRegion repaintRegion;
 
-  // For each page, we traverse the paragraphs and set their start position.
+  // For each new page, we traverse the paragraphs and set their start
+  // position, which is the sum of the heights of the preceding paragraphs
+  // on the page.
 
-  for (int iPage = 0; iPage < iNewPages; ++iPage)
+  for (int iPage = iFirstPage; iPage < (iFirstPage + iNewPages); ++iPage)
   {
-    int iPageHeight = iPage * PAGE_HEIGHT;
-
     Page page = m_pageArray[iPage];
-    int iFirstParagraph = page.GetFirstParagraph();
-    int iLastParagraph = page.GetLastParagraph();
+    int iFirstPageParagraph = page.GetFirstParagraph();
+    int iLastPageParagraph = page.GetLastParagraph();
+    int yPageTop = iPage * PAGE_HEIGHT - m_heightSum.Sum(iFirstPageParagraph);
 
-    for (int iParagraph = iFirstParagraph;
-         iParagraph <= iLastParagraph; ++iParagraph)
+    for (int iParagraph = iFirstPageParagraph;
+         iParagraph <= iLastPageParagraph; ++iParagraph)
     {
       Paragraph* pParagraph = m_paragraphArray[iParagraph];
       int iHeight = pParagraph->GetHeight();
       int yPos = pParagraph->GetStartPos();
+      int yNewPos = yPageTop + m_heightSum.Sum(iParagraph);
 
       // If the previous start position of the paragraphs is being updated, we
       // set the new start position and add the paragraphs' area to the
-      // repaint set.
+      // repaint region.
 
-      if (iPageHeight != yPos)
+      if (yNewPos != yPos)
       {
         CRect rcOldParagraph(0, yPos, PAGE_WIDTH, yPos + iHeight);
-        repaintSet.Add(rcOldParagraph);
+        repaintRegion.Add(rcOldParagraph);
 
-        CRect rcNewParagraph(0, iPageHeight, PAGE_WIDTH,
-                             iPageHeight + iHeight);
-        repaintSet.Add(rcNewParagraph);
+        CRect rcNewParagraph(0, yNewPos, PAGE_WIDTH, yNewPos + iHeight);
+        repaintRegion.Add(rcNewParagraph);
 
-        pParagraph->SetStartPos(iPageHeight);
+        pParagraph->SetStartPos(yNewPos);
       }
-
-      iPageHeight += iHeight;
     }
 
-    // For each page, we add the rest of the page to the repaint set.
+    // For each page, we add the rest of the page to the repaint region.
 
-    CRect rcPageRest(0, iPageHeight, PAGE_WIDTH, (iPage + 1) * PAGE_HEIGHT);
-    repaintSet.Add(rcPageRest);
+    int yPageRest = yPageTop + m_heightSum.Sum(iLastPageParagraph + 1);
+    CRect rcPageRest(0, yPageRest, PAGE_WIDTH, (iPage + 1) * PAGE_HEIGHT);
+    repaintRegion.Add(rcPageRest);
+  }
+
+  // If the number of new pages differs from the number of old pages they
+  // replace, the paragraphs of the kept pages are moved to other pages. In
+  // that case, the number of pages of the document has changed too, and the
+  // whole document is repainted below.
+
+  if (iPageDelta != 0)
+  {
+    for (int iPage = iFirstPage + iNewPages; iPage < iPages; ++iPage)
+    {
+      Page page = m_pageArray[iPage];
+
+      for (int iParagraph = page.GetFirstParagraph();
+           iParagraph <= page.GetLastParagraph(); ++iParagraph)
+      {
+        Paragraph* pParagraph = m_paragraphArray[iParagraph];
+        pParagraph->SetStartPos(pParagraph->GetStartPos() +
+                                iPageDelta * PAGE_HEIGHT);
+      }
+    }
   }
 
   // If the number of pages has decreased, we need to repaint the rest of
   // document.
 
-  if (iNewPages < iOldPages)
+  if (iPages < iOldPages)
   {
-    CRect rcRestDocument(0, iNewPages * PAGE_HEIGHT, PAGE_WIDTH,
+    CRect rcRestDocument(0, iPages * PAGE_HEIGHT, PAGE_WIDTH,
                          iOldPages * PAGE_HEIGHT);
-    repaintSet.Add(rcRestDocument);
+    repaintRegion.Add(rcRestDocument);
   }
 
   // If the number of pages has been changed, we need to notify OnUpdate in
   // the view class to reset the vertical scroll bars. In that case, the whole
   // document is repainted.
 
-  if (iNewPages != iOldPages)
+  if (iPages != iOldPages)
   {
-    UpdateAllViews(NULL, (LPARAM) iNewPages);
+    UpdateAllViews(NULL, (LPARAM) iPages);
   }
 
   // If the number of pages are unchanged, we only update the areas of the
-  // repaint set.
+  // repaint region.
 
-  else if (!repaintSet.IsEmpty())
+  else if (!repaintRegion.IsEmpty())
   {
-    UpdateAllViews(NULL, 0, &repaintSet);
+    UpdateAllViews(NULL, 0, &repaintRegion);
   }
 }
 
-void CWordDoc::SetDocumentHome()
-{
-  EnsureEditStatus();
-  m_psEdit.Paragraph() = 0;
-  m_psEdit.Character() = 0;
-  MakeVisible();
-  UpdateCaret();
-}
+// BreakPage finds the page starting at the given paragraph, and returns the
+// index of the first paragraph of the next page. A page holds the
+// paragraphs whose total height does not exceed the height of the page,
+// which are found in logarithmic time by looking up the position at the
+// bottom of the page in the prefix sum of the paragraph heights. If a single
+// paragraph is higher than the page, it makes up a page of its own.
 
-void CWordDoc::SetDocumentEnd()
+int CWordDoc::BreakPage(int iFirstParagraph, Page& page) const
 {
-  EnsureEditStatus();
-  int iSize = m_paragraphArray.GetSize();
-  Paragraph* pLastParagraph = m_paragraphArray[iSize - 1];
-  m_psEdit.Paragraph() = iSize - 1;
-  m_psEdit.Character() = pLastParagraph->GetLength();
-  MakeVisible();
-  UpdateCaret();
+  int iLastParagraph;
+  int iNextParagraph = ::BreakPage(m_heightSum, iFirstParagraph,
+                                   (int) m_paragraphArray.GetSize(),
+                                   PAGE_HEIGHT, iLastParagraph);
+
+  page = Page(iFirstParagraph, iLastParagraph);
+  return iNextParagraph;
 }
 
-// The following four update methods set a radio button on the current
-// alignment menu item. They simple call IsAlignment to check the current
-// alignment.
+// FindPage returns the index of the page holding the given paragraph. As
+// the pages are sorted, we perform a binary search.
 
-void CWordDoc::OnUpdateAlignLeft(CCmdUI *pCmdUI)
+int CWordDoc::FindPage(int iParagraph) const
 {
-  pCmdUI->SetRadio(IsAlignment(ALIGN_LEFT));
-}
+  int iMinPage = 0, iMaxPage = (int) m_pageArray.GetSize() - 1;
 
-void CWordDoc::OnUpdateAlignCenter(CCmdUI *pCmdUI)
-{
-  pCmdUI->SetRadio(IsAlignment(ALIGN_CENTER));
-}
+  while (iMinPage < iMaxPage)
+  {
+    int iMiddlePage = (iMinPage + iMaxPage + 1) / 2;
 
-void CWordDoc::OnUpdateAlignRight(CCmdUI *pCmdUI)
-{
-  pCmdUI->SetRadio(IsAlignment(ALIGN_RIGHT));
-}
+    if (m_pageArray[iMiddlePage].GetFirstParagraph() <= iParagraph)
+    {
+      iMinPage = iMiddlePage;
+    }
 
-void CWordDoc::OnUpdateAlignJustifed(CCmdUI *pCmdUI)
-{
-  pCmdUI->SetRadio(IsAlignment(ALIGN_JUSTIFIED));
-}
+    else
+    {
+      iMaxPage = iMiddlePage - 1;
+    }
+  }
 
-// In edit mode, IsAlignment checks whether the current paragraph has the
-// given alignment. In mark mode, it check that all partly or completely
-// marked paragraph have the given alignment. This implies that if several
-// paragraph are marked and not all of them have the same alignment, no menu
-// item is checked.
+  return iMinPage;
+}
 
-BOOL CWordDoc::IsAlignment(Alignment eAlignment) const
+// LayOutParagraphs lays out the paragraphs in the given range whose layout
+// is pending, which by default is every paragraph of the document. As the
+// pending paragraphs are not drawn, the area of each of them is repainted,
+// and as their heights were estimated, the pages are updated. It returns
+// whether any paragraph was laid out. The views are repainted while the
+// layout flag is set, so that painting does not lay out other paragraphs
+// in the middle of the update. If there are at least PARALLEL_PARAGRAPHS
+// pending paragraphs, they are laid out on worker threads, and only the
+// pagination is performed on this thread.
+
+BOOL CWordDoc::LayOutParagraphs(int iFirstParagraph /* = 0 */,
+                                int iLastParagraph /* = -1 */)
 {
-  switch (m_eWordState)
+  if (iLastParagraph == -1)
   {
-    case WS_EDIT:
-      {
-        Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
-        return (pParagraph->GetAlignment() == eAlignment);
-      }
+    iLastParagraph = (int) m_paragraphArray.GetSize() - 1;
+  }
 
-    case WS_MARK:
-      for (int iParagraph = m_psFirstMark.Paragraph();
-           iParagraph <= m_psLastMark.Paragraph(); ++iParagraph)
-      {
-        Paragraph* pParagraph = m_paragraphArray[iParagraph];
+  // We first look up the first pending paragraph, as this method is called
+  // every time the caret is updated, and usually there is nothing to do.
 
-        if (pParagraph->GetAlignment() != eAlignment)
-        {
-          return FALSE;
-        }
-      }
+  int iFirstLaidOut = iFirstParagraph;
+  while ((iFirstLaidOut <= iLastParagraph) &&
+         !m_paragraphArray[iFirstLaidOut]->IsLayoutPending())
+  {
+    ++iFirstLaidOut;
+  }
 
-      return TRUE;
+  if (iFirstLaidOut > iLastParagraph)
+  {
+    return FALSE;
   }
 
-  return TRUE;    
-}
+  // The estimated heights of the pending paragraphs are kept, as the larger
+  // of the estimated and the laid out area is repainted. The height of a
+  // paragraph that is not pending is set to minus one.
 
-// The following methods are called when the user choose an alignment, they
-// all call SetAlignment.
+  IntArray oldHeightArray;
+  check_memory(oldHeightArray.SetSize(iLastParagraph - iFirstLaidOut + 1));
+  int iPending = 0;
 
-void CWordDoc::OnAlignLeft()
-{
-  SetAlignment(ALIGN_LEFT);
-}
+  for (int iParagraph = iFirstLaidOut; iParagraph <= iLastParagraph;
+       ++iParagraph)
+  {
+    Paragraph* pParagraph = m_paragraphArray[iParagraph];
+
+    if (pParagraph->IsLayoutPending())
+    {
+      oldHeightArray[iParagraph - iFirstLaidOut] = pParagraph->GetHeight();
+      ++iPending;
+    }
+
+    else
+    {
+      oldHeightArray[iParagraph - iFirstLaidOut] = -1;
+    }
+  }
+
+  if (iPending >= PARALLEL_PARAGRAPHS)
+  {
+    ParallelLayout parallelLayout(&m_paragraphArray, &m_fontCache);
+    parallelLayout.LayOut(iFirstLaidOut, iLastParagraph);
+  }
+
+  // The view may not have the focus, so we use the first view of the
+  // document instead of m_pView.
+
+  else
+  {
+    POSITION position = GetFirstViewPosition();
+    CView* pView = GetNextView(position);
+
+    CClientDC dc(pView);
+    pView->OnPrepareDC(&dc);
+
+    for (int iParagraph = iFirstLaidOut; iParagraph <= iLastParagraph;
+         ++iParagraph)
+    {
+      Paragraph* pParagraph = m_paragraphArray[iParagraph];
+
+      if (pParagraph->IsLayoutPending())
+      {
+        pParagraph->Recalculate(&dc, &m_fontCache);
+      }
+    }
+  }
+
+  RepaintRegion repaintRegion;
+  int iLastLaidOut = iFirstLaidOut;
+
+  for (int iParagraph = iFirstLaidOut; iParagraph <= iLastParagraph;
+       ++iParagraph)
+  {
+    int iOldHeight = oldHeightArray[iParagraph - iFirstLaidOut];
+
+    if (iOldHeight != -1)
+    {
+      Paragraph* pParagraph = m_paragraphArray[iParagraph];
+      int iHeight = max(iOldHeight, pParagraph->GetHeight());
+      int yPos = pParagraph->GetStartPos();
+
+      CRect rcParagraph(0, yPos, PAGE_WIDTH, yPos + iHeight);
+      repaintRegion.Add(rcParagraph);
+      iLastLaidOut = iParagraph;
+    }
+  }
+
+  BOOL bLayingOut = m_bLayingOut;
+  m_bLayingOut = TRUE;
+
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
+  UpdateParagraphAndPageArray(iFirstLaidOut, iLastLaidOut);
+
+  m_bLayingOut = bLayingOut;
+  return TRUE;
+}
+
+// LayOutArea is called by the view before it paints its client area, and
+// lays out the pending paragraphs in the given area. When they have been
+// laid out, the paragraphs below them may have moved into or out of the
+// area, so we repeat until every paragraph in the area has been laid out.
+// Laying out the paragraphs repaints the view, which calls this method
+// again; that call does nothing.
+
+void CWordDoc::LayOutArea(const CRect& rcArea)
+{
+  if (m_bLayingOut)
+  {
+    return;
+  }
+
+  m_bLayingOut = TRUE;
+  int iParagraphs = (int) m_paragraphArray.GetSize();
+
+  BOOL bLaidOut = TRUE;
+  while (bLaidOut)
+  {
+    int iFirstParagraph =
+      max(0, PointToParagraph(CPoint(0, rcArea.top)));
+    int iLastParagraph = iFirstParagraph;
+
+    while (((iLastParagraph + 1) < iParagraphs) &&
+           (m_paragraphArray[iLastParagraph + 1]->GetStartPos() <
+            rcArea.bottom))
+    {
+      ++iLastParagraph;
+    }
+
+    bLaidOut = LayOutParagraphs(iFirstParagraph, iLastParagraph);
+  }
+
+  m_bLayingOut = FALSE;
+}
+
+// OnIdle is called by the application when there are no messages to
+// process. The pending paragraphs are laid out a few at a time, which
+// refines the heights and the page count of the document in the background.
+// The search for pending paragraphs continues where the previous call
+// stopped. When a whole turn through the document finds no pending
+// paragraph, there is nothing more to do until a layout is deferred again.
+// It returns whether more idle time is wanted. A background save whose
+// worker thread has finished is finished here, as the thread posts a
+// message when it is done, which makes the application idle.
+
+BOOL CWordDoc::OnIdle()
+{
+  if (m_backgroundSave.IsFinished())
+  {
+    FinishSave();
+  }
+
+  if (!m_bIdleLayout)
+  {
+    return FALSE;
+  }
+
+  int iParagraphs = (int) m_paragraphArray.GetSize();
+  for (int iCount = 0; iCount < iParagraphs; ++iCount)
+  {
+    if (m_iIdleParagraph >= iParagraphs)
+    {
+      m_iIdleParagraph = 0;
+    }
+
+    if (m_paragraphArray[m_iIdleParagraph]->IsLayoutPending())
+    {
+      int iLastParagraph =
+        min(m_iIdleParagraph + IDLE_PARAGRAPHS, iParagraphs) - 1;
+
+      LayOutParagraphs(m_iIdleParagraph, iLastParagraph);
+
+      m_iIdleParagraph = iLastParagraph + 1;
+      return TRUE;
+    }
+
+    ++m_iIdleParagraph;
+  }
+
+  m_bIdleLayout = FALSE;
+  return FALSE;
+}
+
+void CWordDoc::SetDocumentHome()
+{
+  EnsureEditStatus();
+  m_psEdit.Paragraph() = 0;
+  m_psEdit.Character() = 0;
+  MakeVisible();
+  UpdateCaret();
+}
+
+void CWordDoc::SetDocumentEnd()
+{
+  EnsureEditStatus();
+  int iSize = m_paragraphArray.GetSize();
+  Paragraph* pLastParagraph = m_paragraphArray[iSize - 1];
+  m_psEdit.Paragraph() = iSize - 1;
+  m_psEdit.Character() = pLastParagraph->GetLength();
+  MakeVisible();
+  UpdateCaret();
+}
+
+// The following four update methods set a radio button on the current
+// alignment menu item. They simple call IsAlignment to check the current
+// alignment.
+
+void CWordDoc::OnUpdateAlignLeft(CCmdUI *pCmdUI)
+{
+  pCmdUI->SetRadio(IsAlignment(ALIGN_LEFT));
+}
+
+void CWordDoc::OnUpdateAlignCenter(CCmdUI *pCmdUI)
+{
+  pCmdUI->SetRadio(IsAlignment(ALIGN_CENTER));
+}
+
+void CWordDoc::OnUpdateAlignRight(CCmdUI *pCmdUI)
+{
+  pCmdUI->SetRadio(IsAlignment(ALIGN_RIGHT));
+}
+
+void CWordDoc::OnUpdateAlignJustifed(CCmdUI *pCmdUI)
+{
+  pCmdUI->SetRadio(IsAlignment(ALIGN_JUSTIFIED));
+}
+
+// In edit mode, IsAlignment checks whether the current paragraph has the
+// given alignment. In mark mode, it check that all partly or completely
+// marked paragraph have the given alignment. This implies that if several
+// paragraph are marked and not all of them have the same alignment, no menu
+// item is checked.
+
+BOOL CWordDoc::IsAlignment(Alignment eAlignment) const
+{
+  switch (m_eWordState)
+  {
+    case WS_EDIT:
+      {
+        Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
+        return (pParagraph->GetAlignment() == eAlignment);
+      }
+
+    case WS_MARK:
+      for (int iParagraph = m_psFirstMark.Paragraph();
+           iParagraph <= m_psLastMark.Paragraph(); ++iParagraph)
+      {
+        Paragraph* pParagraph = m_paragraphArray[iParagraph];
+
+        if (pParagraph->GetAlignment() != eAlignment)
+        {
+          return FALSE;
+        }
+      }
+
+      return TRUE;
+  }
+
+  return TRUE;    
+}
+
+// The following methods are called when the user choose an alignment, they
+// all call SetAlignment.
+
+void CWordDoc::OnAlignLeft()
+{
+  SetAlignment(ALIGN_LEFT);
+}
 
 void CWordDoc::OnAlignCenter()
 {
@@ -1559,13 +2173,14 @@ void CWordDoc::OnAlignJustified()
 }
 
 // In edit mode, SetAlignment sets the given alignment to the current
-// paragraph. In mark mode, it traverses through the paragraphs and sets the
-// given alignment to them one by one.
+// paragraph. In mark mode, it sets the given alignment to the marked
+// paragraphs by calling ApplyFormat.
 
 void CWordDoc::SetAlignment(Alignment eAlignment)
 {
   CClientDC dc(m_pView);
   m_pView->OnPrepareDC(&dc);
+  BeginUndo();
 
   switch (m_eWordState)
   {
@@ -1579,52 +2194,111 @@ void CWordDoc::SetAlignment(Alignment eAlignment)
         Paragraph* pParagraph = m_paragraphArray[m_psEdit.Paragraph()];
 
         pParagraph->SetAlignment(eAlignment);
-        pParagraph->Recalculate(&dc);
+        pParagraph->Recalculate(&dc, &m_fontCache);
 
         int iHeight = pParagraph->GetHeight();
         int yPos = pParagraph->GetStartPos();
 
         CRect rcParagraph(0, yPos, PAGE_WIDTH, yPos + iHeight);
-        RectSet repaintSet;
-        repaintSet.Add(rcParagraph);
-        UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+        RepaintRegion repaintRegion;
+        repaintRegion.Add(rcParagraph);
+        UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
 
         MakeVisible();
         UpdateCaret();
       }
       break;
 
-    // In mark mode, we traverse the marked paragraphs and set the alignment
-    // on those who has not already been set to the alignment in question.
-    // Remember that this method can only be called if at least one paragraph
-    // is not already set to the alignment in question.
+    // In mark mode, we set the alignment on the marked paragraphs that do
+    // not already have it. Remember that this method can only be called if
+    // at least one paragraph is not already set to the alignment in
+    // question.
 
     case WS_MARK:
-      RectSet repaintSet;
-      for (int iParagraph = m_psFirstMark.Paragraph();
-           iParagraph <= m_psLastMark.Paragraph(); ++iParagraph)
-      {
-        Paragraph* pParagraph = m_paragraphArray[iParagraph];
+      Position psMin = min(m_psFirstMark, m_psLastMark);
+      Position psMax = max(m_psFirstMark, m_psLastMark);
+      ApplyFormat(psMin, psMax, FORMAT_ALIGNMENT, -1, eAlignment);
+      UpdateCaret();
+      break;
+  }
 
-        if (pParagraph->GetAlignment() != eAlignment)
-        {
-          pParagraph->SetAlignment(eAlignment);
-          pParagraph->Recalculate(&dc);
+  EndUndo();
+  SetModifiedFlag();
+}
 
-          int iHeight = pParagraph->GetHeight();
-          int yPos = pParagraph->GetStartPos();
+// ApplyFormat sets a style on the characters between the given positions,
+// an alignment on their paragraphs, or both, as given by the format flags,
+// and updates the layout and the pages once for the whole range. The first
+// and last paragraphs of the range, one of which holds the caret, are laid
+// out at once. The layout of the paragraphs in between is deferred: those
+// that are painted are laid out together, in parallel if they are many, and
+// the rest during idle time. Each changed paragraph is repainted in full,
+// with the larger of its old and new heights.
+
+void CWordDoc::ApplyFormat(Position psMin, Position psMax, UINT uFormat,
+                           int iStyle, Alignment eAlignment)
+{
+  StopWatch stopWatch;
 
-          CRect rcParagraph(0, yPos, PAGE_WIDTH, yPos + iHeight);
-          repaintSet.Add(rcParagraph);
-        }
-      }
+  CClientDC dc(m_pView);
+  m_pView->OnPrepareDC(&dc);
 
-      UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
-      UpdateCaret();
-      break;
+  RepaintRegion repaintRegion;
+  int iChanged = 0;
+
+  for (int iParagraph = psMin.Paragraph();
+       iParagraph <= psMax.Paragraph(); ++iParagraph)
+  {
+    Paragraph* pParagraph = m_paragraphArray[iParagraph];
+    int iFirstIndex = (iParagraph == psMin.Paragraph())
+                      ? psMin.Character() : 0;
+    int iLastIndex = (iParagraph == psMax.Paragraph())
+                     ? psMax.Character() : pParagraph->GetLength();
+    BOOL bChanged = FALSE;
+
+    if (((uFormat & FORMAT_ALIGNMENT) != 0) &&
+        (pParagraph->GetAlignment() != eAlignment))
+    {
+      pParagraph->SetAlignment(eAlignment);
+      bChanged = TRUE;
+    }
+
+    if (((uFormat & FORMAT_STYLE) != 0) && (iFirstIndex < iLastIndex))
+    {
+      pParagraph->SetStyle(iStyle, iFirstIndex, iLastIndex);
+      bChanged = TRUE;
+    }
+
+    if (!bChanged)
+    {
+      continue;
+    }
+
+    int iOldHeight = pParagraph->GetHeight();
+
+    if ((iParagraph == psMin.Paragraph()) ||
+        (iParagraph == psMax.Paragraph()))
+    {
+      pParagraph->Recalculate(&dc, &m_fontCache);
+    }
+
+    else
+    {
+      pParagraph->DeferLayout(&dc, &m_fontCache);
+      m_bIdleLayout = TRUE;
+    }
+
+    int iHeight = max(iOldHeight, pParagraph->GetHeight());
+    int yPos = pParagraph->GetStartPos();
+    repaintRegion.Add(CRect(0, yPos, PAGE_WIDTH, yPos + iHeight));
+    ++iChanged;
   }
 
-  SetModifiedFlag();
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
+  UpdateParagraphAndPageArray(psMin.Paragraph(), psMax.Paragraph());
+
+  TRACE(TEXT("Formatted %d paragraphs in %.1f ms.\n"), iChanged,
+        stopWatch.GetMilliseconds());
 }
 
 // The cut menu item shall be enabled when the application in in edit mode;
@@ -1718,9 +2392,7 @@ void CWordDoc::OnCopy()
          iParagraph < psMax.Paragraph(); ++iParagraph)
     {
       Paragraph* pParagraph = m_paragraphArray[iParagraph];
-      Paragraph* pCopyParagraph;
-      check_memory(pCopyParagraph = new Paragraph(*pParagraph));
-      m_copyArray.Add(pCopyParagraph);
+      m_copyArray.Add(pParagraph->ExtractText());
     }
 
     Paragraph* pMaxParagraph = m_paragraphArray[psMax.Paragraph()];
@@ -1744,26 +2416,29 @@ void CWordDoc::OnUpdatePaste(CCmdUI *pCmdUI)
 // paste it. If the copy buffer array consists of only one paragraph, we just
 // insert it and update the current carat position. Otherwise, split the
 // current paragraph in two halves and insert the copied paragraphs between
-// the halves.
+// the halves. The inserted paragraphs share their characters with the copy
+// buffer, and they are inserted into the paragraph array all at once.
 
 void CWordDoc::OnPaste()
 {
   CClientDC dc(m_pView);
   m_pView->OnPrepareDC(&dc);
 
-  RectSet repaintSet;
+  RepaintRegion repaintRegion;
+  BeginUndo();
 
   // If the application is in mark mode, we delete the marked text and set the
   // application in edit mode.
 
   if (m_eWordState == WS_MARK)
   {
-    DeleteText(repaintSet, &dc, m_psFirstMark, m_psLastMark);
+    DeleteText(repaintRegion, &dc, m_psFirstMark, m_psLastMark);
 
     m_eWordState = WS_EDIT;
-    m_psEdit = min(m_psFirstMark, m_psFirstMark);
+    m_psEdit = min(m_psFirstMark, m_psLastMark);
   }
 
+  int iFirstParagraph = m_psEdit.Paragraph();
   Paragraph* pEditParagraph = m_paragraphArray[m_psEdit.Paragraph()];
   int iSize = (int) m_copyArray.GetSize();
 
@@ -1775,7 +2450,7 @@ void CWordDoc::OnPaste()
     Paragraph* pCopyParagraph = m_copyArray[0];
 
     pEditParagraph->Insert(m_psEdit.Character(), pCopyParagraph);
-    pEditParagraph->Recalculate(&dc, &repaintSet);
+    pEditParagraph->Recalculate(&dc, &m_fontCache, &repaintRegion);
 
     m_psEdit.Character() += pCopyParagraph->GetLength();
   }
@@ -1783,8 +2458,13 @@ void CWordDoc::OnPaste()
   // If the copy buffer holds more than one paragraph, we split the current
   // paragraph in two halves. The first copied paragraph is appended to the
   // first half, and the last one is inserted to the beginning of the second
-  // half. We also add the copied paragraphs in between, in any, to the
-  // paragraph array.
+  // half. The copied paragraphs in between, if any, are extracted from the
+  // copy buffer, which copies their pieces and runs but not their
+  // characters, and their layout is deferred until they are needed; when
+  // many of them are needed at once, they are laid out in parallel. The
+  // paragraphs are collected in an array that is inserted into the
+  // paragraph array by one single call, which moves the following
+  // paragraphs only once.
 
   else
   {
@@ -1792,40 +2472,43 @@ void CWordDoc::OnPaste()
     Paragraph* pCopyParagraph = m_copyArray[0];
 
     pEditParagraph->Append(pCopyParagraph);
-    pEditParagraph->Recalculate(&dc, &repaintSet);
-  
-    for (int iParagraph = iSize - 2; iParagraph > 0; --iParagraph)
+    pEditParagraph->Recalculate(&dc, &m_fontCache, &repaintRegion);
+
+    ParagraphPtrArray insertArray;
+    insertArray.SetSize(iSize - 1);
+
+    for (int iParagraph = 1; iParagraph < (iSize - 1); ++iParagraph)
     {
-      Paragraph* pCopyParagraph = m_copyArray[iParagraph];
-      Paragraph* pInsertParagraph;
-      check_memory(pInsertParagraph =
-                   new Paragraph(*pCopyParagraph));
+      Paragraph* pInsertParagraph = m_copyArray[iParagraph]->ExtractText();
+      pInsertParagraph->DeferLayout(&dc, &m_fontCache);
+      insertArray[iParagraph - 1] = pInsertParagraph;
+    }
 
-      m_paragraphArray.InsertAt(m_psEdit.Paragraph() + 1,
-                                pInsertParagraph);
+    if (iSize > 2)
+    {
+      m_bIdleLayout = TRUE;
     }
 
-    pCopyParagraph = m_copyArray[iSize - 1];
-    Paragraph* pInsertParagraph;
-    check_memory(pInsertParagraph = new Paragraph(*pCopyParagraph));
+    Paragraph* pInsertParagraph = m_copyArray[iSize - 1]->ExtractText();
 
     m_psEdit.Character() = pInsertParagraph->GetLength();
     pInsertParagraph->Append(pLastParagraph);
-    pInsertParagraph->Recalculate(&dc);
+    pInsertParagraph->Recalculate(&dc, &m_fontCache);
+    insertArray[iSize - 2] = pInsertParagraph;
 
     delete pLastParagraph;
 
+    m_paragraphArray.InsertAt(m_psEdit.Paragraph() + 1, &insertArray);
     m_psEdit.Paragraph() += iSize - 1;
-    m_paragraphArray.InsertAt(m_psEdit.Paragraph(),
-                                pInsertParagraph);
   }
 
   // Finally, we update the affected characters and the paragraph array. We
   // also make the current position visible and update the caret.
 
-  UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
-  UpdateParagraphAndPageArray();
-  
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
+  UpdateParagraphAndPageArray(iFirstParagraph, m_psEdit.Paragraph());
+  EndUndo();
+
   MakeVisible();
   UpdateCaret();
 
@@ -1903,52 +2586,396 @@ void CWordDoc::OnFont()
         Position psMin = min(m_psFirstMark, m_psLastMark);
         Position psMax = max(m_psFirstMark, m_psLastMark);
 
-        CClientDC dc(m_pView);
-        m_pView->OnPrepareDC(&dc);
+        BeginUndo();
+        ApplyFormat(psMin, psMax, FORMAT_STYLE,
+                    StyleTable::GetStyle(newFont), ALIGN_LEFT);
+        EndUndo();
 
-        RectSet repaintSet;
+        MakeVisible();
+        UpdateCaret();
 
-        // If only one paragraph is marked, we set the new font on its marked
-        // portion.
+        SetModifiedFlag();
+      }
+      break;
+  }
+}
 
-        if (psMin.Paragraph() == psMax.Paragraph())
-        {
-          Paragraph* pParagraph = m_paragraphArray[psMin.Paragraph()];
-          pParagraph->SetFont(newFont, psMin.Character(), psMax.Character());
-          pParagraph->Recalculate(&dc, &repaintSet);
-        }
+// BeginUndo is called by every editing command before it changes the
+// document. It begins an undo entry holding the paragraphs that may be
+// changed, which are the current paragraph in edit mode and the marked
+// paragraphs in mark mode, unless the command gives the range itself. The
+// edit and mark positions are saved with the paragraphs. EndUndo is called
+// when the change has been made.
 
-        // If at least two paragraphs are marked, we set the new font on the
-        // marked part of the first and last paragraphs and on the whole
-        // paragraphs in between, if any.
+void CWordDoc::BeginUndo(BOOL bTyping /* = FALSE */)
+{
+  if (m_eWordState == WS_EDIT)
+  {
+    PrepareChange(m_psEdit.Paragraph(), m_psEdit.Paragraph());
+    m_undoLog.Begin(m_psEdit.Paragraph(), m_psEdit.Paragraph(), bTyping,
+                    m_eWordState, m_psEdit, m_psFirstMark, m_psLastMark);
+  }
 
-        else
-        {
-          Paragraph* pFirstParagraph = m_paragraphArray[psMin.Paragraph()];
-          pFirstParagraph->SetFont(newFont, psMin.Character());
-          pFirstParagraph->Recalculate(&dc, &repaintSet);
-
-          for (int iParagraph = psMin.Paragraph() + 1;
-               iParagraph < psMax.Paragraph() - 1; ++iParagraph)
-          {
-            Paragraph* pParagraph = m_paragraphArray[iParagraph];
-            pParagraph->SetFont(newFont);
-            pParagraph->Recalculate(&dc, &repaintSet);
-          }
-
-          Paragraph* pLastParagraph = m_paragraphArray[psMax.Paragraph()];
-          pLastParagraph->SetFont(newFont, 0, psMax.Character());
-          pLastParagraph->Recalculate(&dc, &repaintSet);
-        }
+  else
+  {
+    Position psMin = min(m_psFirstMark, m_psLastMark);
+    Position psMax = max(m_psFirstMark, m_psLastMark);
 
-        UpdateAllViews(NULL, 0, (CObject*) &repaintSet);
+    PrepareChange(psMin.Paragraph(), psMax.Paragraph());
+    m_undoLog.Begin(psMin.Paragraph(), psMax.Paragraph(), bTyping,
+                    m_eWordState, m_psEdit, m_psFirstMark, m_psLastMark);
+  }
+}
 
-        UpdateParagraphAndPageArray();
-        MakeVisible();
-        UpdateCaret();
+void CWordDoc::BeginUndo(int iFirstParagraph, int iLastParagraph)
+{
+  PrepareChange(iFirstParagraph, iLastParagraph);
+  m_undoLog.Begin(iFirstParagraph, iLastParagraph, FALSE, m_eWordState,
+                  m_psEdit, m_psFirstMark, m_psLastMark);
+}
 
-        SetModifiedFlag();
-      }
-      break;
+void CWordDoc::EndUndo()
+{
+  m_undoLog.End((m_eWordState == WS_EDIT) ? m_psEdit : m_psLastMark);
+}
+
+// PrepareChange is called before the given paragraphs are changed or
+// deleted. They are detached from a save in progress, which keeps the save
+// writing the paragraphs as they were when it started, and the document is
+// marked as changed since the latest autosave.
+
+void CWordDoc::PrepareChange(int iFirstParagraph, int iLastParagraph)
+{
+  m_backgroundSave.Detach(&m_paragraphArray, iFirstParagraph,
+                          iLastParagraph);
+  m_bAutoSaveDirty = TRUE;
+}
+
+// ReplaceParagraphs replaces the given number of paragraphs, starting with
+// the given one, by copies of the paragraphs of the source array, which
+// belong to an undo entry and must be left untouched. Only the paragraphs
+// of the change are copied, and their layout is deferred until they are
+// needed, so undoing or redoing a change takes time in proportion to the
+// size of the change. As the change may cover any part of the document,
+// the whole view is repainted.
+
+void CWordDoc::ReplaceParagraphs(int iFirstParagraph, int iCount,
+                                 const ParagraphPtrArray& sourceArray)
+{
+  CClientDC dc(m_pView);
+  m_pView->OnPrepareDC(&dc);
+  PrepareChange(iFirstParagraph, iFirstParagraph + iCount - 1);
+
+  for (int iIndex = 0; iIndex < iCount; ++iIndex)
+  {
+    delete m_paragraphArray[iFirstParagraph + iIndex];
+  }
+
+  m_paragraphArray.RemoveAt(iFirstParagraph, iCount);
+
+  int iSourceParagraphs = (int) sourceArray.GetSize();
+  ParagraphPtrArray insertArray;
+  insertArray.SetSize(iSourceParagraphs);
+
+  for (int iIndex = 0; iIndex < iSourceParagraphs; ++iIndex)
+  {
+    Paragraph* pParagraph = sourceArray[iIndex]->ExtractText();
+    pParagraph->DeferLayout(&dc, &m_fontCache);
+    insertArray[iIndex] = pParagraph;
+  }
+
+  m_paragraphArray.InsertAt(iFirstParagraph, &insertArray);
+  m_bIdleLayout = TRUE;
+
+  delete m_pNextFont;
+  m_pNextFont = NULL;
+
+  UpdateParagraphAndPageArray(iFirstParagraph,
+                              iFirstParagraph + iSourceParagraphs - 1);
+  UpdateAllViews(NULL);
+}
+
+// The undo and redo menu items are enabled when there is an entry to undo
+// or redo, respectively. OnUndo replaces the paragraphs of the latest entry
+// with the paragraphs before the change and restores the edit and mark
+// positions. OnRedo replaces them with the paragraphs after the change and
+// sets the edit position after the change.
+
+void CWordDoc::OnUpdateUndo(CCmdUI *pCmdUI)
+{
+  pCmdUI->Enable(m_undoLog.CanUndo());
+}
+
+void CWordDoc::OnUndo()
+{
+  UndoEntry* pEntry = m_undoLog.Undo();
+
+  if (pEntry != NULL)
+  {
+    ReplaceParagraphs(pEntry->GetFirstParagraph(),
+                      (int) pEntry->GetNewArray().GetSize(),
+                      pEntry->GetOldArray());
+
+    m_eWordState = pEntry->GetWordState();
+    m_psEdit = pEntry->GetEditBefore();
+    m_psFirstMark = pEntry->GetFirstMark();
+    m_psLastMark = pEntry->GetLastMark();
+
+    MakeVisible();
+    UpdateCaret();
+    SetModifiedFlag();
   }
 }
+
+void CWordDoc::OnUpdateRedo(CCmdUI *pCmdUI)
+{
+  pCmdUI->Enable(m_undoLog.CanRedo());
+}
+
+void CWordDoc::OnRedo()
+{
+  UndoEntry* pEntry = m_undoLog.Redo();
+
+  if (pEntry != NULL)
+  {
+    ReplaceParagraphs(pEntry->GetFirstParagraph(),
+                      (int) pEntry->GetOldArray().GetSize(),
+                      pEntry->GetNewArray());
+
+    m_eWordState = WS_EDIT;
+    m_psEdit = pEntry->GetEditAfter();
+
+    MakeVisible();
+    UpdateCaret();
+    SetModifiedFlag();
+  }
+}
+
+// FindNext marks the next occurrence of the text to find, searching from the
+// edit position, or from the end of the marked text in mark mode, which
+// makes repeated calls step from one occurrence to the next. The search
+// continues through the following paragraphs, wraps around at the end of
+// the document, and ends in the paragraph it started in. It returns false
+// if the text does not occur in the document.
+
+BOOL CWordDoc::FindNext(const CString& stFind, BOOL bMatchCase)
+{
+  TextSearch search(stFind, bMatchCase);
+
+  if (search.IsEmpty())
+  {
+    return FALSE;
+  }
+
+  Position psStart = (m_eWordState == WS_EDIT) ? m_psEdit
+                     : max(m_psFirstMark, m_psLastMark);
+  int iParagraphs = (int) m_paragraphArray.GetSize();
+
+  for (int iCount = 0; iCount <= iParagraphs; ++iCount)
+  {
+    int iParagraph = (psStart.Paragraph() + iCount) % iParagraphs;
+    Paragraph* pParagraph = m_paragraphArray[iParagraph];
+
+    // In the paragraph the search started in, the first pass searches after
+    // the start position, and the last pass, after the wrap around, searches
+    // the occurrences beginning before it.
+
+    int iFirstChar = 0, iLastChar = pParagraph->GetLength();
+
+    if (iCount == 0)
+    {
+      iFirstChar = psStart.Character();
+    }
+
+    else if (iCount == iParagraphs)
+    {
+      iLastChar = min(iLastChar,
+                      psStart.Character() + search.GetLength() - 1);
+    }
+
+    int iMatch = pParagraph->Find(search, iFirstChar, iLastChar);
+
+    if (iMatch != -1)
+    {
+      MarkText(Position(iParagraph, iMatch),
+               Position(iParagraph, iMatch + search.GetLength()));
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+// MarkText marks the given text, which is in one paragraph, and repaints
+// the previously marked text as well as the new one. The paragraph is laid
+// out first, in case its layout is pending.
+
+void CWordDoc::MarkText(Position psFirst, Position psLast)
+{
+  RepaintRegion repaintRegion;
+
+  if (m_eWordState == WS_MARK)
+  {
+    GetRepaintRegion(repaintRegion, m_psFirstMark, m_psLastMark);
+  }
+
+  LayOutParagraphs(psFirst.Paragraph(), psFirst.Paragraph());
+
+  m_eWordState = WS_MARK;
+  m_psFirstMark = psFirst;
+  m_psLastMark = psLast;
+
+  GetRepaintRegion(repaintRegion, m_psFirstMark, m_psLastMark);
+  UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
+
+  MakeVisible();
+  UpdateCaret();
+}
+
+// ReplaceNext replaces the marked text with the replacement text, if it is
+// an occurrence of the text to find, which is the case when it has been
+// marked by FindNext. Then it finds the next occurrence. Only the replaced
+// characters of the paragraph are laid out anew.
+
+BOOL CWordDoc::ReplaceNext(const CString& stFind, const CString& stReplace,
+                           BOOL bMatchCase)
+{
+  TextSearch search(stFind, bMatchCase);
+  Position psMin = min(m_psFirstMark, m_psLastMark);
+  Position psMax = max(m_psFirstMark, m_psLastMark);
+
+  if ((m_eWordState == WS_MARK) && !search.IsEmpty() &&
+      (psMin.Paragraph() == psMax.Paragraph()) &&
+      ((psMax.Character() - psMin.Character()) == search.GetLength()))
+  {
+    Paragraph* pParagraph = m_paragraphArray[psMin.Paragraph()];
+
+    if (pParagraph->Find(search, psMin.Character(), psMax.Character()) ==
+        psMin.Character())
+    {
+      CClientDC dc(m_pView);
+      m_pView->OnPrepareDC(&dc);
+      BeginUndo();
+
+      RepaintRegion repaintRegion;
+      GetRepaintRegion(repaintRegion, m_psFirstMark, m_psLastMark);
+
+      pParagraph->Replace(search, stReplace, psMin.Character(),
+                          psMax.Character());
+      pParagraph->Recalculate(&dc, &m_fontCache, &repaintRegion);
+      UpdateAllViews(NULL, 0, (CObject*) &repaintRegion);
+
+      m_eWordState = WS_EDIT;
+      m_psEdit = psMin;
+      m_psEdit.Character() += stReplace.GetLength();
+
+      UpdateParagraphAndPageArray(psMin.Paragraph(), psMin.Paragraph());
+      EndUndo();
+      SetModifiedFlag();
+    }
+  }
+
+  if (!FindNext(stFind, bMatchCase))
+  {
+    MakeVisible();
+    UpdateCaret();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+// ReplaceAll replaces every occurrence of the text to find in the whole
+// document as one change. The paragraphs holding an occurrence are first
+// looked up, so that the undo entry covers them only. Then each of them is
+// rebuilt once by Replace, and its layout is deferred. The paragraphs are
+// laid out when they become visible or the application is idle, and the
+// document is paginated once for the whole change. It returns the number of
+// replaced occurrences.
+
+int CWordDoc::ReplaceAll(const CString& stFind, const CString& stReplace,
+                         BOOL bMatchCase)
+{
+  TextSearch search(stFind, bMatchCase);
+
+  if (search.IsEmpty())
+  {
+    return 0;
+  }
+
+  IntArray matchArray;
+  int iParagraphs = (int) m_paragraphArray.GetSize();
+
+  for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
+  {
+    if (m_paragraphArray[iParagraph]->Find(search) != -1)
+    {
+      check_memory(matchArray.Add(iParagraph));
+    }
+  }
+
+  int iMatches = (int) matchArray.GetSize();
+  if (iMatches == 0)
+  {
+    return 0;
+  }
+
+  int iFirstParagraph = matchArray[0];
+  int iLastParagraph = matchArray[iMatches - 1];
+  BeginUndo(iFirstParagraph, iLastParagraph);
+
+  CClientDC dc(m_pView);
+  m_pView->OnPrepareDC(&dc);
+  int iReplaced = 0;
+
+  for (int iMatch = 0; iMatch < iMatches; ++iMatch)
+  {
+    Paragraph* pParagraph = m_paragraphArray[matchArray[iMatch]];
+    iReplaced += pParagraph->Replace(search, stReplace);
+    pParagraph->DeferLayout(&dc, &m_fontCache);
+  }
+
+  m_bIdleLayout = TRUE;
+
+  // The marked text may have been replaced, so the application is set in
+  // edit mode at the beginning of the marked text, and the edit position is
+  // kept inside its paragraph.
+
+  if (m_eWordState == WS_MARK)
+  {
+    m_eWordState = WS_EDIT;
+    m_psEdit = min(m_psFirstMark, m_psLastMark);
+  }
+
+  Paragraph* pEditParagraph = m_paragraphArray[m_psEdit.Paragraph()];
+  m_psEdit.Character() = min(m_psEdit.Character(),
+                             pEditParagraph->GetLength());
+
+  UpdateParagraphAndPageArray(iFirstParagraph, iLastParagraph);
+  UpdateAllViews(NULL);
+  EndUndo();
+
+  TRACE(TEXT("Replaced %d occurrences in %d paragraphs.\n"), iReplaced,
+        iMatches);
+
+  MakeVisible();
+  UpdateCaret();
+  SetModifiedFlag();
+  return iReplaced;
+}
+
+// OnUpdateStatistics shows the numbers of pages, words, characters, and
+// lines of the document in the status bar. It is called every time the
+// application is idle, and as the totals are kept in prefix sums, it takes
+// constant time regardless of the size of the document.
+
+void CWordDoc::OnUpdateStatistics(CCmdUI *pCmdUI)
+{
+  CString stStatistics;
+  stStatistics.Format(TEXT("Pages %d  Words %d  Characters %d  Lines %d"),
+                      GetPageNum(), GetWordCount(), GetCharCount(),
+                      GetLineCount());
+
+  pCmdUI->Enable();
+  pCmdUI->SetText(stStatistics);
+}
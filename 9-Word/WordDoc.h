@@ -5,7 +5,14 @@ static const int PAGE_MARGIN = 2500;
 static const int PAGE_WIDTH = (PAGE_TOTALWIDTH - 2 * PAGE_MARGIN);
 static const int PAGE_HEIGHT = (PAGE_TOTALHEIGHT - 2 * PAGE_MARGIN);
 
-enum WordState {WS_EDIT, WS_MARK};
+static const int IDLE_PARAGRAPHS = 32;
+static const int PARALLEL_PARAGRAPHS = 256;
+
+static const UINT FORMAT_STYLE = 1;
+static const UINT FORMAT_ALIGNMENT = 2;
+
+static const LPCTSTR AUTOSAVE_EXTENSION = TEXT(".autosave");
+
 typedef CArray<Page> PageArray;
 
 class CWordDoc : public CDocument
@@ -21,8 +28,16 @@ class CWordDoc : public CDocument
   public:
     void Serialize(CArchive& archive);
     virtual BOOL OnNewDocument();
+    virtual BOOL OnOpenDocument(LPCTSTR lpszPathName);
+    virtual BOOL OnSaveDocument(LPCTSTR lpszPathName);
+    virtual BOOL SaveModified();
+    void AutoSave();
+
+    BOOL ImportText(LPCTSTR lpszPathName, TextFormat eFormat);
+    afx_msg void OnFileExport();
 
     ParagraphPtrArray* GetParagraphArray() {return &m_paragraphArray;}
+    FontCache* GetFontCache() {return &m_fontCache;}
 
     void KeyDown(UINT uChar, CDC* pDC);
     void ShiftKeyDown(UINT uChar, CDC* pDC);
@@ -64,11 +79,8 @@ class CWordDoc : public CDocument
     void CharDown(UINT uChar, CDC* pDC);
     int GetPageNum() const {return (int) m_pageArray.GetSize();}
 
-  private:
     int PointToParagraph(const CPoint& ptMouse) const;
-
-  public:
-    Position PointToChar(const CPoint& ptMouse) const;
+    Position PointToChar(const CPoint& ptMouse);
 
     void MouseDown(const CPoint& ptMouse);
     void MouseDrag(const CPoint& ptMouse);
@@ -78,12 +90,28 @@ class CWordDoc : public CDocument
     void MakeVisible();
     void UpdateCaret();
 
-    void GetRepaintSet(RectSet& repaintSet, Position psFirst,
-                            Position psLast);
-    void DeleteText(RectSet& repaintSet, CDC* pDC, Position psFirst,
-                    Position psLast);
+    void GetRepaintRegion(RepaintRegion& repaintRegion, Position psFirst,
+                          Position psLast);
+    void DeleteText(RepaintRegion& repaintRegion, CDC* pDC,
+                    Position psFirst, Position psLast);
+
+    void UpdateParagraphAndPageArray(int iFirstParagraph = 0,
+                                     int iLastParagraph = -1);
+
+    int GetWordCount() const {return m_wordSum.GetTotal();}
+    int GetCharCount() const {return m_charSum.GetTotal();}
+    int GetLineCount() const {return m_lineSum.GetTotal();}
+    afx_msg void OnUpdateStatistics(CCmdUI *pCmdUI);
 
-    void UpdateParagraphAndPageArray();
+  private:
+    static void ResizeSum(PrefixSum<int>& prefixSum, int iIndex, int iDelta);
+    int BreakPage(int iFirstParagraph, Page& page) const;
+    int FindPage(int iParagraph) const;
+
+  public:
+    BOOL LayOutParagraphs(int iFirstParagraph = 0, int iLastParagraph = -1);
+    void LayOutArea(const CRect& rcArea);
+    BOOL OnIdle();
 
     void SetDocumentHome();
     void SetDocumentEnd();
@@ -102,6 +130,8 @@ class CWordDoc : public CDocument
 
     BOOL IsAlignment(Alignment eAlignment) const;
     void SetAlignment(Alignment eAlignment);
+    void ApplyFormat(Position psMin, Position psMax, UINT uFormat,
+                     int iStyle, Alignment eAlignment);
 
     afx_msg void OnUpdateCopy(CCmdUI *pCmdUI);
     void ClearCopyArray();
@@ -116,6 +146,33 @@ class CWordDoc : public CDocument
     Font GetFont() const;
     afx_msg void OnFont();
 
+  private:
+    void BeginUndo(BOOL bTyping = FALSE);
+    void BeginUndo(int iFirstParagraph, int iLastParagraph);
+    void EndUndo();
+    void PrepareChange(int iFirstParagraph, int iLastParagraph);
+    BOOL FinishSave();
+    void ReplaceParagraphs(int iFirstParagraph, int iCount,
+                           const ParagraphPtrArray& sourceArray);
+
+  public:
+    afx_msg void OnUpdateUndo(CCmdUI *pCmdUI);
+    afx_msg void OnUndo();
+
+    afx_msg void OnUpdateRedo(CCmdUI *pCmdUI);
+    afx_msg void OnRedo();
+
+    BOOL FindNext(const CString& stFind, BOOL bMatchCase);
+    BOOL ReplaceNext(const CString& stFind, const CString& stReplace,
+                     BOOL bMatchCase);
+    int ReplaceAll(const CString& stFind, const CString& stReplace,
+                   BOOL bMatchCase);
+
+  private:
+    void MarkText(Position psFirst, Position psLast);
+
+  public:
+
     void OnSetFocus(CWordView* pView) {m_pView = pView;
                                         m_caret.OnSetFocus(pView);}
     void OnKillFocus() {m_pView = NULL; m_caret.OnKillFocus();}
@@ -132,8 +189,17 @@ class CWordDoc : public CDocument
     Caret m_caret;
 
     ParagraphPtrArray m_paragraphArray, m_copyArray;
+    UndoLog m_undoLog;
+    BackgroundSave m_backgroundSave;
     PageArray m_pageArray;
+    PrefixSum<int> m_heightSum, m_wordSum, m_charSum, m_lineSum;
+
+    BOOL m_bLayingOut, m_bIdleLayout;
+    int m_iIdleParagraph;
+    BOOL m_bAutoSaving, m_bAutoSaveDirty;
 
     Position m_psEdit, m_psFirstMark, m_psLastMark;
     Font *m_pNextFont;
+
+    FontCache m_fontCache;
 };
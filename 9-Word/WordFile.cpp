@@ -0,0 +1,447 @@
+#include "StdAfx.h"
+#include <AfxTempl.h>
+
+#include "Font.h"
+#include "Check.h"
+#include "StyleTable.h"
+#include "WordFile.h"
+
+static const BYTE WORD_FILE_MAGIC[] = {'W', 'O', 'R', 'D'};
+
+MappedFile::MappedFile()
+ :m_hFile(INVALID_HANDLE_VALUE),
+  m_hMapping(NULL),
+  m_pBuffer(NULL),
+  m_iSize(0)
+{
+  // Empty.
+}
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+// Open opens the file and maps all of it into memory. It returns false if
+// the file cannot be opened or mapped, which includes the case of an empty
+// file.
+
+BOOL MappedFile::Open(LPCTSTR lpszPathName)
+{
+  m_hFile = ::CreateFile(lpszPathName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  if (m_hFile == INVALID_HANDLE_VALUE)
+  {
+    return FALSE;
+  }
+
+  LARGE_INTEGER liSize;
+  if (!::GetFileSizeEx(m_hFile, &liSize) || (liSize.QuadPart == 0) ||
+      (liSize.QuadPart > INT_MAX))
+  {
+    Close();
+    return FALSE;
+  }
+
+  m_iSize = (int) liSize.QuadPart;
+  m_hMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+  if (m_hMapping == NULL)
+  {
+    Close();
+    return FALSE;
+  }
+
+  m_pBuffer = (const BYTE*) ::MapViewOfFile(m_hMapping, FILE_MAP_READ,
+                                            0, 0, 0);
+
+  if (m_pBuffer == NULL)
+  {
+    Close();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void MappedFile::Close()
+{
+  if (m_pBuffer != NULL)
+  {
+    ::UnmapViewOfFile(m_pBuffer);
+    m_pBuffer = NULL;
+  }
+
+  if (m_hMapping != NULL)
+  {
+    ::CloseHandle(m_hMapping);
+    m_hMapping = NULL;
+  }
+
+  if (m_hFile != INVALID_HANDLE_VALUE)
+  {
+    ::CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+  }
+
+  m_iSize = 0;
+}
+
+WordFileReader::WordFileReader(const BYTE* pBuffer, int iSize)
+ :m_pBuffer(pBuffer),
+  m_iSize(iSize),
+  m_iPosition(0),
+  m_iParagraphs(0)
+{
+  // Empty.
+}
+
+// ReadHeader checks the magic bytes and the version, reads the style table,
+// and adds its fonts to the style table of the application. It returns false
+// if the buffer does not hold a Word file of this version, which is the
+// case for documents saved in the previous format.
+
+BOOL WordFileReader::ReadHeader()
+{
+  if (m_iSize < sizeof WORD_FILE_MAGIC)
+  {
+    return FALSE;
+  }
+
+  for (int iIndex = 0; iIndex < sizeof WORD_FILE_MAGIC; ++iIndex)
+  {
+    if (m_pBuffer[iIndex] != WORD_FILE_MAGIC[iIndex])
+    {
+      return FALSE;
+    }
+  }
+
+  m_iPosition = sizeof WORD_FILE_MAGIC;
+
+  int iVersion, iStyles;
+  if (!ReadInt(iVersion) || (iVersion != WORD_FILE_VERSION) ||
+      !ReadInt(iStyles) || (iStyles < 0))
+  {
+    return FALSE;
+  }
+
+  m_styleArray.RemoveAll();
+  for (int iStyle = 0; iStyle < iStyles; ++iStyle)
+  {
+    Font font;
+
+    if (!ReadFont(font))
+    {
+      return FALSE;
+    }
+
+    check_memory(m_styleArray.Add(StyleTable::GetStyle(font)));
+  }
+
+  return ReadInt(m_iParagraphs) && (m_iParagraphs > 0);
+}
+
+BOOL WordFileReader::ReadByte(BYTE& bValue)
+{
+  if (m_iPosition >= m_iSize)
+  {
+    return FALSE;
+  }
+
+  bValue = m_pBuffer[m_iPosition++];
+  return TRUE;
+}
+
+BOOL WordFileReader::ReadInt(int& iValue)
+{
+  if ((m_iSize - m_iPosition) < 4)
+  {
+    return FALSE;
+  }
+
+  const BYTE* pValue = m_pBuffer + m_iPosition;
+  iValue = (int) (pValue[0] | (pValue[1] << 8) | (pValue[2] << 16) |
+                  ((UINT) pValue[3] << 24));
+  m_iPosition += 4;
+  return TRUE;
+}
+
+// ReadString reads the number of bytes of the string followed by the bytes
+// themselves, and converts them from UTF-8. In a multibyte build, a
+// character beyond the basic multilingual plane can not be held by the
+// string, and its surrogate pair is replaced by one question mark, so that
+// each code point of the file becomes one character of the string, which
+// the lengths of the font runs rely on.
+
+BOOL WordFileReader::ReadString(CString& stText)
+{
+  int iBytes;
+  if (!ReadInt(iBytes) || (iBytes < 0) || (iBytes > (m_iSize - m_iPosition)))
+  {
+    return FALSE;
+  }
+
+  const char* pBytes = (const char*) (m_pBuffer + m_iPosition);
+  m_iPosition += iBytes;
+
+  if (iBytes == 0)
+  {
+    stText.Empty();
+    return TRUE;
+  }
+
+  int iChars = ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, pBytes,
+                                     iBytes, NULL, 0);
+  if (iChars == 0)
+  {
+    return FALSE;
+  }
+
+  CStringW stWide;
+  LPWSTR pWide = stWide.GetBuffer(iChars);
+  ::MultiByteToWideChar(CP_UTF8, 0, pBytes, iBytes, pWide, iChars);
+
+#ifndef _UNICODE
+  int iWideChars = 0;
+  for (int iIndex = 0; iIndex < iChars; ++iIndex)
+  {
+    if (IS_HIGH_SURROGATE(pWide[iIndex]) && ((iIndex + 1) < iChars) &&
+        IS_LOW_SURROGATE(pWide[iIndex + 1]))
+    {
+      pWide[iWideChars++] = L'?';
+      ++iIndex;
+    }
+
+    else
+    {
+      pWide[iWideChars++] = pWide[iIndex];
+    }
+  }
+
+  iChars = iWideChars;
+#endif
+
+  stWide.ReleaseBuffer(iChars);
+
+  stText = CString(stWide);
+  return TRUE;
+}
+
+// ReadStyle reads a style of the file and translates it into the style of
+// the same font in the style table of the application.
+
+BOOL WordFileReader::ReadStyle(int& iStyle)
+{
+  int iFileStyle;
+  if (!ReadInt(iFileStyle) || (iFileStyle < 0) ||
+      (iFileStyle >= m_styleArray.GetSize()))
+  {
+    return FALSE;
+  }
+
+  iStyle = m_styleArray[iFileStyle];
+  return TRUE;
+}
+
+// ReadFont reads the fields of the logical font one by one, followed by its
+// face name.
+
+BOOL WordFileReader::ReadFont(Font& font)
+{
+  LOGFONT logFont;
+  ::ZeroMemory(&logFont, sizeof logFont);
+
+  int iHeight, iWidth, iEscapement, iOrientation, iWeight;
+  if (!ReadInt(iHeight) || !ReadInt(iWidth) || !ReadInt(iEscapement) ||
+      !ReadInt(iOrientation) || !ReadInt(iWeight) ||
+      !ReadByte(logFont.lfItalic) || !ReadByte(logFont.lfUnderline) ||
+      !ReadByte(logFont.lfStrikeOut) || !ReadByte(logFont.lfCharSet) ||
+      !ReadByte(logFont.lfOutPrecision) ||
+      !ReadByte(logFont.lfClipPrecision) || !ReadByte(logFont.lfQuality) ||
+      !ReadByte(logFont.lfPitchAndFamily))
+  {
+    return FALSE;
+  }
+
+  logFont.lfHeight = iHeight;
+  logFont.lfWidth = iWidth;
+  logFont.lfEscapement = iEscapement;
+  logFont.lfOrientation = iOrientation;
+  logFont.lfWeight = iWeight;
+
+  CString stFaceName;
+  if (!ReadString(stFaceName) || (stFaceName.GetLength() >= LF_FACESIZE))
+  {
+    return FALSE;
+  }
+
+  _tcscpy_s(logFont.lfFaceName, LF_FACESIZE, stFaceName);
+  font = Font(logFont);
+  return TRUE;
+}
+
+// The paragraphs are written first, the header is written when the style
+// table is complete.
+
+WordFileWriter::WordFileWriter()
+ :m_pByteArray(&m_paragraphArray)
+{
+  // Empty.
+}
+
+void WordFileWriter::WriteByte(BYTE bValue)
+{
+  check_memory(m_pByteArray->Add(bValue));
+}
+
+void WordFileWriter::WriteInt(int iValue)
+{
+  UINT uValue = (UINT) iValue;
+  WriteByte((BYTE) uValue);
+  WriteByte((BYTE) (uValue >> 8));
+  WriteByte((BYTE) (uValue >> 16));
+  WriteByte((BYTE) (uValue >> 24));
+}
+
+// WriteString converts the string into UTF-8, and writes the number of bytes
+// followed by the bytes themselves.
+
+void WordFileWriter::WriteString(const CString& stText)
+{
+  CStringW stWide(stText);
+  int iChars = stWide.GetLength();
+
+  int iBytes = (iChars == 0) ? 0 :
+               ::WideCharToMultiByte(CP_UTF8, 0, stWide, iChars, NULL, 0,
+                                     NULL, NULL);
+  WriteInt(iBytes);
+
+  if (iBytes > 0)
+  {
+    int iPosition = (int) m_pByteArray->GetSize();
+    check_memory(m_pByteArray->SetSize(iPosition + iBytes));
+    ::WideCharToMultiByte(CP_UTF8, 0, stWide, iChars,
+                          (char*) m_pByteArray->GetData() + iPosition,
+                          iBytes, NULL, NULL);
+  }
+}
+
+// WriteStyle writes the style of the file that corresponds to the given
+// style of the application. The first time a style is written, it is added
+// to the style table of the file.
+
+void WordFileWriter::WriteStyle(int iStyle)
+{
+  int iFileStyle;
+
+  if (!m_styleMap.Lookup(iStyle, iFileStyle))
+  {
+    iFileStyle = (int) m_styleArray.GetSize();
+    check_memory(m_styleArray.Add(iStyle));
+    check_memory(m_styleMap.SetAt(iStyle, iFileStyle));
+  }
+
+  WriteInt(iFileStyle);
+}
+
+void WordFileWriter::WriteFont(const Font& font)
+{
+  Font fontCopy = font;
+  LOGFONT logFont = fontCopy;
+
+  WriteInt(logFont.lfHeight);
+  WriteInt(logFont.lfWidth);
+  WriteInt(logFont.lfEscapement);
+  WriteInt(logFont.lfOrientation);
+  WriteInt(logFont.lfWeight);
+
+  WriteByte(logFont.lfItalic);
+  WriteByte(logFont.lfUnderline);
+  WriteByte(logFont.lfStrikeOut);
+  WriteByte(logFont.lfCharSet);
+  WriteByte(logFont.lfOutPrecision);
+  WriteByte(logFont.lfClipPrecision);
+  WriteByte(logFont.lfQuality);
+  WriteByte(logFont.lfPitchAndFamily);
+
+  WriteString(logFont.lfFaceName);
+}
+
+// Save writes the header and the paragraphs to the file. It returns false
+// if the file cannot be written. The file is written to a temporary file in
+// the same directory, which is flushed to the disk and then swapped in for
+// the file. Hence the file holds either the old or the new document, even
+// if the application or the system fails in the middle of the save.
+
+BOOL WordFileWriter::Save(LPCTSTR lpszPathName, int iParagraphs)
+{
+  m_pByteArray = &m_headerArray;
+  m_headerArray.RemoveAll();
+
+  for (int iIndex = 0; iIndex < sizeof WORD_FILE_MAGIC; ++iIndex)
+  {
+    WriteByte(WORD_FILE_MAGIC[iIndex]);
+  }
+
+  WriteInt(WORD_FILE_VERSION);
+
+  int iStyles = (int) m_styleArray.GetSize();
+  WriteInt(iStyles);
+
+  for (int iFileStyle = 0; iFileStyle < iStyles; ++iFileStyle)
+  {
+    WriteFont(StyleTable::GetFont(m_styleArray[iFileStyle]));
+  }
+
+  WriteInt(iParagraphs);
+  m_pByteArray = &m_paragraphArray;
+
+  CString stPathName(lpszPathName), stDirectory(TEXT("."));
+  int iSeparator = max(stPathName.ReverseFind(TEXT('\\')),
+                       stPathName.ReverseFind(TEXT('/')));
+
+  if (iSeparator >= 0)
+  {
+    stDirectory = stPathName.Left(iSeparator + 1);
+  }
+
+  TCHAR szTempName[MAX_PATH];
+  if (::GetTempFileName(stDirectory, TEXT("wrd"), 0, szTempName) == 0)
+  {
+    return FALSE;
+  }
+
+  try
+  {
+    CFile file(szTempName, CFile::modeCreate | CFile::modeWrite |
+                           CFile::shareExclusive);
+    file.Write(m_headerArray.GetData(), (UINT) m_headerArray.GetSize());
+    file.Write(m_paragraphArray.GetData(),
+               (UINT) m_paragraphArray.GetSize());
+    file.Flush();
+    file.Close();
+  }
+
+  catch (CFileException* pException)
+  {
+    pException->Delete();
+    ::DeleteFile(szTempName);
+    return FALSE;
+  }
+
+  // ReplaceFile keeps the attributes of an existing file. If there is no
+  // file to replace, the temporary file is simply renamed.
+
+  if (!::ReplaceFile(lpszPathName, szTempName, NULL,
+                     REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL) &&
+      !((::GetFileAttributes(lpszPathName) == INVALID_FILE_ATTRIBUTES) &&
+        ::MoveFileEx(szTempName, lpszPathName,
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)))
+  {
+    ::DeleteFile(szTempName);
+    return FALSE;
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,88 @@
+const int WORD_FILE_VERSION = 1;
+
+// A Word file begins with a header holding the magic bytes "WORD", the
+// version of the format, the style table, and the number of paragraphs.
+// The style table holds each font used by the document once, and the
+// paragraphs refer to the fonts by their index in that table. Each paragraph
+// holds its alignment, the style of its empty font, its text in UTF-8, and
+// its font runs as pairs of style and length. The length is counted in the
+// code points of the text, which does not depend on how the text is held in
+// memory: a double-byte character of a multibyte build and a surrogate pair
+// of a Unicode build are both one code point. Every integer is stored as
+// four bytes in little-endian order. No layout is stored, it is recomputed
+// when the document is opened.
+
+// A MappedFile maps a file for reading into memory, which makes it possible
+// to read the file without copying it into a buffer first. The file is
+// unmapped and closed when the object is destroyed.
+
+class MappedFile
+{
+  public:
+    MappedFile();
+    ~MappedFile();
+
+    BOOL Open(LPCTSTR lpszPathName);
+    void Close();
+
+    const BYTE* GetBuffer() const {return m_pBuffer;}
+    int GetSize() const {return m_iSize;}
+
+  private:
+    HANDLE m_hFile, m_hMapping;
+    const BYTE* m_pBuffer;
+    int m_iSize;
+};
+
+// A WordFileReader reads the header and paragraphs of a Word file from a
+// buffer. Every read method returns false if the buffer ends before the
+// value, or if the value is invalid, in which case the file is corrupt.
+
+class WordFileReader
+{
+  public:
+    WordFileReader(const BYTE* pBuffer, int iSize);
+
+    BOOL ReadHeader();
+    int GetParagraphCount() const {return m_iParagraphs;}
+
+    BOOL ReadByte(BYTE& bValue);
+    BOOL ReadInt(int& iValue);
+    BOOL ReadString(CString& stText);
+    BOOL ReadStyle(int& iStyle);
+
+  private:
+    BOOL ReadFont(Font& font);
+
+    const BYTE* m_pBuffer;
+    int m_iSize, m_iPosition, m_iParagraphs;
+    CArray<int> m_styleArray;
+};
+
+// A WordFileWriter collects the paragraphs of a Word file in a buffer, and
+// maps the styles of the style table of the application to the styles of
+// the file as they are written. When every paragraph has been written, Save
+// writes the header, whose style table is now complete, followed by the
+// paragraphs.
+
+class WordFileWriter
+{
+  public:
+    WordFileWriter();
+
+    void WriteByte(BYTE bValue);
+    void WriteInt(int iValue);
+    void WriteString(const CString& stText);
+    void WriteStyle(int iStyle);
+
+    BOOL Save(LPCTSTR lpszPathName, int iParagraphs);
+
+  private:
+    void WriteFont(const Font& font);
+
+    CByteArray* m_pByteArray;
+    CByteArray m_headerArray, m_paragraphArray;
+
+    CArray<int> m_styleArray;
+    CMap<int,int,int,int> m_styleMap;
+};
@@ -1,22 +1,36 @@
 #include "StdAfx.h"
 #include <AfxTempl.h>
 
-#include "Set.h"
 #include "Color.h"
 #include "Font.h"
 #include "Caret.h"
+#include "Check.h"
+#include "PrefixSum.h"
 
+#include "RepaintRegion.h"
 #include "Line.h"
 #include "Position.h"
+#include "PieceTable.h"
+#include "StyleTable.h"
+#include "FontRun.h"
+#include "FontCache.h"
 #include "Paragraph.h"
 
 #include "Page.h"
+#include "UndoLog.h"
+#include "BackgroundSave.h"
+#include "TextFile.h"
 #include "WordView.h"
 #include "WordDoc.h"
 #include "Word.h"
 
 IMPLEMENT_DYNCREATE(CWordView, CView)
 
+// The find and replace dialog notifies its owner with a registered message.
+
+static const UINT uFindReplaceMessage =
+  ::RegisterWindowMessage(FINDMSGSTRING);
+
 BEGIN_MESSAGE_MAP(CWordView, CView)
   // As this application support printing as well as print preview, the print
   // messages are caught. 
@@ -46,11 +60,21 @@ BEGIN_MESSAGE_MAP(CWordView, CView)
 
   ON_WM_MOVE()
   ON_WM_LBUTTONDBLCLK()
+
+  ON_COMMAND(ID_EDIT_FIND, OnFind)
+  ON_COMMAND(ID_EDIT_REPLACE, OnReplace)
+  ON_UPDATE_COMMAND_UI(ID_EDIT_REPEAT, OnUpdateRepeat)
+  ON_COMMAND(ID_EDIT_REPEAT, OnRepeat)
+
+  ON_REGISTERED_MESSAGE(uFindReplaceMessage, OnFindReplace)
+  ON_WM_DESTROY()
 END_MESSAGE_MAP()
 
 CWordView::CWordView()
  :m_pWordDoc(NULL),
-  m_bDoubleClick(FALSE)
+  m_bDoubleClick(FALSE),
+  m_pFindDialog(NULL),
+  m_bMatchCase(FALSE)
 {
   // Empty.
 }
@@ -103,6 +127,27 @@ void CWordView::OnInitialUpdate()
 // coordinates.
 
 void CWordView::OnPrepareDC(CDC* pDC, CPrintInfo* /* pInfo */)
+{
+  SetLogicalUnits(pDC);
+
+  // We also set origin of the client area to be at the bottom left corner by
+  // looking up the current positions of the scroll bars.
+
+  SCROLLINFO scrollInfo;
+  GetScrollInfo(SB_HORZ, &scrollInfo, SIF_POS);
+  int xOrg = scrollInfo.nPos;
+
+  GetScrollInfo(SB_VERT, &scrollInfo, SIF_POS);
+  int yOrg = scrollInfo.nPos;
+
+  pDC->SetWindowOrg(xOrg, yOrg);
+}
+
+// SetLogicalUnits sets the logical units of the device context to hundreds
+// of millimeters. It does not depend on the view, and is also used by the
+// layout threads to measure characters in their own device contexts.
+
+void CWordView::SetLogicalUnits(CDC* pDC)
 {
   // We choose the isotropic mode, this implies that the units are equal in
   // the horizontal and vertical directions (circles will be round).
@@ -122,18 +167,6 @@ void CWordView::OnPrepareDC(CDC* pDC, CPrintInfo* /* pInfo */)
 
   pDC->SetWindowExt(szWindow);
   pDC->SetViewportExt(szViewport);
-
-  // We also set origin of the client area to be at the bottom left corner by
-  // looking up the current positions of the scroll bars.
-
-  SCROLLINFO scrollInfo;
-  GetScrollInfo(SB_HORZ, &scrollInfo, SIF_POS);
-  int xOrg = scrollInfo.nPos;
-
-  GetScrollInfo(SB_VERT, &scrollInfo, SIF_POS);
-  int yOrg = scrollInfo.nPos;
-
-  pDC->SetWindowOrg(xOrg, yOrg);
 }
 
 // OnSize is called every time the user changes the size of the window. We
@@ -592,6 +625,127 @@ void CWordView::OnChar(UINT uChar, UINT /* uRepCnt */, UINT /* uFlags */)
   m_pWordDoc->CharDown(uChar, &dc);
 }
 
+// OnFind and OnReplace show the modeless find and replace dialog, with or
+// without the replace fields. If the dialog of the other kind is shown, it
+// is closed first. The dialog starts with the latest text to find.
+
+void CWordView::OnFind()
+{
+  ShowFindDialog(TRUE);
+}
+
+void CWordView::OnReplace()
+{
+  ShowFindDialog(FALSE);
+}
+
+void CWordView::ShowFindDialog(BOOL bFindOnly)
+{
+  if (m_pFindDialog != NULL)
+  {
+    if (m_pFindDialog->m_fr.lpstrReplaceWith == NULL)
+    {
+      if (bFindOnly)
+      {
+        m_pFindDialog->SetActiveWindow();
+        return;
+      }
+    }
+
+    else if (!bFindOnly)
+    {
+      m_pFindDialog->SetActiveWindow();
+      return;
+    }
+
+    m_pFindDialog->DestroyWindow();
+    m_pFindDialog = NULL;
+  }
+
+  // The dialog deletes itself when it is closed.
+
+  check_memory(m_pFindDialog = new CFindReplaceDialog());
+  DWORD dwFlags = FR_DOWN | FR_HIDEUPDOWN | FR_HIDEWHOLEWORD |
+                  (m_bMatchCase ? FR_MATCHCASE : 0);
+  check(m_pFindDialog->Create(bFindOnly, m_stFind, m_stReplace, dwFlags,
+                              this));
+}
+
+// The repeat menu item, with the F3 key, finds the next occurrence of the
+// latest text to find without showing the dialog.
+
+void CWordView::OnUpdateRepeat(CCmdUI *pCmdUI)
+{
+  pCmdUI->Enable(!m_stFind.IsEmpty());
+}
+
+void CWordView::OnRepeat()
+{
+  if (!m_pWordDoc->FindNext(m_stFind, m_bMatchCase))
+  {
+    ::MessageBeep(MB_ICONASTERISK);
+  }
+}
+
+// OnFindReplace is called when the user presses a button of the find and
+// replace dialog. The document needs the view to have the focus while it
+// marks or replaces the text, so the focus is taken from the dialog. When
+// no more occurrence is found, the user is notified with a beep.
+
+LRESULT CWordView::OnFindReplace(WPARAM /* wParam */, LPARAM lParam)
+{
+  CFindReplaceDialog* pDialog = CFindReplaceDialog::GetNotifier(lParam);
+
+  if (pDialog->IsTerminating())
+  {
+    m_pFindDialog = NULL;
+    return 0;
+  }
+
+  m_stFind = pDialog->GetFindString();
+  m_stReplace = pDialog->GetReplaceString();
+  m_bMatchCase = pDialog->MatchCase();
+  SetFocus();
+
+  BOOL bFound = TRUE;
+  if (pDialog->FindNext())
+  {
+    bFound = m_pWordDoc->FindNext(m_stFind, m_bMatchCase);
+  }
+
+  else if (pDialog->ReplaceCurrent())
+  {
+    bFound = m_pWordDoc->ReplaceNext(m_stFind, m_stReplace, m_bMatchCase);
+  }
+
+  else if (pDialog->ReplaceAll())
+  {
+    bFound = (m_pWordDoc->ReplaceAll(m_stFind, m_stReplace,
+                                     m_bMatchCase) > 0);
+  }
+
+  if (!bFound)
+  {
+    ::MessageBeep(MB_ICONASTERISK);
+  }
+
+  return 0;
+}
+
+// OnDestroy closes the find and replace dialog, which would otherwise
+// notify a view that no longer exists.
+
+void CWordView::OnDestroy()
+{
+  if (m_pFindDialog != NULL)
+  {
+    m_pFindDialog->DestroyWindow();
+    m_pFindDialog = NULL;
+  }
+
+  CView::OnDestroy();
+}
+
 // OnUpdate is called indirectly by the document class when it calls
 // UpdateAllViews. It takes two parameters, lHint and pHint, that are used
 // to update the vertical scroll bar when the number of pages has been changed
@@ -614,26 +768,38 @@ void CWordView::OnUpdate(CView* /* pSender */, LPARAM lHint, CObject* pHint)
   }
 
   // If pHint is not null the document needs to be repainted, pHint is a
-  // pointer to an array of rectangles to be repainted. We translate them
-  // into device units and repaint them. Finally, we update the window.
+  // pointer to the region to be repainted. We translate its rectangles into
+  // device units and combine them into one region, which is invalidated by a
+  // single call. Finally, we update the window.
 
   else if (pHint != NULL)
   {
-    RectSet* pRepaintSet = (RectSet*) pHint;
+    RepaintRegion* pRepaintRegion = (RepaintRegion*) pHint;
 
-    if (!pRepaintSet->IsEmpty())
+    if (!pRepaintRegion->IsEmpty())
     {
       CClientDC dc(this);
       OnPrepareDC(&dc);
 
-      for (POSITION position = pRepaintSet->GetHeadPosition();
-           position != NULL; pRepaintSet->GetNext(position))
+      CRgn rgnRepaint;
+      check(rgnRepaint.CreateRectRgn(0, 0, 0, 0));
+
+      int iRects = pRepaintRegion->GetSize();
+      for (int iIndex = 0; iIndex < iRects; ++iIndex)
       {
-        CRect rcRepaint = pRepaintSet->GetAt(position);
+        CRect rcRepaint = pRepaintRegion->GetAt(iIndex);
         dc.LPtoDP(&rcRepaint);
-        InvalidateRect(rcRepaint);
+        rcRepaint.NormalizeRect();
+
+        CRgn rgnRect;
+        check(rgnRect.CreateRectRgnIndirect(rcRepaint));
+        rgnRepaint.CombineRgn(&rgnRepaint, &rgnRect, RGN_OR);
       }
 
+      InvalidateRgn(&rgnRepaint);
+      TRACE(TEXT("OnUpdate: %d rectangles added, %d invalidated at once.\n"),
+            pRepaintRegion->GetAddCount(), iRects);
+
       UpdateWindow();
     }
   }
@@ -677,8 +843,15 @@ void CWordView::OnUpdate(CView* /* pSender */, LPARAM lHint, CObject* pHint)
 // the middle of the document or in the middle of the client area, whatever is
 // least. The y position is the page height for each page.
 
+// However, before the painting starts, the paragraphs of the client area
+// whose layout is pending are laid out by LayOutClientArea. As that may
+// repaint parts of the client area, it is done before the paint device
+// context is created.
+
 void CWordView::OnPaint()
 {
+  LayOutClientArea();
+
   CPaintDC dc(this);
   OnPrepareDC(&dc);
 
@@ -735,12 +908,30 @@ void CWordView::OnPaint()
   OnDraw(&dc);
 }
 
+// LayOutClientArea translates the client area into logical units and lets
+// the document lay out the pending paragraphs in it.
+
+void CWordView::LayOutClientArea()
+{
+  CClientDC dc(this);
+  OnPrepareDC(&dc);
+
+  CRect rcClient;
+  GetClientRect(&rcClient);
+  dc.DPtoLP(&rcClient);
+
+  m_pWordDoc->LayOutArea(rcClient);
+}
+
 // OnPreparePrinting is used to set the range of pages to print. The
 // paragraphs of the document are spread over a number of pages. GetPageNum in
-// the document class returns the number of pages.
+// the document class returns the number of pages. The number is exact only
+// when every paragraph has been laid out, so we lay out the pending ones
+// first.
 
 BOOL CWordView::OnPreparePrinting(CPrintInfo* pInfo)
 {
+  m_pWordDoc->LayOutParagraphs();
   pInfo->SetMinPage(1);
   pInfo->SetMaxPage(m_pWordDoc->GetPageNum());
   return DoPreparePrinting(pInfo);
@@ -845,10 +1036,19 @@ void CWordView::OnPrint(CDC* pDC, CPrintInfo* pInfo)
 // be the last of several marked paragraph; in that case, we mark from the
 // beginning. Finally, in may be not marked at all, then we just draw it.
 
+// Only the paragraphs overlapping the clip box of the device context need to
+// be drawn, which is the update region when painting and the current page
+// when printing. We look up the paragraph at the top of the clip box and stop
+// at the first paragraph starting below it.
+
 void CWordView::OnDraw(CDC* pDC)
 {
+  CRect rcClip;
+  pDC->GetClipBox(&rcClip);
+
   int eWordStatus = m_pWordDoc->GetWordStatus();
   ParagraphPtrArray* pParagraphArray = m_pWordDoc->GetParagraphArray();
+  FontCache* pFontCache = m_pWordDoc->GetFontCache();
 
   Position psFirstMarked = m_pWordDoc->GetFirstMarked();
   Position psLastMarked = m_pWordDoc->GetLastMarked();
@@ -857,16 +1057,25 @@ void CWordView::OnDraw(CDC* pDC)
   Position psMaxMarked = max(psFirstMarked, psLastMarked);
 
   int iParagraphs = (int) pParagraphArray->GetSize();
-  for (int iParagraph = 0; iParagraph < iParagraphs; ++iParagraph)
+  int iFirstParagraph =
+    max(0, m_pWordDoc->PointToParagraph(CPoint(0, rcClip.top)));
+
+  for (int iParagraph = iFirstParagraph; iParagraph < iParagraphs;
+       ++iParagraph)
   {
     Paragraph* pParagraph = pParagraphArray->GetAt(iParagraph);
 
+    if (pParagraph->GetStartPos() >= rcClip.bottom)
+    {
+      break;
+    }
+
     switch (eWordStatus)
     {
       // If the application is in edit mode, we just write the paragraph.
 
       case WS_EDIT:
-        pParagraph->Draw(pDC, 0, -1);
+        pParagraph->Draw(pDC, pFontCache, 0, -1);
         break;
 
       // If the application is in mark mode, we have to check if the paragraph
@@ -881,7 +1090,8 @@ void CWordView::OnDraw(CDC* pDC)
         if ((iParagraph == psMinMarked.Paragraph()) &&
             (iParagraph == psMaxMarked.Paragraph()))
         {
-          pParagraph->Draw(pDC, psMinMarked.Character(), psMaxMarked.Character());
+          pParagraph->Draw(pDC, pFontCache, psMinMarked.Character(),
+                           psMaxMarked.Character());
         }
 
         // If the paragraph is at the beginning of the marked area, we write
@@ -890,7 +1100,7 @@ void CWordView::OnDraw(CDC* pDC)
 
         else if (iParagraph == psMinMarked.Paragraph())
         {
-          pParagraph->Draw(pDC, psMinMarked.Character(), iLength);
+          pParagraph->Draw(pDC, pFontCache, psMinMarked.Character(), iLength);
         }
 
         // If the paragraph is completely inside the marked area, we write
@@ -900,7 +1110,7 @@ void CWordView::OnDraw(CDC* pDC)
         else if ((iParagraph > psMinMarked.Paragraph()) && 
                  (iParagraph < psMaxMarked.Paragraph()))
         {
-          pParagraph->Draw(pDC, 0, iLength);
+          pParagraph->Draw(pDC, pFontCache, 0, iLength);
         }
 
         // If the paragraph is the end of the marked area, we write it and
@@ -910,14 +1120,14 @@ void CWordView::OnDraw(CDC* pDC)
 
         else if (iParagraph == psMaxMarked.Paragraph())
         {
-          pParagraph->Draw(pDC, 0, psMaxMarked.Character());
+          pParagraph->Draw(pDC, pFontCache, 0, psMaxMarked.Character());
         }
 
         // If the paragraph is not marked at all, we just write it.
 
         else
         {
-          pParagraph->Draw(pDC, 0, -1);
+          pParagraph->Draw(pDC, pFontCache, 0, -1);
         }
         break;
     }
@@ -14,6 +14,7 @@ class CWordView : public CView
 
     virtual void OnInitialUpdate();
     virtual void OnPrepareDC(CDC* pDC, CPrintInfo* pInfo = NULL);
+    static void SetLogicalUnits(CDC* pDC);
 
     afx_msg void OnSize(UINT uType, int cxClient, int cyClient);
 
@@ -35,15 +36,30 @@ class CWordView : public CView
     afx_msg void OnKeyDown(UINT nChar, UINT nRepCnt, UINT nFlags);
     afx_msg void OnChar(UINT nChar, UINT nRepCnt, UINT nFlags);
 
+    afx_msg void OnFind();
+    afx_msg void OnReplace();
+    void ShowFindDialog(BOOL bFindOnly);
+
+    afx_msg void OnUpdateRepeat(CCmdUI *pCmdUI);
+    afx_msg void OnRepeat();
+
+    afx_msg LRESULT OnFindReplace(WPARAM wParam, LPARAM lParam);
+    afx_msg void OnDestroy();
+
     virtual BOOL OnPreparePrinting(CPrintInfo* pInfo);
     virtual void OnUpdate(CView* pSender, LPARAM lHint,
                           CObject* pHint);
 
     afx_msg void OnPaint();
+    void LayOutClientArea();
     virtual void OnPrint(CDC* pDC, CPrintInfo* pInfo);
     virtual void OnDraw(CDC* pDC);
 
   private:
     CWordDoc* m_pWordDoc;
     BOOL m_bDoubleClick;
+
+    CFindReplaceDialog* m_pFindDialog;
+    CString m_stFind, m_stReplace;
+    BOOL m_bMatchCase;
 };
@@ -21,6 +21,7 @@
 
 #include <afxwin.h>         // MFC core and standard components
 #include <afxext.h>         // MFC extensions
+#include <afxmt.h>          // MFC synchronization classes
 
 
 #include <afxdisp.h>        // MFC Automation classes